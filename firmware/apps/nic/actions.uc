@@ -26,17 +26,179 @@
 
 
 .alloc_mem __actions_sriov_keys lmem me 32 64
+.alloc_mem __actions_flow_keys lmem me 64 64
 
 .reg global volatile g_mac_lkup_addr[2]
 
+#define ACTIONS_XFER_BASE 32
+#if (ACTIONS_XFER_BASE < EBPF_JIT_XFER_REGS)
+    #error "$__actions must not overlap the transfer registers of eBPF programs"
+#endif
+#if ((ACTIONS_XFER_BASE + NIC_MAX_INSTR) > 64)
+    #error "$__actions exceeds the transfer registers of a context"
+#endif
+
 .reg volatile read $__actions[NIC_MAX_INSTR]
-.addr $__actions[0] 32
+.addr $__actions[0] ACTIONS_XFER_BASE
 .xfer_order $__actions
 .reg volatile __actions_t_idx
 
+/* The $__actions transfer registers of a context keep the list of its last
+ * packet. __actions_cache_addr is the NIC_CFG_INSTR_TBL address they were
+ * loaded from (~0 once overwritten by a reload from elsewhere) and
+ * __actions_cache_gen the NIC_CFG_INSTR_GEN_NN_IDX generation at the time,
+ * see actions_load. The list is kept across eBPF program calls, the JIT only
+ * uses transfer registers below EBPF_JIT_XFER_REGS and the assembler allocates
+ * those of the helpers around the volatile $__actions.
+ */
+.reg volatile __actions_cache_addr
+.reg volatile __actions_cache_gen
+
 mem_lkup_init_hash_tbl(_mac_lkup_tbl, imem0, MAC_LKUP_NUM_BUCKETS, MAC_LKUP_BUCKET_SZ)
 mem_lkup_init_hash_addr(g_mac_lkup_addr, _mac_lkup_tbl, HASH_OP_CAMR48_64B, 0, MAC_LKUP_NUM_BUCKETS, MAC_LKUP_BUCKET_SZ)
 
+/* Per action cycle profiling, enabled by building with ACTIONS_PROFILE.
+ *
+ * Every instruction dispatch closes the interval of the previous action and
+ * adds the elapsed TIMESTAMP ticks (16 ME cycles each) and one invocation to
+ * the LM slot of its opcode. The time from the end of a packet's actions
+ * (egress) to the first dispatch for the next packet is accounted to the
+ * ACTIONS_PROF_IDLE slot, so the slots of a context add up to its elapsed
+ * time. Intervals include time spent swapped out, i.e. they measure action
+ * latency. Pipelined actions are dispatched individually in this mode.
+ *
+ * Every 2^ACTIONS_PROF_FLUSH_SHF packets the LM slots are added to the
+ * per ME 64-bit counters in the _actions_prof rtsym and cleared, see
+ * firmware/scripts/nic-actions-prof.py for the layout.
+ */
+#define ACTIONS_PROF_IDLE       (INSTR_FLOW_LOOKUP + 1)
+#define ACTIONS_PROF_SLOTS      32
+#define ACTIONS_PROF_ME_SIZE    (ACTIONS_PROF_SLOTS * 16)
+#ifndef ACTIONS_PROF_FLUSH_SHF
+    #define ACTIONS_PROF_FLUSH_SHF  10
+#endif
+
+#ifdef ACTIONS_PROFILE
+    .alloc_mem __actions_prof lmem me (ACTIONS_PROF_SLOTS * 8) (ACTIONS_PROF_SLOTS * 8)
+    // indexed by (island << 4) | ME
+    .alloc_mem _actions_prof emem global (64 * 16 * ACTIONS_PROF_ME_SIZE) 256
+
+    .reg volatile __actions_prof_ts
+    .reg volatile __actions_prof_op
+#endif
+
+
+#macro actions_init()
+    alu[__actions_cache_addr, --, ~B, 0]
+    actions_prof_init()
+    ebpf_prog_stats_init()
+#endm
+
+
+#macro actions_prof_init()
+#ifdef ACTIONS_PROFILE
+.begin
+    .reg addr
+    .reg count
+
+    immed[addr, __actions_prof]
+    local_csr_wr[ACTIVE_LM_ADDR_0, addr]
+    immed[__actions_prof_op, ACTIONS_PROF_IDLE]
+    immed[count, (ACTIONS_PROF_SLOTS * 2)]
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[__actions_prof_ts, 0]
+
+clear_loop#:
+    alu[count, count, -, 1]
+    bne[clear_loop#], defer[1]
+        alu[*l$index0++, --, B, 0]
+.end
+#endif
+#endm
+
+
+/* Close the interval of the current action and start in_op */
+#macro __actions_prof(in_op)
+#ifdef ACTIONS_PROFILE
+.begin
+    .reg addr
+    .reg delta
+    .reg now
+
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[now, 0]
+    immed[addr, __actions_prof]
+    alu[addr, addr, OR, __actions_prof_op, <<3]
+    local_csr_wr[ACTIVE_LM_ADDR_0, addr]
+    alu[delta, now, -, __actions_prof_ts]
+    alu[__actions_prof_ts, --, B, now]
+    alu[__actions_prof_op, --, B, in_op]
+    alu[*l$index0[0], *l$index0[0], +, delta]
+    alu[*l$index0[1], *l$index0[1], +, 1]
+.end
+#endif
+#endm
+
+
+#macro __actions_prof_flush()
+.begin
+    .reg addr
+    .reg addr_hi
+    .reg addr_lo
+    .reg count
+    .reg sts
+    .reg write $prof[4]
+    .xfer_order $prof
+    .sig sig_prof
+
+    immed[addr, __actions_prof]
+    alu[addr, addr, OR, (ACTIONS_PROF_IDLE * 8)]
+    local_csr_wr[ACTIVE_LM_ADDR_0, addr]
+    immed[count, (1 << ACTIONS_PROF_FLUSH_SHF)]
+    local_csr_rd[ACTIVE_CTX_STS]
+    immed[sts, 0]
+    alu[--, *l$index0[1], -, count]
+    blo[end#]
+
+    alu[addr_lo, 0xf, AND, sts, >>3]
+    alu[sts, 0x3f, AND, sts, >>25]
+    alu[addr_lo, addr_lo, OR, sts, <<4]
+    alu[addr_lo, --, B, addr_lo, <<(log2(ACTIONS_PROF_ME_SIZE))]
+    move(addr_hi, (_actions_prof >> 8))
+
+    immed[addr, __actions_prof]
+    immed[count, (ACTIONS_PROF_IDLE + 1)]
+    immed[$prof[0], 0]
+    immed[$prof[2], 0]
+
+flush_loop#:
+    local_csr_wr[ACTIVE_LM_ADDR_0, addr]
+    alu[addr, addr, +, 8]
+    nop
+    nop
+    alu[$prof[1], --, B, *l$index0[0]]
+    alu[$prof[3], --, B, *l$index0[1]]
+    alu[*l$index0[0], --, B, 0]
+    alu[*l$index0[1], --, B, 0]
+    mem[add64, $prof[0], addr_hi, <<8, addr_lo, 2], ctx_swap[sig_prof]
+    alu[addr_lo, addr_lo, +, 16]
+    alu[count, count, -, 1]
+    bne[flush_loop#]
+
+end#:
+.end
+#endm
+
+
+/* Close the interval of the last action of a packet */
+#macro actions_prof_end()
+#ifdef ACTIONS_PROFILE
+    __actions_prof(ACTIONS_PROF_IDLE)
+    __actions_prof_flush()
+#endif
+#endm
+
+
 #macro __actions_read(out_data, in_mask, in_shf)
     #if (streq('in_mask', '--'))
         #if (streq('in_shf', '--'))
@@ -97,7 +259,11 @@ mem_lkup_init_hash_addr(g_mac_lkup_addr, _mac_lkup_tbl, HASH_OP_CAMR48_64B, 0, M
 
 
 #macro __actions_next()
-    br_bclr[*$index, INSTR_PIPELINE_BIT, next#]
+    #ifdef ACTIONS_PROFILE
+        br[next#] // account for pipelined actions individually
+    #else
+        br_bclr[*$index, INSTR_PIPELINE_BIT, next#]
+    #endif
 #endm
 
 
@@ -203,7 +369,7 @@ veb_hit#:
     ctx_arb[sig_read], defer[2], br[done#]
         .reg_addr __actions_t_idx 28 B
         alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
-        nop
+        alu[__actions_cache_addr, --, ~B, 0]
 
 mac_match_check#:
     alu[mac_hi, port_mac[0], XOR, *$index++]
@@ -282,7 +448,7 @@ end#:
     cls[read, $__actions[0], 0, act_addr, max_16], indirect_ref, defer[2], ctx_swap[sig_actions]
         .reg_addr __actions_t_idx 28 B
         alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
-        nop
+        alu[__actions_cache_addr, --, ~B, 0]
 
 skip_act_list#:
     __actions_restore_t_idx()
@@ -330,8 +496,118 @@ end#:
     cls[read, $__actions[0], 0, act_addr, max_16], indirect_ref, defer[2], ctx_swap[sig_actions]
         .reg_addr __actions_t_idx 28 B
         alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
-        nop
+        alu[__actions_cache_addr, --, ~B, 0]
+
+    __actions_restore_t_idx()
+
+end#:
+.end
+#endm
+
+
+#macro __actions_jump()
+.begin
+    .reg act_addr
+    .sig sig_actions
+
+    //Read rest of action list from the continuation entry
+    alu[act_addr, 0, +16, *$index]
+    ov_start(OV_LENGTH)
+    ov_set_use(OV_LENGTH, 16, OVF_SUBTRACT_ONE)
+    ov_clean()
+    cls[read, $__actions[0], 0, act_addr, max_16], indirect_ref, defer[2], ctx_swap[sig_actions]
+        .reg_addr __actions_t_idx 28 B
+        alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+        alu[__actions_cache_addr, --, ~B, 0]
+
+    __actions_restore_t_idx()
+.end
+#endm
+
+
+/* Exact match flow cache, see INSTR_FLOW_LOOKUP. Only plain IPv4 TCP/UDP
+ * packets are looked up, the key and a useful terminal action list do not
+ * both fit the 64 byte hashmap entry for IPv6.
+ */
+#macro __actions_flow_lookup(in_pkt_vec)
+.begin
+    .reg daddr
+    .reg ins_addr[2]
+    .reg key_addr
+    .reg l3_offset
+    .reg l4_offset
+    .reg port
+    .reg ports
+    .reg proto
+    .reg saddr
+    .reg tid
+
+    .sig sig_read
+
+    __actions_read(port, 0xffff)
+
+    alu[proto, 0xfe, AND, BF_A(in_pkt_vec, PV_PROTO_bf)] ; PV_PROTO_bf
+    alu[--, proto, -, PROTO_IPV4_TCP]
+    bne[end#]
+
+    /* Read the ports first, seeking to L3 might context swap */
+    bitfield_extract__sz1(l4_offset, BF_AML(in_pkt_vec, PV_HEADER_OFFSET_INNER_L4_bf)) ; PV_HEADER_OFFSET_INNER_L4_bf
+    pv_seek(in_pkt_vec, l4_offset)
+
+    byte_align_be[--, *$index++]
+    byte_align_be[ports, *$index++]
+
+    bitfield_extract__sz1(l3_offset, BF_AML(in_pkt_vec, PV_HEADER_OFFSET_INNER_IP_bf)) ; PV_HEADER_OFFSET_INNER_IP_bf
+    alu[l3_offset, l3_offset, +, (12 + 2)] // IPv4 addresses, 2 bytes seek align
+    pv_seek(in_pkt_vec, l3_offset, PV_SEEK_PAD_INCLUDED)
+
+    byte_align_be[--, *$index++]
+    byte_align_be[saddr, *$index++]
+    byte_align_be[daddr, *$index++]
+
+    immed[key_addr, __actions_flow_keys]
+    alu[key_addr, key_addr, OR, t_idx_ctx, >>4]
+    local_csr_wr[ACTIVE_LM_ADDR_0, key_addr]
+
+    alu[tid, --, B, FLOW_TID]
+    alu[proto, 0xff, AND, BF_A(in_pkt_vec, PV_PROTO_bf)] ; PV_PROTO_bf
+    alu[port, port, OR, proto, <<16]
+
+    alu[*l$index0++, --, B, saddr]
+    alu[*l$index0++, --, B, daddr]
+    alu[*l$index0++, --, B, ports]
+    alu[*l$index0, --, B, port]
+
+    #define HASHMAP_RXFR_COUNT 4
+    #define MAP_RDXR $__pv_pkt_data
+    // hashmap_ops will overwrite the packet cache, we MUST invalidate
+    pv_invalidate_cache(in_pkt_vec)
+    hashmap_ops(tid,
+                key_addr,
+                --,
+                HASHMAP_OP_LOOKUP,
+                done#, // flow cache map not allocated, treat as miss
+                done#, // flow miss
+                HASHMAP_RTN_ADDR,
+                --,
+                --,
+                ins_addr,
+                swap)
+    #undef MAP_RDXR
+    #undef HASHMAP_RXFR_COUNT
+
+    /* Replace the rest of the list with the cached one, the value only */
+    ov_start(OV_LENGTH)
+    ov_set_use(OV_LENGTH, (FLOW_VALUE_SZ / 4), OVF_SUBTRACT_ONE)
+    ov_clean()
+    mem[read32, $__actions[0], ins_addr[0], <<8, ins_addr[1], max_16], indirect_ref, sig_done[sig_read]
+
+    ctx_arb[sig_read], defer[2]
+        .reg_addr __actions_t_idx 28 B
+        alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+        alu[__actions_cache_addr, --, ~B, 0]
 
+done#:
     __actions_restore_t_idx()
 
 end#:
@@ -367,12 +643,60 @@ end#:
 #endm
 
 
+/* Toeplitz hash one word of RSS input. The key table holds one row of 16
+ * precomputed key windows per input nibble, io_key_tbl is advanced to the
+ * rows of the next input word. 33 instructions and one context swap per
+ * word: the 8 CLS reads are issued back to back and waited on together.
+ */
+#macro __actions_rss_toeplitz(io_hash, in_data, io_key_tbl)
+.begin
+    .reg nibble
+    .reg read $key_row[8]
+    .xfer_order $key_row
+    .sig key_row_sig0
+    .sig key_row_sig1
+    .sig key_row_sig2
+    .sig key_row_sig3
+    .sig key_row_sig4
+    .sig key_row_sig5
+    .sig key_row_sig6
+    .sig key_row_sig7
+
+    #define_eval _NIBBLE 0
+    #while (_NIBBLE < 8)
+        #define_eval _SHF (26 - (_NIBBLE * 4))
+        #if (_SHF > 0)
+            alu[nibble, 0x3c, AND, in_data, >>_SHF]
+        #else
+            alu[nibble, 0x3c, AND, in_data, <<2]
+        #endif
+        cls[read, $key_row[_NIBBLE], io_key_tbl, nibble, 1], sig_done[key_row_sig/**/_NIBBLE]
+        alu[io_key_tbl, io_key_tbl, +, NIC_RSS_KEY_TBL_ROW_SZ]
+        #define_eval _NIBBLE (_NIBBLE + 1)
+    #endloop
+    #undef _SHF
+
+    ctx_arb[key_row_sig0, key_row_sig1, key_row_sig2, key_row_sig3, key_row_sig4, key_row_sig5, key_row_sig6, key_row_sig7]
+
+    #define_eval _NIBBLE 0
+    #while (_NIBBLE < 8)
+        alu[io_hash, io_hash, XOR, $key_row[_NIBBLE]]
+        #define_eval _NIBBLE (_NIBBLE + 1)
+    #endloop
+    #undef _NIBBLE
+.end
+#endm
+
+
 #macro __actions_rss(in_pkt_vec)
 .begin
     .reg args[2]
-    .reg data
+    .reg data[8]
+    .reg hash
     .reg hash_type
+    .reg key_tbl
     .reg l3_offset
+    .reg l3_words
     .reg l4_offset
     .reg l4_data
     .reg max_queue
@@ -399,7 +723,7 @@ begin#:
 
     /* Read and cache L4 data first because seeking might context swap. The
      * additional branch later to skip L4 when not required is cheaper than
-     * waiting for CRC instruction latencies to save and restore CRC state.
+     * seeking back to the L4 header after hashing L3.
      * The l4_offset is used as discriminator for processing L4. It is zero
      * in the packet vector if L4 is unrecognized and we set it to zero here
      * by masking out the bits if L4 is not configured for the packet. Note,
@@ -427,30 +751,54 @@ begin#:
 process_l3#:
     pv_seek(in_pkt_vec, l3_offset, PV_SEEK_PAD_INCLUDED)
 
-    local_csr_wr[CRC_REMAINDER, BF_A(args, INSTR_RSS_KEY_bf)]
+    /* Cache the addresses, key table lookups context swap and T_INDEX
+     * and BYTE_INDEX are not preserved.
+     */
     byte_align_be[--, *$index++]
-    byte_align_be[data, *$index++]
-    br_bset[BF_A(in_pkt_vec, PV_PROTO_bf), 1, process_l4#], defer[3] // branch if IPv4, 2 words hashed
-        crc_be[crc_32, --, data]
-        byte_align_be[data, *$index++]
-        crc_be[crc_32, --, data]
+    byte_align_be[data[0], *$index++]
+    br_bset[BF_A(in_pkt_vec, PV_PROTO_bf), 1, hash_l3#], defer[2] // branch if IPv4, 2 words hashed
+        byte_align_be[data[1], *$index++]
+        immed[l3_words, 2]
 
     // hash 6 more words for IPv6
     #define_eval LOOP (0)
     #while (LOOP < 6)
-        byte_align_be[data, *$index++]
-        crc_be[crc_32, --, data]
+        byte_align_be[data[LOOP + 2], *$index++]
         #define_eval LOOP (LOOP + 1)
     #endloop
     #undef LOOP
 
+    immed[l3_words, 8]
     alu[hash_type, hash_type, +, 1]
 
+hash_l3#:
+    /* Toeplitz over the full key: XOR the key table rows selected by each
+     * input nibble, the table walks through the input words in order. Both
+     * address families hash an even number of words, two per pass halves
+     * the register moves and loop branches.
+     */
+    alu[key_tbl, --, B, BF_A(args, INSTR_RSS_KEY_TBL_bf)]
+    immed[hash, 0]
+
+hash_l3_loop#:
+    __actions_rss_toeplitz(hash, data[0], key_tbl)
+    __actions_rss_toeplitz(hash, data[1], key_tbl)
+    alu[l3_words, l3_words, -, 2]
+    beq[process_l4#]
+
+    #define_eval LOOP (0)
+    #while (LOOP < 6)
+        alu[data[LOOP], --, B, data[LOOP + 2]]
+        #define_eval LOOP (LOOP + 1)
+    #endloop
+    #undef LOOP
+    br[hash_l3_loop#]
+
 process_l4#:
     br=byte[l4_offset, 0, 0, skip_l4#], defer[1]
         alu[rss_table_addr, BF_A(args, INSTR_RSS_TABLE_IDX_bf), AND, BF_MASK(INSTR_RSS_TABLE_IDX_bf), <<BF_L(INSTR_RSS_TABLE_IDX_bf)]
 
-    crc_be[crc_32, --, l4_data]
+    __actions_rss_toeplitz(hash, l4_data, key_tbl)
 
     alu[proto_shf, BF_A(in_pkt_vec, PV_PROTO_bf), AND, 1]
     alu[proto_delta, proto_shf, B, 3]
@@ -463,11 +811,10 @@ skip_l4#:
     passert(LOG2(NIC_RSS_TBL_ADDR), "GT", BF_M(INSTR_RSS_TABLE_IDX_bf))
     alu[rss_table_addr, rss_table_addr, OR, 1, <<(log2(NIC_RSS_TBL_ADDR))]
 
-    local_csr_rd[CRC_REMAINDER]
-    immed[*l$index2, 0]
+    alu[*l$index2++, --, B, hash]
 
     /* Select queue = rss_tbl[hash % NFP_NET_CFG_RSS_ITBL_SZ] */
-    alu[rss_table_idx, (NFP_NET_CFG_RSS_ITBL_SZ - 1), AND, *l$index2++]
+    alu[rss_table_idx, (NFP_NET_CFG_RSS_ITBL_SZ - 1), AND, hash]
     cls[read, $rss_tbl_row, rss_table_addr, rss_table_idx, 1], sig_done[rss_tbl_sig]
     ctx_arb[rss_tbl_sig], defer[2], br[finalize#]
         pv_meta_push_type__sz1(in_pkt_vec, hash_type)
@@ -922,19 +1269,35 @@ end#:
 #endm
 
 
+/* Load the action list at in_act_addr unless the transfer registers still
+ * hold it from the previous packet of this context and the app master has
+ * not written NIC_CFG_INSTR_TBL since (see cfg_act_release()). The
+ * generation is read before the CLS read so that a list read concurrently
+ * with an update is tagged with the old generation.
+ */
 #macro actions_load(in_act_addr)
 .begin
     .reg pkt_vec_addr
     .sig sig_actions
 
+    local_csr_wr[NN_GET, NIC_CFG_INSTR_GEN_NN_IDX]
+    .reg_addr __actions_t_idx 28 B
+    alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+    alu[pkt_vec_addr, (PV_META_BASE_wrd * 4), OR, t_idx_ctx, >>(8 - log2((PV_SIZE_LW * 4 * PV_MAX_CLONES), 1))]
+    alu[--, in_act_addr, -, __actions_cache_addr]
+    bne[miss#]
+    alu[--, __actions_cache_gen, -, *n$index]
+    beq[hit#]
+
+miss#:
     ov_start(OV_LENGTH)
     ov_set_use(OV_LENGTH, 16, OVF_SUBTRACT_ONE)
     ov_clean()
     cls[read, $__actions[0], 0, in_act_addr, max_16], indirect_ref, defer[2], ctx_swap[sig_actions]
-        .reg_addr __actions_t_idx 28 B
-        alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
-        alu[pkt_vec_addr, (PV_META_BASE_wrd * 4), OR, t_idx_ctx, >>(8 - log2((PV_SIZE_LW * 4 * PV_MAX_CLONES), 1))]
+        alu[__actions_cache_gen, --, B, *n$index]
+        alu[__actions_cache_addr, --, B, in_act_addr]
 
+hit#:
     pv_reset(pkt_vec_addr, in_act_addr, __actions_t_idx, (NIC_MAX_INSTR *4))
 
 .end
@@ -949,7 +1312,8 @@ end#:
 
 next#:
     alu[jump_idx, --, B, *$index, >>INSTR_OPCODE_LSB]
-    jump[jump_idx, ins_0#], targets[ins_0#, ins_1#, ins_2#, ins_3#, ins_4#, ins_5#, ins_6#, ins_7#, ins_8#, ins_9#, ins_10#, ins_11#, ins_12#, ins_13#, ins_14#, ins_15#, ins_16#, ins_17#, ins_18#]
+    __actions_prof(jump_idx)
+    jump[jump_idx, ins_0#], targets[ins_0#, ins_1#, ins_2#, ins_3#, ins_4#, ins_5#, ins_6#, ins_7#, ins_8#, ins_9#, ins_10#, ins_11#, ins_12#, ins_13#, ins_14#, ins_15#, ins_16#, ins_17#, ins_18#, ins_19#, ins_20#]
 
     ins_0#: br[drop_act#]
     ins_1#: br[rx_wire#]
@@ -970,6 +1334,8 @@ next#:
     ins_16#: br[tx_vlan#]
     ins_17#: br[l2_switch_wire#]
     ins_18#: br[l2_switch_host#]
+    ins_19#: br[jump#]
+    ins_20#: br[flow_lookup#]
 
 error_pkt_stack#:
     pv_stats_update(io_pkt_vec, ERROR_PKT_STACK, drop#)
@@ -1058,6 +1424,14 @@ l2_switch_host#:
     __actions_l2_switch_host(io_pkt_vec)
     __actions_next()
 
+jump#:
+    __actions_jump()
+    br[next#]
+
+flow_lookup#:
+    __actions_flow_lookup(io_pkt_vec)
+    __actions_next()
+
 .end
 #endm
 
@@ -16,14 +16,51 @@
 #define NUM_PCIE_Q          64      // number of queues configured per PCIe
 #define NUM_PCIE_Q_PER_PORT NFD_MAX_PF_QUEUES // nr queues cfg per port
 #define NIC_MAX_INSTR       16      // max number of instructions in table
+#define NIC_MAX_INSTR_BLKS  2       // max number of table entries per list
 
 #define NIC_CFG_INSTR_TBL_ADDR 0x00
 #define NIC_CFG_INSTR_TBL_SIZE 32768
 
+/* Action lists longer than NIC_MAX_INSTR words are split into table entries
+ * chained with INSTR_JUMP. The continuation entries are allocated from the
+ * top of NIC_CFG_INSTR_TBL, above the host and wire lists. The same pool
+ * holds the staged copy of a list while its live entries are replaced. */
+#define NIC_CFG_INSTR_CHAIN_BASE 384
+#define NIC_CFG_INSTR_CHAIN_BLKS 128
+
+#if (((NIC_CFG_INSTR_CHAIN_BASE + NIC_CFG_INSTR_CHAIN_BLKS) * NIC_MAX_INSTR * 4) > NIC_CFG_INSTR_TBL_SIZE)
+    #error "NIC_CFG_INSTR_TBL too small for the continuation entries"
+#endif
+
+#if (((1 << 8) + NS_PLATFORM_NUM_PORTS) > NIC_CFG_INSTR_CHAIN_BASE)
+    #error "Wire action lists overlap the continuation entries"
+#endif
+
+/* Generation of NIC_CFG_INSTR_TBL, bumped in the NN registers of the
+ * worker MEs whenever the app master has rewritten action lists. Workers
+ * reuse the list already in their transfer registers, and the free list
+ * buffer sizes copied into LM, while it matches. */
+#define NIC_CFG_INSTR_GEN_NN_IDX 126
+
 #define RSS_TBL_SIZE_LW     (NFP_NET_CFG_RSS_ITBL_SZ / 4)
 #define NIC_RSS_TBL_SIZE    (NFP_NET_CFG_RSS_ITBL_SZ * NS_PLATFORM_NUM_PORTS * NFD_MAX_ISL)
 #define NIC_RSS_TBL_ADDR    NIC_CFG_INSTR_TBL_SIZE
 
+/* Toeplitz key tables: one 16 entry row of precomputed key windows per nibble
+ * of hash input (IPv6 source and destination addresses plus L4 ports, i.e.
+ * 9 words). Tables are shared by vNICs configured with the same RSS key. */
+#define NIC_RSS_KEY_TBL_WORDS   9
+#define NIC_RSS_KEY_TBL_ROW_SZ  (16 * 4)
+#define NIC_RSS_KEY_TBL_WORD_SZ (8 * NIC_RSS_KEY_TBL_ROW_SZ)
+#define NIC_RSS_KEY_TBL_SZ      (NIC_RSS_KEY_TBL_WORDS * NIC_RSS_KEY_TBL_WORD_SZ)
+#define NIC_RSS_KEY_TBL_NUM     4
+#define NIC_RSS_KEY_TBL_SIZE    (NIC_RSS_KEY_TBL_SZ * NIC_RSS_KEY_TBL_NUM)
+#define NIC_RSS_KEY_TBL_ADDR    0x9000
+
+#if ((NIC_RSS_TBL_ADDR + NIC_RSS_TBL_SIZE) > NIC_RSS_KEY_TBL_ADDR)
+    #error "NIC_RSS_TBL overlaps NIC_RSS_KEY_TBL"
+#endif
+
 #define VLAN_TO_VNICS_MAP_TBL_SIZE ((1<<12) * 8)
 
 /* For host ports,
@@ -38,6 +75,9 @@
     .alloc_mem NIC_RSS_TBL cls+NIC_RSS_TBL_ADDR \
                 island NIC_RSS_TBL_SIZE addr40
 
+    .alloc_mem NIC_RSS_KEY_TBL cls+NIC_RSS_KEY_TBL_ADDR \
+                island NIC_RSS_KEY_TBL_SIZE addr40
+
     .alloc_mem _vf_vlan_cache ctm island VLAN_TO_VNICS_MAP_TBL_SIZE 65536
 
     /* PCIe Queue RX BUF SZ table*/
@@ -57,6 +97,12 @@
             island NIC_RSS_TBL_SIZE addr40
     }
 
+    __asm
+    {
+        .alloc_mem NIC_RSS_KEY_TBL cls + NIC_RSS_KEY_TBL_ADDR \
+            island NIC_RSS_KEY_TBL_SIZE addr40
+    }
+
     __asm
     {
         .alloc_mem _vf_vlan_cache ctm island VLAN_TO_VNICS_MAP_TBL_SIZE 65536
@@ -102,6 +148,8 @@
     #define    INSTR_TX_VLAN           16
     #define    INSTR_L2_SWITCH_WIRE    17
     #define    INSTR_L2_SWITCH_HOST    18
+    #define    INSTR_JUMP              19
+    #define    INSTR_FLOW_LOOKUP       20
 #elif defined(__NFP_LANG_MICROC)
 enum instruction_ops {
     INSTR_DROP = 0,
@@ -122,7 +170,9 @@ enum instruction_ops {
     INSTR_PUSH_PKT,
     INSTR_TX_VLAN,
     INSTR_L2_SWITCH_WIRE,
-    INSTR_L2_SWITCH_HOST
+    INSTR_L2_SWITCH_HOST,
+    INSTR_JUMP,
+    INSTR_FLOW_LOOKUP
 };
 
 /* this maping will eventually be replaced at build time with actual offsets
@@ -198,7 +248,7 @@ enum instruction_ops {
  *       +-----------------------------+-+-+-+-+-+---------+-+-+---------+
  *    0  |              4              |P|u|t|U|T| Tbl idx |1| MAX Queue |
  *       +---------------+-------------+-+-+-+-+-+---------+-+-+---------+
- *    1  |                            RSS Key                            |
+ *    1  |                     RSS Key Table Address                     |
  *       +---------------------------------------------------------------+
  *
  *       u - Enable IPV4_UDP
@@ -207,6 +257,10 @@ enum instruction_ops {
  *       T - Enable IPV6_TCP
  *       1 - RSSv1
  *
+ *       The key table is the NIC_RSS_KEY_TBL slot holding the key windows
+ *       for the vNIC RSS key, entry [(word * 8 + nibble) * 16 + value] is
+ *       the XOR of the windows selected by value at that input position.
+ *
  * INSTR_CHECKSUM:
  * Bit \  3 3 2 2 2 2 2 2 2 2 2 2 1 1 1 1 1 1 1 1 1 1 0 0 0 0 0 0 0 0 0 0
  * Word   1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0
@@ -314,6 +368,30 @@ enum instruction_ops {
  *       +-----------------------------+-+-------------------------------+
  *    0  |              18             |P|                               |
  *       +-----------------------------+-+-------------------------------+
+ *
+ * INSTR_JUMP:
+ * Bit \  3 3 2 2 2 2 2 2 2 2 2 2 1 1 1 1 1 1 1 1 1 1 0 0 0 0 0 0 0 0 0 0
+ * Word   1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0
+ *       +-----------------------------+-+-------------------------------+
+ *    0  |              19             |P|            ADDRESS            |
+ *       +-----------------------------+-+-------------------------------+
+ *
+ *       ADDRESS = CLS address of the continuation entry, execution resumes
+ *                 with the first instruction of that entry
+ *
+ * INSTR_FLOW_LOOKUP:
+ * Bit \  3 3 2 2 2 2 2 2 2 2 2 2 1 1 1 1 1 1 1 1 1 1 0 0 0 0 0 0 0 0 0 0
+ * Word   1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0
+ *       +-----------------------------+-+-------------------------------+
+ *    0  |              20             |P|             PORT              |
+ *       +-----------------------------+-+-------------------------------+
+ *
+ *       PORT = ingress port of the list, (1 << 8) | port for wire lists
+ *              and (PCIe << 6) | vNIC for host lists
+ *
+ *       Looks up the IPv4 TCP/UDP five-tuple and PORT in the FLOW_TID map.
+ *       On a hit execution continues with the action list held in the map
+ *       value, on a miss (or any other packet) with the next instruction.
  */
 
 /* Instruction format of NIC_CFG_INSTR_TBL table. Some 32-bit words will
@@ -335,7 +413,7 @@ typedef union {
         uint32_t tbl_idx : 5;
         uint32_t v1_meta : 1;
         uint32_t max_queue : 6;
-        uint32_t key;
+        uint32_t key_tbl;
     };
     uint32_t __raw[2];
 } instr_rss_t;
@@ -423,7 +501,7 @@ typedef union {
 #define INSTR_RSS_TABLE_IDX_bf  0, 11, 7
 #define INSTR_RSS_V1_META_bf    0, 6, 6
 #define INSTR_RSS_MAX_QUEUE_bf  0, 5, 0
-#define INSTR_RSS_KEY_bf        1, 31, 0
+#define INSTR_RSS_KEY_TBL_bf    1, 31, 0
 
 #define INSTR_RX_HOST_MTU_bf     0, 15, 2
 
@@ -451,6 +529,10 @@ typedef union {
 #define INSTR_DEL_OFFSET_bf      0, 14, 8
 #define INSTR_DEL_LENGTH_bf      0, 7, 0
 
+#define INSTR_JUMP_ADDR_bf       0, 15, 0
+
+#define INSTR_FLOW_PORT_bf       0, 15, 0
+
 #if defined(__NFP_LANG_ASM)
 
     #define __LOOP 0
@@ -182,6 +182,38 @@ __export __shared __cls struct mac_addr nvnic_macs[NFD_MAX_ISL][NVNICS];
 /* RSS table length in words */
 #define NFP_NET_CFG_RSS_ITBL_SZ_wrd (NFP_NET_CFG_RSS_ITBL_SZ >> 2)
 
+/* RSS key length in words */
+#define NFP_NET_CFG_RSS_KEY_SZ_wrd (NFP_NET_CFG_RSS_KEY_SZ >> 2)
+
+/* RSS key expanded into each NIC_RSS_KEY_TBL slot and the RSS tables
+ * (bitmask of rss_tbl_idx) currently using the slot */
+struct rss_key_slot {
+    uint32_t key[NFP_NET_CFG_RSS_KEY_SZ_wrd];
+    uint32_t users;
+};
+
+__shared __lmem struct rss_key_slot rss_key_slots[NIC_RSS_KEY_TBL_NUM];
+
+/* Continuation entries (INSTR_JUMP) of the host and wire action lists,
+ * indexed like the head of the list in NIC_CFG_INSTR_TBL. Each entry holds
+ * the number of continuation entries in use (bits 31:16) and the first one */
+#define CFG_ACT_CHAIN_OWNERS ((1 << 8) + NS_PLATFORM_NUM_PORTS)
+
+__export __emem uint32_t cfg_act_chain_tbl[CFG_ACT_CHAIN_OWNERS];
+__export __emem uint64_t cfg_error_act_chain_cntr = 0;
+
+/* Bitmap of allocated continuation entries */
+__shared __lmem uint32_t cfg_act_chain_used[NIC_CFG_INSTR_CHAIN_BLKS / 32];
+
+/* INSTR_JUMP written over a live head entry, see cfg_act_swap_queue() */
+__shared __lmem union instruction_format cfg_act_swap_instr[NIC_MAX_INSTR];
+
+/* Grace period for table updates, see nic_basic */
+__intrinsic void nic_local_epoch();
+
+/* Last generation written to NIC_CFG_INSTR_GEN_NN_IDX */
+__shared __lmem uint32_t cfg_act_gen = 0;
+
 /* Cluster target NN write defines and structures */
 typedef enum CT_ADDR_MODE
 {
@@ -260,7 +292,8 @@ void ct_nn_write(__xwrite void *xfer,
 
 /* Write the RSS table to NN registers for all MEs */
 /* RSS table uses 0-63 NN registers (max of 2 VNIC ports, 1 RSS tbl per port) */
-/* HASH table uses 64-103, EPOCH uses NN 127  */
+/* HASH table uses 64-103, HASHMAP_FD_GEN_NN_IDX uses NN 125,
+ * NIC_CFG_INSTR_GEN_NN_IDX uses NN 126, EPOCH uses NN 127 */
 __intrinsic void
 upd_nn_table_instr(__xwrite uint32_t *xwr_instr, uint32_t start_offset,
                    uint32_t count)
@@ -322,23 +355,18 @@ init_nn_tables()
 }
 
 
-/* Write RSS indirection table */
+/* Write a table in CLS on all worker islands */
 __intrinsic void
-wr_rss_tbl(__xwrite uint32_t *xwr_rss,
-           uint32_t start_offset, uint32_t count)
+wr_cls_tbl(__xwrite uint32_t *xwr_tbl, uint32_t cls_addr, uint32_t count)
 {
-    __cls __addr32 void *nic_rss_tbl = (__cls __addr32 void*)
-                                        __link_sym("NIC_RSS_TBL");
     SIGNAL sig;
     uint32_t addr_hi;
-    uint32_t addr_lo;
     uint32_t isl;
     struct nfp_mecsr_prev_alu ind;
 
     ctassert(count <= 32);
 
     for (isl = 0; isl < sizeof(app_isl_ids) / sizeof(uint32_t); isl++) {
-        addr_lo = (uint32_t) nic_rss_tbl + start_offset;
         addr_hi = app_isl_ids[isl] >> 4; /* only use island, mask out ME */
         addr_hi = (addr_hi << (34 - 8)); /* address shifted by 8 in instr */
 
@@ -347,13 +375,140 @@ wr_rss_tbl(__xwrite uint32_t *xwr_rss,
         ind.length = count - 1;
         __asm {
             alu[--, --, B, ind.__raw]
-            cls[write, *xwr_rss, addr_hi, <<8, addr_lo, \
+            cls[write, *xwr_tbl, addr_hi, <<8, cls_addr, \
                 __ct_const_val(count)], ctx_swap[sig], indirect_ref
         }
     }
     return;
 }
 
+/* Write RSS indirection table */
+__intrinsic void
+wr_rss_tbl(__xwrite uint32_t *xwr_rss,
+           uint32_t start_offset, uint32_t count)
+{
+    __cls __addr32 void *nic_rss_tbl = (__cls __addr32 void*)
+                                        __link_sym("NIC_RSS_TBL");
+
+    wr_cls_tbl(xwr_rss, (uint32_t) nic_rss_tbl + start_offset, count);
+}
+
+/* Window of 32 key bits starting at bit (MSB first) */
+static uint32_t
+rss_key_window(__lmem uint32_t *key, uint32_t bit)
+{
+    uint32_t word = bit >> 5;
+    uint32_t shf = bit & 31;
+
+    if (shf == 0)
+        return key[word];
+
+    return (key[word] << shf) | (key[word + 1] >> (32 - shf));
+}
+
+/* Expand the RSS key of a slot into its Toeplitz key table. Every nibble of
+ * hash input gets a row of 16 entries, each the XOR of the key windows
+ * selected by the bits set in the nibble value (see INSTR_RSS). */
+__intrinsic void
+wr_rss_key_tbl(uint32_t slot)
+{
+    __cls __addr32 uint8_t *nic_rss_key_tbl = (__cls __addr32 uint8_t*)
+                                        __link_sym("NIC_RSS_KEY_TBL");
+    __xwrite uint32_t xwr_row[16];
+    __lmem uint32_t *key = rss_key_slots[slot].key;
+    uint32_t win[4];
+    uint32_t entry;
+    uint32_t addr;
+    uint32_t pos;
+    uint32_t i;
+
+    ctassert(NIC_RSS_KEY_TBL_ROW_SZ == sizeof(xwr_row));
+    ctassert(NIC_RSS_KEY_TBL_WORDS * 32 + 31 <
+             NFP_NET_CFG_RSS_KEY_SZ * 8);
+
+    addr = (uint32_t) nic_rss_key_tbl + slot * NIC_RSS_KEY_TBL_SZ;
+    for (pos = 0; pos < NIC_RSS_KEY_TBL_WORDS * 8; pos++) {
+        for (i = 0; i < 4; i++)
+            win[i] = rss_key_window(key, pos * 4 + i);
+
+        for (i = 0; i < 16; i++) {
+            entry = 0;
+            if (i & 8)
+                entry ^= win[0];
+            if (i & 4)
+                entry ^= win[1];
+            if (i & 2)
+                entry ^= win[2];
+            if (i & 1)
+                entry ^= win[3];
+            xwr_row[i] = entry;
+        }
+
+        wr_cls_tbl(xwr_row, addr, 16);
+        addr += NIC_RSS_KEY_TBL_ROW_SZ;
+    }
+}
+
+/* Select the Toeplitz key table for an RSS table. vNICs configured with the
+ * same key (the common case, Linux uses one key for all netdevs) share a
+ * slot, the table is only expanded when a new key is seen.
+ * Returns the CLS address of the key table in *key_tbl, or -1 and leaves
+ * the slots as they are if all of them hold the keys of other vNICs. */
+__intrinsic int
+upd_rss_key_tbl(uint32_t rss_tbl_idx, __xread uint32_t *rss_key,
+                uint32_t *key_tbl)
+{
+    __cls __addr32 uint8_t *nic_rss_key_tbl = (__cls __addr32 uint8_t*)
+                                        __link_sym("NIC_RSS_KEY_TBL");
+    uint32_t user = 1 << (rss_tbl_idx & 31);
+    uint32_t slot;
+    uint32_t sel = NIC_RSS_KEY_TBL_NUM;
+    uint32_t diff;
+    uint32_t i;
+
+    for (slot = 0; slot < NIC_RSS_KEY_TBL_NUM; slot++) {
+        if (rss_key_slots[slot].users == 0)
+            continue;
+
+        diff = 0;
+        for (i = 0; i < NFP_NET_CFG_RSS_KEY_SZ_wrd; i++)
+            diff |= rss_key_slots[slot].key[i] ^ rss_key[i];
+
+        if (diff == 0)
+            sel = slot;
+    }
+
+    if (sel == NIC_RSS_KEY_TBL_NUM) {
+        /* A slot no other vNIC uses, possibly the previous one of this
+         * RSS table */
+        for (slot = 0; slot < NIC_RSS_KEY_TBL_NUM; slot++) {
+            if ((rss_key_slots[slot].users & ~user) == 0)
+                break;
+        }
+
+        if (slot == NIC_RSS_KEY_TBL_NUM) {
+            /* Out of key tables, hashing with the key of another vNIC
+             * would spread flows differently than the host expects */
+            cfg_error_rss_cntr++;
+            return -1;
+        }
+
+        sel = slot;
+        for (i = 0; i < NFP_NET_CFG_RSS_KEY_SZ_wrd; i++)
+            rss_key_slots[sel].key[i] = rss_key[i];
+        wr_rss_key_tbl(sel);
+    }
+
+    for (slot = 0; slot < NIC_RSS_KEY_TBL_NUM; slot++) {
+        if (slot != sel)
+            rss_key_slots[slot].users &= ~user;
+    }
+    rss_key_slots[sel].users |= user;
+
+    *key_tbl = (uint32_t) nic_rss_key_tbl + sel * NIC_RSS_KEY_TBL_SZ;
+    return 0;
+}
+
 /* Update RX wire instr -> one table entry per NBI queue/port */
 __intrinsic void
 upd_rx_wire_instr(__xwrite uint32_t *xwr_instr,
@@ -548,30 +703,33 @@ cfg_act_upd_vxlan_table(uint32_t pcie, uint32_t vid)
 __intrinsic void
 cfg_act_init(action_list_t *acts)
 {
-    reg_zero(acts->instr, NIC_MAX_INSTR);
+    reg_zero(acts->instr, sizeof(acts->instr));
     acts->count = 0;
     acts->prev = 0;
+    acts->err = 0;
 }
 
 
+/* Write count words of one NIC_CFG_INSTR_TBL entry, starting at word off,
+ * on all islands */
 __intrinsic void
-cfg_act_write_queue(uint32_t qid, action_list_t *acts)
+cfg_act_write_entry(uint32_t idx, uint32_t off,
+                    __lmem union instruction_format *instr, uint32_t count)
 {
     SIGNAL sig;
     uint32_t addr_hi;
     uint32_t addr_lo;
     uint32_t isl;
-    uint32_t count;
     struct nfp_mecsr_prev_alu ind;
     __xwrite uint32_t xwr_instr[NIC_MAX_INSTR];
     __cls __addr32 void *nic_cfg_instr_tbl = (__cls __addr32 void*)
                                               __link_sym("NIC_CFG_INSTR_TBL");
 
-    reg_cp(xwr_instr, (void *) acts->instr, NIC_MAX_INSTR << 2);
-    count = acts->count;
+    reg_cp(xwr_instr, (void *) instr, NIC_MAX_INSTR << 2);
 
     for (isl = 0; isl < sizeof(app_isl_ids) / sizeof(uint32_t); isl++) {
-        addr_lo = (uint32_t) nic_cfg_instr_tbl + qid * NIC_MAX_INSTR * 4;
+        addr_lo = (uint32_t) nic_cfg_instr_tbl + idx * NIC_MAX_INSTR * 4 +
+                  off * 4;
         addr_hi = app_isl_ids[isl] >> 4; /* only use island, mask out ME */
         addr_hi = (addr_hi << (34 - 8)); /* address shifted by 8 in instr */
 
@@ -587,28 +745,322 @@ cfg_act_write_queue(uint32_t qid, action_list_t *acts)
 }
 
 
+/* Rewrite a head entry. The first word is written last, so a worker sees
+ * either the previous first word (the INSTR_JUMP written by
+ * cfg_act_swap_queue() if the list was staged) or the complete new list. */
+__intrinsic void
+cfg_act_write_queue(uint32_t qid, action_list_t *acts)
+{
+    uint32_t count = acts->count;
+
+    /* Chained lists, see cfg_act_chain() */
+    if (count > NIC_MAX_INSTR)
+        count = NIC_MAX_INSTR;
+
+    if (count > 1)
+        cfg_act_write_entry(qid, 1, &acts->instr[1], count - 1);
+    cfg_act_write_entry(qid, 0, acts->instr, 1);
+}
+
+
+/* Number of words of an instruction (see app_config_instr.h) */
+__intrinsic uint32_t
+cfg_act_instr_len(uint32_t op)
+{
+    if (op == cfg_act_map[INSTR_DST_MAC_MATCH] ||
+        op == cfg_act_map[INSTR_SRC_MAC_MATCH] ||
+        op == cfg_act_map[INSTR_RSS] ||
+        op == cfg_act_map[INSTR_VEB_LOOKUP])
+        return 2;
+
+    return 1;
+}
+
+
+/* Allocate n consecutive continuation entries, returns the first entry or
+ * NIC_CFG_INSTR_CHAIN_BLKS if there is no room */
+static uint32_t
+cfg_act_chain_alloc(uint32_t n)
+{
+    uint32_t blk;
+    uint32_t i;
+
+    for (blk = 0; blk + n <= NIC_CFG_INSTR_CHAIN_BLKS; blk++) {
+        for (i = 0; i < n; i++) {
+            if (cfg_act_chain_used[(blk + i) >> 5] & (1 << ((blk + i) & 31)))
+                break;
+        }
+
+        if (i == n) {
+            for (i = 0; i < n; i++)
+                cfg_act_chain_used[(blk + i) >> 5] |= 1 << ((blk + i) & 31);
+            return blk;
+        }
+    }
+
+    return NIC_CFG_INSTR_CHAIN_BLKS;
+}
+
+
+static void
+cfg_act_chain_free(uint32_t blk, uint32_t n)
+{
+    for (; n > 0; n--, blk++)
+        cfg_act_chain_used[blk >> 5] &= ~(1 << (blk & 31));
+}
+
+
+/* Lay out a list longer than NIC_MAX_INSTR words in place as NIC_MAX_INSTR
+ * word entries, each ending with an INSTR_JUMP to the next one. The
+ * continuation entries start at blk. Instructions are never split across
+ * entries. Returns the number of entries used, 0 if the list does not fit. */
+static uint32_t
+cfg_act_chain_layout(action_list_t *acts, uint32_t blk)
+{
+    __cls __addr32 uint8_t *nic_cfg_instr_tbl = (__cls __addr32 uint8_t*)
+                                              __link_sym("NIC_CFG_INSTR_TBL");
+    uint32_t precursor_act = 2 * cfg_act_map[INSTR_JUMP] -
+                             cfg_act_map[INSTR_JUMP + 1];
+    uint32_t base = 0;
+    uint32_t blks = 1;
+    uint32_t prev;
+    uint32_t end;
+    uint32_t pad;
+    uint32_t len;
+    uint32_t i;
+
+    while (acts->count - base > NIC_MAX_INSTR) {
+        if (blks == NIC_MAX_INSTR_BLKS)
+            return 0;
+
+        /* Fill the entry, leaving room for the jump */
+        end = base;
+        prev = cfg_act_map[INSTR_JUMP];
+        for (;;) {
+            len = cfg_act_instr_len(acts->instr[end].op);
+            if (end + len > base + NIC_MAX_INSTR - 1)
+                break;
+            prev = acts->instr[end].op;
+            end += len;
+        }
+
+        /* Move the remaining instructions to the next entry */
+        pad = base + NIC_MAX_INSTR - end;
+        if (acts->count + pad > NIC_MAX_INSTR * NIC_MAX_INSTR_BLKS)
+            return 0;
+
+        for (i = acts->count; i > end; i--)
+            acts->instr[i - 1 + pad] = acts->instr[i - 1];
+        for (i = end; i < base + NIC_MAX_INSTR; i++)
+            acts->instr[i].value = 0;
+        acts->count += pad;
+
+        acts->instr[end].op = cfg_act_map[INSTR_JUMP];
+        acts->instr[end].pipeline = (prev == precursor_act) ? 1 : 0;
+        acts->instr[end].args = (uint32_t) nic_cfg_instr_tbl +
+            (NIC_CFG_INSTR_CHAIN_BASE + blk + blks - 1) * NIC_MAX_INSTR * 4;
+
+        /* The jump always dispatches the first instruction of the entry */
+        base += NIC_MAX_INSTR;
+        acts->instr[base].pipeline = 0;
+        blks++;
+    }
+
+    return blks;
+}
+
+
+/* Split an action list longer than NIC_MAX_INSTR words across chained
+ * NIC_CFG_INSTR_TBL entries and write the continuation entries, the caller
+ * writes the head entry. Returns the continuation entries previously used
+ * by the owner list, the caller releases them with cfg_act_release() once
+ * the head has been rewritten. A list that cannot be chained is replaced
+ * by a drop list. */
+static uint32_t
+cfg_act_chain(uint32_t owner, action_list_t *acts)
+{
+    uint32_t prev_chain = cfg_act_chain_tbl[owner];
+    uint32_t chain = 0;
+    uint32_t blks;
+    uint32_t blk;
+    uint32_t i;
+
+    if (acts->count > NIC_MAX_INSTR) {
+        blk = cfg_act_chain_alloc(NIC_MAX_INSTR_BLKS - 1);
+        blks = 0;
+        if (blk != NIC_CFG_INSTR_CHAIN_BLKS)
+            blks = cfg_act_chain_layout(acts, blk);
+
+        if (blks == 0) {
+            if (blk != NIC_CFG_INSTR_CHAIN_BLKS)
+                cfg_act_chain_free(blk, NIC_MAX_INSTR_BLKS - 1);
+            cfg_error_act_chain_cntr++;
+
+            cfg_act_init(acts);
+            acts->instr[acts->count++].op = cfg_act_map[INSTR_DROP];
+        } else {
+            cfg_act_chain_free(blk + blks - 1, NIC_MAX_INSTR_BLKS - blks);
+
+            for (i = 1; i < blks; i++) {
+                cfg_act_write_entry(NIC_CFG_INSTR_CHAIN_BASE + blk + i - 1, 0,
+                                    &acts->instr[i * NIC_MAX_INSTR],
+                                    (i == blks - 1) ?
+                                    acts->count - i * NIC_MAX_INSTR :
+                                    NIC_MAX_INSTR);
+            }
+
+            chain = ((blks - 1) << 16) | blk;
+        }
+    }
+
+    cfg_act_chain_tbl[owner] = chain;
+
+    return prev_chain;
+}
+
+
+/* Stage the head entry of a list in a spare continuation entry, see
+ * cfg_act_write_queue(). Returns NIC_CFG_INSTR_CHAIN_BLKS if there is no
+ * spare entry, the heads are then rewritten in place. */
+static uint32_t
+cfg_act_stage(action_list_t *acts)
+{
+    uint32_t count = acts->count;
+    uint32_t blk;
+
+    if (count > NIC_MAX_INSTR)
+        count = NIC_MAX_INSTR;
+
+    blk = cfg_act_chain_alloc(1);
+    if (blk != NIC_CFG_INSTR_CHAIN_BLKS)
+        cfg_act_write_entry(NIC_CFG_INSTR_CHAIN_BASE + blk, 0, acts->instr,
+                            count);
+
+    return blk;
+}
+
+
+/* Point a live head entry at the staged copy of its new list. Workers that
+ * load the entry from now on follow the single word INSTR_JUMP and ignore
+ * the rest of the entry. */
+static void
+cfg_act_swap_queue(uint32_t qid, uint32_t blk)
+{
+    __cls __addr32 uint8_t *nic_cfg_instr_tbl = (__cls __addr32 uint8_t*)
+                                              __link_sym("NIC_CFG_INSTR_TBL");
+
+    if (blk == NIC_CFG_INSTR_CHAIN_BLKS)
+        return;
+
+    cfg_act_swap_instr[0].value = 0;
+    cfg_act_swap_instr[0].op = cfg_act_map[INSTR_JUMP];
+    cfg_act_swap_instr[0].args = (uint32_t) nic_cfg_instr_tbl +
+        (NIC_CFG_INSTR_CHAIN_BASE + blk) * NIC_MAX_INSTR * 4;
+
+    cfg_act_write_entry(qid, 0, cfg_act_swap_instr, 1);
+}
+
+
+/* Invalidate the action lists and free list buffer sizes cached by the
+ * workers, see actions_load and __pkt_io_fl_buf_sz */
+static void
+cfg_act_bump_gen(void)
+{
+    SIGNAL sig;
+    uint32_t i;
+    union ct_nn_write_format command;
+    __xwrite uint32_t xwr_gen;
+
+    xwr_gen = ++cfg_act_gen;
+
+    command.value = 0;
+    command.sig_num = 0x0;
+    command.addr_mode = CT_ADDR_MODE_ABSOLUTE;
+    command.NN_reg_num = NIC_CFG_INSTR_GEN_NN_IDX;
+
+    for (i = 0; i < sizeof(cfg_mes_ids) / sizeof(uint32_t); i++) {
+        command.remote_isl = cfg_mes_ids[i] >> 4;
+        command.master = cfg_mes_ids[i] & 0x0f;
+        ct_nn_write(&xwr_gen, &command, 1, ctx_swap, &sig);
+    }
+}
+
+
+/* Wait until no worker can still be executing a list read before the heads
+ * were rewritten, then free the staged entry and the previous continuation
+ * entries of the list. */
+static void
+cfg_act_release(uint32_t prev_chain, uint32_t blk)
+{
+    cfg_act_bump_gen();
+    nic_local_epoch();
+
+    if (blk != NIC_CFG_INSTR_CHAIN_BLKS)
+        cfg_act_chain_free(blk, 1);
+    if (prev_chain)
+        cfg_act_chain_free(prev_chain & 0xffff, prev_chain >> 16);
+}
+
+
+/* Action lists are replaced while the workers keep processing packets:
+ * the new list is staged in a spare entry and the live heads are switched
+ * to it with a single word write, then rewritten once no worker can be
+ * reading the old list (nic_local_epoch()), see cfg_act_write_queue(). */
 __intrinsic void
 cfg_act_write_host(uint32_t pcie, uint32_t vid, action_list_t *acts)
 {
+    uint32_t prev_chain;
+    uint32_t blk;
     uint32_t i;
 
+    prev_chain = cfg_act_chain((pcie << 6) | vid, acts);
+    blk = cfg_act_stage(acts);
+
+    for (i = 0; i < NFD_VID_MAXQS(vid); ++i)
+        cfg_act_swap_queue((pcie << 6) | NFD_VID2QID(vid, i), blk);
+
+    if (blk != NIC_CFG_INSTR_CHAIN_BLKS)
+        nic_local_epoch();
+
     for (i = 0; i < NFD_VID_MAXQS(vid); ++i)
         cfg_act_write_queue((pcie << 6) | NFD_VID2QID(vid, i), acts);
+
+    cfg_act_release(prev_chain, blk);
 }
 
 
 __intrinsic void
 cfg_act_write_wire(uint32_t port, action_list_t *acts)
 {
+    uint32_t prev_chain;
+    uint32_t blk;
+
+    prev_chain = cfg_act_chain((1 << 8) | port, acts);
+    blk = cfg_act_stage(acts);
+
+    cfg_act_swap_queue((1 << 8) | port, blk);
+
+    if (blk != NIC_CFG_INSTR_CHAIN_BLKS)
+        nic_local_epoch();
+
     cfg_act_write_queue((1 << 8) | port, acts);
+
+    cfg_act_release(prev_chain, blk);
 }
 
 
+/* Instructions past the capacity of a chained list flag it, the list is
+ * not written, see cfg_act_pf_up() */
 __intrinsic void
 cfg_act_append(action_list_t *acts, uint16_t op, uint16_t args)
 {
     uint32_t precursor_act = 2 * cfg_act_map[op] - cfg_act_map[op + 1];
 
+    if (acts->count >= NIC_MAX_INSTR * NIC_MAX_INSTR_BLKS) {
+        acts->err = 1;
+        return;
+    }
+
     acts->instr[acts->count].pipeline =
         (acts->count && acts->prev == precursor_act) ? 1 : 0;
 
@@ -619,6 +1071,19 @@ cfg_act_append(action_list_t *acts, uint16_t op, uint16_t args)
 }
 
 
+/* Second word of a two word instruction */
+__intrinsic void
+cfg_act_append_word(action_list_t *acts, uint32_t value)
+{
+    if (acts->count >= NIC_MAX_INSTR * NIC_MAX_INSTR_BLKS) {
+        acts->err = 1;
+        return;
+    }
+
+    acts->instr[acts->count++].value = value;
+}
+
+
 __intrinsic void
 cfg_act_append_drop(action_list_t *acts)
 {
@@ -656,7 +1121,7 @@ cfg_act_append_veb_lookup(action_list_t *acts, uint32_t pcie, uint32_t vid,
 
     if (promisc) {
         cfg_act_append(acts, INSTR_VEB_LOOKUP, 0);
-        acts->instr[acts->count++].value = 0;
+        cfg_act_append_word(acts, 0);
     } else {
         if (mac_match) {
             mem_read64(bar_mac,
@@ -670,17 +1135,24 @@ cfg_act_append_veb_lookup(action_list_t *acts, uint32_t pcie, uint32_t vid,
             mac[1] = 0;
         }
         cfg_act_append(acts, INSTR_VEB_LOOKUP, mac[0] >> 16);
-        acts->instr[acts->count++].value = (mac[0] << 16) | (mac[1] >> 16);
+        cfg_act_append_word(acts, (mac[0] << 16) | (mac[1] >> 16));
     }
 }
 
 
+__intrinsic void
+cfg_act_append_flow_lookup(action_list_t *acts, uint32_t port)
+{
+    cfg_act_append(acts, INSTR_FLOW_LOOKUP, port);
+}
+
+
 __intrinsic void
 cfg_act_append_dmac_match(action_list_t *acts, uint32_t mac_hi16,
                           uint32_t mac_lo32)
 {
     cfg_act_append(acts, INSTR_DST_MAC_MATCH, mac_hi16);
-    acts->instr[acts->count++].value = mac_lo32;
+    cfg_act_append_word(acts, mac_lo32);
 }
 
 
@@ -703,7 +1175,7 @@ cfg_act_append_smac_match(action_list_t *acts, uint32_t mac_hi32,
                           uint32_t mac_lo16)
 {
     cfg_act_append(acts, INSTR_SRC_MAC_MATCH, mac_lo16);
-    acts->instr[acts->count++].value = mac_hi32;
+    cfg_act_append_word(acts, mac_hi32);
 }
 
 
@@ -736,6 +1208,7 @@ cfg_act_append_rss(action_list_t *acts, uint32_t pcie, uint32_t vid,
     __xread uint32_t rx_rings[2];
     __xread uint32_t rss_key[NFP_NET_CFG_RSS_KEY_SZ / sizeof(uint32_t)];
     uint32_t rss_tbl_idx;
+    uint32_t key_tbl;
     uint32_t type, vnic;
     instr_rss_t instr_rss;
 
@@ -756,7 +1229,11 @@ cfg_act_append_rss(action_list_t *acts, uint32_t pcie, uint32_t vid,
     __mem_read64(&rx_rings, (__mem void*) (bar_base + NFP_NET_CFG_RXRS_ENABLE),
                  sizeof(uint64_t), sizeof(uint64_t), sig_done, &sig3);
     wait_for_all(&sig1, &sig2, &sig3);
-    instr_rss.key = rss_key[0];
+    if (upd_rss_key_tbl(rss_tbl_idx, rss_key, &key_tbl)) {
+        acts->err = 1;
+        return;
+    }
+    instr_rss.key_tbl = key_tbl;
 
     // Driver does L3 unconditionally, so we only care about L4 combinations
     instr_rss.cfg_proto = 0;
@@ -776,7 +1253,7 @@ cfg_act_append_rss(action_list_t *acts, uint32_t pcie, uint32_t vid,
     instr_rss.tbl_idx = rss_tbl_idx;
 
     cfg_act_append(acts, INSTR_RSS, instr_rss.__raw[0]);
-    acts->instr[acts->count++].value = instr_rss.__raw[1];
+    cfg_act_append_word(acts, instr_rss.__raw[1]);
 }
 
 
@@ -1069,6 +1546,12 @@ cfg_act_build_nbi(action_list_t *acts, uint32_t pcie, uint32_t vid,
     cfg_act_append_rx_wire(acts, pcie, vid, vxlan, nvgre,
                            rx_csum && !csum_compl);
 
+#ifdef NIC_FLOW_CACHE
+    /* Cached flows bypass the rest of the list, including BPF */
+    if (!(control & NFP_NET_CFG_CTRL_BPF))
+        cfg_act_append_flow_lookup(acts, (1 << 8) | vnic);
+#endif
+
     if (veb_up)
         cfg_act_append_veb_lookup(acts, pcie, vid, promisc, 1);
     else if (! promisc)
@@ -1200,6 +1683,10 @@ cfg_act_cache_fl_buf_sz(uint32_t pcie, uint32_t vid)
     for (i = 0; i < NFD_VID_MAXQS(vid); ++i)
         mem_write32(&rxb_w, &fl_buf_sz_cache[pcie * 64 + NFD_VID2NATQ(vid, i)],
                     sizeof(rxb_w));
+
+    /* the workers drop their copies now, the callers may still fail before
+     * they write the action lists */
+    cfg_act_bump_gen();
 }
 
 
@@ -1221,6 +1708,10 @@ cfg_act_write_veb(uint32_t vid, __lmem struct nic_mac_vlan_key *veb_key,
         if (new_mac_addr == 0 || ((new_mac_addr >> 40) & 0x01))
             return MAC_VLAN_ADD_FAIL;
 
+        /* The VEB entry holds a single NIC_CFG_INSTR_TBL entry */
+        if (acts->count > NIC_MAX_INSTR)
+            return MAC_VLAN_ADD_FAIL;
+
         new_vlan_id = veb_key->vlan_id;
         /* Add or overwrite VEB table entries */
         for (vlan_id = 0; vlan_id <= NIC_NO_VLAN_ID; vlan_id++) {
@@ -1277,6 +1768,8 @@ cfg_act_vf_up(uint32_t pcie, uint32_t vid, uint32_t pf_control,
     cfg_act_cache_fl_buf_sz(pcie, vid);
 
     cfg_act_build_veb_vf(&acts, pcie, vid, pf_control, vf_control, update);
+    if (acts.err)
+        return 1;
 
     vf_cfg_base = nfd_vf_cfg_base(pcie, NFD_VID2VF(vid), NFD_VF_CFG_SEL_VF);
     mem_read32(&sriov_cfg_data, vf_cfg_base, sizeof(struct sriov_cfg));
@@ -1323,6 +1816,8 @@ cfg_act_vf_up(uint32_t pcie, uint32_t vid, uint32_t pf_control,
     upd_ctm_vlan_members(pcie);
 
     cfg_act_build_vf(&acts, pcie, vid, pf_control, vf_control);
+    if (acts.err)
+        return 1;
     cfg_act_write_host(pcie, vid, &acts);
 
     return 0;
@@ -1362,10 +1857,14 @@ cfg_act_pf_up(uint32_t pcie, uint32_t vid, uint32_t veb_up,
     cfg_act_cache_fl_buf_sz(pcie, vid);
 
     cfg_act_build_nbi(&acts, pcie, vid, veb_up, control, update);
+    if (acts.err)
+        return 1;
     NFD_VID2VNIC(type, vnic, vid);
     cfg_act_write_wire(vnic, &acts);
 
     cfg_act_build_pf(&acts, pcie, vid, veb_up, control, update);
+    if (acts.err)
+        return 1;
     cfg_act_write_host(pcie, vid, &acts);
 
     mem_read64(&mac_xr.mac_word[0], (__mem void*) (nfd_cfg_bar_base(pcie, vid) +
@@ -1376,6 +1875,8 @@ cfg_act_pf_up(uint32_t pcie, uint32_t vid, uint32_t veb_up,
 
     if (vnic == 0) { // VFs are only associated with the first PF VNIC (for now)
         cfg_act_build_veb_pf(&acts, pcie, vid, control, update);
+        if (acts.err)
+            return 1;
 
         veb_key.__raw[0] = 0;
         veb_key.mac_addr_hi = mac.mac_word[0];
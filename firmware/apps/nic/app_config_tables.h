@@ -38,9 +38,10 @@ enum cfg_msg_err {
 } while (0);
 
 typedef struct {
-    union instruction_format instr[NIC_MAX_INSTR];
+    union instruction_format instr[NIC_MAX_INSTR * NIC_MAX_INSTR_BLKS];
     uint32_t count;
     uint32_t prev;
+    uint32_t err;       /* the list could not be built, see cfg_act_pf_up() */
 } __lmem __shared action_list_t;
 
 void cfg_act_build_vf(action_list_t *acts, uint32_t pcie, uint32_t vid,
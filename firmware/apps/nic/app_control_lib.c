@@ -407,7 +407,10 @@ process_pf_reconfig(int pcie, uint32_t control, uint32_t update, uint32_t vid,
     }
 
     if (update & NFP_NET_CFG_UPDATE_BPF) {
-        nic_local_bpf_reconfig(&ctx_mode, vid, vnic);
+        if (nic_local_bpf_reconfig(&ctx_mode, vid, vnic)) {
+            cfg_msg->error = 1;
+            return 1;
+        }
     }
 
     if (update & NFP_NET_CFG_UPDATE_VF) {
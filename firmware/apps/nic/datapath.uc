@@ -18,6 +18,7 @@
 .reg act_addr
 
 // kick off processing loop
+actions_init()
 pkt_io_init(pkt_vec)
 br[ingress#]
 
@@ -31,6 +32,7 @@ drop#:
     pkt_io_drop(pkt_vec)
 
 egress#:
+    actions_prof_end()
     pkt_io_reorder(pkt_vec)
 
 ingress#:
@@ -20,6 +20,13 @@
 #include "slicc_hash.h"
 
 #define EBPF_CAP_FUNC_ID_LOOKUP 1
+#define EBPF_CAP_FUNC_ID_KTIME_GET_NS 5
+#define EBPF_CAP_FUNC_ID_TAIL_CALL 12
+#define EBPF_CAP_FUNC_ID_REDIRECT 23
+#define EBPF_CAP_FUNC_ID_PERF_EVENT_OUTPUT 25
+#define EBPF_CAP_FUNC_ID_CSUM_DIFF 28
+#define EBPF_CAP_FUNC_ID_REDIRECT_MAP 51
+#define EBPF_CAP_FUNC_ID_XDP_ADJUST_META 54
 
 #define EBPF_CAP_ADJUST_HEAD_FLAG_NO_META (1 << 0)
 
@@ -29,6 +36,8 @@
 #define NFP_BPF_CAP_TYPE_RANDOM       4
 #define NFP_BPF_CAP_TYPE_QUEUE_SELECT 5
 #define NFP_BPF_CAP_TYPE_ADJUST_TAIL  6
+/* 7 and 8 are the ABI version and multi-entry cmsg types of the host driver */
+#define NFP_BPF_CAP_TYPE_XADD         9
 
 #define EBPF_DEBUG
 #define EBPF_MAPS
@@ -74,6 +83,13 @@
 #endm
 
 
+/* subroutines the JIT calls for 32 and 64 bit XADD on map values */
+#macro ebpf_init_cap_xadd(LABEL32, LABEL64)
+    #define_eval __EBPF_CAP_DATA '__EBPF_CAP_DATA,NFP_BPF_CAP_TYPE_XADD,8,(LABEL32),(LABEL64)'
+    #define_eval __EBPF_CAP_LENGTH (__EBPF_CAP_LENGTH + 16)
+#endm
+
+
 #macro ebpf_init_cap_empty(type)
     #define_eval __EBPF_CAP_DATA '__EBPF_CAP_DATA,(type),0'
     #define_eval __EBPF_CAP_LENGTH (__EBPF_CAP_LENGTH + 8)
@@ -97,12 +113,35 @@
 ebpf_init_cap_empty(NFP_BPF_CAP_TYPE_RANDOM)
 ebpf_init_cap_empty(NFP_BPF_CAP_TYPE_QUEUE_SELECT)
 ebpf_init_cap_empty(NFP_BPF_CAP_TYPE_ADJUST_TAIL)
-ebpf_init_cap_adjust_head(EBPF_CAP_ADJUST_HEAD_FLAG_NO_META, 44, 248, 84, 112)
-ebpf_init_cap_maps(((1 << BPF_MAP_TYPE_HASH)+(1<<BPF_MAP_TYPE_ARRAY)), HASHMAP_MAX_TID_EBPF, HASHMAP_MAX_ENTRIES, HASHMAP_MAX_KEYS_SZ, HASHMAP_MAX_VALU_SZ, \
+#define EBPF_PKT_MIN_OFFSET 44
+ebpf_init_cap_adjust_head(EBPF_CAP_ADJUST_HEAD_FLAG_NO_META, EBPF_PKT_MIN_OFFSET, 248, 84, 112)
+// one limit for all map types, per-cpu maps also reserve their entries
+// from the HASHMAP_PERCPU_ENTRIES blocks and are refused at ALLOC with E2BIG,
+// as are LPM_TRIE maps of more than the HASHMAP_LPM_LEAVES leaves they share,
+// less the HASHMAP_LPM_LEAF_DEFER kept back so freed leaves are not reused at once
+ebpf_init_cap_maps(((1 << BPF_MAP_TYPE_HASH)+(1<<BPF_MAP_TYPE_ARRAY)+(1<<BPF_MAP_TYPE_LRU_HASH)+(1<<BPF_MAP_TYPE_PERCPU_HASH)+(1<<BPF_MAP_TYPE_PERCPU_ARRAY)+(1<<BPF_MAP_TYPE_LPM_TRIE)+(1<<BPF_MAP_TYPE_PROG_ARRAY)+(1<<BPF_MAP_TYPE_DEVMAP)+(1<<BPF_MAP_TYPE_PERF_EVENT_ARRAY)), HASHMAP_MAX_TID_EBPF, HASHMAP_MAX_ENTRIES, HASHMAP_MAX_KEYS_SZ, HASHMAP_MAX_VALU_SZ, \
                    (HASHMAP_KEYS_VALU_SZ))
 ebpf_init_cap_func(EBPF_CAP_FUNC_ID_LOOKUP, HTAB_MAP_LOOKUP_SUBROUTINE#)
+ebpf_init_cap_func(EBPF_CAP_FUNC_ID_TAIL_CALL, HTAB_PROG_TAIL_CALL_SUBROUTINE#)
+// bpf_redirect() needs the ifindex as a constant the JIT rewrites to a
+// redirect target, others abort, see htab_redirect_subr_func()
+ebpf_init_cap_func(EBPF_CAP_FUNC_ID_REDIRECT, HTAB_REDIRECT_SUBROUTINE#)
+ebpf_init_cap_func(EBPF_CAP_FUNC_ID_REDIRECT_MAP, HTAB_REDIRECT_MAP_SUBROUTINE#)
+ebpf_init_cap_func(EBPF_CAP_FUNC_ID_PERF_EVENT_OUTPUT, CMSG_PERF_OUTPUT_SUBROUTINE#)
+ebpf_init_cap_func(EBPF_CAP_FUNC_ID_KTIME_GET_NS, EBPF_KTIME_SUBROUTINE#)
+ebpf_init_cap_func(EBPF_CAP_FUNC_ID_CSUM_DIFF, EBPF_CSUM_DIFF_SUBROUTINE#)
+ebpf_init_cap_func(EBPF_CAP_FUNC_ID_XDP_ADJUST_META, EBPF_ADJUST_META_SUBROUTINE#)
+// XADDs are single MU atomic adds to value words kept in NFP byte order,
+// the host marks these words at ALLOC, see CMSG_MAP_ALLOC_XADD_SHF
+ebpf_init_cap_xadd(HTAB_MAP_XADD32_SUBROUTINE#, HTAB_MAP_XADD64_SUBROUTINE#)
 ebpf_init_cap_finalize()
 
+/* Transfer registers the kernel JIT emits code for, xfer 0 up to a 32 word
+ * memcpy. Registers of the firmware that must survive a program call are
+ * placed above them, see $__actions.
+ */
+#define EBPF_JIT_XFER_REGS 32
+
 #define EBPF_STACK_SIZE 512
 .alloc_mem EBPF_STACK_BASE lmem me (4 * (1 << log2(EBPF_STACK_SIZE, 1))) (4 * (1 << log2(EBPF_STACK_SIZE, 1)))
 
@@ -134,11 +173,510 @@ ebpf_init_cap_finalize()
 
 #define _ebpf_pkt_vec *l$index1
 
+/* Per program runtime statistics, enabled by building with EBPF_PROG_STATS.
+ *
+ * A program is the eBPF image in the NFD_BPF_MAX_LEN code store slot of a
+ * vNIC, including the programs it tail calls. ebpf_call() takes the
+ * TIMESTAMP of the packet, ebpf_reentry() adds one run, the elapsed ticks
+ * (16 ME cycles each), the return code and the helper and tail calls of the
+ * packet to the LM counters of the program. Ticks include time swapped out
+ * on memory accesses of the program and its helpers, i.e. they measure the
+ * latency of the program like the kernel's run_time_ns.
+ *
+ * Every 2^EBPF_PROG_STATS_FLUSH_SHF runs of a program on an ME, on every
+ * epoch of pkt_io_rx() and when the ME quiesces for a new image its LM
+ * counters are added to the 64-bit counters of the program in the
+ * _ebpf_prog_stats rtsym and cleared, see firmware/scripts/nic-ebpf-stats.py
+ * for the layout. Runs of an idle ME are thus exported within an epoch and
+ * a reload starts the new image from empty LM counters.
+ */
+#define EBPF_PROG_STATS_SLOTS           ((__HASHMAP_PROG_USTORE_SZ - NFD_BPF_START_OFF) / NFD_BPF_MAX_LEN)
+#define EBPF_PROG_STATS_CNTRS           8
+#define EBPF_PROG_STATS_NDX_RUN         0
+#define EBPF_PROG_STATS_NDX_TICKS       1
+#define EBPF_PROG_STATS_NDX_PASS        2   // followed by DROP, REDIR, ABORT
+#define EBPF_PROG_STATS_NDX_HELPERS     6
+#define EBPF_PROG_STATS_NDX_TAIL_CALLS  7
+#ifndef EBPF_PROG_STATS_FLUSH_SHF
+    #define EBPF_PROG_STATS_FLUSH_SHF   10
+#endif
+
+#ifdef EBPF_PROG_STATS
+    #if (EBPF_PROG_STATS_SLOTS != 2)
+        #error "EBPF_PROG_STATS: ebpf_prog_stats_start() expects two code store slots"
+    #endif
+    .alloc_mem __ebpf_prog_stats lmem me (EBPF_PROG_STATS_SLOTS * EBPF_PROG_STATS_CNTRS * 4) (EBPF_PROG_STATS_SLOTS * EBPF_PROG_STATS_CNTRS * 4)
+    .alloc_mem _ebpf_prog_stats emem global (EBPF_PROG_STATS_SLOTS * EBPF_PROG_STATS_CNTRS * 8) 256
+#endif
+
+
+#macro ebpf_prog_stats_init()
+#ifdef EBPF_PROG_STATS
+.begin
+    .reg addr
+    .reg count
+
+    immed[addr, __ebpf_prog_stats]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    immed[count, (EBPF_PROG_STATS_SLOTS * EBPF_PROG_STATS_CNTRS)]
+    nop
+    nop
+
+clear_loop#:
+    alu[count, count, -, 1]
+    bne[clear_loop#], defer[1]
+        alu[*l$index3++, --, B, 0]
+.end
+#endif
+#endm
+
+
+/* Start the run of the program at in_ustore_addr, LM3 is on the context state */
+#macro ebpf_prog_stats_start(in_ustore_addr)
+#ifdef EBPF_PROG_STATS
+.begin
+    .reg slot
+    .reg ts
+
+    immed[*l$index3[HASHMAP_PROG_CTX_NDX_HELPERS], 0]
+    immed[slot, (NFD_BPF_START_OFF + NFD_BPF_MAX_LEN)]
+    alu[--, in_ustore_addr, -, slot]
+    blo[slot0#], defer[1]
+        immed[slot, __ebpf_prog_stats]
+    alu[slot, slot, +, (EBPF_PROG_STATS_CNTRS * 4)]
+slot0#:
+    alu[*l$index3[HASHMAP_PROG_CTX_NDX_STATS], --, B, slot]
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[ts, 0]
+    alu[*l$index3[HASHMAP_PROG_CTX_NDX_TS], --, B, ts]
+.end
+#endif
+#endm
+
+
+/* Add the LM counters of the program at in_slot to _ebpf_prog_stats */
+#macro __ebpf_prog_stats_flush(in_slot)
+.begin
+    .reg addr
+    .reg addr_hi
+    .reg addr_lo
+    .reg count
+    .reg write $stats[4]
+    .xfer_order $stats
+    .sig sig_stats
+
+    immed[addr_lo, __ebpf_prog_stats]
+    alu[addr_lo, in_slot, -, addr_lo]
+    alu[addr_lo, --, B, addr_lo, <<1]
+    move(addr_hi, (_ebpf_prog_stats >> 8))
+
+    alu[addr, --, B, in_slot]
+    immed[count, (EBPF_PROG_STATS_CNTRS / 2)]
+    immed[$stats[0], 0]
+    immed[$stats[2], 0]
+
+flush_loop#:
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    alu[addr, addr, +, 8]
+    nop
+    nop
+    alu[$stats[1], --, B, *l$index3[0]]
+    alu[$stats[3], --, B, *l$index3[1]]
+    alu[*l$index3[0], --, B, 0]
+    alu[*l$index3[1], --, B, 0]
+    mem[add64, $stats[0], addr_hi, <<8, addr_lo, 2], ctx_swap[sig_stats]
+    alu[addr_lo, addr_lo, +, 16]
+    alu[count, count, -, 1]
+    bne[flush_loop#]
+.end
+#endm
+
+
+/* Add the LM counters of all programs that ran since the last flush to
+ * _ebpf_prog_stats, clobbers LM3
+ */
+#macro ebpf_prog_stats_flush()
+#ifdef EBPF_PROG_STATS
+.begin
+    .reg end
+    .reg slot
+
+    immed[slot, __ebpf_prog_stats]
+    immed[end, (__ebpf_prog_stats + (EBPF_PROG_STATS_SLOTS * EBPF_PROG_STATS_CNTRS * 4))]
+
+slot_loop#:
+    local_csr_wr[ACTIVE_LM_ADDR_3, slot]
+    nop
+    nop
+    nop
+    alu[--, --, B, *l$index3[EBPF_PROG_STATS_NDX_RUN]]
+    beq[next_slot#]
+    __ebpf_prog_stats_flush(slot)
+next_slot#:
+    alu[slot, slot, +, (EBPF_PROG_STATS_CNTRS * 4)]
+    alu[--, end, -, slot]
+    bne[slot_loop#]
+.end
+#endif
+#endm
+
+
+/* End the run of the program of the packet with return code in_rc */
+#macro ebpf_prog_stats(in_rc)
+#ifdef EBPF_PROG_STATS
+.begin
+    .reg addr
+    .reg count
+    .reg delta
+    .reg helpers
+    .reg now
+    .reg run
+    .reg slot
+    .reg stat
+    .reg tail_calls
+
+    hashmap_prog_ctx_addr(addr)
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[now, 0]
+    immed[count, (1 << EBPF_PROG_STATS_FLUSH_SHF)]
+    alu[delta, now, -, *l$index3[HASHMAP_PROG_CTX_NDX_TS]]
+    alu[helpers, --, B, *l$index3[HASHMAP_PROG_CTX_NDX_HELPERS]]
+    alu[tail_calls, --, B, *l$index3[HASHMAP_PROG_CTX_NDX_TAIL_CNT]]
+    alu[slot, --, B, *l$index3[HASHMAP_PROG_CTX_NDX_STATS]]
+
+    local_csr_wr[ACTIVE_LM_ADDR_3, slot]
+    alu[stat, EBPF_RET_STATS_MASK, AND, in_rc, >>EBPF_RET_STATS_PASS]
+    ffs[addr, stat]
+    alu[addr, slot, +, addr, <<2]
+    alu[run, *l$index3[EBPF_PROG_STATS_NDX_RUN], +, 1]
+    alu[*l$index3[EBPF_PROG_STATS_NDX_RUN], --, B, run]
+    alu[*l$index3[EBPF_PROG_STATS_NDX_TICKS], *l$index3[EBPF_PROG_STATS_NDX_TICKS], +, delta]
+    alu[*l$index3[EBPF_PROG_STATS_NDX_HELPERS], *l$index3[EBPF_PROG_STATS_NDX_HELPERS], +, helpers]
+    alu[*l$index3[EBPF_PROG_STATS_NDX_TAIL_CALLS], *l$index3[EBPF_PROG_STATS_NDX_TAIL_CALLS], +, tail_calls]
+
+    alu[--, --, B, stat]
+    beq[no_rc#]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    nop
+    nop
+    nop
+    alu[*l$index3[EBPF_PROG_STATS_NDX_PASS], *l$index3[EBPF_PROG_STATS_NDX_PASS], +, 1]
+no_rc#:
+
+    alu[--, run, -, count]
+    blo[end#]
+    __ebpf_prog_stats_flush(slot)
+
+end#:
+.end
+#endif
+#endm
+
+
+/* Helpers without map state, called like the map helpers in hashmap.uc:
+ * B0 return address, arguments in A0, B1, B2, A1, A2, R0 returns in A0
+ * (low) and A1 (high).
+ */
+#define EBPF_CSUM_DIFF_MAX      512     // bytes, as the kernel
+#define EBPF_XDP_META_MAX       (PV_META_BASE_wrd * 4) // the PV prepend area, 32 bytes as the kernel
+#define EBPF_EINVAL             22
+
+/* ns per TIMESTAMP tick of 16 ME cycles in 16.16 fixed point */
+#define_eval EBPF_KTIME_NS_PER_TICK_Q16 (((16000 << 16) + (NS_PLATFORM_TCLK / 2)) / NS_PLATFORM_TCLK)
+
+/* out_hi:out_lo = in_a * in_b */
+#macro __ebpf_mul32(out_hi, out_lo, in_a, in_b)
+    mul_step[in_a, in_b], 32x32_start
+    mul_step[in_a, in_b], 32x32_step1
+    mul_step[in_a, in_b], 32x32_step2
+    mul_step[in_a, in_b], 32x32_step3
+    mul_step[in_a, in_b], 32x32_step4
+    mul_step[out_lo, --], 32x32_last
+    mul_step[out_hi, --], 32x32_last2
+#endm
+
+/*
+ * bpf_ktime_get_ns(), the TIMESTAMP of the ME in ns, scaled by the
+ * NS_PLATFORM_TCLK ME clock the host is told in NFP_NET_CFG_TLV_TYPE_ME_FREQ.
+ * The timestamps of all islands run off the same clock, see
+ * timestamp_enable().
+ */
+#macro ebpf_ktime_subr_func()
+.reentry
+.begin
+    htab_subr_regs_alloc()
+    .reg htab_return_addr
+    .reg_addr htab_return_addr 0 B
+    .set htab_return_addr
+
+    .reg rtn_addr
+    .reg hi
+    .reg lo
+    .reg tmp
+    .reg scale
+    .reg prod_lo[2]
+    .reg prod_hi[2]
+    .reg ebpf_rc
+    .reg ebpf_rc_hi
+
+    hashmap_prog_count_helper()
+    alu[rtn_addr, --, b, htab_return_addr]
+
+    // TIMESTAMP_LOW may wrap between the reads
+    local_csr_rd[TIMESTAMP_HIGH]
+    immed[hi, 0]
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[lo, 0]
+    local_csr_rd[TIMESTAMP_HIGH]
+    immed[tmp, 0]
+    alu[--, hi, -, tmp]
+    beq[scale#]
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[lo, 0]
+    alu[hi, --, b, tmp]
+
+scale#:
+    // ns = (hi:lo * NS_PER_TICK_Q16) >> 16, the bits past 64 are dropped
+    .reg_addr ebpf_rc 0 A
+    .reg_addr ebpf_rc_hi 1 A
+    move(scale, EBPF_KTIME_NS_PER_TICK_Q16)
+    __ebpf_mul32(prod_lo[1], prod_lo[0], lo, scale)
+    __ebpf_mul32(prod_hi[1], prod_hi[0], hi, scale)
+    alu[prod_lo[1], prod_lo[1], +, prod_hi[0]]
+    alu[prod_hi[1], prod_hi[1], +carry, 0]
+    dbl_shf[ebpf_rc, prod_lo[1], prod_lo[0], >>16]
+    dbl_shf[ebpf_rc_hi, prod_hi[1], prod_lo[1], >>16]
+
+    htab_subr_regs_free()
+    #pragma warning(push)
+    #pragma warning(disable: 5116)  // disable warning "Return register may not contain valid addr"
+        .use htab_return_addr
+        .use ebpf_rc
+        .use ebpf_rc_hi
+        rtn[rtn_addr]
+    #pragma warning(pop)
+.end
+#endm
+
+
+/*
+ * io_sum:io_carries plus the in_words words at LM address in_lm_addr, in
+ * chunks of up to 32 words of +carry adds like __actions_checksum().
+ * Clobbers in_words and LM3.
+ */
+#macro __ebpf_csum_lm(io_sum, io_carries, in_lm_addr, in_words)
+.begin
+    .reg chunk
+    .reg idx
+
+    local_csr_wr[ACTIVE_LM_ADDR_3, in_lm_addr]
+    alu[--, --, B, in_words]
+    beq[end#]
+
+loop#:
+    alu[chunk, --, B, in_words]
+    alu[--, chunk, -, 32]
+    blo[unroll#]
+    immed[chunk, 32]
+unroll#:
+    alu[idx, 32, -, chunk]
+    jump[idx, w0#], targets[w0#,  w1#,  w2#,  w3#,  w4#,  w5#,  w6#,  w7#,
+                            w8#,  w9#,  w10#, w11#, w12#, w13#, w14#, w15#,
+                            w16#, w17#, w18#, w19#, w20#, w21#, w22#, w23#,
+                            w24#, w25#, w26#, w27#, w28#, w29#, w30#, w31#], defer[2]
+        alu[in_words, in_words, -, chunk]
+        alu[chunk, chunk, +, 0] // clear the carry
+
+#define_eval LOOP_UNROLL (0)
+#while (LOOP_UNROLL < 32)
+w/**/LOOP_UNROLL#:
+    alu[io_sum, io_sum, +carry, *l$index3++]
+    #define_eval LOOP_UNROLL (LOOP_UNROLL + 1)
+#endloop
+#undef LOOP_UNROLL
+
+    alu[io_carries, io_carries, +carry, 0]
+    alu[--, --, B, in_words]
+    bne[loop#]
+
+end#:
+.end
+#endm
+
+/*
+ * bpf_csum_diff() of buffers on the eBPF stack.
+ *
+ * A0 LM address of from, B1 from size, B2 LM address of to, A1 to size,
+ * A2 seed. Returns the seed plus the ones' complement sum of the words of
+ * to minus those of from, in 32 bits with end around carry like the
+ * checksum of __actions_checksum(). It folds to the 16 bit checksum of the
+ * kernel's. Sizes that are not multiples of 4 or add up to more than
+ * EBPF_CSUM_DIFF_MAX bytes return -EINVAL.
+ */
+#macro ebpf_csum_diff_subr_func()
+.reentry
+.begin
+    htab_subr_regs_alloc()
+    .reg htab_return_addr
+    .reg_addr htab_return_addr 0 B
+    .set htab_return_addr
+    .reg htab_from
+    .reg_addr htab_from 0 A
+    .set htab_from
+    .reg htab_from_sz
+    .reg_addr htab_from_sz 1 B
+    .set htab_from_sz
+    .reg htab_to
+    .reg_addr htab_to 2 B
+    .set htab_to
+    .reg htab_to_sz
+    .reg_addr htab_to_sz 1 A
+    .set htab_to_sz
+    .reg htab_seed
+    .reg_addr htab_seed 2 A
+    .set htab_seed
+
+    .reg rtn_addr
+    .reg count
+    .reg from_carries
+    .reg from_sum
+    .reg sum
+    .reg tmp
+    .reg to_carries
+    .reg to_sum
+    .reg ebpf_rc
+    .reg ebpf_rc_hi
+
+    hashmap_prog_count_helper()
+    alu[rtn_addr, --, b, htab_return_addr]
+    alu[tmp, htab_from_sz, OR, htab_to_sz]
+    alu[--, tmp, AND, 3]
+    bne[einval#]
+    alu[tmp, htab_from_sz, +, htab_to_sz]
+    immed[count, EBPF_CSUM_DIFF_MAX]
+    alu[--, count, -, tmp]
+    blo[einval#]
+
+    immed[from_sum, 0]
+    immed[from_carries, 0]
+    alu[count, --, b, htab_from_sz, >>2]
+    __ebpf_csum_lm(from_sum, from_carries, htab_from, count)
+    immed[to_sum, 0]
+    immed[to_carries, 0]
+    alu[count, --, b, htab_to_sz, >>2]
+    __ebpf_csum_lm(to_sum, to_carries, htab_to, count)
+
+    // seed + to - from, the carries of each fold back in at the end
+    .reg_addr ebpf_rc 0 A
+    .reg_addr ebpf_rc_hi 1 A
+    alu[from_sum, from_sum, +, from_carries]
+    alu[from_sum, from_sum, +carry, 0]
+    alu[from_sum, --, ~b, from_sum]
+    alu[sum, htab_seed, +, to_sum]
+    alu[sum, sum, +carry, to_carries]
+    alu[sum, sum, +carry, from_sum]
+    alu[sum, sum, +carry, 0]
+    alu[ebpf_rc, sum, +carry, 0]
+    br[ret#], defer[1]
+        immed[ebpf_rc_hi, 0]
+
+einval#:
+    alu[ebpf_rc, --, ~b, (EBPF_EINVAL - 1)]
+    alu[ebpf_rc_hi, --, ~b, 0]
+
+ret#:
+    htab_subr_regs_free()
+    #pragma warning(push)
+    #pragma warning(disable: 5116)  // disable warning "Return register may not contain valid addr"
+        .use htab_return_addr
+        .use ebpf_rc
+        .use ebpf_rc_hi
+        rtn[rtn_addr]
+    #pragma warning(pop)
+.end
+#endm
+
+
+/*
+ * bpf_xdp_adjust_meta(), A0 delta.
+ *
+ * The XDP metadata of a packet is kept in the prepend area in front of the
+ * packet data, the bytes pv_meta_write() prepends the PV metadata for the
+ * host in, so it is EBPF_XDP_META_MAX bytes at most. Its length is kept in
+ * the context state of hashmap_prog.uc: ctx->data_meta is the packet offset
+ * minus that length. The metadata has to leave the EBPF_PKT_MIN_OFFSET
+ * bytes of the buffer that adjust head leaves. It is for the program and
+ * the programs it tail calls, on XDP_PASS the PV metadata takes its place
+ * (EBPF_CAP_ADJUST_HEAD_FLAG_NO_META).
+ * Returns 0 or -EINVAL for lengths that are negative, not multiples of 4
+ * or too long.
+ */
+#macro ebpf_adjust_meta_subr_func()
+.reentry
+.begin
+    htab_subr_regs_alloc()
+    .reg htab_return_addr
+    .reg_addr htab_return_addr 0 B
+    .set htab_return_addr
+    .reg htab_delta
+    .reg_addr htab_delta 0 A
+    .set htab_delta
+
+    .reg rtn_addr
+    .reg ctx_addr
+    .reg meta_len
+    .reg offset
+    .reg ebpf_rc
+    .reg ebpf_rc_hi
+
+    hashmap_prog_ctx_addr(ctx_addr)
+    local_csr_wr[ACTIVE_LM_ADDR_3, ctx_addr]
+    alu[rtn_addr, --, b, htab_return_addr]
+    bitfield_extract__sz1(offset, BF_AML(_ebpf_pkt_vec, PV_OFFSET_bf))
+    alu[offset, offset, -, EBPF_PKT_MIN_OFFSET]
+    alu[meta_len, *l$index3[HASHMAP_PROG_CTX_NDX_META_LEN], -, htab_delta]
+#ifdef EBPF_PROG_STATS
+    alu[*l$index3[HASHMAP_PROG_CTX_NDX_HELPERS], *l$index3[HASHMAP_PROG_CTX_NDX_HELPERS], +, 1]
+#endif
+
+    alu[--, meta_len, AND, 3]
+    bne[einval#]
+    alu[--, meta_len, -, (EBPF_XDP_META_MAX + 1)]
+    bhs[einval#]
+    alu[--, offset, -, meta_len]
+    blo[einval#]
+
+    .reg_addr ebpf_rc 0 A
+    .reg_addr ebpf_rc_hi 1 A
+    alu[*l$index3[HASHMAP_PROG_CTX_NDX_META_LEN], --, b, meta_len]
+    immed[ebpf_rc, 0]
+    br[ret#], defer[1]
+        immed[ebpf_rc_hi, 0]
+
+einval#:
+    alu[ebpf_rc, --, ~b, (EBPF_EINVAL - 1)]
+    alu[ebpf_rc_hi, --, ~b, 0]
+
+ret#:
+    htab_subr_regs_free()
+    #pragma warning(push)
+    #pragma warning(disable: 5116)  // disable warning "Return register may not contain valid addr"
+        .use htab_return_addr
+        .use ebpf_rc
+        .use ebpf_rc_hi
+        rtn[rtn_addr]
+    #pragma warning(pop)
+.end
+#endm
+
+
 #macro ebpf_reentry()
 .begin
     .reg egress_q_base
     .reg stat
     .reg pkt_length
+    .reg target
     .reg ebpf_rc
     .reg_addr ebpf_rc 0 A
     .set ebpf_rc
@@ -154,6 +692,7 @@ ebpf_init_cap_finalize()
         alu[stat, stat, +, NIC_STATS_QUEUE_BPF_PASS_IDX]
         pv_stats_update(_ebpf_pkt_vec, stat, --)
     skip_ebpf_stats#:
+    ebpf_prog_stats(rc)
 
     br_bset[rc, EBPF_RET_DROP, drop#]
 
@@ -163,9 +702,23 @@ ebpf_init_cap_finalize()
     __actions_restore_t_idx()
     br_bset[rc, EBPF_RET_PASS, actions#]
 
-    // EBF_RET_REDIR
+    // EBF_RET_REDIR, to the target of the redirect helpers or out of the ingress port
+    hashmap_prog_ctx_addr(target)
+    local_csr_wr[ACTIVE_LM_ADDR_3, target]
     pv_get_nbi_egress_channel_mapped_to_ingress(egress_q_base, _ebpf_pkt_vec)
+    nop
+    alu[target, --, B, *l$index3[HASHMAP_PROG_CTX_NDX_REDIR]]
+    br_bclr[target, CMSG_MAP_REDIR_VALID_SHF, tx_wire#]
+    br_bset[target, CMSG_MAP_REDIR_HOST_SHF, tx_host#], defer[1]
+        alu[egress_q_base, 0, +16, target]
+
+tx_wire#:
     pkt_io_tx_wire(_ebpf_pkt_vec, egress_q_base, egress#)
+
+tx_host#:
+    // the target names the queue, RSS of the ingress does not apply
+    alu[BF_A(_ebpf_pkt_vec, PV_QUEUE_OFFSET_bf), BF_A(_ebpf_pkt_vec, PV_QUEUE_OFFSET_bf), AND~, BF_MASK(PV_QUEUE_OFFSET_bf)] ; PV_QUEUE_OFFSET_bf
+    pkt_io_tx_host(_ebpf_pkt_vec, egress_q_base, egress#)
 .end
 #endm
 
@@ -174,8 +727,16 @@ ebpf_init_cap_finalize()
 .begin
     .reg jump_offset
     .reg stack_addr
+    .reg prog_ctx_addr
 
+    // new packet, no tail calls, redirect target or XDP metadata yet
+    hashmap_prog_ctx_addr(prog_ctx_addr)
+    local_csr_wr[ACTIVE_LM_ADDR_3, prog_ctx_addr]
     pv_save_meta_lm_ptr(_ebpf_pkt_vec)
+    immed[*l$index3[HASHMAP_PROG_CTX_NDX_TAIL_CNT], 0]
+    immed[*l$index3[HASHMAP_PROG_CTX_NDX_REDIR], 0]
+    immed[*l$index3[HASHMAP_PROG_CTX_NDX_META_LEN], 0]
+    ebpf_prog_stats_start(in_ustore_addr)
     load_addr[jump_offset, ebpf_start#]
     alu[jump_offset, in_ustore_addr, -, jump_offset]
     jump[jump_offset, ebpf_start#], targets[dummy0#, dummy1#], defer[3]
@@ -194,7 +755,7 @@ dummy0#:
 dummy1#:
     nop
 
-    br_addr[NFD_BPF_START_OFF], rtn[ebpf_reentry#], targets[HTAB_MAP_LOOKUP_SUBROUTINE#]
+    br_addr[NFD_BPF_START_OFF], rtn[ebpf_reentry#], targets[HTAB_MAP_LOOKUP_SUBROUTINE#, HTAB_MAP_XADD32_SUBROUTINE#, HTAB_MAP_XADD64_SUBROUTINE#, HTAB_PROG_TAIL_CALL_SUBROUTINE#, HTAB_REDIRECT_SUBROUTINE#, HTAB_REDIRECT_MAP_SUBROUTINE#, CMSG_PERF_OUTPUT_SUBROUTINE#, EBPF_KTIME_SUBROUTINE#, EBPF_CSUM_DIFF_SUBROUTINE#, EBPF_ADJUST_META_SUBROUTINE#]
 .end
 #endm
 
@@ -208,6 +769,24 @@ cmsg_init()
 
 HTAB_MAP_LOOKUP_SUBROUTINE#:
 	htab_map_lookup_subr_func()
+HTAB_MAP_XADD32_SUBROUTINE#:
+	htab_map_xadd_subr_func(32)
+HTAB_MAP_XADD64_SUBROUTINE#:
+	htab_map_xadd_subr_func(64)
+HTAB_PROG_TAIL_CALL_SUBROUTINE#:
+	htab_prog_tail_call_subr_func()
+HTAB_REDIRECT_SUBROUTINE#:
+	htab_redirect_subr_func(0)
+HTAB_REDIRECT_MAP_SUBROUTINE#:
+	htab_redirect_subr_func(1)
+CMSG_PERF_OUTPUT_SUBROUTINE#:
+	cmsg_perf_output_subr_func()
+EBPF_KTIME_SUBROUTINE#:
+	ebpf_ktime_subr_func()
+EBPF_CSUM_DIFF_SUBROUTINE#:
+	ebpf_csum_diff_subr_func()
+EBPF_ADJUST_META_SUBROUTINE#:
+	ebpf_adjust_meta_subr_func()
 HTAB_MAP_UPDATE_SUBROUTINE#:
 //	htab_map_update_subr_func()
 
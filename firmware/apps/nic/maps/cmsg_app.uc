@@ -57,6 +57,9 @@ cmsg_init()
 
     .if (ctx() == 0)
 	        hashmap_alloc_fd(SRIOV_TID, 8, 56, NIC_MAC_VLAN_TABLE__NUM_ENTRIES, --, swap, BPF_MAP_TYPE_HASH)
+#ifdef NIC_FLOW_CACHE
+	        hashmap_alloc_fd(FLOW_TID, FLOW_KEY_SZ, FLOW_VALUE_SZ, FLOW_TABLE_NUM_ENTRIES, --, swap, BPF_MAP_TYPE_HASH)
+#endif
     .endif
 
 main_loop#:
@@ -8,6 +8,8 @@
  *	 cmsg_init() - declare global and local resources
  *	 cmsg_rx() - receive from workq and process cmsg
  *	 cmsg_desc_workq() - create GRO descriptors destined for cmsg workq
+ *	 cmsg_perf_flush_workq() - ask for the records of a perf ring, see
+ *		cmsg_perf.uc
  *
  * typical use
  *	 from datapath action
@@ -56,6 +58,8 @@
 
 #define CMSG_DESC_LW	3
 
+#include "cmsg_perf.uc"
+
 #ifndef NFD_META_MAX_LW
     #define NFD_META_MAX_LW NFP_NET_META_FIELD_SIZE
 #endif
@@ -110,6 +114,8 @@
 #macro cmsg_init()
 
 	.alloc_resource MAP_CMSG_Q_IDX emem0_queues global 1
+	.alloc_mem MAP_CMSG_Q_BASE emem0 global MAP_CMSG_IN_WQ_SZ MAP_CMSG_IN_WQ_SZ
+	cmsg_perf_init()
 
 #ifdef CMSG_MAP_PROC
 	.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const ; 0x2=NN path from CTM MiscEngine
@@ -123,8 +129,8 @@
 	pkt_counter_decl(cmsg_rx_bad_type)
 	pkt_counter_decl(cmsg_dbg_enq)
 	pkt_counter_decl(cmsg_dbg_rxq)
+	pkt_counter_decl(cmsg_perf_flush)
 
-	.alloc_mem MAP_CMSG_Q_BASE emem0 global MAP_CMSG_IN_WQ_SZ MAP_CMSG_IN_WQ_SZ
 	.init_mu_ring MAP_CMSG_Q_IDX MAP_CMSG_Q_BASE 0
 
 	#define CMSG_NUM_FD_BM_LW	((HASHMAP_MAX_TID_EBPF+31)/32)
@@ -134,6 +140,14 @@
 	.alloc_mem LM_CMSG_BASE	lm me (NUM_CONTEXT * (CMSG_LM_FIELD_SZ * 4)) 8
 	.init LM_CMSG_BASE 0
 
+	// set while a context moves map entries, see _cmsg_resize_fd()
+	.reg volatile @cmsg_resize_busy
+	immed[@cmsg_resize_busy, 0]
+
+	// set while a context changes an LPM_TRIE map, see _cmsg_hashmap_op()
+	.reg volatile @cmsg_lpm_busy
+	immed[@cmsg_lpm_busy, 0]
+
     #define CMSG_TXFR_COUNT 16
     #define HASHMAP_TXFR_COUNT 16
     #define HASHMAP_RXFR_COUNT 16
@@ -467,6 +481,8 @@ ret#:
 	#undef __CMSG_Q_IDX__
 
     mem[qadd_thread, $nfd_data[0], q_base_hi, <<8, q_idx, CMSG_DESC_LW], ctx_swap[q_sig]
+	alu[--, --, b, $nfd_data[1]]
+	beq[cmsg_perf_flush#]
 	pkt_counter_incr(cmsg_rx)
 
 	alu[nfd_pkt_meta[0], --, b, $nfd_data[0]]
@@ -487,6 +503,13 @@ ret#:
 	cmsg_reply(nfd_pkt_meta, cmsg_reply_pktlen, cmsg_no_credit#)
 	br[cmsg_exit#]
 
+	// flush request without MU buffer, see cmsg_perf_flush_workq()
+cmsg_perf_flush#:
+	pkt_counter_incr(cmsg_perf_flush)
+	alu[nfd_pkt_meta[0], --, b, $nfd_data[0]]
+	cmsg_perf_flush(nfd_pkt_meta[0])
+	br[cmsg_exit#]
+
 cmsg_error#:
 	pkt_counter_incr(cmsg_err)
 cmsg_no_credit#:
@@ -545,7 +568,7 @@ cmsg_exit#:
 .begin
     .reg read $pkt_data[CMSG_TXFR_COUNT]
     .xfer_order $pkt_data
-	.reg write $reply[3]
+	.reg write $reply[4]
 	.xfer_order $reply
     .sig rd_sig
 	.reg ctx_num
@@ -591,7 +614,9 @@ cmsg_exit#:
 
     s/**/CMSG_TYPE_MAP_ALLOC#:
 		.begin
-			.reg keysz, valuesz, maxent
+			.reg keysz, valuesz, maxent, parts, xadd_words
+			alu[parts, CMSG_MAP_ALLOC_PART_MSK, and, HDR_DATA[CMSG_MAP_ALLOC_FLAGS_IDX], >>CMSG_MAP_ALLOC_PART_SHF]
+			ld_field_w_clr[xadd_words, 0011, HDR_DATA[CMSG_MAP_ALLOC_FLAGS_IDX], >>CMSG_MAP_ALLOC_XADD_SHF]
 			alu[keysz, --, b, HDR_DATA[CMSG_MAP_ALLOC_KEYSZ_IDX]]
 			alu[valuesz, --, b,  HDR_DATA[CMSG_MAP_ALLOC_VALUESZ_IDX]]
 			alu[maxent, --, b,  HDR_DATA[CMSG_MAP_ALLOC_MAXENT_IDX]]
@@ -599,14 +624,28 @@ cmsg_exit#:
 			bne[alloc_cont#]
 			immed[map_type, BPF_MAP_TYPE_HASH]		; default is hash
 alloc_cont#:
-			_cmsg_alloc_fd(keysz, valuesz, maxent, swap, map_type)
+			_cmsg_alloc_fd(keysz, valuesz, maxent, swap, map_type, parts, xadd_words)
 			br[cmsg_proc_ret#]
 		 .end
 
+    s/**/CMSG_TYPE_PRINT#:
+			br[ERROR_LABEL]
+
+    s/**/CMSG_TYPE_MAP_BATCH_LOOKUP#:
+    s/**/CMSG_TYPE_MAP_BATCH_UPDATE#:
+    s/**/CMSG_TYPE_MAP_BATCH_DELETE#:
+    s/**/CMSG_TYPE_MAP_BATCH_DUMP#:
+			_cmsg_batch_proc(HDR_DATA, ctx_num)
+			br[cmsg_proc_ret#]
+
+    s/**/CMSG_TYPE_MAP_RESIZE#:
+			_cmsg_resize_fd(HDR_DATA, ctx_num)
+			br[cmsg_proc_ret#]
+
 	s0#:
     s/**/CMSG_TYPE_MAP_FREE#:
 			alu[cur_fd, --, b, HDR_DATA[CMSG_MAP_TID_IDX]]
-			_cmsg_free_fd(cur_fd)
+			_cmsg_free_fd(cur_fd, ctx_num)
 			br[cmsg_proc_ret#]
 
     s/**/CMSG_TYPE_MAP_LOOKUP#:
@@ -624,6 +663,7 @@ alloc_cont#:
 			.reg max_entries
 			.reg cur_key
 			.reg le_key
+			.reg xadd_words
 
 			cmsg_lm_ctx_addr(lm_key_offset,lm_value_offset, ctx_num)
 			cmsg_lm_handles_define()
@@ -640,6 +680,7 @@ alloc_cont#:
 
 			immed[save_rc, CMSG_RC_ERR_MAP_FD]
 			hashmap_get_fd_attr(cur_fd, map_type, max_entries, done#)
+			hashmap_get_fd_xadd(cur_fd, xadd_words, done#)
 			immed[save_rc, CMSG_RC_SUCCESS]
 
 			.if (cmsg_type == CMSG_TYPE_MAP_ADD)
@@ -658,6 +699,9 @@ proc_loop#:
 
 			alu[--, map_type, -, BPF_MAP_TYPE_ARRAY]
 			beq[proc_array_map#]
+			alu[--, map_type, -, BPF_MAP_TYPE_PERCPU_ARRAY]
+			beq[proc_array_map#]
+			hashmap_prog_br_table(map_type, proc_array_map#)
     		ov_single(OV_LENGTH, CMSG_TXFR_COUNT, OVF_SUBTRACT_ONE) // Length in 32-bit LWs
     		mem[read32_swap, $pkt_data[0], cmsg_addr_hi, <<8, key_offset, max_/**/CMSG_TXFR_COUNT], indirect_ref, sig_done[rd_sig]
 			ctx_arb[rd_sig]
@@ -696,13 +740,14 @@ proc_loop_cont#:
 			ctx_arb[rd_sig]
 
 			aggregate_copy(CMSG_VALUE_LM_INDEX, ++, $pkt_data, 0, CMSG_TXFR_COUNT)
+			_cmsg_xadd_swap_lm(lm_value_offset, xadd_words)
 
 			cmsg_lm_handles_undef()
 
 do_op#:
 			swap(le_key, cur_key, NO_LOAD_CC)
 
-			_cmsg_hashmap_op(l_cmsg_type, cur_fd, lm_key_offset, lm_value_offset, cmsg_addr_hi, key_offset, value_offset, flags, rc, swap, le_key, cur_key)
+			_cmsg_hashmap_op(l_cmsg_type, cur_fd, map_type, xadd_words, lm_key_offset, lm_value_offset, cmsg_addr_hi, key_offset, value_offset, flags, rc, swap, le_key, cur_key)
     /* check if reply required */
             alu[--, cur_fd, -, SRIOV_TID]
             beq[FREE_LABEL]
@@ -734,11 +779,20 @@ do_op#:
 
 done#:
 			/* fill in header here */
+			immed[$reply[CMSG_MAP_RESIZE_HINT_IDX], 0]
+			.if (cmsg_type == CMSG_TYPE_MAP_ADD)
+				.begin
+					.reg hint
+					hashmap_resize_hint(cur_fd, hint, hint_done#)
+					alu[$reply[CMSG_MAP_RESIZE_HINT_IDX], --, b, hint]
+hint_done#:
+				.end
+			.endif
 			cmsg_set_reply($reply[0], cmsg_type, cmsg_tag)
 			alu[$reply[1], --, b, save_rc]
 			alu[$reply[2], --, b, rtn_count]
 			immed[addr_lo, NFD_IN_DATA_OFFSET]
-    		mem[write32, $reply[0], cmsg_addr_hi, <<8, addr_lo, 3], sig_done[sig_reply_map_ops]
+    		mem[write32, $reply[0], cmsg_addr_hi, <<8, addr_lo, 4], sig_done[sig_reply_map_ops]
     		alu[cmsg_reply_pktlen, cmsg_reply_pktlen, +, (4*4)]
 			ctx_arb[sig_reply_map_ops]
 
@@ -748,7 +802,468 @@ cmsg_proc_ret#:
 .end
 #endm
 
-#macro _cmsg_alloc_fd(key_sz, value_sz, max_entries, endian, map_type)
+/*
+ * Value words the programs XADD to are kept in NFP byte order, see
+ * htab_map_xadd_subr_func(), and swapped here between the host and the
+ * map like the other words are by read32_swap and write32_swap. Bit LW of
+ * in_xadd_words is set for such a word.
+ */
+#macro _cmsg_xadd_swap(out_word, in_word, in_xadd_words, LW)
+	alu[out_word, --, b, in_word]
+	br_bclr[in_xadd_words, LW, done#]
+	swap(out_word, in_word, NO_LOAD_CC)
+done#:
+#endm
+
+/* the XADD words of the value in io_xfer, after the copy to its write half */
+#macro _cmsg_xadd_swap_xfer(io_xfer, in_xadd_words)
+.begin
+	.reg word
+
+	alu[--, --, b, in_xadd_words]
+	beq[ret#]
+	#define_eval __LW 0
+	#while (__LW < _CMSG_FLD_LW)
+		br_bclr[in_xadd_words, __LW, next/**/__LW#]
+		swap(word, io_xfer[__LW], NO_LOAD_CC)
+		alu[io_xfer[__LW], --, b, word]
+next/**/__LW#:
+		#define_eval __LW (__LW + 1)
+	#endloop
+	#undef __LW
+ret#:
+.end
+#endm
+
+/* the XADD words of the value at in_lm_value, CMSG_VALUE_LM_HANDLE is used */
+#macro _cmsg_xadd_swap_lm(in_lm_value, in_xadd_words)
+.begin
+	.reg word
+
+	alu[--, --, b, in_xadd_words]
+	beq[ret#]
+	local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_VALUE_LM_HANDLE, in_lm_value]
+	nop
+	nop
+	nop
+	#define_eval __LW 0
+	#while (__LW < _CMSG_FLD_LW)
+		br_bclr[in_xadd_words, __LW, next/**/__LW#]
+		swap(word, CMSG_VALUE_LM_INDEX[__LW], NO_LOAD_CC)
+		alu[CMSG_VALUE_LM_INDEX[__LW], --, b, word]
+next/**/__LW#:
+		#define_eval __LW (__LW + 1)
+	#endloop
+	#undef __LW
+ret#:
+.end
+#endm
+
+/*
+ * rc of a failed hashmap_ops() to the CMSG_RC_ERR_xxx the host expects, a
+ * failure without a code did not find the key
+ */
+#macro _cmsg_map_rc(io_rc)
+	.if (io_rc == CMSG_RC_SUCCESS)
+		immed[io_rc, CMSG_RC_ERR_MAP_NOENT]
+	.elif (io_rc == CMSG_RC_ERR_ENOENT)
+		immed[io_rc, CMSG_RC_ERR_MAP_NOENT]
+	.elif (io_rc == CMSG_RC_ERR_EEXIST)
+		immed[io_rc, CMSG_RC_ERR_MAP_EXIST]
+	.elif (io_rc == CMSG_RC_ERR_ENOMEM)
+		immed[io_rc, CMSG_RC_ERR_NOMEM]
+	.elif (io_rc > CMSG_RC_ERR_MAP_BUSY)
+		immed[io_rc, CMSG_RC_ERR_MAP_ERR]
+	.endif
+#endm
+
+/*
+ * Batched map ops, see map_batch_xxx in cmsg_map_types.h. Records are
+ * packed at the key and value sizes of the map and processed in the
+ * message buffer: lookup replies are compacted in place over the request
+ * and dumps walk the buckets from the cursor of the request.
+ */
+#macro _cmsg_batch_emit(in_key_hi, in_key_lo, in_value_hi, in_value_lo)
+.begin
+	.reg out_offset
+
+	ov_start(OV_LENGTH)
+	ov_set_use(OV_LENGTH, b_key_lw, OVF_SUBTRACT_ONE)
+	ov_clean
+	mem[read32, $b_ent[0], in_key_hi, <<8, in_key_lo, max_/**/_CMSG_FLD_LW], indirect_ref, ctx_swap[sig_batch_rd]
+	unroll_copy($b_ent, 0, $b_ent, 0, b_key_lw, _CMSG_FLD_LW, --)
+	ov_start(OV_LENGTH)
+	ov_set_use(OV_LENGTH, b_key_lw, OVF_SUBTRACT_ONE)
+	ov_clean
+	mem[write32, $b_ent[0], cmsg_addr_hi, <<8, b_wr_offset, max_/**/_CMSG_FLD_LW], indirect_ref, ctx_swap[sig_batch_wr]
+
+	ov_start(OV_LENGTH)
+	ov_set_use(OV_LENGTH, b_value_lw, OVF_SUBTRACT_ONE)
+	ov_clean
+	mem[read32, $b_ent[0], in_value_hi, <<8, in_value_lo, max_/**/_CMSG_FLD_LW], indirect_ref, ctx_swap[sig_batch_rd]
+	unroll_copy($b_ent, 0, $b_ent, 0, b_value_lw, _CMSG_FLD_LW, --)
+	_cmsg_xadd_swap_xfer($b_ent, b_xadd)
+	alu[out_offset, b_wr_offset, +, b_key_bytes]
+	ov_start(OV_LENGTH)
+	ov_set_use(OV_LENGTH, b_value_lw, OVF_SUBTRACT_ONE)
+	ov_clean
+	mem[write32, $b_ent[0], cmsg_addr_hi, <<8, out_offset, max_/**/_CMSG_FLD_LW], indirect_ref, ctx_swap[sig_batch_wr]
+
+	alu[b_wr_offset, b_wr_offset, +, b_rec_bytes]
+	alu[b_done, b_done, +, 1]
+.end
+#endm
+
+#macro _cmsg_batch_proc(HDR_DATA, in_ctx)
+.begin
+	.reg b_fd, b_count, b_flags, b_type
+	.reg b_key_lw, b_value_lw, b_key_mask, b_value_mask, b_map_type, b_slab
+	.reg b_key_bytes, b_rec_bytes, b_req_bytes
+	.reg b_rd_offset, b_wr_offset, b_end_offset
+	.reg b_done, b_rc, b_cursor
+	.reg b_xadd
+	.reg lm_key_offset, lm_value_offset
+	.reg reply_lw
+	.reg r_addr[2]
+	.reg tmp
+	.reg $b_ent[_CMSG_FLD_LW]
+	.xfer_order $b_ent
+	.reg write $b_reply[4]
+	.xfer_order $b_reply
+	.sig sig_batch_rd
+	.sig sig_batch_wr
+
+	aggregate_directive(.set, $b_ent, _CMSG_FLD_LW)
+
+	alu[b_type, --, b, cmsg_type]
+	alu[b_fd, --, b, HDR_DATA[CMSG_MAP_TID_IDX]]
+	alu[b_count, --, b, HDR_DATA[CMSG_MAP_OP_COUNT_IDX]]
+	alu[b_flags, --, b, HDR_DATA[CMSG_MAP_OP_FLAGS_IDX]]
+	immed[b_done, 0]
+	immed[b_cursor, 0]
+	immed[b_rc, CMSG_RC_SUCCESS]
+	cmsg_lm_ctx_addr(lm_key_offset, lm_value_offset, in_ctx)
+
+	move(b_rd_offset, (NFD_IN_DATA_OFFSET + (CMSG_OP_HDR_LW * 4)))
+	alu[b_wr_offset, --, b, b_rd_offset]
+	move(b_end_offset, (CMSG_MAP_BATCH_DATA_LW * 4))
+	alu[b_end_offset, b_end_offset, +, b_rd_offset]
+
+	hashmap_get_fd(b_fd, b_key_lw, b_value_lw, b_key_mask, b_value_mask, b_map_type, batch_fd_error#, --, b_slab)
+	hashmap_get_fd_xadd(b_fd, b_xadd, batch_fd_error#)
+	/* the prefixes of LPM_TRIE maps and the rows of hashmap_prog.uc are not in the buckets */
+	hashmap_prog_br_table(b_map_type, batch_type_error#)
+	alu[--, b_map_type, -, BPF_MAP_TYPE_LPM_TRIE]
+	bne[batch_type_ok#]
+batch_type_error#:
+	br[batch_reply#], defer[1]
+	immed[b_rc, CMSG_RC_ERR_MAP_ERR]
+batch_type_ok#:
+	alu[b_key_bytes, --, b, b_key_lw, <<2]
+	alu[b_rec_bytes, b_key_lw, +, b_value_lw]
+	alu[b_rec_bytes, --, b, b_rec_bytes, <<2]
+	alu[b_req_bytes, --, b, b_rec_bytes]
+
+	.if (b_type == CMSG_TYPE_MAP_BATCH_DUMP)
+		br[batch_dump#]
+	.elif (b_type == CMSG_TYPE_MAP_BATCH_LOOKUP)
+		/* the host reads per-cpu values one at a time, summed */
+		__hashmap_percpu_br_not(b_map_type, rec_loop#)
+		br[batch_reply#], defer[1]
+		immed[b_rc, CMSG_RC_ERR_MAP_ERR]
+	.elif (b_type == CMSG_TYPE_MAP_BATCH_DELETE)
+		alu[b_req_bytes, --, b, b_key_bytes]
+	.endif
+
+rec_loop#:
+	alu[--, b_count, -, 0]
+	beq[batch_reply#]
+	alu[tmp, b_rd_offset, +, b_req_bytes]
+	alu[--, b_end_offset, -, tmp]
+	blo[batch_reply#], defer[1]
+	immed[b_rc, CMSG_RC_ERR_E2BIG]
+
+	cmsg_lm_handles_define()
+	local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_KEY_LM_HANDLE, lm_key_offset]
+	local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_VALUE_LM_HANDLE, lm_value_offset]
+	ov_single(OV_LENGTH, _CMSG_FLD_LW, OVF_SUBTRACT_ONE)
+	mem[read32_swap, $b_ent[0], cmsg_addr_hi, <<8, b_rd_offset, max_/**/_CMSG_FLD_LW], indirect_ref, ctx_swap[sig_batch_rd]
+	aggregate_copy(CMSG_KEY_LM_INDEX, ++, $b_ent, 0, _CMSG_FLD_LW_MINUS_1)
+	.if (b_type == CMSG_TYPE_MAP_BATCH_UPDATE)
+		alu[tmp, b_rd_offset, +, b_key_bytes]
+		ov_single(OV_LENGTH, _CMSG_FLD_LW, OVF_SUBTRACT_ONE)
+		mem[read32_swap, $b_ent[0], cmsg_addr_hi, <<8, tmp, max_/**/_CMSG_FLD_LW], indirect_ref, ctx_swap[sig_batch_rd]
+		aggregate_copy(CMSG_VALUE_LM_INDEX, ++, $b_ent, 0, _CMSG_FLD_LW_MINUS_1)
+		_cmsg_xadd_swap_lm(lm_value_offset, b_xadd)
+	.endif
+	cmsg_lm_handles_undef()
+	immed[b_rc, CMSG_RC_SUCCESS]
+
+	.if (b_type == CMSG_TYPE_MAP_BATCH_LOOKUP)
+		hashmap_ops(b_fd, lm_key_offset, --, HASHMAP_OP_LOOKUP, batch_fd_error#, next_rec#, HASHMAP_RTN_ADDR, reply_lw, --, r_addr, swap, --, HASHMAP_CALLER_HOST)
+		/* found, the key is still in the request */
+		_cmsg_batch_emit(cmsg_addr_hi, b_rd_offset, r_addr[0], r_addr[1])
+	.elif (b_type == CMSG_TYPE_MAP_BATCH_DELETE)
+		hashmap_ops(b_fd, lm_key_offset, --, HASHMAP_OP_REMOVE, batch_fd_error#, batch_op_error#, HASHMAP_RTN_ADDR, reply_lw, --, --, swap, b_rc, HASHMAP_CALLER_HOST)
+		alu[b_done, b_done, +, 1]
+	.elif (b_flags == CMSG_BPF_NOEXIST)
+		hashmap_ops(b_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_ADD_ONLY, batch_fd_error#, batch_op_error#, HASHMAP_RTN_ADDR, reply_lw, --, --, swap, b_rc, HASHMAP_CALLER_HOST)
+		alu[b_done, b_done, +, 1]
+	.elif (b_flags == CMSG_BPF_EXIST)
+		hashmap_ops(b_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_UPDATE, batch_fd_error#, batch_op_error#, HASHMAP_RTN_ADDR, reply_lw, --, --, swap, b_rc, HASHMAP_CALLER_HOST)
+		alu[b_done, b_done, +, 1]
+	.else
+		hashmap_ops(b_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_ADD_ANY, batch_fd_error#, batch_op_error#, HASHMAP_RTN_ADDR, reply_lw, --, --, swap, b_rc, HASHMAP_CALLER_HOST)
+		alu[b_done, b_done, +, 1]
+	.endif
+
+next_rec#:
+	alu[b_rd_offset, b_rd_offset, +, b_req_bytes]
+	br[rec_loop#], defer[1]
+	alu[b_count, b_count, -, 1]
+
+batch_dump#:
+	.begin
+		.reg ent_state, ent_addr_hi, ent_offset, ent_index
+		.reg tbl_addr_hi
+		.reg value_offset
+		.reg bucket_bytes
+		.reg scan
+		.reg seen
+		.reg used
+
+		__hashmap_percpu_br_not(b_map_type, dump_start#)
+		br[batch_reply#], defer[1]
+		immed[b_rc, CMSG_RC_ERR_MAP_ERR]
+dump_start#:
+		/* the dump is over once the map's entries are all returned */
+		mem[read32, $b_ent[0], cmsg_addr_hi, <<8, b_rd_offset, 1], ctx_swap[sig_batch_rd]
+		alu[seen, --, b, $b_ent[0]]
+		hashmap_get_fd_used(b_fd, used, batch_fd_error#)
+		/* room for a full bucket: primary entry and HASHMAP_ENTRIES_PER_BUCKET ov entries */
+		alu[bucket_bytes, --, b, b_rec_bytes, <<3]
+		alu[bucket_bytes, bucket_bytes, +, b_rec_bytes]
+		move(scan, CMSG_MAP_BATCH_SCAN_MAX)
+		alu[ent_index, --, b, b_flags]
+		move(tmp, HASHMAP_BUCKETS)
+		alu[--, ent_index, -, tmp]
+		bhs[dump_end#]
+
+bucket_loop#:
+		alu[tmp, seen, +, b_done]
+		alu[--, tmp, -, used]
+		bhs[dump_end#]
+		alu[b_cursor, --, b, ent_index]
+		alu[tmp, b_done, +, CMSG_MAP_BATCH_DUMP_MIN]
+		alu[--, b_count, -, tmp]
+		blo[batch_reply#]
+		alu[tmp, b_wr_offset, +, bucket_bytes]
+		alu[--, b_end_offset, -, tmp]
+		blo[batch_reply#]
+
+		__hashmap_lock_init(ent_state, tbl_addr_hi, ent_offset, ent_index)
+		alu[ent_addr_hi, --, b, tbl_addr_hi]
+		__hashmap_lock_shared(ent_index, b_fd, ov_next#, ov_next#)
+emit_ent#:
+		__hashmap_calc_value_addr(ent_offset, b_key_bytes, value_offset)
+		_cmsg_batch_emit(ent_addr_hi, ent_offset, ent_addr_hi, value_offset)
+ov_next#:
+		__hashmap_ov_getnext(tbl_addr_hi, ent_index, b_fd, b_slab, ent_addr_hi, ent_offset, ent_state, emit_ent#)
+		__hashmap_lock_release(ent_index, ent_state)
+		__hashmap_select_next_bucket(ent_index, dump_end#)
+		alu[scan, scan, -, 1]
+		bne[bucket_loop#]
+		br[batch_reply#], defer[1]
+		alu[b_cursor, --, b, ent_index]
+
+dump_end#:
+		br[batch_reply#], defer[1]
+		alu[b_cursor, --, ~b, 0]			; CMSG_MAP_BATCH_CURSOR_END
+	.end
+
+batch_fd_error#:
+	br[batch_reply#], defer[1]
+	immed[b_rc, CMSG_RC_ERR_MAP_FD]
+
+batch_op_error#:
+	_cmsg_map_rc(b_rc)
+
+batch_reply#:
+	.if (b_type == CMSG_TYPE_MAP_BATCH_UPDATE)
+		hashmap_resize_hint(b_fd, b_cursor, hint_done#)
+hint_done#:
+	.endif
+	cmsg_set_reply($b_reply[0], cmsg_type, cmsg_tag)
+	alu[$b_reply[1], --, b, b_rc]
+	alu[$b_reply[2], --, b, b_done]
+	alu[$b_reply[3], --, b, b_cursor]
+	immed[tmp, NFD_IN_DATA_OFFSET]
+	mem[write32, $b_reply[0], cmsg_addr_hi, <<8, tmp, 4], ctx_swap[sig_batch_wr]
+	alu[cmsg_reply_pktlen, b_wr_offset, -, NFD_IN_DATA_OFFSET]
+.end
+#endm
+
+/*
+ * Online resize of a hash map, see map_resize in cmsg_map_types.h. The
+ * start grows the map and moves it to its new partitions, see
+ * hashmap_resize_fd(). Each move message walks the buckets from the
+ * cursor and re-adds the entries whose bucket differs in the new layout
+ * before dropping them from the old one. Moving holds the old bucket
+ * while the new one is locked, contexts take turns so that two moves
+ * never wait on each other.
+ */
+#macro _cmsg_resize_fd(HDR_DATA, in_ctx)
+.begin
+	.reg r_fd, r_cursor, r_rc, r_moved, r_part
+	.reg key_lw, value_lw, key_mask, value_mask, map_type, slab, part_cfg
+	.reg key_bytes
+	.reg lm_key_offset, lm_value_offset
+	.reg ent_state, ent_addr_hi, ent_offset, ent_index
+	.reg tbl_addr_hi
+	.reg value_offset
+	.reg tindex
+	.reg hash[2]
+	.reg new_index
+	.reg scan
+	.reg tmp
+	.reg write $r_reply[4]
+	.xfer_order $r_reply
+	.sig sig_resize_wr
+
+	alu[r_fd, --, b, HDR_DATA[CMSG_MAP_TID_IDX]]
+	alu[r_cursor, --, b, HDR_DATA[CMSG_MAP_RESIZE_CURSOR_IDX]]
+	immed[r_moved, 0]
+	immed[r_rc, CMSG_RC_SUCCESS]
+	cmsg_lm_ctx_addr(lm_key_offset, lm_value_offset, in_ctx)
+
+wait_busy#:
+	alu[--, --, b, @cmsg_resize_busy]
+	beq[resize_lock#]
+	ctx_arb[voluntary]
+	br[wait_busy#]
+resize_lock#:
+	immed[@cmsg_resize_busy, 1]
+
+	/* LPM_TRIE, PROG_ARRAY and DEVMAP maps have no buckets to grow */
+	hashmap_get_fd_attr(r_fd, map_type, tmp, resize_fd_error#)
+	hashmap_prog_br_table(map_type, resize_type_error#)
+	alu[--, map_type, -, BPF_MAP_TYPE_LPM_TRIE]
+	bne[resize_type_ok#]
+resize_type_error#:
+	br[resize_reply#], defer[1]
+	immed[r_rc, CMSG_RC_ERR_MAP_ERR]
+resize_type_ok#:
+
+	alu[--, r_cursor, +, 1]			; CMSG_MAP_BATCH_CURSOR_END
+	bne[resize_move#]
+	alu[r_part, CMSG_MAP_ALLOC_PART_MSK, and, HDR_DATA[CMSG_MAP_RESIZE_FLAGS_IDX], >>CMSG_MAP_ALLOC_PART_SHF]
+	alu[tmp, --, b, HDR_DATA[CMSG_MAP_RESIZE_MAXENT_IDX]]
+	hashmap_resize_fd(r_fd, tmp, r_part, r_part, resize_busy#, resize_no_room#, resize_fd_error#)
+	alu[--, --, b, r_part, >>__HASHMAP_PART_OLD_SHFT]
+	beq[resize_reply#]
+	br[resize_reply#], defer[1]
+	immed[r_cursor, 0]
+
+resize_move#:
+	hashmap_get_fd(r_fd, key_lw, value_lw, key_mask, value_mask, map_type, resize_fd_error#, part_cfg, slab)
+	alu[--, --, b, part_cfg, >>__HASHMAP_PART_OLD_SHFT]
+	beq[resize_end#]
+	alu[part_cfg, part_cfg, and, __HASHMAP_PART_MSK]
+	alu[key_bytes, --, b, key_lw, <<2]
+	move(scan, CMSG_MAP_RESIZE_SCAN_MAX)
+	alu[ent_index, --, b, r_cursor]
+	move(tmp, HASHMAP_BUCKETS)
+	alu[--, ent_index, -, tmp]
+	bhs[resize_done#]
+
+bucket_loop#:
+	__hashmap_lock_init(ent_state, tbl_addr_hi, ent_offset, ent_index)
+	alu[ent_addr_hi, --, b, tbl_addr_hi]
+	__hashmap_lock_shared(ent_index, r_fd, ov_next#, ov_next#)
+check_ent#:
+	/* the key is read back as the host wrote it, it picks the new bucket */
+	immed[tindex, 0]
+	__hashmap_read_field(tindex, lm_key_offset, ent_addr_hi, ent_offset, key_lw, key_lw, HASHMAP_RTN_LMEM, --, --, swap)
+	slicc_hash_words(hash, r_fd, lm_key_offset, key_lw, key_mask)
+	__hashmap_index_from_hash(hash[0], new_index)
+	__hashmap_select_partition(hash[0], part_cfg, new_index)
+	alu[--, new_index, -, ent_index]
+	beq[ov_next#]
+
+	/* on failure the bucket is walked again */
+	__hashmap_lock_upgrade(ent_index, ent_state, bucket_loop#)
+	__hashmap_calc_value_addr(ent_offset, key_bytes, value_offset)
+	immed[tindex, 0]
+	__hashmap_read_field(tindex, lm_value_offset, ent_addr_hi, value_offset, value_lw, value_lw, HASHMAP_RTN_LMEM, --, --, swap)
+	hashmap_ops(r_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_ADD_ONLY, move_map_error#, move_error#, HASHMAP_RTN_ADDR, --, --, --, swap, r_rc, HASHMAP_CALLER_RESIZE)
+	alu[r_moved, r_moved, +, 1]
+drop_ent#:
+	/* the entry moves with its credit and per-cpu block */
+	br_bset[ent_state, __HASHMAP_DESC_OV_BIT, drop_ov_ent#]
+	__hashmap_lock_release_and_invalidate(ent_index, ent_state, r_fd)
+	br[bucket_loop#]
+drop_ov_ent#:
+	__hashmap_ov_delete(tbl_addr_hi, ent_index, slab, ent_offset, ent_state)
+	__hashmap_lock_release(ent_index, ent_state)
+	br[bucket_loop#]
+
+ov_next#:
+	__hashmap_ov_getnext(tbl_addr_hi, ent_index, r_fd, slab, ent_addr_hi, ent_offset, ent_state, check_ent#)
+	__hashmap_lock_release(ent_index, ent_state)
+	__hashmap_select_next_bucket(ent_index, resize_done#)
+	alu[scan, scan, -, 1]
+	bne[bucket_loop#]
+	br[resize_reply#], defer[1]
+	alu[r_cursor, --, b, ent_index]
+
+move_map_error#:
+	immed[r_rc, CMSG_RC_ERR_MAP_ERR]
+move_error#:
+	/*
+	 * a later add of the key is in the new layout already with a credit
+	 * and per-cpu block of its own, the old entry gives back both
+	 */
+	.if (r_rc == CMSG_RC_ERR_EEXIST)
+		__hashmap_percpu_release(map_type, ent_addr_hi, value_offset)
+		__hashmap_table_return_credits(r_fd)
+		br[drop_ent#], defer[1]
+		immed[r_rc, CMSG_RC_SUCCESS]
+	.endif
+	/* the host sees why the move failed, E2BIG for a full bucket */
+	__hashmap_lock_release(ent_index, ent_state)
+	br[resize_reply#], defer[1]
+	alu[r_cursor, --, b, ent_index]
+
+resize_done#:
+	hashmap_resize_done(r_fd)
+resize_end#:
+	br[resize_reply#], defer[1]
+	alu[r_cursor, --, ~b, 0]			; CMSG_MAP_BATCH_CURSOR_END
+
+resize_busy#:
+	br[resize_reply#], defer[1]
+	immed[r_rc, CMSG_RC_ERR_MAP_BUSY]
+
+resize_no_room#:
+	br[resize_reply#], defer[1]
+	immed[r_rc, CMSG_RC_ERR_E2BIG]
+
+resize_fd_error#:
+	immed[r_rc, CMSG_RC_ERR_MAP_FD]
+
+resize_reply#:
+	immed[@cmsg_resize_busy, 0]
+	cmsg_set_reply($r_reply[0], cmsg_type, cmsg_tag)
+	alu[$r_reply[1], --, b, r_rc]
+	alu[$r_reply[2], --, b, r_moved]
+	alu[$r_reply[3], --, b, r_cursor]
+	immed[tmp, NFD_IN_DATA_OFFSET]
+	mem[write32, $r_reply[0], cmsg_addr_hi, <<8, tmp, 4], ctx_swap[sig_resize_wr]
+	immed[cmsg_reply_pktlen, (4<<2)]
+.end
+#endm
+
+#macro _cmsg_alloc_fd(key_sz, value_sz, max_entries, endian, map_type, partitions, xadd_words)
 .begin
 		.reg fd
 		.reg $reply[3]
@@ -763,11 +1278,33 @@ cmsg_proc_ret#:
 
 		cmsg_alloc_fd_from_bm(fd, cont#)			; skip alloc if no free slots
 
+		.if (map_type == BPF_MAP_TYPE_LPM_TRIE)
+			hashmap_lpm_alloc(fd, key_sz, max_entries, type_error#, no_room#)
+		.endif
+		hashmap_prog_br_table(map_type, table_alloc#)
+		hashmap_percpu_reserve(map_type, max_entries, no_room#)
+
+alloc_fd#:
 		// driver will initialize arraymap
-		hashmap_alloc_fd(fd, key_sz, value_sz, max_entries, cont#, endian, map_type)
+		hashmap_alloc_fd(fd, key_sz, value_sz, max_entries, cont#, endian, map_type, partitions)
+		hashmap_set_fd_xadd(fd, xadd_words)
 
 		immed[$reply[1], CMSG_RC_SUCCESS]			; success
 		alu[$reply[2], --, b, fd]
+		br[cont#]
+
+table_alloc#:
+		hashmap_prog_alloc(fd, key_sz, value_sz, max_entries, type_error#)
+		br[alloc_fd#]
+
+no_room#:
+		cmsg_free_fd_from_bm(fd, cont#)
+		br[cont#], defer[1]
+		immed[$reply[1], CMSG_RC_ERR_E2BIG]			; per-cpu blocks or LPM leaves short
+
+type_error#:
+		cmsg_free_fd_from_bm(fd, cont#)
+		immed[$reply[1], CMSG_RC_ERR_MAP_ERR]		; sizes not supported
 
 cont#:
 		cmsg_set_reply($reply[0], CMSG_TYPE_MAP_ALLOC, cmsg_tag)
@@ -781,41 +1318,70 @@ ret#:
 .end
 #endm
 
-#macro _cmsg_free_fd(in_fd)
+#macro _cmsg_free_fd(in_fd, in_ctx)
 .begin
 		.reg del_entries
+		.reg lm_key_offset, lm_value_offset
 		.reg $reply[3]
 		.xfer_order $reply
 		.sig sig_reply_map_free
 		.reg addr_lo
 		.reg key_sz
 		.reg value_sz
-		.reg ent_state, ent_addr_hi, ent_offset, mu_partition, ent_index
+		.reg ent_state, ent_addr_hi, ent_offset, ent_index
 		.reg tbl_addr_hi, out_ent_lw
+		.reg key_mask, value_mask, map_type
+		.reg value_offset
+		.reg slab
+		.reg max_entries
 
 		immed[del_entries, 0]
 
 		immed[$reply[1], CMSG_RC_ERR_MAP_FD]			;
 		cmsg_free_fd_from_bm(in_fd, ret#)
 
+		hashmap_get_fd(in_fd, key_sz, value_sz, key_mask, value_mask, map_type, ret#, --, slab)
+		alu[key_sz, --, b, key_sz, <<2]
+
+		/* LPM_TRIE prefixes are deleted one by one, LM holds their keys */
+		.if (map_type == BPF_MAP_TYPE_LPM_TRIE)
+			cmsg_lm_ctx_addr(lm_key_offset, lm_value_offset, in_ctx)
+lpm_wait#:
+			alu[--, --, b, @cmsg_lpm_busy]
+			beq[lpm_lock#]
+			ctx_arb[voluntary]
+			br[lpm_wait#]
+lpm_lock#:
+			immed[@cmsg_lpm_busy, 1]
+			hashmap_lpm_free(in_fd, lm_key_offset, swap, del_entries)
+			immed[@cmsg_lpm_busy, 0]
+			__hashmap_table_delete(in_fd)
+			br[end_loop#]
+		.endif
+		hashmap_prog_br_table(map_type, table_free#)
+
+		hashmap_get_fd_attr(in_fd, map_type, max_entries, ret#)
+		hashmap_percpu_unreserve(map_type, max_entries)
 		__hashmap_table_delete(in_fd)		/* set num entries to 0 */
 
 		immed[ent_index, 0]
 loop#:
-		__hashmap_lock_init(ent_state, ent_addr_hi, ent_offset, mu_partition, ent_index)
+		__hashmap_lock_init(ent_state, ent_addr_hi, ent_offset, ent_index)
 		alu[tbl_addr_hi, --, b, ent_addr_hi]
 		__hashmap_lock_shared(ent_index, in_fd, cont#, cont#)
 cont#:
         /* check overflow first */
-        __hashmap_ov_getnext(tbl_addr_hi, ent_index, in_fd, ent_addr_hi, ent_offset, ent_state, del_ent#)
+        __hashmap_ov_getnext(tbl_addr_hi, ent_index, in_fd, slab, ent_addr_hi, ent_offset, ent_state, del_ent#)
         __hashmap_lock_release(ent_index, ent_state)
-        __hashmap_select_next_/**/HASHMAP_PARTITIONS/**/_partition(mu_partition,ent_index, end_loop#)
-        __hashmap_lock_init(ent_state, tbl_addr_hi, ent_offset, mu_partition, ent_index)
+        __hashmap_select_next_bucket(ent_index, end_loop#)
+        __hashmap_lock_init(ent_state, tbl_addr_hi, ent_offset, ent_index)
         __hashmap_lock_shared(ent_index, in_fd, cont#, cont#)
         alu[ent_addr_hi, --, b, tbl_addr_hi]
 del_ent#:
         __hashmap_lock_upgrade(ent_index, ent_state, loop#)
         __hashmap_set_opt_field(out_ent_lw, 0)
+        __hashmap_calc_value_addr(ent_offset, key_sz, value_offset)
+        __hashmap_percpu_release(map_type, ent_addr_hi, value_offset)
         br_bset[ent_state, __HASHMAP_DESC_OV_BIT, delete_ov_ent#]
         __hashmap_lock_release_and_invalidate(ent_index, ent_state, in_fd)
 
@@ -823,12 +1389,16 @@ del_ent#:
 		br[loop#]
 
 delete_ov_ent#:
-    	__hashmap_ov_delete(tbl_addr_hi, ent_index, ent_offset, ent_state)
+    	__hashmap_ov_delete(tbl_addr_hi, ent_index, slab, ent_offset, ent_state)
     	__hashmap_lock_release(ent_index, ent_state)
 
 		alu[del_entries, 1, +, del_entries]
 		br[loop#]
 
+table_free#:
+		hashmap_prog_free(in_fd)
+		__hashmap_table_delete(in_fd)
+
 end_loop#:
 
 		immed[$reply[1], CMSG_RC_SUCCESS]
@@ -848,7 +1418,7 @@ ret#:
 #define_eval _CMSG_FLD_LW 			(CMSG_MAP_KEY_VALUE_LW)
 #define_eval _CMSG_FLD_LW_MINUS_1   (_CMSG_FLD_LW - 1)
 
-#macro _cmsg_hashmap_op(in_op, in_fd, in_lm_key, in_lm_value, in_addr_hi, in_key_offset, in_value_offset, in_flags, out_rc, endian, array_lekey, array_bekey)
+#macro _cmsg_hashmap_op(in_op, in_fd, in_map_type, in_xadd_words, in_lm_key, in_lm_value, in_addr_hi, in_key_offset, in_value_offset, in_flags, out_rc, endian, array_lekey, array_bekey)
 .begin
 	.reg op
 	.sig sig_read_ent
@@ -879,6 +1449,10 @@ ret#:
 	.endif
 	#undef __HASHMAP_OP__
 
+	alu[--, in_map_type, -, BPF_MAP_TYPE_LPM_TRIE]
+	beq[lpm_op#]
+	hashmap_prog_br_table(in_map_type, prog_op#)
+
 	#define_eval MAX_JUMP (HASHMAP_OP_MAX + 1)
     preproc_jump_targets(j, MAX_JUMP)
 
@@ -902,30 +1476,34 @@ s2#:
 	immed[out_rc, CMSG_RC_ERR_MAP_PARSE]
 
 s/**/HASHMAP_OP_LOOKUP#:
-	hashmap_ops(in_fd, in_lm_key, --, HASHMAP_OP_LOOKUP, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc)
+	/* host lookups do not refresh LRU entries */
+	hashmap_ops(in_fd, in_lm_key, --, HASHMAP_OP_LOOKUP, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc, HASHMAP_CALLER_HOST)
 	alu[--, reply_lw, -, 0]				;error if 0
-	bne[reply_value#]
+	beq[lookup_error#]
+	__hashmap_percpu_br_not(in_map_type, reply_value#)
+	br[reply_percpu_value#]
+lookup_error#:
 	br[error_map_function#], defer[1]
 	immed[out_rc, CMSG_RC_ERR_MAP_ERR]
 
 s/**/HASHMAP_OP_ADD_ANY#:
-	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_ADD_ANY, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, --, endian, out_rc)
+	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_ADD_ANY, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, --, endian, out_rc, HASHMAP_CALLER_HOST)
     br[ret#]
 
 s/**/HASHMAP_OP_UPDATE#:
-	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_UPDATE, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, --, endian, out_rc)
+	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_UPDATE, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, --, endian, out_rc, HASHMAP_CALLER_HOST)
     br[ret#]
 
 s/**/HASHMAP_OP_ADD_ONLY#:
-	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_ADD_ONLY, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, --, endian, out_rc)
+	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_ADD_ONLY, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, --, endian, out_rc, HASHMAP_CALLER_HOST)
     br[ret#]
 
 s/**/HASHMAP_OP_REMOVE#:
-	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_REMOVE, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc)
+	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_REMOVE, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc, HASHMAP_CALLER_HOST)
     br[ret#]
 
 s/**/HASHMAP_OP_GETNEXT#:
-	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_GETNEXT, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc)
+	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_GETNEXT, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc, HASHMAP_CALLER_HOST)
 	alu[--, reply_lw, -, 0]				;error if 0
 	bne[reply_keys#]
 	br[error_map_function#], defer[1]
@@ -934,13 +1512,79 @@ s/**/HASHMAP_OP_GETNEXT#:
 s/**/HASHMAP_OP_GETFIRST#:
 	#pragma warning(push)
     #pragma warning(disable: 4702) // disable warning "unreachable code"
-	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_GETFIRST, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc)
+	hashmap_ops(in_fd, in_lm_key, in_lm_value, HASHMAP_OP_GETFIRST, error_map_fd#, not_found#,HASHMAP_RTN_ADDR,reply_lw, --, r_addr, endian, out_rc, HASHMAP_CALLER_HOST)
 	alu[--, reply_lw, -, 0]				;error if 0
 	bne[reply_keys#]
 	br[error_map_function#], defer[1]
 	immed[out_rc, CMSG_RC_ERR_MAP_ERR]
 	#pragma warning(pop)
 
+lpm_op#:
+	/* one context at a time walks or changes the tries */
+	alu[--, --, b, @cmsg_lpm_busy]
+	beq[lpm_lock#]
+	ctx_arb[voluntary]
+	br[lpm_op#]
+lpm_lock#:
+	immed[@cmsg_lpm_busy, 1]
+	.if (op == HASHMAP_OP_LOOKUP)
+		hashmap_lpm_lookup(in_fd, in_lm_key, lpm_error_fd#, lpm_not_found#, reply_lw, r_addr, endian)
+		br[reply_value#], defer[1]
+		immed[@cmsg_lpm_busy, 0]
+	.elif (op == HASHMAP_OP_GETFIRST)
+		hashmap_lpm_getnext(in_fd, in_lm_key, op, lpm_error_fd#, lpm_not_found#, reply_lw, r_addr, endian)
+		br[reply_keys#], defer[1]
+		immed[@cmsg_lpm_busy, 0]
+	.elif (op == HASHMAP_OP_GETNEXT)
+		hashmap_lpm_getnext(in_fd, in_lm_key, op, lpm_error_fd#, lpm_not_found#, reply_lw, r_addr, endian)
+		br[reply_keys#], defer[1]
+		immed[@cmsg_lpm_busy, 0]
+	.elif (op == HASHMAP_OP_REMOVE)
+		hashmap_lpm_delete(in_fd, in_lm_key, lpm_error_fd#, lpm_error#, endian, out_rc)
+	.elif (op < HASHMAP_OP_LOOKUP)
+		immed[out_rc, CMSG_RC_ERR_MAP_PARSE]
+		br[lpm_error#]
+	.else
+		/* ADD_ANY, UPDATE or ADD_ONLY */
+		hashmap_lpm_update(in_fd, in_lm_key, in_lm_value, op, lpm_error_fd#, lpm_error#, endian, out_rc)
+	.endif
+	br[ret#], defer[1]
+	immed[@cmsg_lpm_busy, 0]
+
+prog_op#:
+	/* getnext and getfirst came as lookups of the next index */
+	.if (op == HASHMAP_OP_LOOKUP)
+		hashmap_prog_lookup(in_fd, in_lm_key, not_found#, tmp)
+		alu[$ent_reply[0], --, b, tmp]
+		mem[write32_swap, $ent_reply[0], in_addr_hi, <<8, in_value_offset, 1], sig_done[sig_reply_map_ops]
+		immed[out_rc, CMSG_RC_SUCCESS]
+		ctx_arb[sig_reply_map_ops], br[ret#]
+	.elif (op == HASHMAP_OP_REMOVE)
+		hashmap_prog_delete(in_fd, in_lm_key, error_map_function#, out_rc)
+	.elif (op < HASHMAP_OP_LOOKUP)
+		br[s0#]
+	.elif (op == HASHMAP_OP_GETNEXT)
+		br[s0#]
+	.elif (op == HASHMAP_OP_GETFIRST)
+		br[s0#]
+	.else
+		/* ADD_ANY, UPDATE or ADD_ONLY */
+		hashmap_prog_update(in_fd, in_map_type, in_lm_key, in_lm_value, op, error_map_function#, out_rc)
+	.endif
+	br[ret#]
+
+lpm_error_fd#:
+	br[error_map_fd#], defer[1]
+	immed[@cmsg_lpm_busy, 0]
+
+lpm_not_found#:
+	br[not_found#], defer[1]
+	immed[@cmsg_lpm_busy, 0]
+
+lpm_error#:
+	br[error_map_function#], defer[1]
+	immed[@cmsg_lpm_busy, 0]
+
 error_map_fd#:
 	br[error_map_function#], defer[1]
 	immed[out_rc, CMSG_RC_ERR_MAP_FD]
@@ -950,11 +1594,7 @@ not_found#:
 	immed[out_rc, CMSG_RC_ERR_MAP_NOENT]
 
 error_map_function#:
-    .if (out_rc == CMSG_RC_ERR_EEXIST)
-        immed[out_rc, CMSG_RC_ERR_MAP_EXIST]
-    .elif (out_rc == CMSG_RC_ERR_ENOMEM)
-        immed[out_rc, CMSG_RC_ERR_NOMEM]
-    .endif
+	_cmsg_map_rc(out_rc)
 	move(error_value, 0xffff0000)
 	alu[$ent_reply[0], error_value, or, out_rc]
 	alu[ent_offset, in_key_offset, +, (15*4)]				; write FFs and rc to last 1 words of key
@@ -1002,12 +1642,80 @@ reply_value#:
 	ctx_arb[sig_read_ent]
 
 	unroll_copy($ent_reply, 0, $ent_reply, 0, reply_lw, _CMSG_FLD_LW, --)
+	_cmsg_xadd_swap_xfer($ent_reply, in_xadd_words)
 
 	ov_single(OV_LENGTH, _CMSG_FLD_LW, OVF_SUBTRACT_ONE)
     mem[write32, $ent_reply[0], in_addr_hi, <<8, in_value_offset, max_/**/_CMSG_FLD_LW], indirect_ref, sig_done[sig_reply_map_ops]
 
 	immed[out_rc, CMSG_RC_SUCCESS]
-	ctx_arb[sig_reply_map_ops]
+	ctx_arb[sig_reply_map_ops], br[ret#]
+
+reply_percpu_value#:
+	/*
+	 * r_addr is the start of the value block, reply with the sum of the
+	 * slots of all contexts. Values of a multiple of 8 bytes are summed as
+	 * 64-bit lanes, others as 32-bit lanes. The LM value field of the
+	 * request holds the sums. XADD words are in NFP byte order and swapped
+	 * back once more before they are added.
+	 */
+	.begin
+		.reg slot_addr
+		.reg slot_word
+		.reg slot_word_hi
+		.reg slots
+
+		cmsg_lm_handles_define()
+		local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_VALUE_LM_HANDLE, in_lm_value]
+		immed[slots, HASHMAP_PERCPU_SLOTS]
+		alu[slot_addr, --, b, r_addr[1]]
+		nop
+		#define_eval __LW 0
+		#while (__LW < _CMSG_FLD_LW)
+			immed[CMSG_VALUE_LM_INDEX[__LW], 0]
+			#define_eval __LW (__LW + 1)
+		#endloop
+
+slot_loop#:
+		ov_single(OV_LENGTH, _CMSG_FLD_LW, OVF_SUBTRACT_ONE)
+		mem[read32_swap, $ent_reply[0], r_addr[0], <<8, slot_addr, max_/**/_CMSG_FLD_LW], indirect_ref, sig_done[sig_read_ent]
+		ctx_arb[sig_read_ent]
+		br_bset[reply_lw, 0, sum_32#]
+		#define_eval __LW 0
+		#while (__LW < _CMSG_FLD_LW)
+			#define_eval __LW_HI (__LW + 1)
+			_cmsg_xadd_swap(slot_word, $ent_reply[__LW], in_xadd_words, __LW)
+			_cmsg_xadd_swap(slot_word_hi, $ent_reply[__LW_HI], in_xadd_words, __LW_HI)
+			alu[CMSG_VALUE_LM_INDEX[__LW], CMSG_VALUE_LM_INDEX[__LW], +, slot_word]
+			alu[CMSG_VALUE_LM_INDEX[__LW_HI], CMSG_VALUE_LM_INDEX[__LW_HI], +carry, slot_word_hi]
+			#define_eval __LW (__LW + 2)
+		#endloop
+		#undef __LW_HI
+		br[next_slot#]
+sum_32#:
+		#define_eval __LW 0
+		#while (__LW < _CMSG_FLD_LW)
+			_cmsg_xadd_swap(slot_word, $ent_reply[__LW], in_xadd_words, __LW)
+			alu[CMSG_VALUE_LM_INDEX[__LW], CMSG_VALUE_LM_INDEX[__LW], +, slot_word]
+			#define_eval __LW (__LW + 1)
+		#endloop
+next_slot#:
+		alu[slots, slots, -, 1]
+		bne[slot_loop#], defer[1]
+		alu[slot_addr, slot_addr, +, HASHMAP_PERCPU_SLOT_SZ]
+
+		#define_eval __LW 0
+		#while (__LW < _CMSG_FLD_LW)
+			alu[$ent_reply[__LW], --, b, CMSG_VALUE_LM_INDEX[__LW]]
+			#define_eval __LW (__LW + 1)
+		#endloop
+		#undef __LW
+		cmsg_lm_handles_undef()
+
+		ov_single(OV_LENGTH, _CMSG_FLD_LW, OVF_SUBTRACT_ONE)
+		mem[write32_swap, $ent_reply[0], in_addr_hi, <<8, in_value_offset, max_/**/_CMSG_FLD_LW], indirect_ref, sig_done[sig_reply_map_ops]
+		immed[out_rc, CMSG_RC_SUCCESS]
+		ctx_arb[sig_reply_map_ops]
+	.end
 
 ret#:
 
@@ -1052,9 +1760,9 @@ init_loop#:
     cmsg_lm_handles_undef()
 
 	#if (streq('TABLE_OP', 'INIT'))
-		hashmap_ops(in_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_ADD_ANY, error_rtn#, error_rtn#, HASHMAP_RTN_ADDR, reply_lw, --, --, be)
+		hashmap_ops(in_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_ADD_ANY, error_rtn#, error_rtn#, HASHMAP_RTN_ADDR, reply_lw, --, --, be, --, HASHMAP_CALLER_HOST)
 	#else
-		hashmap_ops(in_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_REMOVE, error_rtn#, error_rtn#, HASHMAP_RTN_ADDR, reply_lw, --, --, be)
+		hashmap_ops(in_fd, lm_key_offset, lm_value_offset, HASHMAP_OP_REMOVE, error_rtn#, error_rtn#, HASHMAP_RTN_ADDR, reply_lw, --, --, be, --, HASHMAP_CALLER_HOST)
 	#endif
 
 	alu[--, reply_lw, -, 0]
@@ -19,6 +19,28 @@
 //SR-IOV VLAN-MAC Table ID
 #define SRIOV_TID               (HASHMAP_MAX_TID - 1)
 
+//Flow cache Table ID (INSTR_FLOW_LOOKUP), populated by the host
+#define FLOW_TID                (HASHMAP_MAX_TID - 2)
+#define FLOW_TABLE_NUM_ENTRIES  0x20000
+
+/*
+ * Flow cache key, 16 bytes:
+ * Word  +---------------------------------------------------------------+
+ *    0  |                       IPv4 Source Address                     |
+ *       +---------------------------------------------------------------+
+ *    1  |                     IPv4 Destination Address                  |
+ *       +-------------------------------+-------------------------------+
+ *    2  |          Source Port          |        Destination Port       |
+ *       +---------------+---------------+-------------------------------+
+ *    3  |       0       |   PV_PROTO    |         Ingress Port          |
+ *       +---------------+---------------+-------------------------------+
+ *
+ * The value is a terminal action list of up to FLOW_VALUE_SZ bytes in
+ * NIC_CFG_INSTR_TBL format, e.g. CHECKSUM -> TX_HOST or POP_VLAN -> TX_WIRE.
+ */
+#define FLOW_KEY_SZ             16
+#define FLOW_VALUE_SZ           48
+
 /*
  * enhancement:  add field length to support variable size
  */
@@ -116,6 +138,10 @@
  *       +---------------------------------------------------------------+
  *    1  |  RC, 0=success                                                |
  *       +---------------------------------------------------------------+
+ *    2  |  number of successful ops                                     |
+ *       +---------------------------------------------------------------+
+ *    3  |  CMSG_MAP_RESIZE_HINT if the map should be resized            |
+ *       +---------------------------------------------------------------+
  *
  *  map_get_next_key request
  *       +---------------------------------------------------------------+
@@ -183,6 +209,107 @@
  *       +---------------------------------------------------------------+
  *    1  |   RC                                                          |
  *       +---------------------------------------------------------------+
+ *
+ *  map_batch_{lookup,update,delete,dump} request
+ *       +---------------------------------------------------------------+
+ *    1  |   map fd                                                      |
+ *       +---------------------------------------------------------------+
+ *    2  |   count                                                       |
+ *       +---------------------------------------------------------------+
+ *    3  |   update: flags, dump: bucket to start from                   |
+ *       +---------------------------------------------------------------+
+ *    4  |   records, dump: records returned by the previous messages    |
+ *       |     ...                                                       |
+ *       +---------------------------------------------------------------+
+ *  map_batch_{lookup,update,delete,dump} reply
+ *       +---------------------------------------------------------------+
+ *    1  |   RC, 0=success                                               |
+ *       +---------------------------------------------------------------+
+ *    2  |   number of records processed or returned                     |
+ *       +---------------------------------------------------------------+
+ *    3  |   dump: next bucket, CMSG_MAP_BATCH_CURSOR_END when done      |
+ *       |   update: CMSG_MAP_RESIZE_HINT if the map should be resized   |
+ *       +---------------------------------------------------------------+
+ *    4  |   lookup, dump: records                                       |
+ *       |     ...                                                       |
+ *       +---------------------------------------------------------------+
+ *
+ *  Records are packed: key and value are each rounded up to a word, so a
+ *  record takes (key words + value words) of the map, not 2 * 16 words.
+ *  Lookup and update requests carry key and value, delete requests the
+ *  key only and dump requests none. Lookup replies hold the records that
+ *  were found, in request order. Update and delete stop at the first
+ *  failure. A dump returns whole buckets only, so count must be at least
+ *  CMSG_MAP_BATCH_DUMP_MIN, and scans at most CMSG_MAP_BATCH_SCAN_MAX
+ *  buckets per message. It ends once the records returned so far reach
+ *  the number of entries in the map, entries added or deleted meanwhile
+ *  may be missed. Failed updates and deletes return CMSG_RC_ERR_MAP_NOENT,
+ *  _MAP_EXIST, _NOMEM, _E2BIG or _MAP_ERR.
+ *
+ *  map_resize request
+ *       +---------------------------------------------------------------+
+ *    1  |   map fd                                                      |
+ *       +---------------------------------------------------------------+
+ *    2  |   max entries, lower than the current value keeps it          |
+ *       +---------------------------------------------------------------+
+ *    3  |   CMSG_MAP_BATCH_CURSOR_END to start, else bucket to move from |
+ *       +---------------------------------------------------------------+
+ *    4  |   map_flags, partitions as for map_alloc                      |
+ *       +---------------------------------------------------------------+
+ *  map_resize reply
+ *       +---------------------------------------------------------------+
+ *    1  |   RC, 0=success                                               |
+ *       +---------------------------------------------------------------+
+ *    2  |   number of entries moved                                     |
+ *       +---------------------------------------------------------------+
+ *    3  |   next bucket, CMSG_MAP_BATCH_CURSOR_END when done             |
+ *       +---------------------------------------------------------------+
+ *
+ *  A resize is started with the cursor at CMSG_MAP_BATCH_CURSOR_END: the
+ *  map grows to max entries at once and, if its partitions change, the
+ *  reply returns cursor 0. The host then sends the cursor of each reply
+ *  back until CMSG_MAP_BATCH_CURSOR_END, each message moves the entries
+ *  of at most CMSG_MAP_RESIZE_SCAN_MAX buckets to the new layout. The
+ *  map is searched in both layouts meanwhile. Datapath ops that started
+ *  before the resize are done by the time the first move arrives.
+ *  CMSG_RC_ERR_MAP_BUSY is returned when the map is being resized
+ *  already. A failed move returns the RC of the add to the new layout,
+ *  CMSG_RC_ERR_E2BIG when a bucket of it is full, and can be retried
+ *  from the returned cursor.
+ *
+ *  Map updates report CMSG_MAP_RESIZE_HINT when fewer than max entries
+ *  >> HASHMAP_RESIZE_HINT_SHFT (hashmap.uc) entries are left.
+ *
+ *  BPF_MAP_TYPE_LPM_TRIE keys are a 32 bit prefix length followed by 1
+ *  to 16 address bytes. Lookups return the value of the longest prefix
+ *  matching the key, add, delete and getnext take the exact prefix.
+ *  map_alloc fails with CMSG_RC_ERR_MAP_ERR for other key sizes, as do
+ *  batch and resize requests on these maps.
+ *
+ *  BPF_MAP_TYPE_PROG_ARRAY maps have 4 byte keys and values and at most
+ *  HASHMAP_PROG_ENTRIES (hashmap_prog.uc) entries. Values are code store
+ *  addresses of programs of the eBPF image, adds of other values fail
+ *  with CMSG_RC_ERR_MAP_ERR. Empty entries look up as 0. Batch and
+ *  resize requests fail with CMSG_RC_ERR_MAP_ERR.
+ *
+ *  BPF_MAP_TYPE_DEVMAP maps are kept the same way, their values are
+ *  redirect targets rather than ifindexes: the host resolves the netdev
+ *  of the entry to the arguments of its TX_WIRE or TX_HOST action, see
+ *  app_config_instr.h. bpf_redirect() gets a target the same way.
+ *
+ * Bit    3 3 2 2 2 2 2 2 2 2 2 2 1 1 1 1 1 1 1 1 1 1 0 0 0 0 0 0 0 0 0 0
+ * -----\ 1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0
+ * Word  +-+-+---------------------------+-+-+---------------------------+
+ *    0  |V|H|             0             |0|0|  TX_WIRE or TX_HOST args  |
+ *       +-+-+---------------------------+-+-+---------------------------+
+ *
+ *  V - valid target
+ *  H - TX_HOST arguments (PCIe, queue, MIN RXB), else TX_WIRE (NBI, TM queue)
+ *  The continue and multicast bits of the arguments are 0.
+ *
+ *  BPF_MAP_TYPE_PERF_EVENT_ARRAY maps are kept like PROG_ARRAY maps,
+ *  indexed by host CPU. An entry other than 0 enables
+ *  bpf_perf_event_output() to that CPU, the value is not used otherwise.
 */
 
 /**
@@ -197,11 +324,18 @@
 #define CMSG_TYPE_MAP_GETNEXT   6
 #define CMSG_TYPE_MAP_GETFIRST  7
 #define CMSG_TYPE_PRINT			8
+#define CMSG_TYPE_MAP_BATCH_LOOKUP	9
+#define CMSG_TYPE_MAP_BATCH_UPDATE	10
+#define CMSG_TYPE_MAP_BATCH_DELETE	11
+#define CMSG_TYPE_MAP_BATCH_DUMP	12
+#define CMSG_TYPE_MAP_RESIZE		13
 	/* CMSG_TYPE_MAP_ARRAY_GETNEXT is internal type */
 #define CMSG_TYPE_MAP_ARRAY_GETNEXT  0xf6
 
 #define CMSG_TYPE_MAP_START		1
-#define CMSG_TYPE_MAP_MAX		7
+#define CMSG_TYPE_MAP_MAX		13
+	/* CMSG_TYPE_PERF_EVENT is only sent to the host */
+#define CMSG_TYPE_PERF_EVENT		14
 
 //#define CMSG_TYPE_MAX (CMSG_TYPE_LAST_UNUSED)
 
@@ -212,6 +346,11 @@
 #define CMSG_TYPE_MAP_DELETE_REPLY		0x85
 #define CMSG_TYPE_MAP_GETNEXT_REPLY		0x86
 #define CMSG_TYPE_MAP_GETFIRST_REPLY	0x87
+#define CMSG_TYPE_MAP_BATCH_LOOKUP_REPLY	0x89
+#define CMSG_TYPE_MAP_BATCH_UPDATE_REPLY	0x8a
+#define CMSG_TYPE_MAP_BATCH_DELETE_REPLY	0x8b
+#define CMSG_TYPE_MAP_BATCH_DUMP_REPLY		0x8c
+#define CMSG_TYPE_MAP_RESIZE_REPLY		0x8d
 
 #define CMSG_TYPE_MAP_REPLY_BIT			7
 
@@ -234,6 +373,7 @@
 #define CMSG_RC_ERR_NOMEM           6
 #define CMSG_RC_ERR_ENOENT          2
 #define CMSG_RC_ERR_E2BIG           7
+#define CMSG_RC_ERR_MAP_BUSY        8   /* EBUSY */
 #define CMSG_RC_ERR_EINVAL          22
 #define CMSG_RC_ERR_EEXIST          17
 #define CMSG_RC_ERR_ENOMEM          12
@@ -244,6 +384,20 @@
 #define CMSG_MAP_TID_IDX			1
 #define CMSG_MAP_OP_COUNT_IDX		2
 #define CMSG_MAP_OP_FLAGS_IDX		3
+#define CMSG_MAP_BATCH_CURSOR_IDX	3
+
+/* batched ops, records follow the CMSG_OP_HDR_LW header */
+#define CMSG_MAP_BATCH_DATA_LW		(353 - CMSG_OP_HDR_LW)
+#define CMSG_MAP_BATCH_DUMP_MIN		9		/* entries per bucket */
+#define CMSG_MAP_BATCH_SCAN_MAX		(1 << 16)
+#define CMSG_MAP_BATCH_CURSOR_END	0xffffffff
+
+#define CMSG_MAP_RESIZE_MAXENT_IDX	2
+#define CMSG_MAP_RESIZE_CURSOR_IDX	3
+#define CMSG_MAP_RESIZE_FLAGS_IDX	4
+#define CMSG_MAP_RESIZE_SCAN_MAX	(1 << 12)
+#define CMSG_MAP_RESIZE_HINT_IDX	3
+#define CMSG_MAP_RESIZE_HINT		1
 
 #define CMSG_MAP_ALLOC_KEYSZ_IDX	1
 #define CMSG_MAP_ALLOC_VALUESZ_IDX	2
@@ -251,6 +405,46 @@
 #define CMSG_MAP_ALLOC_TYPE_IDX		4
 #define CMSG_MAP_ALLOC_FLAGS_IDX	5
 
+/* map_flags of an alloc: EMEM partitions of the map, 0 for all of them */
+#define CMSG_MAP_ALLOC_PART_SHF		28
+#define CMSG_MAP_ALLOC_PART_MSK		0x3
+/*
+ * map_flags of an alloc: value words the programs XADD to, bit n for LW n.
+ * They are kept in NFP byte order, lookup replies and updates swap them
+ * from and to host byte order.
+ */
+#define CMSG_MAP_ALLOC_XADD_SHF		12
+#define CMSG_MAP_ALLOC_XADD_MSK		0xffff
+
+/*
+ * CMSG_TYPE_PERF_EVENT, bpf_perf_event_output() records of a host CPU
+ * ring, see cmsg_perf.uc. The tag is 0, the other CMSG_OP_HDR_LW header
+ * words are the ring, the number of records and the number of records of
+ * the ring lost since its last message because the ring was full. A record
+ * is 3 words followed by its data padded to words:
+ *
+ * Word  +---------------------------------------------------------------+
+ *    0  |                            map tid                            |
+ *       +---------------------------------------------------------------+
+ *    1  |   CPU, index of the flags or 0xffffffff (BPF_F_CURRENT_CPU)   |
+ *       +---------------------------------------------------------------+
+ *    2  |                       data size in bytes                      |
+ *       +---------------------------------------------------------------+
+ *    3  |           data, in the byte order of the eBPF stack           |
+ *       +---------------------------------------------------------------+
+ */
+#define CMSG_PERF_RING_IDX		1
+#define CMSG_PERF_COUNT_IDX		2
+#define CMSG_PERF_LOST_IDX		3
+#define CMSG_PERF_REC_HDR_LW	3
+
+/*
+ * DEVMAP values and the ifindex argument of bpf_redirect() as the JIT
+ * rewrites it, redirect targets
+ */
+#define CMSG_MAP_REDIR_VALID_SHF	31
+#define CMSG_MAP_REDIR_HOST_SHF		30
+
 /* flags used for add/update */
 #define CMSG_BPF_ANY     0 /* create new element or update existing */
 #define CMSG_BPF_NOEXIST 1 /* create new element if it didn't exist */
@@ -267,7 +461,7 @@ struct cmsg_req_map_alloc_tbl {
 			uint32_t value_size;	/* in bytes */
 			uint32_t max_entries;
 			uint32_t map_type;
-			uint32_t map_flags;		/* reserved */
+			uint32_t map_flags;		/* partitions in bits 29:28, XADD words in 27:12 */
 		};
 		uint32_t __raw[5];
 	};
@@ -341,7 +535,7 @@ struct cmsg_reply_map_op {
 			uint32_t tag:16;
 			uint32_t rc;					/* rc cummulative */
 			uint32_t count;					/* # of successful ops */
-			uint32_t reserve;
+			uint32_t hint;					/* add: CMSG_MAP_RESIZE_HINT */
 			uint32_t key[CMSG_MAP_KEY_VALUE_LW];
 			uint32_t value[CMSG_MAP_KEY_VALUE_LW];
 		};
@@ -349,6 +543,62 @@ struct cmsg_reply_map_op {
 
 	};
 };
+struct cmsg_req_map_batch {
+	union {
+		struct {
+			uint32_t type:8;				/* CMSG_TYPE_MAP_BATCH_xxx */
+			uint32_t ver:8;
+			uint32_t tag:16;
+			uint32_t tid;
+			uint32_t count;					/* records, or max records to dump */
+			uint32_t flags;					/* update: CMSG_BPF_xxx, dump: start bucket */
+			uint32_t data[CMSG_MAP_BATCH_DATA_LW];	/* packed key/value records,
+											 * dump: records returned so far */
+		};
+		uint32_t __raw[353];
+	};
+};
+struct cmsg_reply_map_batch {
+	union {
+		struct {
+			uint32_t type:8;
+			uint32_t ver:8;
+			uint32_t tag:16;
+			uint32_t rc;
+			uint32_t count;					/* records processed or returned */
+			uint32_t cursor;				/* dump: next start bucket */
+			uint32_t data[CMSG_MAP_BATCH_DATA_LW];
+		};
+		uint32_t __raw[353];
+	};
+};
+struct cmsg_req_map_resize {
+	union {
+		struct {
+			uint32_t type:8;				/* CMSG_TYPE_MAP_RESIZE */
+			uint32_t ver:8;
+			uint32_t tag:16;
+			uint32_t tid;
+			uint32_t max_entries;
+			uint32_t cursor;				/* CMSG_MAP_BATCH_CURSOR_END starts */
+			uint32_t map_flags;
+		};
+		uint32_t __raw[5];
+	};
+};
+struct cmsg_reply_map_resize {
+	union {
+		struct {
+			uint32_t type:8;
+			uint32_t ver:8;
+			uint32_t tag:16;
+			uint32_t rc;
+			uint32_t count;					/* entries moved */
+			uint32_t cursor;				/* next bucket to move */
+		};
+		uint32_t __raw[4];
+	};
+};
 #endif /* __NFP_LANG_ASM */
 
 #endif	/* _MAP_CTL_MSG_TYPES_H_ */
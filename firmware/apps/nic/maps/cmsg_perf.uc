@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2020,  Netronome Systems, Inc.  All rights reserved.
+ *
+ * @file       cmsg_perf.uc
+ * @brief      bpf_perf_event_output() records, batched to the host over the
+ *             control vNIC.
+ *
+ * The records of a host CPU go to a ring of CMSG_PERF_SLOTS slots in EMEM,
+ * there is a ring for each of the CMSG_PERF_RINGS CPUs a
+ * BPF_MAP_TYPE_PERF_EVENT_ARRAY map can have, see hashmap_prog.uc. Records
+ * of BPF_F_CURRENT_CPU go to the ring of the context number, the host
+ * delivers them on the CPU that handles the message.
+ *
+ * A datapath context takes the next sequence number of the ring with an
+ * atomic add and writes the slot of it, see cmsg_perf_output_subr_func().
+ * The first word of a slot is its sequence number + 1, the record is
+ * published by writing it last. A ring is not locked: a producer that laps
+ * the consumer overwrites the oldest records, the host is told how many
+ * were lost.
+ *
+ * Every CMSG_PERF_BATCH records of a ring, and for the first record of a
+ * rate window of an ME, the producer adds a flush request for the ring to
+ * the work queue of the cmsg ME. Other records mark their ring dirty on the
+ * ME, the next epoch of pkt_io_rx() requests a flush of the dirty rings,
+ * see cmsg_perf_epoch(). Every record is thus followed by a request made
+ * after it was published and is sent within an epoch, also when a batch
+ * is never completed. There cmsg_perf_flush() copies the published records
+ * into CMSG_TYPE_PERF_EVENT messages of up to CMSG_PERF_BATCH records, see
+ * cmsg_map_types.h.
+ *
+ * An ME writes at most CMSG_PERF_RATE records in CMSG_PERF_RATE_TICKS
+ * TIMESTAMP ticks, other records are dropped with -ENOSPC as for a full
+ * perf buffer. The _cmsg_perf_stats rtsym counts records, rate limited
+ * drops, records lost to full rings and messages, CMSG_PERF_STAT_* 64 bit
+ * counters.
+ *
+ * slot, CMSG_PERF_SLOT_SZ bytes
+ *    w0 sequence number + 1, w1 map tid, w2 CPU of the flags, w3 data size
+ *    in bytes, data in the byte order of the eBPF stack
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __CMSG_PERF_UC__
+#define __CMSG_PERF_UC__
+
+#include <ov.uc>
+
+#ifdef CMSG_MAP_PROC
+    #include "cmsg_print.uc"
+#endif
+
+#define CMSG_PERF_RINGS                 HASHMAP_PROG_ENTRIES
+#ifndef CMSG_PERF_SLOTS
+    #define CMSG_PERF_SLOTS             128
+#endif
+#define CMSG_PERF_SLOT_SZ               128
+#define __CMSG_PERF_SLOT_SHFT           7
+#define_eval __CMSG_PERF_RING_SHFT      (LOG2(CMSG_PERF_SLOTS) + __CMSG_PERF_SLOT_SHFT)
+#define __CMSG_PERF_SLOT_HDR_LW         4
+#define CMSG_PERF_DATA_MAX              (CMSG_PERF_SLOT_SZ - (__CMSG_PERF_SLOT_HDR_LW * 4))
+
+/* records per flush request and message, a power of 2 */
+#ifndef CMSG_PERF_BATCH
+    #define CMSG_PERF_BATCH             8
+#endif
+
+/* records per ME and window, 16 per ms at 800 MHz */
+#ifndef CMSG_PERF_RATE
+    #define CMSG_PERF_RATE              16
+#endif
+#ifndef CMSG_PERF_RATE_TICKS
+    #define CMSG_PERF_RATE_TICKS        50000
+#endif
+
+#define CMSG_PERF_STAT_RECORDS          0
+#define CMSG_PERF_STAT_RATE_DROPS       1
+#define CMSG_PERF_STAT_LOST             2
+#define CMSG_PERF_STAT_MSGS             3
+#define CMSG_PERF_STATS                 4
+
+#define __CMSG_PERF_ENOSPC              28
+#define __CMSG_PERF_PENDING_BIT         30      // followed by BUSY
+#define __CMSG_PERF_BUSY_BIT            31
+
+
+#macro cmsg_perf_init()
+    #if ((CMSG_PERF_BATCH * (CMSG_PERF_REC_HDR_LW + (CMSG_PERF_DATA_MAX / 4))) > CMSG_MAP_BATCH_DATA_LW)
+        #error "CMSG_PERF_BATCH records do not fit a message"
+    #endif
+    #if ((CMSG_PERF_RINGS % 32) != 0)
+        #error "CMSG_PERF_RINGS is not a multiple of the 32 dirty bits per word"
+    #endif
+
+    .alloc_mem _cmsg_perf_rings emem global (CMSG_PERF_RINGS << __CMSG_PERF_RING_SHFT) 256
+    .alloc_mem _cmsg_perf_prod emem global (CMSG_PERF_RINGS * 4) 256
+    .init _cmsg_perf_prod 0
+    .alloc_mem _cmsg_perf_stats emem global (CMSG_PERF_STATS * 8) 256
+    .init _cmsg_perf_stats 0
+
+    /* rate window of the datapath ME: w0 start TIMESTAMP, w1 records, then
+     * a dirty bit per ring
+     */
+    .alloc_mem __cmsg_perf_rate lmem me (8 + (CMSG_PERF_RINGS / 8)) 16
+    .init __cmsg_perf_rate 0
+
+#ifdef CMSG_MAP_PROC
+    /* consumer state of a ring: w0 next sequence number, w1 lost records
+     * and the PENDING and BUSY bits of cmsg_perf_flush()
+     */
+    .alloc_mem __cmsg_perf_ring lmem me (CMSG_PERF_RINGS * 8) (CMSG_PERF_RINGS * 8)
+    .init __cmsg_perf_ring 0
+#endif
+#endm
+
+#macro cmsg_perf_lm_define()
+    lm_handle_alloc(CMSG_PERF_LM_HANDLE)
+    #define_eval CMSG_PERF_LM_HANDLE    _LM_NEXT_HANDLE
+    #define_eval CMSG_PERF_LM_INDEX     _LM_NEXT_INDEX
+#endm
+
+#macro cmsg_perf_lm_undef()
+    lm_handle_free(CMSG_PERF_LM_HANDLE)
+    #undef CMSG_PERF_LM_HANDLE
+    #undef CMSG_PERF_LM_INDEX
+#endm
+
+#macro __cmsg_perf_stat_incr(STAT)
+.begin
+    .reg addr_hi
+
+    move(addr_hi, _cmsg_perf_stats >>8)
+    mem[incr64, --, addr_hi, <<8, (STAT * 8)]
+.end
+#endm
+
+#macro __cmsg_perf_stat_add(STAT, in_value)
+.begin
+    .reg addr_hi
+    .reg addr_lo
+    .reg write $stat[2]
+    .xfer_order $stat
+    .sig sig_stat
+
+    move(addr_hi, _cmsg_perf_stats >>8)
+    immed[addr_lo, (STAT * 8)]
+    immed[$stat[0], 0]
+    alu[$stat[1], --, b, in_value]
+    mem[add64, $stat[0], addr_hi, <<8, addr_lo, 1], ctx_swap[sig_stat]
+.end
+#endm
+
+/* ask the cmsg ME to send the records of in_ring */
+#macro cmsg_perf_flush_workq(in_ring)
+.begin
+    .reg q_base_hi
+    .reg q_idx
+    .reg write $flush[CMSG_DESC_LW]
+    .xfer_order $flush
+    .sig sig_flush
+
+    move(q_base_hi, (((MAP_CMSG_Q_BASE >>32) & 0xff) <<24))
+    immed[q_idx, MAP_CMSG_Q_IDX]
+    alu[$flush[0], --, b, in_ring]
+    immed[$flush[1], 0]         // no MU buffer, see cmsg_rx()
+    immed[$flush[2], 0]
+    mem[qadd_work, $flush[0], q_base_hi, <<8, q_idx, CMSG_DESC_LW], ctx_swap[sig_flush]
+.end
+#endm
+
+/*
+ * ask the cmsg ME to send the records of the rings the datapath ME marked
+ * dirty since the last epoch, clobbers LM3
+ */
+#macro cmsg_perf_epoch()
+.begin
+    .reg addr
+    .reg base
+    .reg bit
+    .reg dirty
+    .reg ring
+
+    immed[addr, (__cmsg_perf_rate + 8)]
+    immed[base, 0]
+
+word_loop#:
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    nop
+    nop
+    nop
+    alu[dirty, --, b, *l$index3]
+    beq[next_word#]
+    // clear before the requests swap out, records of other contexts mark it again
+    alu[*l$index3, --, b, 0]
+
+ring_loop#:
+    ffs[ring, dirty]
+    alu[--, ring, OR, 0]
+    alu[bit, --, b, 1, <<indirect]
+    alu[dirty, dirty, AND~, bit]
+    alu[ring, ring, +, base]
+    cmsg_perf_flush_workq(ring)
+    alu[--, --, b, dirty]
+    bne[ring_loop#]
+
+next_word#:
+    alu[addr, addr, +, 4]
+    alu[base, base, +, 32]
+    alu[--, base, -, CMSG_PERF_RINGS]
+    blo[word_loop#]
+.end
+#endm
+
+/*
+ * bpf_perf_event_output() of an eBPF program.
+ *
+ * A0 PERF_EVENT_ARRAY tid, B1 low word of the flags: the CPU index or
+ * BPF_F_CURRENT_CPU, B2 LM address of the data, A1 data size. B0 return
+ * address. The packet data flags (BPF_F_CTXLEN_MASK) are not supported.
+ *
+ * A0/A1 return 0, -EINVAL for a bad tid, -E2BIG for a CPU past the end of
+ * the map or a size over CMSG_PERF_DATA_MAX, -ENOENT for a CPU without perf
+ * event and -ENOSPC past the rate of the ME.
+ */
+#macro cmsg_perf_output_subr_func()
+.reentry
+.begin
+    htab_subr_regs_alloc()
+    .reg htab_return_addr
+    .reg_addr htab_return_addr 0 B
+    .set htab_return_addr
+    .reg htab_in_tid
+    .reg_addr htab_in_tid 0 A
+    .set htab_in_tid
+    .reg htab_in_cpu
+    .reg_addr htab_in_cpu 1 B
+    .set htab_in_cpu
+    .reg htab_in_data
+    .reg_addr htab_in_data 2 B
+    .set htab_in_data
+    .reg htab_in_size
+    .reg_addr htab_in_size 1 A
+    .set htab_in_size
+
+    .reg rtn_addr
+    .reg rc
+    .reg ebpf_rc
+    .reg ebpf_rc_hi
+    .reg ring
+    .reg seq
+    .reg flush
+    .reg now
+    .reg window
+    .reg tmp
+    .reg count
+    .reg n
+    .reg bit
+    .reg addr_hi
+    .reg offset
+    .reg data_offset
+    .reg $entry
+    .reg $seq
+    .reg write $data[8]
+    .xfer_order $data
+    .reg write $hdr[__CMSG_PERF_SLOT_HDR_LW]
+    .xfer_order $hdr
+    .sig sig_entry
+    .sig sig_seq
+    .sig sig_data
+    .sig sig_hdr
+
+    hashmap_prog_count_helper()
+    __hashmap_lm_handles_define()
+
+    alu[rtn_addr, --, b, htab_return_addr]
+    immed[rc, CMSG_RC_ERR_EINVAL]
+    alu[--, htab_in_tid, -, HASHMAP_MAX_TID]
+    bhs[ret#]
+
+    immed[rc, CMSG_RC_ERR_E2BIG]
+    alu[tmp, htab_in_size, -, 1]
+    alu[--, tmp, -, CMSG_PERF_DATA_MAX]
+    bhs[ret#]
+
+    alu[--, htab_in_cpu, +, 1]
+    bne[cpu#]
+    br[rate#], defer[1]
+        alu[ring, --, b, t_idx_ctx, >>7]
+cpu#:
+    __hashmap_prog_entry_addr(htab_in_tid, htab_in_cpu, addr_hi, offset, ret#)
+    mem[read32, $entry, addr_hi, <<8, offset, 1], ctx_swap[sig_entry]
+    immed[rc, CMSG_RC_ERR_ENOENT]
+    alu[--, --, b, $entry]
+    beq[ret#]
+    alu[ring, --, b, htab_in_cpu]
+
+rate#:
+    immed[tmp, __cmsg_perf_rate]
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, tmp]
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[now, 0]
+    immed[flush, 0]
+    alu[tmp, now, -, HASHMAP_LM_INDEX[0]]
+    move(window, CMSG_PERF_RATE_TICKS)
+    alu[--, tmp, -, window]
+    blo[in_window#]
+    alu[HASHMAP_LM_INDEX[0], --, b, now]
+    immed[HASHMAP_LM_INDEX[1], 0]
+    immed[flush, 1]
+in_window#:
+    immed[rc, __CMSG_PERF_ENOSPC]
+    alu[--, HASHMAP_LM_INDEX[1], -, CMSG_PERF_RATE]
+    bhs[rate_drop#]
+    alu[HASHMAP_LM_INDEX[1], HASHMAP_LM_INDEX[1], +, 1]
+
+    move(addr_hi, _cmsg_perf_prod >>8)
+    alu[offset, --, b, ring, <<2]
+    immed[$seq, 1]
+    mem[test_add, $seq, addr_hi, <<8, offset, 1], ctx_swap[sig_seq]
+    alu[seq, --, b, $seq]
+
+    /* the slot of the lap before until the data is written */
+    move(addr_hi, _cmsg_perf_rings >>8)
+    alu[offset, --, b, ring, <<__CMSG_PERF_RING_SHFT]
+    alu[tmp, seq, AND, (CMSG_PERF_SLOTS - 1)]
+    alu[offset, offset, OR, tmp, <<__CMSG_PERF_SLOT_SHFT]
+    alu[tmp, seq, +, 1]
+    alu[$hdr[0], tmp, -, CMSG_PERF_SLOTS]
+    mem[write32, $hdr[0], addr_hi, <<8, offset, 1], ctx_swap[sig_hdr]
+
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, htab_in_data]
+    alu[count, htab_in_size, +, 3]
+    alu[count, --, b, count, >>2]
+    alu[data_offset, offset, +, (__CMSG_PERF_SLOT_HDR_LW * 4)]
+
+data_loop#:
+    #define_eval _CMSG_PERF_LOOP 0
+    #while (_CMSG_PERF_LOOP < 8)
+        alu[$data[_CMSG_PERF_LOOP], --, b, HASHMAP_LM_INDEX++]
+        #define_eval _CMSG_PERF_LOOP (_CMSG_PERF_LOOP + 1)
+    #endloop
+    #undef _CMSG_PERF_LOOP
+    alu[n, --, b, count]
+    alu[--, count, -, 8]
+    blo[data_write#]
+    immed[n, 8]
+data_write#:
+    ov_start(OV_LENGTH)
+    ov_set_use(OV_LENGTH, n, OVF_SUBTRACT_ONE)
+    ov_clean
+    mem[write32_swap, $data[0], addr_hi, <<8, data_offset, max_8], indirect_ref, ctx_swap[sig_data]
+    alu[data_offset, data_offset, +, 32]
+    alu[count, count, -, n]
+    bne[data_loop#]
+
+    /* publish */
+    alu[$hdr[0], seq, +, 1]
+    alu[$hdr[1], --, b, htab_in_tid]
+    alu[$hdr[2], --, b, htab_in_cpu]
+    alu[$hdr[3], --, b, htab_in_size]
+    mem[write32, $hdr[0], addr_hi, <<8, offset, __CMSG_PERF_SLOT_HDR_LW], ctx_swap[sig_hdr]
+    __cmsg_perf_stat_incr(CMSG_PERF_STAT_RECORDS)
+
+    alu[tmp, seq, +, 1]
+    alu[--, tmp, AND, (CMSG_PERF_BATCH - 1)]
+    beq[flush#]
+    alu[--, --, b, flush]
+    bne[flush#]
+
+    /* the next epoch asks for the rest of the batch, see cmsg_perf_epoch() */
+    immed[tmp, (__cmsg_perf_rate + 8)]
+    alu[n, --, b, ring, >>5]
+    alu[tmp, tmp, +, n, <<2]
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, tmp]
+    alu[--, ring, OR, 0]
+    alu[bit, --, b, 1, <<indirect]
+    immed[rc, 0]
+    br[ret#], defer[1]
+        alu[HASHMAP_LM_INDEX[0], HASHMAP_LM_INDEX[0], OR, bit]
+flush#:
+    cmsg_perf_flush_workq(ring)
+    br[ret#], defer[1]
+        immed[rc, 0]
+
+rate_drop#:
+    __cmsg_perf_stat_incr(CMSG_PERF_STAT_RATE_DROPS)
+
+ret#:
+    __hashmap_lm_handles_undef()
+
+    .reg_addr ebpf_rc 0 A
+    .reg_addr ebpf_rc_hi 1 A
+    alu[ebpf_rc, 0, -, rc]
+    beq[rtn#], defer[1]
+        immed[ebpf_rc_hi, 0]
+    alu[ebpf_rc_hi, --, ~b, 0]
+
+rtn#:
+    htab_subr_regs_free()
+    #pragma warning(push)
+    #pragma warning(disable: 5116)  // disable warning "Return register may not contain valid addr"
+        .use htab_return_addr
+        .use ebpf_rc
+        .use ebpf_rc_hi
+        rtn[rtn_addr]
+    #pragma warning(pop)
+.end
+#endm
+
+
+#ifdef CMSG_MAP_PROC
+
+/* LM consumer state of in_ring */
+#macro __cmsg_perf_ring_state(out_lm_addr, in_ring)
+    immed[out_lm_addr, __cmsg_perf_ring]
+    alu[out_lm_addr, out_lm_addr, OR, in_ring, <<3]
+#endm
+
+/*
+ * copy the published records of in_ring up to sequence number in_prod into
+ * a CMSG_TYPE_PERF_EVENT message in the buffer at in_buf_hi, see
+ * cmsg_map_types.h. out_pkt_len is 0 for nothing to send, out_more is set
+ * when the message is full and records are left.
+ */
+#macro cmsg_perf_fill(in_ring, in_prod, in_buf_hi, out_pkt_len, out_more)
+.begin
+    .reg lm_addr
+    .reg cons
+    .reg lost
+    .reg count
+    .reg ring_hi
+    .reg ring_offset
+    .reg slot_offset
+    .reg buf_offset
+    .reg src
+    .reg dst
+    .reg rec_words
+    .reg words
+    .reg n
+    .reg tmp
+    .reg $chunk[8]
+    .xfer_order $chunk
+    .reg read $slot[__CMSG_PERF_SLOT_HDR_LW]
+    .xfer_order $slot
+    .reg write $hdr[CMSG_OP_HDR_LW]
+    .xfer_order $hdr
+    .sig sig_slot
+    .sig sig_chunk
+    .sig sig_hdr
+
+    cmsg_perf_lm_define()
+    __cmsg_perf_ring_state(lm_addr, in_ring)
+    local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_PERF_LM_HANDLE, lm_addr]
+    move(ring_hi, _cmsg_perf_rings >>8)
+    alu[ring_offset, --, b, in_ring, <<__CMSG_PERF_RING_SHFT]
+    move(buf_offset, (NFD_IN_DATA_OFFSET + (CMSG_OP_HDR_LW * 4)))
+    alu[cons, --, b, CMSG_PERF_LM_INDEX[0]]
+    alu[lost, CMSG_PERF_LM_INDEX[1], AND~, 3, <<__CMSG_PERF_PENDING_BIT]
+    immed[count, 0]
+    immed[out_more, 0]
+
+    /* the producers lapped the ring, the oldest records are gone */
+    alu[tmp, in_prod, -, cons]
+    alu[tmp, tmp, -, CMSG_PERF_SLOTS]
+    blo[rec_loop#]
+    alu[lost, lost, +, tmp]
+    alu[cons, in_prod, -, CMSG_PERF_SLOTS]
+
+rec_loop#:
+    alu[--, in_prod, -, cons]
+    beq[done#]
+    alu[--, count, -, CMSG_PERF_BATCH]
+    beq[full#]
+
+    alu[tmp, cons, AND, (CMSG_PERF_SLOTS - 1)]
+    alu[slot_offset, ring_offset, OR, tmp, <<__CMSG_PERF_SLOT_SHFT]
+    mem[read32, $slot[0], ring_hi, <<8, slot_offset, __CMSG_PERF_SLOT_HDR_LW], ctx_swap[sig_slot]
+    alu[tmp, $slot[0], -, 1]
+    alu[tmp, tmp, -, cons]
+    beq[copy#]
+    // an earlier lap, the record is not published yet
+    bmi[done#]
+    // a later lap overwrote the record
+    br[rec_loop#], defer[2]
+        alu[lost, lost, +, 1]
+        alu[cons, cons, +, 1]
+
+copy#:
+    alu[rec_words, $slot[3], +, 3]
+    alu[rec_words, --, b, rec_words, >>2]
+    alu[rec_words, rec_words, +, CMSG_PERF_REC_HDR_LW]
+    alu[words, --, b, rec_words]
+    alu[src, slot_offset, +, 4]
+    alu[dst, --, b, buf_offset]
+
+copy_loop#:
+    alu[n, --, b, words]
+    alu[--, words, -, 8]
+    blo[copy_chunk#]
+    immed[n, 8]
+copy_chunk#:
+    ov_start(OV_LENGTH)
+    ov_set_use(OV_LENGTH, n, OVF_SUBTRACT_ONE)
+    ov_clean
+    mem[read32, $chunk[0], ring_hi, <<8, src, max_8], indirect_ref, ctx_swap[sig_chunk]
+    aggregate_copy($chunk, $chunk, 8)
+    ov_start(OV_LENGTH)
+    ov_set_use(OV_LENGTH, n, OVF_SUBTRACT_ONE)
+    ov_clean
+    mem[write32, $chunk[0], in_buf_hi, <<8, dst, max_8], indirect_ref, ctx_swap[sig_chunk]
+    alu[src, src, +, 32]
+    alu[dst, dst, +, 32]
+    alu[words, words, -, n]
+    bne[copy_loop#]
+
+    /* a producer took the slot while it was copied */
+    mem[read32, $slot[0], ring_hi, <<8, slot_offset, 1], ctx_swap[sig_slot]
+    alu[tmp, $slot[0], -, 1]
+    alu[--, tmp, -, cons]
+    beq[copied#]
+    br[rec_loop#], defer[2]
+        alu[lost, lost, +, 1]
+        alu[cons, cons, +, 1]
+copied#:
+    alu[buf_offset, buf_offset, +, rec_words, <<2]
+    alu[count, count, +, 1]
+    br[rec_loop#], defer[1]
+        alu[cons, cons, +, 1]
+
+full#:
+    immed[out_more, 1]
+done#:
+    alu[CMSG_PERF_LM_INDEX[0], --, b, cons]
+    immed[out_pkt_len, 0]
+    alu[--, count, OR, lost]
+    beq[ret#]
+    alu[CMSG_PERF_LM_INDEX[1], CMSG_PERF_LM_INDEX[1], AND, 3, <<__CMSG_PERF_PENDING_BIT]
+
+    #define __CMSG_PERF_HDR__ ((CMSG_TYPE_PERF_EVENT << 24) | (CMSG_MAP_VERSION << 16))
+    move(tmp, __CMSG_PERF_HDR__)
+    #undef __CMSG_PERF_HDR__
+    alu[$hdr[0], --, b, tmp]
+    alu[$hdr[CMSG_PERF_RING_IDX], --, b, in_ring]
+    alu[$hdr[CMSG_PERF_COUNT_IDX], --, b, count]
+    alu[$hdr[CMSG_PERF_LOST_IDX], --, b, lost]
+    move(tmp, NFD_IN_DATA_OFFSET)
+    mem[write32, $hdr[0], in_buf_hi, <<8, tmp, CMSG_OP_HDR_LW], ctx_swap[sig_hdr]
+    alu[out_pkt_len, buf_offset, -, tmp]
+
+    alu[--, --, b, lost]
+    beq[ret#]
+    __cmsg_perf_stat_add(CMSG_PERF_STAT_LOST, lost)
+
+ret#:
+    cmsg_perf_lm_undef()
+.end
+#endm
+
+/*
+ * send the records of in_ring to the host, for a flush request of
+ * cmsg_perf_flush_workq(). One context at a time drains a ring, a request
+ * for a ring that is being drained marks it PENDING and the draining
+ * context looks at the ring again before it lets go of it.
+ */
+#macro cmsg_perf_flush(in_ring)
+.begin
+    .reg lm_addr
+    .reg prod
+    .reg bls
+    .reg mu_addr
+    .reg mu_ptr
+    .reg pkt_len
+    .reg more
+    .reg addr_hi
+    .reg offset
+    .reg $prod
+    .sig sig_prod
+
+    alu[--, in_ring, -, CMSG_PERF_RINGS]
+    bhs[end#]
+    __cmsg_perf_ring_state(lm_addr, in_ring)
+    move(addr_hi, _cmsg_perf_prod >>8)
+    alu[offset, --, b, in_ring, <<2]
+
+    cmsg_perf_lm_define()
+    local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_PERF_LM_HANDLE, lm_addr]
+    immed[bls, 0]
+    nop
+    nop
+    br_bclr[CMSG_PERF_LM_INDEX[1], __CMSG_PERF_BUSY_BIT, lock#]
+    br[done#], defer[1]
+        alu[CMSG_PERF_LM_INDEX[1], CMSG_PERF_LM_INDEX[1], OR, 1, <<__CMSG_PERF_PENDING_BIT]
+lock#:
+    alu[CMSG_PERF_LM_INDEX[1], CMSG_PERF_LM_INDEX[1], OR, 1, <<__CMSG_PERF_BUSY_BIT]
+
+drain#:
+    mem[read32, $prod, addr_hi, <<8, offset, 1], ctx_swap[sig_prod]
+    local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_PERF_LM_HANDLE, lm_addr]
+    alu[prod, --, b, $prod]
+    nop
+    nop
+    alu[--, prod, -, CMSG_PERF_LM_INDEX[0]]
+    bne[alloc#]
+    alu[--, CMSG_PERF_LM_INDEX[1], AND~, 3, <<__CMSG_PERF_PENDING_BIT]
+    beq[unlock#]
+alloc#:
+    cmsg_perf_lm_undef()
+
+    cmsg_alloc_mu_buffer(bls, mu_addr, mu_ptr)
+    cmsg_perf_fill(in_ring, prod, mu_ptr, pkt_len, more)
+    alu[--, --, b, pkt_len]
+    bne[send#]
+    pkt_buf_free_mu_buffer(bls, mu_addr)
+    br[unlock#]
+
+send#:
+    cmsg_send_mu_buffer(bls, mu_addr, pkt_len)
+    __cmsg_perf_stat_incr(CMSG_PERF_STAT_MSGS)
+    alu[--, --, b, more]
+    bne[drain#]
+
+unlock#:
+    cmsg_perf_lm_define()
+    local_csr_wr[ACTIVE_LM_ADDR_/**/CMSG_PERF_LM_HANDLE, lm_addr]
+    nop
+    nop
+    nop
+    // a request came in while the ring was drained
+    br_bclr[CMSG_PERF_LM_INDEX[1], __CMSG_PERF_PENDING_BIT, unlocked#]
+    br[drain#], defer[1]
+        alu[CMSG_PERF_LM_INDEX[1], CMSG_PERF_LM_INDEX[1], AND~, 1, <<__CMSG_PERF_PENDING_BIT]
+unlocked#:
+    alu[CMSG_PERF_LM_INDEX[1], CMSG_PERF_LM_INDEX[1], AND~, 1, <<__CMSG_PERF_BUSY_BIT]
+done#:
+    cmsg_perf_lm_undef()
+end#:
+.end
+#endm
+
+#endif /* CMSG_MAP_PROC */
+
+#endif /* __CMSG_PERF_UC__ */
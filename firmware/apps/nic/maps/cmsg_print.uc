@@ -117,11 +117,46 @@ ret#:
 #endm
 
 
+/*
+ * send the control message of pkt_len bytes at NFD_IN_DATA_OFFSET of an
+ * MU buffer from cmsg_alloc_mu_buffer() to the host, waits for credits
+ */
+#macro cmsg_send_mu_buffer(in_bls, in_mu_addr, in_pkt_len)
+.begin
+	.reg nfdo_desc[NFD_OUT_DESC_SIZE_LW]
+	.reg pkt_offset
+	.reg $credit
+	.sig credit_sig
+
+	move(pkt_offset, NFD_IN_DATA_OFFSET)
+
+	/* meta_len = 0, ctm_isl=0, ctm_pnum=0, ctm_split=0 */
+	nfd_out_fill_desc(nfdo_desc, 0, 0, 0, in_bls, in_mu_addr, pkt_offset, in_pkt_len, 0)
+
+get_credits#:
+    nfd_out_get_credits($credit, NIC_PCI, NFD_CTRL_QUEUE, 1, credit_sig, SIG_WAIT)
+    alu[--, --, b, $credit]
+    bne[send_nfd#]
+
+		#define __NO_CREDIT_SLEEP__ 500
+        #define_eval _SLEEP_TICKS (__NO_CREDIT_SLEEP__ / 16)
+            timestamp_sleep(_SLEEP_TICKS)
+			br[get_credits#]
+        #undef _SLEEP_TICKS
+		#undef __NO_CREDIT_SLEEP__
+
+send_nfd#:
+    nfd_lm_handle_define()
+    nfd_out_send(nfdo_desc, NIC_PCI, NFD_CTRL_QUEUE, NFD_LM_HANDLE)
+    nfd_lm_handle_undef()
+.end
+#endm
+
+
 #macro cmsg_print(in_lm_addr, in_bytes_len)
 .begin
 
 	.reg bls
-	.reg nfdo_desc[NFD_OUT_DESC_SIZE_LW]
 	.reg mu_ptr
 	.reg cmsg_hdr
 	.reg start_lw
@@ -129,8 +164,6 @@ ret#:
 	.reg cur_lm
 	.reg write_lw
 	.reg num_lw_to_print
-	.reg $credit
-    .sig credit_sig
 	.reg pkt_offset
 	.reg pkt_len
 	.reg bytes
@@ -206,29 +239,7 @@ do_write#:
 
 
 /* finish writing */
-    move(pkt_offset, NFD_IN_DATA_OFFSET)
-
-
-	/* setup nfd descriptors */
-	/* pkt_len = cmsg_hdr + in_bytes_len */
-	/* meta_len = 0, ctm_isl=0, ctm_pnum=0, ctm_split=0 */
-	nfd_out_fill_desc(nfdo_desc, 0, 0, 0, bls, mu_addr, pkt_offset, pkt_len, 0)
-#define __WAIT_FOR_CREDITS
-#define NO_CREDIT_SLEEP 500
-
-get_credits#:
-    nfd_out_get_credits($credit, NIC_PCI, NFD_CTRL_QUEUE, 1, credit_sig, SIG_WAIT)
-    alu[--, --, b, $credit]
-    bne[send_nfd#]
-
-		#define __NO_CREDIT_SLEEP__ 500
-        #define_eval _SLEEP_TICKS (__NO_CREDIT_SLEEP__ / 16)
-            timestamp_sleep(_SLEEP_TICKS)
-			br[get_credits#]
-        #undef _SLEEP_TICKS
-
-send_nfd#:
-    nfd_out_send(nfdo_desc, NIC_PCI, NFD_CTRL_QUEUE, CMSG_PRINT_LM_HANDLE)
+	cmsg_send_mu_buffer(bls, mu_addr, pkt_len)
 
 	__cmsg_print_lm_handles_undef()
 
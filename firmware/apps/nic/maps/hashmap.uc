@@ -8,11 +8,21 @@
  *  htab_map_lookup_elem_subr(in_tid, in_lm_key_offset, out_value_addr)
  *  htab_map_update_elem_subr(in_tid, in_lm_key_offset, in_lm_value_offset, out_rc)
  *  htab_map_delete_elem_subr(in_tid, in_lm_key_offset, out_rc)
+ *  htab_map_xadd_subr(in_value_addr_hi, in_value_addr_lo, in_operand), 32 and 64 bit
+ *  htab_prog_tail_call_subr(in_tid, in_index), see hashmap_prog.uc
+ *  htab_redirect_subr(in_target, in_flags), htab_redirect_map_subr(in_tid, in_index, in_flags)
  *
  *
  * API calls (macro)
  *
- *  hashmap_alloc_fd(out_fd, in_key_size, in_value_size, in_max_entries, ERROR_LABEL)
+ *  hashmap_alloc_fd(out_fd, in_key_size, in_value_size, in_max_entries, ERROR_LABEL, endian, type, in_partitions)
+ *  hashmap_resize_fd(in_fd, in_max_entries, in_partitions, out_part, BUSY_LABEL, NO_ROOM_LABEL, ERROR_LABEL)
+ *  hashmap_resize_done(in_fd)
+ *  hashmap_set_fd_xadd(in_fd, in_words), hashmap_get_fd_xadd(in_fd, out_words, ERROR_LABEL)
+ *  hashmap_lpm_alloc(in_fd, in_key_size, in_max_entries, ERROR_LABEL, NO_ROOM_LABEL)
+ *  hashmap_lpm_lookup(), _update(), _delete(), _getnext(), _free(), see hashmap_lpm.uc
+ *  hashmap_prog_alloc(in_fd, in_key_size, in_value_size, in_max_entries, ERROR_LABEL)
+ *  hashmap_prog_lookup(), _update(), _delete(), _free(), see hashmap_prog.uc
  *
  * OP type defines:
  *  HASHMAP_OP_LOOKUP
@@ -35,8 +45,38 @@
  *                out_ent_lw,         // optional, length (in lw) of returned data
  *                out_ent_tindex,     // optional, tindex of returned data
  *                out_ent_addr        // optional, addr of returned data
+ *                endian,
+ *                out_rc,             // optional, CMSG_RC_xxx
+ *                CALLER              // optional, HASHMAP_CALLER_xxx
  *                )
  *
+ * BPF_MAP_TYPE_LRU_HASH maps evict an entry of the same bucket when an
+ * insert finds the map or the bucket full, see __hashmap_lru_evict().
+ *
+ * BPF_MAP_TYPE_PERCPU_HASH and _PERCPU_ARRAY maps keep their values in
+ * per-context slots, see hashmap_percpu.uc. The datapath reads and updates
+ * the slot of its context without the exclusive lock, the host sees the
+ * start of the block.
+ *
+ * Lookups do not lock the bucket, they are redone if a writer changed it
+ * meanwhile, see __hashmap_seq_begin().
+ *
+ * Overflow entries are sized by the slab class picked for the map by
+ * hashmap_alloc_fd(), entry reads fetch that size rather than a full
+ * HASHMAP_RXFR_COUNT words.
+ *
+ * Maps are resized online, see hashmap_resize_fd(): the old and the new
+ * layout are both searched while the map ME moves the entries over.
+ *
+ * BPF_MAP_TYPE_LPM_TRIE maps keep their prefixes in a multibit trie rather
+ * than in the buckets, see hashmap_lpm.uc. They are looked up with
+ * hashmap_lpm_lookup() instead of hashmap_ops().
+ *
+ * BPF_MAP_TYPE_PROG_ARRAY maps are jump tables of eBPF programs for tail
+ * calls, BPF_MAP_TYPE_DEVMAP maps tables of redirect targets and
+ * BPF_MAP_TYPE_PERF_EVENT_ARRAY maps the host CPUs bpf_perf_event_output()
+ * records go to, see hashmap_prog.uc and cmsg_perf.uc.
+ *
  * example use:
  *#if USE_LM
  *    hashmap_ops(fd, main_lm_key_offset, main_lm_value_offset, HASHMAP_OP_LOOKUP,
@@ -45,7 +85,7 @@
  *    hashmap_ops(fd, main_lm_key_offset, main_lm_value_offset, HASHMAP_OP_LOOKUP,
  *                error_map_fd#, lookup_not_found#,HASHMAP_RTN_TINDEX,rtn_len,my_tindex,rtn_addr]
  *     __hashmap_read_field(my_tindex, main_lm_value_offset,
- *                rtn_addr[0], rtn_addr[1],rtn_len,HASHMAP_RTN_LMEM, --, --)
+ *                rtn_addr[0], rtn_addr[1],rtn_len,rtn_len,HASHMAP_RTN_LMEM, --, --)
  *#elif USE_ADDR
  *    hashmap_ops(fd, main_lm_key_offset, main_lm_value_offset, HASHMAP_OP_LOOKUP,
  *                error_map_fd#, lookup_not_found#,HASHMAP_RTN_ADDR,rtn_len,--,rtn_addr)
@@ -58,6 +98,7 @@
 #define __HASHMAP_UC__
 
 
+#include <platform.h>
 #include <passert.uc>
 #include <stdmac.uc>
 #include <aggregate.uc>
@@ -68,6 +109,9 @@
 
 #include "hashmap_priv.uc"
 #include "hashmap_cam.uc"
+#include "hashmap_percpu.uc"
+#include "hashmap_lpm.uc"
+#include "hashmap_prog.uc"
 
 /*
  * public functions:
@@ -85,16 +129,44 @@
  * compile time configuration
  */
 
-#define HASHMAP_PARTITIONS              1
+/*
+ * number of EMEMs (emem0..2) the buckets are spread over, the partitions
+ * used by a map are picked when it is allocated, see hashmap_alloc_fd().
+ * Only the NFP-6000 (Starfighter) boards have all three EMEMs, the others
+ * emem0 only. Builds for them may set 3, which takes 1.5 times the bucket
+ * memory of 1, see HASHMAP_EMEM_BUDGET.
+ */
+#ifndef HASHMAP_PARTITIONS
+    #define HASHMAP_PARTITIONS          1
+#endif
 #define HASHMAP_TOTAL_ENTRIES           (1024<<12)
 #define HASHMAP_OVERFLOW_ENTRIES        (512<<14)
+/*
+ * overflow entries come from slab classes of 16, 32 and 64 bytes, a map
+ * takes its entries from the smallest class its key and value fit in
+ */
+#define HASHMAP_SLAB_CLASSES            3
+#define HASHMAP_SLAB_MIN_SZ_SHFT        4
+#ifndef HASHMAP_SLAB_0_ENTRIES
+    #define HASHMAP_SLAB_0_ENTRIES      (HASHMAP_OVERFLOW_ENTRIES)
+#endif
+#ifndef HASHMAP_SLAB_1_ENTRIES
+    #define HASHMAP_SLAB_1_ENTRIES      (HASHMAP_OVERFLOW_ENTRIES / 2)
+#endif
+#ifndef HASHMAP_SLAB_2_ENTRIES
+    #define HASHMAP_SLAB_2_ENTRIES      (HASHMAP_OVERFLOW_ENTRIES / 2)
+#endif
 #define HASHMAP_MAX_ENTRIES             (1024*2000)
+/* a map is reported for resize when fewer than max_entries >> SHFT are free */
+#ifndef HASHMAP_RESIZE_HINT_SHFT
+    #define HASHMAP_RESIZE_HINT_SHFT    2
+#endif
 /* the first 1-127 tids are used by ebpf, and managed by cmsg_map.uc */
 /* tid 128-254 are reserved for internal use */
 #define HASHMAP_MAX_TID_EBPF            128
 #define HASHMAP_MAX_TID                 255
     /* 128=max keys + max value + cam overflow = 40+24+32+32 */
-    /* 8=lock + tid = 4+4 */
+    /* 16=lock + tid + seq + spare = 4+4+4+4 */
 #define_eval HASHMAP_MAX_ENTRY_SZ       (128)
 #define HASHMAP_MAX_KEYS_SZ             (56)   // camp_hash limit 120 bytes
 #define HASHMAP_MAX_VALU_SZ             (56)
@@ -112,6 +184,10 @@
 #define BPF_MAP_TYPE_CGROUP_ARRAY       8
 #define BPF_MAP_TYPE_LRU_HASH           9
 #define BPF_MAP_TYPE_LRU_PERCPU_HASH    10
+#define BPF_MAP_TYPE_LPM_TRIE           11
+#define BPF_MAP_TYPE_ARRAY_OF_MAPS      12
+#define BPF_MAP_TYPE_HASH_OF_MAPS       13
+#define BPF_MAP_TYPE_DEVMAP             14
 
 
 /* ********************************* */
@@ -131,6 +207,16 @@
 #define HASHMAP_RTN_TINDEX      2
 #define HASHMAP_RTN_ADDR        3
 
+/*
+ * caller of hashmap_ops(): datapath lookups mark LRU entries as referenced
+ * and use the slot of their ME in per-cpu maps, host ones do neither.
+ * Resize adds move an existing entry to the new layout of its map, see
+ * hashmap_resize_fd(): they take no credit and write the value as is.
+ */
+#define HASHMAP_CALLER_HOST     0
+#define HASHMAP_CALLER_DP       1
+#define HASHMAP_CALLER_RESIZE   2
+
 
 /* ********************************* */
 /*
@@ -139,14 +225,37 @@
 
 #define_eval HASHMAP_ENTRY_SZ_LW        (HASHMAP_MAX_ENTRY_SZ >> 2)
 #define_eval HASHMAP_ENTRY_SZ_SHFT      (LOG2(HASHMAP_MAX_ENTRY_SZ))
-#define HASHMAP_LOCK_SZ                 8
+/*
+ * a lock entry holds the lock descriptor, the tid and the sequence count of
+ * lock-free lookups, see __hashmap_seq_begin(). At 16 bytes the lock table
+ * takes 64 MB of EMEM for the 4M buckets, twice that of 8 byte entries
+ * without the sequence count, see HASHMAP_EMEM_BUDGET.
+ */
+#define HASHMAP_LOCK_SZ                 16
 #define_eval HASHMAP_LOCK_SZ_SHFT       (LOG2(HASHMAP_LOCK_SZ))
 #define_eval HASHMAP_LOCK_SZ_LW         (HASHMAP_LOCK_SZ >> 2)
 
 #define HASHMAP_MAX_KEYS_LW             (HASHMAP_MAX_KEYS_SZ >> 2)
 
-#define HASHMAP_NUM_ENTRIES_SHFT        (LOG2(HASHMAP_TOTAL_ENTRIES))
+/*
+ * buckets per partition, a power of 2. The bucket index carries the
+ * partition above HASHMAP_NUM_ENTRIES_SHFT, see __hashmap_select_partition().
+ * Three partitions are rounded up so that no fewer than
+ * HASHMAP_TOTAL_ENTRIES buckets are left, each EMEM still holds half of
+ * the buckets of a single partition.
+ */
+#if (HASHMAP_PARTITIONS == 1)
+    #define HASHMAP_PART_ENTRIES        HASHMAP_TOTAL_ENTRIES
+#elif (HASHMAP_PARTITIONS == 2)
+    #define HASHMAP_PART_ENTRIES        (HASHMAP_TOTAL_ENTRIES / 2)
+#elif (HASHMAP_PARTITIONS == 3)
+    #define HASHMAP_PART_ENTRIES        (HASHMAP_TOTAL_ENTRIES / 2)
+#else
+    #error "HASHMAP_PARTITIONS must be 1, 2 or 3"
+#endif
+#define_eval HASHMAP_NUM_ENTRIES_SHFT   (LOG2(HASHMAP_PART_ENTRIES))
 #define HASHMAP_NUM_ENTRIES_MASK        ((1<<HASHMAP_NUM_ENTRIES_SHFT)-1)
+#define HASHMAP_BUCKETS                 (HASHMAP_PARTITIONS << HASHMAP_NUM_ENTRIES_SHFT)
 
 /* key_value size = max entry size - hashmap descriptor */
 #define HASHMAP_MAX_KEY_VALUE_SZ        (HASHMAP_MAX_ENTRY_SZ - 4)
@@ -167,8 +276,10 @@
  * typedef __packed struct {
  *   union {
  *       struct {
+ *           uint32_t lru_ref : 1;      bit 31 - primary entry referenced
  *           uint32_t valid : 1;
- *           uint32_t reserved1: 10;
+ *           uint32_t reserved1: 2;
+ *           uint32_t lru_ov_ref : 8;   bit 20..27 - ov cam entry referenced
  *           uint32_t reserved_ov_idx:4 bit 17..19
  *           uint32_t reserved_ov:1;    bit 16 - use in state only, not in mem
  *           uint32_t spare: 1;
@@ -177,15 +288,10 @@
  *       };
  *       uint32_t meta;
  *   };
+ *   uint32_t tid;              // owner of the primary entry
+ *   uint32_t seq;              // odd while a writer holds the bucket
  *  // following are futures
- *   union {
- *      struct {
- *          uint32_t lru_ref : 1;
- *          uint32_t reserved: 31;
- *      };
- *      uint32_t flags;
- *   };
- *   uint32_t spare[2];
+ *   uint32_t spare;
  *   //uint32_t fd;   fd is the first word of the key
  * } __hashmap_descriptor_t;
  *
@@ -194,9 +300,12 @@
 #define __HASHMAP_DESC_NDX_META         0
 #define __HASHMAP_DESC_NDX_LRU_FLG      1
 #define __HASHMAP_DESC_NDX_TID          4
+#define __HASHMAP_DESC_SEQ_OFFSET       8
 #define __HASHMAP_DESC_VALID_BIT        (30)
 #define __HASHMAP_DESC_VALID            (1<<__HASHMAP_DESC_VALID_BIT)
-                                        // Free 29:20
+                                        // Free 29:28
+#define __HASHMAP_DESC_LRU_OV_REF_BIT   (20)
+#define __HASHMAP_DESC_LRU_OV_REF       (0xff<<__HASHMAP_DESC_LRU_OV_REF_BIT)
 #define __HASHMAP_DESC_OV_BIT           (19)
 #define __HASHMAP_DESC_OV_IDX           (16)
 #define __HASHMAP_DESC_LOCK_EXCL_BIT    (14)
@@ -232,11 +341,16 @@
  *   uint32_t value_mask;
  *   uint32_t num_entries_credits;   // number of free entries
  *   uint32_t map_type;
+ *   uint32_t partitions;         //  count << 2 | first partition, bits
+ *                                //  7:4 the previous ones while resizing
+ *   uint32_t slab;               //  slab class of the overflow entries
  *   uint32_t lru_counts_active;
  *   uint32_t lru_counts_inactive;
  *   uint32_t lru_qsize_active;
  *   uint32_t lru_qsize_inactive;
- *   uint32_t spares[6];
+ *   uint32_t lpm_head;           //  first leaf of an LPM_TRIE map
+ *   uint32_t xadd_words;         //  value words in NFP byte order, bit per LW
+ *   uint32_t spares[2];
  * } hashmap_fd_t;
 */
 
@@ -250,42 +364,80 @@
 #define __HASHMAP_FD_NDX_VALUE_MASK 3
 #define __HASHMAP_FD_NDX_CUR_CRED   4
 #define __HASHMAP_FD_NDX_TYPE       5
-#define __HASHMAP_FD_NDX_CNT_ACT    6
-#define __HASHMAP_FD_NDX_CNT_INACT  7
-#define __HASHMAP_FD_NDX_QCNT_ACT   8
-#define __HASHMAP_FD_NDX_QCNT_INACT 9
-#define __HASHMAP_FD_NUM_LW_USED    6
-#define __HASHMAP_FD_MAX_NUM_LW     10
+#define __HASHMAP_FD_NDX_PART       6
+#define __HASHMAP_FD_NDX_SLAB       7
+#define __HASHMAP_FD_NDX_CNT_ACT    8
+#define __HASHMAP_FD_NDX_CNT_INACT  9
+#define __HASHMAP_FD_NDX_QCNT_ACT   10
+#define __HASHMAP_FD_NDX_QCNT_INACT 11
+#define __HASHMAP_FD_NDX_LPM_HEAD   12
+#define __HASHMAP_FD_NDX_XADD       13
+#define __HASHMAP_FD_NUM_LW_USED    8
+#define __HASHMAP_FD_MAX_NUM_LW     12
+#define __HASHMAP_PART_CNT_SHFT     2
+#define __HASHMAP_PART_BASE_MSK     0x3
+#define __HASHMAP_PART_MSK          0xf
+#define __HASHMAP_PART_OLD_SHFT     4
+
+/*
+ * LM cache of the fd table, one slot per fd modulo HASHMAP_FD_CACHE_SLOTS
+ *
+ * typedef struct {
+ *   uint16_t key_size;           //  in LWs
+ *   uint16_t value_size;         //  in LWs
+ *   uint32_t key_mask;
+ *   uint32_t value_mask;
+ *   uint32_t valid : 1;
+ *   uint32_t reserved : 5;
+ *   uint32_t slab : 2;
+ *   uint32_t partitions : 8;
+ *   uint32_t fd : 8;
+ *   uint32_t map_type : 8;
+ * } hashmap_fd_cache_t;
+ */
+#ifndef HASHMAP_FD_CACHE_SLOTS
+    #define HASHMAP_FD_CACHE_SLOTS          16
+#endif
+#define __HASHMAP_FD_CACHE_SLOT_LW          4
+#define_eval __HASHMAP_FD_CACHE_SLOT_SZ     (__HASHMAP_FD_CACHE_SLOT_LW * 4)
+#define_eval __HASHMAP_FD_CACHE_SLOT_SHFT   (LOG2(__HASHMAP_FD_CACHE_SLOT_SZ))
+#define __HASHMAP_FD_CACHE_NDX_KEY          0
+#define __HASHMAP_FD_CACHE_NDX_KEY_MASK     1
+#define __HASHMAP_FD_CACHE_NDX_VALUE_MASK   2
+#define __HASHMAP_FD_CACHE_NDX_TAG          3
+#define __HASHMAP_FD_CACHE_VALID_BIT        31
+#define __HASHMAP_FD_CACHE_TAG_FD_SHFT      8
+#define __HASHMAP_FD_CACHE_TAG_PART_SHFT    16
+#define __HASHMAP_FD_CACHE_TAG_SLAB_SHFT    24
+
+/* fd table generation, written by the map ME */
+#define HASHMAP_FD_GEN_NN_IDX               125
 
 
 
 /* *************************************** */
 
+/* NUM_ENTRIES buckets in each of the HASHMAP_PARTITIONS partitions */
 #macro hashmap_declare_block(NUM_ENTRIES)
     #if (HASHMAP_PARTITIONS == 1)
         .alloc_mem __HASHMAP_DATA_0 emem global (HASHMAP_MAX_ENTRY_SZ * NUM_ENTRIES)  256
+        .alloc_mem __HASHMAP_LOCK_TBL_0 emem global (HASHMAP_LOCK_SZ * NUM_ENTRIES) 256
         .init __HASHMAP_DATA_0 0
-
-    #elif (HASHMAP_PARTITIONS == 2)
-        .alloc_mem __HASHMAP_DATA_0 emem0 global (HASHMAP_MAX_ENTRY_SZ * (NUM_ENTRIES/2))  256
-        .alloc_mem __HASHMAP_DATA_1 emem1 global (HASHMAP_MAX_ENTRY_SZ * (NUM_ENTRIES/2))  256
-        .init __HASHMAP_DATA_0 0
-        .init __HASHMAP_DATA_1 0
+        .init __HASHMAP_LOCK_TBL_0 0
 
     #else
-        .alloc_mem __HASHMAP_DATA_0 emem0 global (HASHMAP_MAX_ENTRY_SZ * (NUM_ENTRIES/3))  256
-        .alloc_mem __HASHMAP_DATA_1 emem1 global (HASHMAP_MAX_ENTRY_SZ * (NUM_ENTRIES/3))  256
-        .alloc_mem __HASHMAP_DATA_2 emem2 global (HASHMAP_MAX_ENTRY_SZ * (NUM_ENTRIES/3))  256
-        .init __HASHMAP_DATA_0 0
-        .init __HASHMAP_DATA_1 0
-        .init __HASHMAP_DATA_2 0
+        #define_eval __PART 0
+        #while (__PART < HASHMAP_PARTITIONS)
+            .alloc_mem __HASHMAP_DATA_/**/__PART emem/**/__PART global (HASHMAP_MAX_ENTRY_SZ * NUM_ENTRIES)  256
+            .alloc_mem __HASHMAP_LOCK_TBL_/**/__PART emem/**/__PART global (HASHMAP_LOCK_SZ * NUM_ENTRIES) 256
+            .init __HASHMAP_DATA_/**/__PART 0
+            .init __HASHMAP_LOCK_TBL_/**/__PART 0
+            #define_eval __PART (__PART + 1)
+        #endloop
+        #undef __PART
 
     #endif
 
-    /* lock table */
-    .alloc_mem __HASHMAP_LOCK_TBL emem global (HASHMAP_LOCK_SZ * NUM_ENTRIES) 256
-    .init __HASHMAP_LOCK_TBL 0
-
     /* fd table */
 #if (NS_PLATFORM_TYPE == NS_PLATFORM_CADMIUM_DDR_1x50)
     #define HASH_MAP_IMEM imem1
@@ -295,12 +447,75 @@
     /* fd table */
     .alloc_mem __HASHMAP_FD_TBL    HASH_MAP_IMEM global (__HASHMAP_FD_TBL_SZ_LW * 4 * HASHMAP_MAX_TID) 256
     .init __HASHMAP_FD_TBL 0
+    .alloc_mem __HASHMAP_FD_GEN    HASH_MAP_IMEM global 8 8
+    .init __HASHMAP_FD_GEN 0
+#if ((HASHMAP_PARTITIONS > 1) && defined(PKT_COUNTER_ENABLE))
+    /* accesses per partition, see __hashmap_select_partition() */
+    .alloc_mem __HASHMAP_PART_STATS HASH_MAP_IMEM global (HASHMAP_PARTITIONS * 8) 8
+    .init __HASHMAP_PART_STATS 0
+#endif
+#endm
+
+/* LM cache of the fd table, see hashmap_get_fd() */
+#macro __hashmap_fd_cache_init()
+    .alloc_mem __hashmap_fd_cache lmem me (HASHMAP_FD_CACHE_SLOTS * __HASHMAP_FD_CACHE_SLOT_SZ) (HASHMAP_FD_CACHE_SLOTS * __HASHMAP_FD_CACHE_SLOT_SZ)
+    .alloc_mem __hashmap_fd_cache_gen lmem me 4 4
+
+    .if (ctx() == 0)
+        __hashmap_lm_handles_define()
+        __hashmap_fd_cache_clear()
+        __hashmap_lm_handles_undef()
+    .endif
+#endm
+
+/*
+ * EMEM taken by the tables of hashmap_init(), in MB for the defaults with
+ * one partition of 4M buckets and with three partitions of 2M:
+ *
+ *                            1     3
+ *   buckets                512   768   HASHMAP_BUCKETS * HASHMAP_MAX_ENTRY_SZ
+ *   bucket locks            64    96   HASHMAP_BUCKETS * HASHMAP_LOCK_SZ
+ *   overflow slabs         512   512   classes of 16, 32 and 64 bytes
+ *   slab free rings         64    64   emem0
+ *   per-cpu blocks          32    32   HASHMAP_PERCPU_ENTRIES blocks of 32 KB
+ *   LPM_TRIE nodes, leaves  24    24
+ *
+ * some 1.2 GB with one partition, which leaves room for NFD and the other
+ * apps within the 2 GB of EMEM of the smallest boards. Three partitions
+ * take some 1.5 GB, spread over the three EMEMs of the boards that have
+ * them. The build fails if the tables grow past HASHMAP_EMEM_BUDGET.
+ */
+#ifndef HASHMAP_EMEM_BUDGET
+    #define HASHMAP_EMEM_BUDGET         1536    /* MB */
+#endif
+
+#macro __hashmap_emem_check()
+    #define_eval __HASHMAP_EMEM_MB ((HASHMAP_BUCKETS * HASHMAP_MAX_ENTRY_SZ) >> 20)
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + ((HASHMAP_BUCKETS * HASHMAP_LOCK_SZ) >> 20))
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + ((HASHMAP_SLAB_0_ENTRIES << HASHMAP_SLAB_MIN_SZ_SHFT) >> 20))
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + ((HASHMAP_SLAB_1_ENTRIES << (HASHMAP_SLAB_MIN_SZ_SHFT + 1)) >> 20))
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + ((HASHMAP_SLAB_2_ENTRIES << (HASHMAP_SLAB_MIN_SZ_SHFT + 2)) >> 20))
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + (((HASHMAP_SLAB_0_ENTRIES + HASHMAP_SLAB_1_ENTRIES + HASHMAP_SLAB_2_ENTRIES) * 4) >> 20))
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + ((HASHMAP_PERCPU_ENTRIES * HASHMAP_PERCPU_BLK_SZ) >> 20))
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + (((HASHMAP_MAX_TID + HASHMAP_LPM_NODES) * HASHMAP_LPM_NODE_SZ) >> 20))
+    #define_eval __HASHMAP_EMEM_MB (__HASHMAP_EMEM_MB + ((HASHMAP_LPM_LEAVES * HASHMAP_LPM_LEAF_SZ) >> 20))
+    passert(__HASHMAP_EMEM_MB, "LE", HASHMAP_EMEM_BUDGET)
+    #undef __HASHMAP_EMEM_MB
 #endm
 
 #macro hashmap_init()
-    hashmap_declare_block(HASHMAP_TOTAL_ENTRIES)
-    __hashmap_freelist_init(HASHMAP_OVERFLOW_ENTRIES)
+    __hashmap_emem_check()
+    hashmap_declare_block(HASHMAP_PART_ENTRIES)
+    __hashmap_freelist_init(0, HASHMAP_SLAB_0_ENTRIES)
+    __hashmap_freelist_init(1, HASHMAP_SLAB_1_ENTRIES)
+    __hashmap_freelist_init(2, HASHMAP_SLAB_2_ENTRIES)
+    __hashmap_percpu_init(HASHMAP_PERCPU_ENTRIES)
+    __hashmap_lpm_init()
+    __hashmap_prog_init()
+    __hashmap_fd_cache_init()
     __hashmap_journal_init()
+    pkt_counter_decl(num_lru_evict)
+    pkt_counter_decl(num_seq_retry)
 #endm
 
 
@@ -319,11 +534,6 @@
  * getnext(fd, key)
  *   find key and return next key
  */
-/*
- * should cache fd table in lmem
- *
- */
-
 #macro __hashmap_rounded_mask(in_val, out_val, out_mask, endian)
 .begin
     .reg tmp
@@ -357,6 +567,52 @@
 
 
 #macro hashmap_alloc_fd(in_tid, key_size, value_size, max_entries, ERROR_LABEL, endian, type)
+    hashmap_alloc_fd(in_tid, key_size, value_size, max_entries, ERROR_LABEL, endian, type, 0)
+#endm
+
+/* partitions word of map in_tid spread over in_partitions, see below */
+#macro __hashmap_part_cfg(in_tid, in_partitions, out_part)
+.begin
+    .reg part_cnt
+    .reg part_base
+
+#if (HASHMAP_PARTITIONS == 1)
+    immed[part_cnt, 1]
+    immed[part_base, 0]
+#else
+    alu[part_cnt, --, b, in_partitions]
+    beq[all_parts#]
+    alu[--, part_cnt, -, HASHMAP_PARTITIONS]
+    blo[first_part#]
+all_parts#:
+    immed[part_cnt, HASHMAP_PARTITIONS]
+    br[part_done#], defer[1]
+        immed[part_base, 0]
+
+first_part#:
+    alu[part_base, --, b, in_tid]
+first_part_loop#:
+    alu[--, part_base, -, HASHMAP_PARTITIONS]
+    blo[part_done#]
+    br[first_part_loop#], defer[1]
+        alu[part_base, part_base, -, HASHMAP_PARTITIONS]
+part_done#:
+#endif
+    alu[out_part, part_base, or, part_cnt, <<__HASHMAP_PART_CNT_SHFT]
+.end
+#endm
+
+/*
+ * in_partitions    number of EMEM partitions the buckets of the map are
+ *                  spread over, 0 or more than HASHMAP_PARTITIONS for all
+ *                  of them. Maps on fewer partitions start at partition
+ *                  in_tid % HASHMAP_PARTITIONS so that small maps don't
+ *                  all land on emem0.
+ *
+ * The overflow entries of the map come from the smallest slab class that
+ * holds the key, padded to 8 bytes, and the value.
+ */
+#macro hashmap_alloc_fd(in_tid, key_size, value_size, max_entries, ERROR_LABEL, endian, type, in_partitions)
 .begin
     .reg base
     .reg offset
@@ -364,6 +620,9 @@
     .reg key_value_sz
     .sig create_fd_sig
     .reg tmp
+    .reg part_cfg
+    .reg slab
+    .reg slab_sz
     .reg $tid
     .reg $fd_xfer[__HASHMAP_FD_NUM_LW_USED]
     .xfer_order $fd_xfer
@@ -378,16 +637,34 @@
     alu[rnd_val, --, b, rnd_val, >>2]
     ld_field[key_value_sz, 0011, rnd_val]
 
+    alu[slab_sz, --, b, key_value_sz, >>16]
+    alu[slab_sz, slab_sz, +, 1]
+    alu[slab_sz, slab_sz, and~, 1]
+    alu[slab_sz, slab_sz, +, rnd_val]
+    immed[slab, 0]
+    alu[--, slab_sz, -, (1 << (HASHMAP_SLAB_MIN_SZ_SHFT - 2))]
+    ble[slab_done#]
+    alu[--, slab_sz, -, (2 << (HASHMAP_SLAB_MIN_SZ_SHFT - 2))]
+    ble[slab_done#], defer[1]
+        immed[slab, 1]
+    immed[slab, 2]
+slab_done#:
+    alu[$fd_xfer[__HASHMAP_FD_NDX_SLAB], --, b, slab]
+
     alu[$fd_xfer[__HASHMAP_FD_NDX_KEY], --, b, key_value_sz]
     move[tmp, max_entries]
     alu[$fd_xfer[__HASHMAP_FD_NDX_MAX_ENT], --, b, tmp]
     alu[$fd_xfer[__HASHMAP_FD_NDX_CUR_CRED], --, b, tmp]
     alu[$fd_xfer[__HASHMAP_FD_NDX_TYPE], --, b, type]
 
+    __hashmap_part_cfg(in_tid, in_partitions, part_cfg)
+    alu[$fd_xfer[__HASHMAP_FD_NDX_PART], --, b, part_cfg]
+
     ov_start(OV_LENGTH)
     ov_set_use(OV_LENGTH, __HASHMAP_FD_NUM_LW_USED, OVF_SUBTRACT_ONE)
     ov_clean
     mem[atomic_write, $fd_xfer[0], base, <<8, offset, max_/**/__HASHMAP_FD_NUM_LW_USED], indirect_ref, ctx_swap[create_fd_sig]
+    __hashmap_fd_cache_invalidate()
 
 .end
 #endm
@@ -408,14 +685,152 @@
 .end
 #endm
 
+/* drop all descriptors cached by the ME, HASHMAP_LM_HANDLE is used */
+#macro __hashmap_fd_cache_clear()
+.begin
+    .reg addr
+    .reg count
+
+    immed[addr, __hashmap_fd_cache]
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, addr]
+    immed[count, (HASHMAP_FD_CACHE_SLOTS * __HASHMAP_FD_CACHE_SLOT_LW)]
+    nop
+    nop
+
+clear_loop#:
+    alu[count, count, -, 1]
+    bne[clear_loop#], defer[1]
+        alu[HASHMAP_LM_INDEX++, --, b, 0]
+.end
+#endm
+
+/*
+ * The descriptor fields used by hashmap_ops() are cached in LM, in the slot
+ * of in_fd modulo HASHMAP_FD_CACHE_SLOTS. The map ME bumps the generation in
+ * NN register HASHMAP_FD_GEN_NN_IDX of every ME when a map is allocated or
+ * freed, see __hashmap_fd_cache_invalidate(), and an ME that sees a new
+ * generation drops its cached descriptors.
+ */
 #macro hashmap_get_fd(in_fd, key_size, value_size, key_mask, value_mask, map_type, ERROR_LABEL)
+    hashmap_get_fd(in_fd, key_size, value_size, key_mask, value_mask, map_type, ERROR_LABEL, --, --)
+#endm
+
+#macro hashmap_get_fd(in_fd, key_size, value_size, key_mask, value_mask, map_type, ERROR_LABEL, out_part)
+    hashmap_get_fd(in_fd, key_size, value_size, key_mask, value_mask, map_type, ERROR_LABEL, out_part, --)
+#endm
+
+/*
+ * out_part     optional, partitions of the map as set by hashmap_alloc_fd(),
+ *              the previous ones above __HASHMAP_PART_OLD_SHFT while the
+ *              map is resized
+ * out_slab     optional, slab class of the overflow entries of the map
+ */
+#macro hashmap_get_fd(in_fd, key_size, value_size, key_mask, value_mask, map_type, ERROR_LABEL, out_part, out_slab)
 .begin
+    .reg addr
+    .reg gen
+    .reg tag
+    .reg tmp
+
+    alu[--, in_fd, -, HASHMAP_MAX_TID]
+    bge[ERROR_LABEL]
+
+    __hashmap_lm_handles_define()
+    local_csr_wr[NN_GET, HASHMAP_FD_GEN_NN_IDX]
+    immed[addr, __hashmap_fd_cache_gen]
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, addr]
+    alu[tmp, (HASHMAP_FD_CACHE_SLOTS - 1), and, in_fd]
+    immed[addr, __hashmap_fd_cache]
+    alu[addr, addr, or, tmp, <<__HASHMAP_FD_CACHE_SLOT_SHFT]
+    alu[gen, --, b, *n$index]
+    alu[--, gen, -, HASHMAP_LM_INDEX]
+    beq[lookup#]
+
+    // maps were allocated or freed, drop the cached descriptors
+    alu[HASHMAP_LM_INDEX, --, b, gen]
+    __hashmap_fd_cache_clear()
+
+lookup#:
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, addr]
+    alu[tag, --, b, in_fd, <<__HASHMAP_FD_CACHE_TAG_FD_SHFT]
+    alu[tag, tag, or, 1, <<__HASHMAP_FD_CACHE_VALID_BIT]
+    nop
+    alu[tmp, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_TAG], and~, 0xff]
+    alu[tmp, tmp, and~, 0xff, <<__HASHMAP_FD_CACHE_TAG_PART_SHFT]
+    alu[tmp, tmp, and~, 0x3, <<__HASHMAP_FD_CACHE_TAG_SLAB_SHFT]
+    alu[--, tmp, -, tag]
+    bne[cache_miss#]
+
+    ld_field_w_clr[key_size, 0011, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_KEY], >>16]
+    ld_field_w_clr[value_size, 0011, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_KEY]]
+    alu[key_mask, --, b, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_KEY_MASK]]
+    alu[value_mask, --, b, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_VALUE_MASK]]
+    #if (!streq('out_part', '--'))
+        alu[out_part, 0xff, and, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_TAG], >>__HASHMAP_FD_CACHE_TAG_PART_SHFT]
+    #endif
+    #if (!streq('out_slab', '--'))
+        alu[out_slab, 0x3, and, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_TAG], >>__HASHMAP_FD_CACHE_TAG_SLAB_SHFT]
+    #endif
+    br[ret#], defer[1]
+        alu[map_type, 0xff, and, HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_TAG]]
+
+cache_miss#:
     _hashmap_get_fd(in_fd, ERROR_LABEL)
+    local_csr_wr[NN_GET, HASHMAP_FD_GEN_NN_IDX]
     ld_field_w_clr[key_size, 0011, MAP_RDXR[__HASHMAP_FD_NDX_KEY], >>16]
     ld_field_w_clr[value_size, 0011, MAP_RDXR[__HASHMAP_FD_NDX_VALUE]]
     alu[key_mask, --, b, MAP_RDXR[__HASHMAP_FD_NDX_KEY_MASK]]
     alu[value_mask, --, b, MAP_RDXR[__HASHMAP_FD_NDX_VALUE_MASK]]
     alu[map_type, --, b, MAP_RDXR[__HASHMAP_FD_NDX_TYPE]]
+    __hashmap_set_opt_field(out_part, MAP_RDXR[__HASHMAP_FD_NDX_PART])
+    __hashmap_set_opt_field(out_slab, MAP_RDXR[__HASHMAP_FD_NDX_SLAB])
+
+    // don't cache a descriptor read while the generation changed
+    alu[--, gen, -, *n$index]
+    bne[ret#]
+    alu[HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_KEY], --, b, MAP_RDXR[__HASHMAP_FD_NDX_KEY]]
+    alu[HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_KEY_MASK], --, b, key_mask]
+    alu[HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_VALUE_MASK], --, b, value_mask]
+    alu[tmp, map_type, or, MAP_RDXR[__HASHMAP_FD_NDX_PART], <<__HASHMAP_FD_CACHE_TAG_PART_SHFT]
+    alu[tmp, tmp, or, MAP_RDXR[__HASHMAP_FD_NDX_SLAB], <<__HASHMAP_FD_CACHE_TAG_SLAB_SHFT]
+    alu[HASHMAP_LM_INDEX[__HASHMAP_FD_CACHE_NDX_TAG], tag, or, tmp]
+
+ret#:
+    __hashmap_lm_handles_undef()
+.end
+#endm
+
+/*
+ * Called on the map ME after a map is allocated or freed: bump the fd
+ * table generation in the NN registers of the MEs in HASHMAP_FD_CACHE_MES
+ * and of this ME.
+ */
+#macro __hashmap_fd_cache_invalidate()
+.begin
+    .reg addr
+    .reg $gen
+    .sig fd_gen_sig
+    .sig fd_gen_nn_sig
+
+    move(addr, __HASHMAP_FD_GEN >>8)
+    immed[$gen, 1]
+    mem[test_add, $gen, addr, <<8, 0, 1], ctx_swap[fd_gen_sig]
+    alu[$gen, $gen, +, 1]
+
+    #define_eval __ME_ID    (__ISLAND << 4 | (__MEID & 0xf))
+    #define_eval __NN_ADDR  (((__ME_ID >> 4) << 24) | ((__ME_ID & 0xf) << 17) | (1 << 9) | (HASHMAP_FD_GEN_NN_IDX << 2))
+    move(addr, __NN_ADDR)
+    ct[ctnn_write, $gen, addr, 0, 1], ctx_swap[fd_gen_nn_sig]
+
+    #ifdef HASHMAP_FD_CACHE_MES
+        #for __ME_ID [HASHMAP_FD_CACHE_MES]
+            #define_eval __NN_ADDR  (((__ME_ID >> 4) << 24) | ((__ME_ID & 0xf) << 17) | (1 << 9) | (HASHMAP_FD_GEN_NN_IDX << 2))
+            move(addr, __NN_ADDR)
+            ct[ctnn_write, $gen, addr, 0, 1], ctx_swap[fd_gen_nn_sig]
+        #endloop
+    #endif
+    #undef __NN_ADDR
+    #undef __ME_ID
 .end
 #endm
 
@@ -427,6 +842,147 @@
 .end
 #endm
 
+/* number of entries in map in_fd */
+#macro hashmap_get_fd_used(in_fd, out_used, ERROR_LABEL)
+.begin
+    _hashmap_get_fd(in_fd, ERROR_LABEL)
+    alu[out_used, MAP_RDXR[__HASHMAP_FD_NDX_MAX_ENT], -, MAP_RDXR[__HASHMAP_FD_NDX_CUR_CRED]]
+.end
+#endm
+
+/*
+ * value words of map in_fd that programs XADD to, bit n for LW n, set by
+ * the host at ALLOC. They are kept in NFP byte order, see
+ * htab_map_xadd_subr_func().
+ */
+#macro hashmap_set_fd_xadd(in_fd, in_words)
+.begin
+    .reg base
+    .reg offset
+    .reg $words
+    .sig sig_xadd_words
+
+    move(base, __HASHMAP_FD_TBL >>8)
+    alu[offset, --, b, in_fd, <<__HASHMAP_FD_TBL_SHFT]
+    alu[offset, offset, +, (__HASHMAP_FD_NDX_XADD * 4)]
+    alu[$words, --, b, in_words]
+    mem[write32, $words, base, <<8, offset, 1], ctx_swap[sig_xadd_words]
+.end
+#endm
+
+#macro hashmap_get_fd_xadd(in_fd, out_words, ERROR_LABEL)
+.begin
+    .reg base
+    .reg offset
+    .reg $words
+    .sig sig_xadd_words
+
+    alu[--, in_fd, -, HASHMAP_MAX_TID]
+    bge[ERROR_LABEL]
+
+    move(base, __HASHMAP_FD_TBL >>8)
+    alu[offset, --, b, in_fd, <<__HASHMAP_FD_TBL_SHFT]
+    alu[offset, offset, +, (__HASHMAP_FD_NDX_XADD * 4)]
+    mem[read32, $words, base, <<8, offset, 1], ctx_swap[sig_xadd_words]
+    alu[out_words, --, b, $words]
+.end
+#endm
+
+/* out_hint is 1 when the map is close to full, see HASHMAP_RESIZE_HINT_SHFT */
+#macro hashmap_resize_hint(in_fd, out_hint, ERROR_LABEL)
+.begin
+    .reg free_min
+
+    _hashmap_get_fd(in_fd, ERROR_LABEL)
+    alu[free_min, --, b, MAP_RDXR[__HASHMAP_FD_NDX_MAX_ENT], >>HASHMAP_RESIZE_HINT_SHFT]
+    alu[--, MAP_RDXR[__HASHMAP_FD_NDX_CUR_CRED], -, free_min]
+    bhs[ret#], defer[1]
+        immed[out_hint, 0]
+    immed[out_hint, 1]
+ret#:
+.end
+#endm
+
+/*
+ * Start to resize map in_fd: max_entries is raised to in_max_entries and
+ * the free entries grow by the difference, a lower value keeps the map at
+ * its size. The map moves to the partitions picked for in_partitions as
+ * by hashmap_alloc_fd(), the current ones are kept above
+ * __HASHMAP_PART_OLD_SHFT. While both are set hashmap_ops() searches the
+ * old layout first and adds to the new one, the map ME moves the entries
+ * of the old layout bucket by bucket and calls hashmap_resize_done().
+ *
+ * out_part         partitions word as written, the old layout is 0 if the
+ *                  buckets of the map did not change and nothing has to move
+ * BUSY_LABEL       the map is being resized already
+ * NO_ROOM_LABEL    in_max_entries is above HASHMAP_MAX_ENTRIES, or the
+ *                  per-cpu blocks for the new entries are not left, see
+ *                  hashmap_percpu_reserve()
+ */
+#macro hashmap_resize_fd(in_fd, in_max_entries, in_partitions, out_part, BUSY_LABEL, NO_ROOM_LABEL, ERROR_LABEL)
+.begin
+    .reg base
+    .reg offset
+    .reg grow
+    .reg map_type
+    .reg $max
+    .reg $credits
+    .reg $part
+    .sig resize_sig
+
+    move(grow, HASHMAP_MAX_ENTRIES)
+    alu[--, grow, -, in_max_entries]
+    blo[NO_ROOM_LABEL]
+
+    _hashmap_get_fd(in_fd, ERROR_LABEL)
+    alu[--, --, b, MAP_RDXR[__HASHMAP_FD_NDX_PART], >>__HASHMAP_PART_OLD_SHFT]
+    bne[BUSY_LABEL]
+
+    move(base, __HASHMAP_FD_TBL >>8)
+    alu[offset, --, b, in_fd, <<__HASHMAP_FD_TBL_SHFT]
+    alu[grow, in_max_entries, -, MAP_RDXR[__HASHMAP_FD_NDX_MAX_ENT]]
+    blo[layout#]
+    beq[layout#]
+    alu[map_type, --, b, MAP_RDXR[__HASHMAP_FD_NDX_TYPE]]
+    hashmap_percpu_reserve(map_type, grow, NO_ROOM_LABEL)
+    alu[$max, --, b, in_max_entries]
+    alu[$credits, --, b, grow]
+    alu[offset, offset, +, (__HASHMAP_FD_NDX_MAX_ENT * 4)]
+    mem[write32, $max, base, <<8, offset, 1], ctx_swap[resize_sig]
+    alu[offset, offset, +, ((__HASHMAP_FD_NDX_CUR_CRED - __HASHMAP_FD_NDX_MAX_ENT) * 4)]
+    mem[add, $credits, base, <<8, offset, 1], ctx_swap[resize_sig]
+    alu[offset, --, b, in_fd, <<__HASHMAP_FD_TBL_SHFT]
+
+layout#:
+    __hashmap_part_cfg(in_fd, in_partitions, out_part)
+    alu[--, out_part, -, MAP_RDXR[__HASHMAP_FD_NDX_PART]]
+    beq[ret#]
+    alu[out_part, out_part, or, MAP_RDXR[__HASHMAP_FD_NDX_PART], <<__HASHMAP_PART_OLD_SHFT]
+    alu[$part, --, b, out_part]
+    alu[offset, offset, +, (__HASHMAP_FD_NDX_PART * 4)]
+    mem[write32, $part, base, <<8, offset, 1], ctx_swap[resize_sig]
+    __hashmap_fd_cache_invalidate()
+ret#:
+.end
+#endm
+
+/* all entries moved, the map is left on its new partitions only */
+#macro hashmap_resize_done(in_fd)
+.begin
+    .reg base
+    .reg offset
+    .reg $part
+    .sig resize_done_sig
+
+    move(base, __HASHMAP_FD_TBL >>8)
+    alu[offset, --, b, in_fd, <<__HASHMAP_FD_TBL_SHFT]
+    alu[offset, offset, +, (__HASHMAP_FD_NDX_PART * 4)]
+    immed[$part, (__HASHMAP_PART_MSK << __HASHMAP_PART_OLD_SHFT)]
+    mem[clr, $part, base, <<8, offset, 1], ctx_swap[resize_done_sig]
+    __hashmap_fd_cache_invalidate()
+.end
+#endm
+
 
 
 
@@ -490,38 +1046,69 @@ ret#:
     alu[$fd_values[3], --, b, 0]
     mem[atomic_write, $fd_values[0], base, <<8, tbl_offset, 4], sig_done[fd_inc_sig]
     ctx_arb[fd_inc_sig]
+    __hashmap_fd_cache_invalidate()
 ret#:
 .end
 #endm
 
 
-#macro __hashmap_lock_init(state, addr_hi, addr_lo, mu_partitions, idx)
+/*
+ * Buckets of partition n live in __HASHMAP_DATA_n and __HASHMAP_LOCK_TBL_n
+ * on emem n, the partition is in the bits of the bucket index above
+ * HASHMAP_NUM_ENTRIES_SHFT.
+ *
+ * BASE     __HASHMAP_DATA_ or __HASHMAP_LOCK_TBL_
+ */
+#macro __hashmap_partition_addr_hi(in_idx, out_addr_hi, BASE)
+#if (HASHMAP_PARTITIONS == 1)
+    move(out_addr_hi, BASE/**/0 >>8)
+#else
 .begin
+    .reg part
+
+    alu[part, --, b, in_idx, >>HASHMAP_NUM_ENTRIES_SHFT]
+    .if (part == 0)
+        move(out_addr_hi, BASE/**/0 >>8)
+    #if (HASHMAP_PARTITIONS == 3)
+    .elif (part == 1)
+        move(out_addr_hi, BASE/**/1 >>8)
+    .else
+        move(out_addr_hi, BASE/**/2 >>8)
+    #else
+    .else
+        move(out_addr_hi, BASE/**/1 >>8)
+    #endif
+    .endif
+.end
+#endif
+#endm
 
+/* offset of bucket in_idx within its partition, for 1<<SZ_SHFT bytes per bucket */
+#macro __hashmap_partition_offset(in_idx, out_offset, SZ_SHFT)
 #if (HASHMAP_PARTITIONS == 1)
-    move(addr_hi, __HASHMAP_DATA_0 >>8)
-#elif (HASHMAP_PARTITIONS == 2)
-    alu[--, mu_partitions, -, 0]
-    beq[cont#], defer[1]
-    move(addr_hi, __HASHMAP_DATA_0 >>8)
-    move(addr_hi, __HASHMAP_DATA_1 >>8)
-#else (HASHMAP_PARTITIONS == 3)
-    alu[--, mu_partitions, -, 0]
-    beq[cont#], defer[1]
-    move(addr_hi, __HASHMAP_DATA_0 >>8)
-    alu[--, mu_partitions, -, 1]
-    beq[cont#], defer[2]
-    move(addr_hi, __HASHMAP_DATA_1 >>8)
-    move(addr_hi, __HASHMAP_DATA_2 >>8)
+    alu[out_offset, --, b, in_idx, <<SZ_SHFT]
+#else
+    alu[out_offset, --, b, in_idx, <<(32 - HASHMAP_NUM_ENTRIES_SHFT)]
+    alu[out_offset, --, b, out_offset, >>(32 - HASHMAP_NUM_ENTRIES_SHFT - SZ_SHFT)]
 #endif
+#endm
+
+#macro __hashmap_lock_addr(in_idx, out_addr_hi, out_addr_lo)
+    __hashmap_partition_addr_hi(in_idx, out_addr_hi, __HASHMAP_LOCK_TBL_)
+    __hashmap_partition_offset(in_idx, out_addr_lo, HASHMAP_LOCK_SZ_SHFT)
+#endm
 
-cont#:
+#macro __hashmap_lock_init(state, addr_hi, addr_lo, idx)
+    __hashmap_partition_addr_hi(idx, addr_hi, __HASHMAP_DATA_)
     immed[state,1]          ; state=1
-    alu_shf[addr_lo, --, b, idx, <<HASHMAP_ENTRY_SZ_SHFT]
-.end
+    __hashmap_partition_offset(idx, addr_lo, HASHMAP_ENTRY_SZ_SHFT)
 #endm
 
 #macro __hashmap_lock_shared(in_idx, in_tid, NOT_VALID_LABEL, NOT_MATCH_TID)
+    __hashmap_lock_shared(in_idx, in_tid, NOT_VALID_LABEL, NOT_MATCH_TID, --)
+#endm
+
+#macro __hashmap_lock_shared(in_idx, in_tid, NOT_VALID_LABEL, NOT_MATCH_TID, out_desc)
 .begin
     .reg $desc_xfer[2]
     .xfer_order $desc_xfer
@@ -532,8 +1119,7 @@ cont#:
 
     immed[$desc_xfer[0], 1]         ;lo
     immed[$desc_xfer[1], 0]         ;hi
-    move(lk_addr_hi, __HASHMAP_LOCK_TBL >>8)
-    alu[lk_addr_lo, --, b, in_idx, <<HASHMAP_LOCK_SZ_SHFT]
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
 
 retry_lock#:
     mem[test_add64, $desc_xfer[0], lk_addr_hi, <<8, lk_addr_lo, 1], sig_done[lock_shared_sig]
@@ -544,12 +1130,76 @@ retry_lock#:
     br[retry_lock#]
 
 ret#:
+    __hashmap_set_opt_field(out_desc, $desc_xfer[0])
     br_bclr[$desc_xfer[0], __HASHMAP_DESC_VALID_BIT, NOT_VALID_LABEL]
     alu[--, in_tid, -, $desc_xfer[1]]
     bne[NOT_MATCH_TID]
 .end
 #endm /* __hashmap_lock_shared */
 
+/*
+ * Lookups do not take the bucket lock. The seq word of the lock entry is
+ * odd while a writer holds the bucket exclusively, see
+ * __hashmap_lock_upgrade() and __hashmap_lock_release(). A reader waits
+ * for an even seq, reads the bucket and checks with __hashmap_seq_end()
+ * that seq did not move, otherwise the bucket changed under it and the
+ * lookup is redone.
+ */
+#macro __hashmap_seq_begin(in_idx, in_tid, NOT_VALID_LABEL, NOT_MATCH_TID, out_seq, out_desc)
+.begin
+    .reg $desc_xfer[3]
+    .xfer_order $desc_xfer
+
+    .sig seq_begin_sig
+    .reg lk_addr_hi
+    .reg lk_addr_lo
+
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+
+retry_seq#:
+    mem[read_atomic, $desc_xfer[0], lk_addr_hi, <<8, lk_addr_lo, 3], ctx_swap[seq_begin_sig]
+    br_bclr[$desc_xfer[2], 0, ret#]
+    timestamp_sleep(4000)
+    br[retry_seq#]
+
+ret#:
+    alu[out_seq, --, b, $desc_xfer[2]]
+    __hashmap_set_opt_field(out_desc, $desc_xfer[0])
+    br_bclr[$desc_xfer[0], __HASHMAP_DESC_VALID_BIT, NOT_VALID_LABEL]
+    alu[--, in_tid, -, $desc_xfer[1]]
+    bne[NOT_MATCH_TID]
+.end
+#endm /* __hashmap_seq_begin */
+
+#macro __hashmap_seq_end(in_idx, in_seq, RETRY_LABEL)
+.begin
+    .reg $seq_xfer
+    .sig seq_end_sig
+    .reg lk_addr_hi
+    .reg lk_addr_lo
+
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+    alu[lk_addr_lo, lk_addr_lo, +, __HASHMAP_DESC_SEQ_OFFSET]
+    mem[read_atomic, $seq_xfer, lk_addr_hi, <<8, lk_addr_lo, 1], ctx_swap[seq_end_sig]
+    alu[--, in_seq, -, $seq_xfer]
+    beq[ret#]
+    pkt_counter_incr(num_seq_retry)
+    br[RETRY_LABEL]
+ret#:
+.end
+#endm /* __hashmap_seq_end */
+
+/* bump seq when the exclusive lock is taken and before it is dropped */
+#macro __hashmap_seq_incr(in_lk_addr_hi, in_lk_addr_lo)
+.begin
+    .sig seq_incr_sig
+    .reg seq_addr_lo
+
+    alu[seq_addr_lo, in_lk_addr_lo, +, __HASHMAP_DESC_SEQ_OFFSET]
+    mem[incr, --, in_lk_addr_hi, <<8, seq_addr_lo], ctx_swap[seq_incr_sig]
+.end
+#endm
+
 #macro __hashmap_lock_upgrade(in_idx, io_state, NO_LOCK_LABEL)
 .begin
     .reg $desc_xfer
@@ -562,10 +1212,9 @@ ret#:
     .reg lk_addr_hi
     .reg lk_addr_lo
 
-    move(lk_addr_hi, __HASHMAP_LOCK_TBL >>8)
-    br_bset[io_state, __HASHMAP_DESC_OV_BIT, get_lock#], defer[2]
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+    br_bset[io_state, __HASHMAP_DESC_OV_BIT, get_lock#], defer[1]
     alu[desc, --, b, 1, <<__HASHMAP_DESC_LOCK_EXCL_BIT]
-    alu[lk_addr_lo, --, b, in_idx, <<HASHMAP_LOCK_SZ_SHFT]
 
     alu[desc, desc, or, 1, <<__HASHMAP_DESC_VALID_BIT]
 
@@ -600,6 +1249,8 @@ has_excl#:
     ctx_arb[lock_wait_sig], br[has_excl#]
 
 ret#:
+    /* readers are drained, make seq odd before anything is written */
+    __hashmap_seq_incr(lk_addr_hi, lk_addr_lo)
     alu_shf[io_state, io_state, or, 1, <<__HASHMAP_DESC_LOCK_EXCL_BIT]
 .end
 #endm /* __hashmap_lock_upgrade  */
@@ -611,8 +1262,10 @@ ret#:
     .reg lk_addr_hi
     .reg lk_addr_lo
 
-    move(lk_addr_hi, (__HASHMAP_LOCK_TBL>>8))
-    alu[lk_addr_lo, --, b, in_idx, <<HASHMAP_LOCK_SZ_SHFT]
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+    br_bclr[state, __HASHMAP_DESC_LOCK_EXCL_BIT, release#]
+    __hashmap_seq_incr(lk_addr_hi, lk_addr_lo)
+release#:
     ld_field_w_clr[imm_ref, 1100, state, <<16]  /* data16, lock->state  */
     alu[imm_ref, imm_ref, or, 2, <<3]           /* ove_data=2 override  */
     alu_shf[--, imm_ref, or, 17, <<7]           /* ov_len (1<<7) | length (16<<8) */
@@ -626,91 +1279,233 @@ ret#:
 .begin
     .reg $desc_xfer[2]
     .xfer_order $desc_xfer
+    .reg $ref_xfer
     .reg tmp
     .sig lock_rel_invalid_sig
+    .sig lru_ref_clr_sig
     .reg lk_addr_hi
     .reg lk_addr_lo
 
-    move(lk_addr_hi, __HASHMAP_LOCK_TBL >>8)
-    alu[lk_addr_lo, --, b, in_idx, <<HASHMAP_LOCK_SZ_SHFT]
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+    /* the next owner of the slot starts out unreferenced */
+    alu_shf[$ref_xfer, --, b, 1, <<__HASHMAP_DESC_LRU_REF_BIT]
+    mem[clr, $ref_xfer, lk_addr_hi, <<8, lk_addr_lo, 1], sig_done[lru_ref_clr_sig]
     alu_shf[tmp, --,b, 1, <<__HASHMAP_DESC_VALID_BIT]
     alu_shf[$desc_xfer[0],tmp, or, state]
     alu[$desc_xfer[1], --, b, in_fd]
+    ctx_arb[lru_ref_clr_sig]
+    __hashmap_seq_incr(lk_addr_hi, lk_addr_lo)
     mem[sub64, $desc_xfer[0], lk_addr_hi, <<8, lk_addr_lo, 1], ctx_swap[lock_rel_invalid_sig]
     immed[state, 0]
-    /* TODO for LRU
-     *      clear ref flag
-     *      incr free_credits
-     */
 .end
 #endm /* __hashmap_lock_release_and_invalidate */
 
+/*
+ * LRU maps keep one reference bit per entry in the lock word of the
+ * bucket: bit 31 for the primary entry, bits 20..27 for the ov cam slots.
+ * Lookups set the bit, the clock sweep in __hashmap_lru_evict() clears it.
+ *
+ * in_desc  lock word as returned by __hashmap_lock_shared()
+ */
+#macro __hashmap_lru_ref_set(in_idx, in_state, in_desc)
+.begin
+    .reg ref
+    .reg $ref_xfer
+    .sig lru_ref_sig
+    .reg lk_addr_hi
+    .reg lk_addr_lo
 
-#macro __hashmap_select_1_partition(hash, selection_mu)
-    alu[selection_mu, --, b, 0]
-#endm
+    br_bclr[in_state, __HASHMAP_DESC_OV_BIT, check_ref#], defer[1]
+        alu_shf[ref, --, b, 1, <<__HASHMAP_DESC_LRU_REF_BIT]
 
-#macro __hashmap_select_2_partition(hash, selection_mu)
-    br_bclr(hash, 31, mu_selected#), defer[1]
-    alu[selection_mu, --, b, 0]
-    alu[selection_mu, --, b, 1]
-mu_selected#:
-#endm
+    alu[ref, 7, and, in_state, >>__HASHMAP_DESC_OV_IDX]
+    alu[ref, ref, +, __HASHMAP_DESC_LRU_OV_REF_BIT]
+    alu[--, ref, or, 0]
+    alu[ref, --, b, 1, <<indirect]
 
-#macro __hashmap_select_3_partition(hash, selection_mu)
-    br=byte[hash, 0, 0x55, mu_selected#], defer[1]
-    alu[selection_mu, --, b, 0]
-    br=byte[hash, 0, 0xAA, mu_selected#], defer[1]
-    alu[selection_mu, --, b, 1]
-    alu[selection_mu, --, b, 2]
-mu_selected#:
-#endm
+check_ref#:
+    /* only the first lookup since the last sweep writes the lock word */
+    alu[--, ref, and, in_desc]
+    bne[ret#]
 
-#macro __hashmap_select_next_1_partition(selection_mu,index, MISS_LABEL)
-.begin
-    .reg max
-    move(max, HASHMAP_TOTAL_ENTRIES)
-    alu[selection_mu, --, b, 0]
-    alu[index, index, +, 1]
-    alu[--, index, -, max]
-    bge[MISS_LABEL]
+    alu[$ref_xfer, --, b, ref]
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+    mem[set, $ref_xfer, lk_addr_hi, <<8, lk_addr_lo, 1], ctx_swap[lru_ref_sig]
+ret#:
 .end
-#endm
+#endm /* __hashmap_lru_ref_set */
 
-#macro __hashmap_select_next_2_partition(selection_mu,index,MISS_LABEL)
+/*
+ * Pick an entry of in_fd in the bucket to make room for a new key, the
+ * bucket must be held exclusively.  Candidates are swept in ov cam slot
+ * order followed by the primary entry; referenced candidates passed over
+ * lose their reference bit and the first unreferenced one is the victim.
+ * If every candidate is referenced they are all cleared and the first
+ * one is taken.  The ov cam slot of a victim is rehashed for the new key.
+ *
+ * out_addr_hi/out_addr_lo  address of the victim entry to overwrite
+ * NO_VICTIM_LABEL          no entry of in_fd in this bucket
+ */
+#macro __hashmap_lru_evict(in_fd, in_hash, in_addr_hi, in_idx, in_slab, out_addr_hi, out_addr_lo, NO_VICTIM_LABEL)
 .begin
-    .reg max
-    alu[--, selection_mu, -, 0]
-    beq[ret#],defer[2]
-    alu[selection_mu, --, b, 1]
-    move(max, HASHMAP_TOTAL_ENTRIES)
-
-    alu[selection_mu, --, b, 0]
-    alu[index, index, +, 1]
-    alu[--, index, -, max]
-    bge[MISS_LABEL]
+    .reg $desc_xfer[2]
+    .xfer_order $desc_xfer
+    .reg $ov_addr[HASHMAP_ENTRIES_PER_BUCKET]
+    .xfer_order $ov_addr
+    .reg $ref_xfer
+    .reg $cam_xfer
+    .sig desc_sig
+    .sig ov_sig
+    .sig ref_clr_sig
+    .sig cam_sig
+    .reg lk_addr_hi
+    .reg lk_addr_lo
+    .reg cam_offset
+    .reg ov_offset
+    .reg cand
+    .reg unref
+    .reg clr_mask
+    .reg victim
+    .reg tid
+    .reg value
+
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+    mem[read_atomic, $desc_xfer[0], lk_addr_hi, <<8, lk_addr_lo, 2], sig_done[desc_sig]
+    __hashmap_partition_offset(in_idx, cam_offset, HASHMAP_ENTRY_SZ_SHFT)
+    alu[cam_offset, cam_offset, +, HASHMAP_OV_CAM_OFFSET]
+    alu[ov_offset, cam_offset, +, HASHMAP_OV_ENTRY_OFFSET]
+    mem[read32, $ov_addr[0], in_addr_hi, <<8, ov_offset, HASHMAP_ENTRIES_PER_BUCKET], sig_done[ov_sig]
+    immed[cand, 0]
+    ctx_arb[desc_sig, ov_sig]
+
+    br_bclr[$desc_xfer[0], __HASHMAP_DESC_VALID_BIT, scan_ov#]
+    alu[--, in_fd, -, $desc_xfer[1]]
+    bne[scan_ov#]
+    alu_shf[cand, --, b, 1, <<__HASHMAP_DESC_LRU_REF_BIT]
+
+scan_ov#:
+    #define_eval __SLOT 0
+    #while (__SLOT < HASHMAP_ENTRIES_PER_BUCKET)
+        alu[tid, --, b, $ov_addr[__SLOT], >>24]
+        alu[--, tid, -, in_fd]
+        bne[skip_slot/**/__SLOT#]
+        alu_shf[cand, cand, or, 1, <<(__HASHMAP_DESC_LRU_OV_REF_BIT + __SLOT)]
+skip_slot/**/__SLOT#:
+        #define_eval __SLOT (__SLOT + 1)
+    #endloop
+    #undef __SLOT
+
+    alu[--, --, b, cand]
+    beq[NO_VICTIM_LABEL]
+
+    alu[unref, cand, and~, $desc_xfer[0]]
+    beq[sweep_all#]
+
+    /* clear the reference of everything up to and including the victim */
+    ffs[victim, unref]
+    alu[--, victim, or, 0]
+    alu[clr_mask, --, b, 1, <<indirect]
+    alu[clr_mask, clr_mask, +, clr_mask]
+    alu[clr_mask, clr_mask, -, 1]
+    br[clear_ref#], defer[1]
+        alu[clr_mask, clr_mask, and, cand]
+
+sweep_all#:
+    ffs[victim, cand]
+    alu[clr_mask, --, b, cand]
+
+clear_ref#:
+    alu[$ref_xfer, --, b, clr_mask]
+    mem[clr, $ref_xfer, lk_addr_hi, <<8, lk_addr_lo, 1], sig_done[ref_clr_sig]
+
+    alu[--, victim, -, __HASHMAP_DESC_LRU_REF_BIT]
+    bne[evict_ov#]
+
+    /* primary entry, the tid stays */
+    alu[out_addr_hi, --, b, in_addr_hi]
+    br[ret#], defer[1]
+        alu[out_addr_lo, cam_offset, -, HASHMAP_OV_CAM_OFFSET]
+
+evict_ov#:
+    alu[victim, victim, -, __HASHMAP_DESC_LRU_OV_REF_BIT]
+    alu[victim, --, b, victim, <<2]
+    alu[cam_offset, cam_offset, +, victim]
+    alu[ov_offset, ov_offset, +, victim]
+    ld_field_w_clr[value, 0111, in_hash]
+    alu[$cam_xfer, value, or, 1]
+    mem[write32, $cam_xfer, in_addr_hi, <<8, cam_offset, 1], sig_done[cam_sig]
+    mem[read32, $ov_addr[0], in_addr_hi, <<8, ov_offset, 1], sig_done[ov_sig]
+    ctx_arb[cam_sig, ov_sig]
+    __hashmap_slab_pool(in_slab, out_addr_hi)
+    ld_field_w_clr[out_addr_lo, 0111, $ov_addr[0]]
+    __hashmap_slab_offset(in_slab, out_addr_lo, out_addr_lo)
+
 ret#:
+    ctx_arb[ref_clr_sig]
+    pkt_counter_incr(num_lru_evict)
+.end
+#endm /* __hashmap_lru_evict */
+
+
+/*
+ * Pick the partition of a bucket from the top byte of in_hash, the
+ * bucket index uses the low HASHMAP_NUM_ENTRIES_SHFT bits only.  With
+ * three partitions (3 * byte) >> 8 splits the byte evenly.
+ *
+ * in_part  partitions word of the map, count << 2 | first partition
+ * io_idx   bucket index within a partition, the partition is or'ed in
+ *
+ * Accesses are counted per partition in __HASHMAP_PART_STATS when built
+ * with PKT_COUNTER_ENABLE.
+ */
+#macro __hashmap_select_partition(in_hash, in_part, io_idx)
+#if (HASHMAP_PARTITIONS > 1)
+.begin
+    .reg cnt
+    .reg part
+    .reg stats_hi
+    .reg stats_lo
+
+    alu[cnt, --, b, in_part, >>__HASHMAP_PART_CNT_SHFT]
+    alu[part, --, b, in_hash, >>24]
+    alu[--, cnt, -, 2]
+    blo[one_part#]
+    beq[two_parts#]
+    alu[part, part, +, part, <<1]
+    br[first_part#], defer[1]
+        alu[part, --, b, part, >>8]
+two_parts#:
+    br[first_part#], defer[1]
+        alu[part, --, b, part, >>7]
+one_part#:
+    immed[part, 0]
+
+first_part#:
+    alu[cnt, in_part, and, __HASHMAP_PART_BASE_MSK]
+    alu[part, part, +, cnt]
+    alu[--, part, -, HASHMAP_PARTITIONS]
+    blo[selected#]
+    alu[part, part, -, HASHMAP_PARTITIONS]
+selected#:
+    alu[io_idx, io_idx, or, part, <<HASHMAP_NUM_ENTRIES_SHFT]
+
+#ifdef PKT_COUNTER_ENABLE
+    move(stats_hi, __HASHMAP_PART_STATS >>8)
+    alu[stats_lo, --, b, part, <<3]
+    mem[incr64, --, stats_hi, <<8, stats_lo]
+#endif
 .end
+#endif
 #endm
 
-#macro __hashmap_select_next_3_partition(selection_mu,index,MISS_LABEL)
+/* walk the buckets of all partitions */
+#macro __hashmap_select_next_bucket(io_idx, MISS_LABEL)
 .begin
     .reg max
-    .reg tmp
-    alu[tmp, selection_mu, -, 0]
-    beq[ret#],defer[2]
-    alu[selection_mu, --, b, 1]
-    move(max, HASHMAP_TOTAL_ENTRIES)
-
-    alu[--, tmp, -, 1]
-    beq[ret#],defer[1]
-    alu[selection_mu, --, b, 2]
-
-    alu[selection_mu, --, b, 0]
-    alu[index, index, +, 1]
-    alu[--, index, -, max]
+    move(max, HASHMAP_BUCKETS)
+    alu[io_idx, io_idx, +, 1]
+    alu[--, io_idx, -, max]
     bge[MISS_LABEL]
-ret#:
 .end
 #endm
 
@@ -730,6 +1525,19 @@ ret#:
 #endm
 
 #macro hashmap_ops(fd, lm_key_addr, lm_value_addr, OP, INVALID_MAP_LABEL, NOTFOUND_LABEL, RTN_OPT, out_ent_lw, out_ent_tindex, out_ent_addr, endian, out_rc)
+    hashmap_ops(fd, lm_key_addr, lm_value_addr, OP, INVALID_MAP_LABEL, NOTFOUND_LABEL, RTN_OPT, out_ent_lw, out_ent_tindex, out_ent_addr, endian, out_rc, HASHMAP_CALLER_DP)
+#endm
+
+/*
+ * CALLER   HASHMAP_CALLER_DP or HASHMAP_CALLER_HOST, whether a lookup counts
+ *          as a use of an LRU map entry and which slot of a per-cpu map
+ *          value is accessed. HASHMAP_CALLER_RESIZE adds to the new layout
+ *          of a map being resized only.
+ *
+ * A key that misses in the old layout of a map being resized is searched
+ * for, and added, in the new one.
+ */
+#macro hashmap_ops(fd, lm_key_addr, lm_value_addr, OP, INVALID_MAP_LABEL, NOTFOUND_LABEL, RTN_OPT, out_ent_lw, out_ent_tindex, out_ent_addr, endian, out_rc, CALLER)
 .begin
     .reg ent_addr_hi
     .reg tbl_addr_hi
@@ -740,17 +1548,25 @@ ret#:
     .reg key_mask
     .reg value_mask
     .reg hash[2]
-    .reg mu_partition
+    .reg part_cfg
+    .reg ent_part
+    .reg new_part
+    .reg slab
+    .reg slab_lwsz
     .reg ent_index
     .reg bytes
     .reg keys_n_tid
     .reg my_act_ctx
     .reg map_tindex
     .reg map_type
+    .reg ent_desc
+    .reg ent_seq
+    .reg percpu_blk
 
     __hashmap_lm_handles_define()
 
-    hashmap_get_fd(fd, key_lwsz, value_lwsz, key_mask, value_mask, map_type, INVALID_MAP_LABEL)
+    hashmap_get_fd(fd, key_lwsz, value_lwsz, key_mask, value_mask, map_type, INVALID_MAP_LABEL, part_cfg, slab)
+    __hashmap_slab_lw(slab, slab_lwsz)
     alu[bytes, --, b, key_lwsz, <<2]
     alu[offset, bytes, +, lm_key_addr]
     alu[offset, offset, -, 4]
@@ -768,28 +1584,49 @@ ret#:
         br[getfirst_ent#]
     #else
         slicc_hash_words(hash, fd, lm_key_addr, key_lwsz, key_mask)
+        alu[ent_part, part_cfg, and, __HASHMAP_PART_MSK]
+        #if (CALLER != HASHMAP_CALLER_RESIZE)
+            alu[--, --, b, part_cfg, >>__HASHMAP_PART_OLD_SHFT]
+            beq[ent_layout#]
+            alu[ent_part, --, b, part_cfg, >>__HASHMAP_PART_OLD_SHFT]
+ent_layout#:
+        #endif
         __hashmap_index_from_hash(hash[0], ent_index)
-        __hashmap_lock_init(ent_state, ent_addr_hi, offset, mu_partition, ent_index)
+        __hashmap_select_partition(hash[0], ent_part, ent_index)
+        __hashmap_lock_init(ent_state, ent_addr_hi, offset, ent_index)
         alu[tbl_addr_hi, --, b, ent_addr_hi]
     #endif
 
 retry#:
     __hashmap_set_opt_field(out_rc, CMSG_RC_ERR_ENOENT)
-    __hashmap_lock_shared(ent_index, fd, check_ov#, check_ov_valid#)
+    #if (OP == HASHMAP_OP_LOOKUP)
+        immed[ent_state, 1]
+        __hashmap_seq_begin(ent_index, fd, check_ov#, check_ov_valid#, ent_seq, ent_desc)
+    #else
+        __hashmap_lock_shared(ent_index, fd, check_ov#, check_ov_valid#, ent_desc)
+    #endif
 
-    __hashmap_compare(map_tindex, lm_key_addr, ent_addr_hi, offset, key_lwsz, check_ov_valid#, endian, map_type)
+    __hashmap_compare(map_tindex, lm_key_addr, ent_addr_hi, offset, key_lwsz, slab_lwsz, check_ov_valid#, endian, map_type)
 found#:     /* found entry which matches the key */
     __hashmap_set_opt_field(out_rc, CMSG_RC_SUCCESS)
     #if (OP == HASHMAP_OP_LOOKUP)
         alu[bytes, --, b, key_lwsz, <<2]
         __hashmap_calc_value_addr(offset, bytes, offset)
-        /* TODO LRU:  set ref flag */
+        __hashmap_percpu_value_addr(map_type, ent_addr_hi, offset, map_tindex, CALLER)
         __hashmap_set_opt_field(out_ent_lw, value_lwsz)
-        __hashmap_read_field(map_tindex, lm_value_addr, ent_addr_hi, offset, value_lwsz, RTN_OPT, out_ent_addr, out_ent_tindex, endian)
-        __hashmap_lock_release(ent_index, ent_state)
+        __hashmap_read_field(map_tindex, lm_value_addr, ent_addr_hi, offset, value_lwsz, slab_lwsz, RTN_OPT, out_ent_addr, out_ent_tindex, endian)
+        __hashmap_seq_end(ent_index, ent_seq, retry#)
+        #if (CALLER == HASHMAP_CALLER_DP)
+            alu[--, map_type, -, BPF_MAP_TYPE_LRU_HASH]
+            bne[ret#]
+            __hashmap_lru_ref_set(ent_index, ent_state, ent_desc)
+        #endif
         br[ret#]
     #elif (OP == HASHMAP_OP_REMOVE)
         __hashmap_lock_upgrade(ent_index, ent_state, retry#)
+        alu[bytes, --, b, key_lwsz, <<2]
+        __hashmap_calc_value_addr(offset, bytes, bytes)
+        __hashmap_percpu_release(map_type, ent_addr_hi, bytes)
         __hashmap_table_return_credits(fd)
         __hashmap_set_opt_field(out_ent_lw, 0)
         br_bset[ent_state, __HASHMAP_DESC_OV_BIT, delete_ov_ent#]
@@ -798,23 +1635,37 @@ found#:     /* found entry which matches the key */
     #elif ( (OP == HASHMAP_OP_GETNEXT) || (OP == HASHMAP_OP_GETFIRST) )
 getnext_loop#:
         /* check overflow first */
-        __hashmap_ov_getnext(tbl_addr_hi, ent_index, fd, ent_addr_hi, offset, ent_state, read_next_key#)
+        __hashmap_ov_getnext(tbl_addr_hi, ent_index, fd, slab, ent_addr_hi, offset, ent_state, read_next_key#)
         __hashmap_lock_release(ent_index, ent_state)
-        __hashmap_select_next_/**/HASHMAP_PARTITIONS/**/_partition(mu_partition,ent_index, NOTFOUND_LABEL)
-        __hashmap_lock_init(ent_state, tbl_addr_hi, offset, mu_partition, ent_index)
+        __hashmap_select_next_bucket(ent_index, NOTFOUND_LABEL)
+        __hashmap_lock_init(ent_state, tbl_addr_hi, offset, ent_index)
         __hashmap_lock_shared(ent_index, fd, getnext_loop#, getnext_loop#)
         alu[ent_addr_hi, --, b, tbl_addr_hi]
 read_next_key#:
         __hashmap_set_opt_field(out_ent_lw, key_lwsz)
         immed[map_tindex, 0]        ; force read
-        __hashmap_read_field(map_tindex,lm_value_addr,ent_addr_hi, offset, key_lwsz, RTN_OPT, out_ent_addr, out_ent_tindex, endian)
+        __hashmap_read_field(map_tindex,lm_value_addr,ent_addr_hi, offset, key_lwsz, slab_lwsz, RTN_OPT, out_ent_addr, out_ent_tindex, endian)
         __hashmap_lock_release(ent_index, ent_state)
         br[ret#]
     #elif ( (OP == HASHMAP_OP_ADD_ANY) || (OP == HASHMAP_OP_UPDATE) ) /* entry exists */
+        #if (CALLER == HASHMAP_CALLER_DP)
+            /* no other context writes this slot, the shared lock keeps the block */
+            __hashmap_percpu_br_not(map_type, update_lock#)
+            br[update_value#]
+update_lock#:
+        #endif
         __hashmap_lock_upgrade(ent_index, ent_state, retry#)
+update_value#:
         __hashmap_set_opt_field(out_ent_lw, 0)
         alu[bytes, --, b, key_lwsz, <<2]
         __hashmap_calc_value_addr(offset, bytes, offset)
+        __hashmap_percpu_value_addr(map_type, ent_addr_hi, offset, map_tindex, CALLER)
+        #if (CALLER == HASHMAP_CALLER_HOST)
+            /* the host value replaces the values of all contexts */
+            __hashmap_percpu_br_not(map_type, write_value#)
+            __hashmap_percpu_zero(ent_addr_hi, offset)
+write_value#:
+        #endif
         __hashmap_write_field(lm_value_addr, value_mask, ent_addr_hi, offset, value_lwsz, endian)
         __hashmap_lock_release(ent_index, ent_state)
         br[ret#]
@@ -826,15 +1677,39 @@ read_next_key#:
 check_ov_valid#:
     alu[ent_state, ent_state, or, 1, <<__HASHMAP_DESC_VALID_BIT]
 check_ov#:
-    __hashmap_ov_lookup(hash[1], fd, tbl_addr_hi, ent_index, lm_key_addr, key_lwsz, map_tindex, ent_addr_hi, offset, ent_state, found#, endian, map_type)
+    __hashmap_ov_lookup(hash[1], fd, tbl_addr_hi, ent_index, slab, lm_key_addr, key_lwsz, slab_lwsz, map_tindex, ent_addr_hi, offset, ent_state, found#, endian, map_type)
+#if ( (OP != HASHMAP_OP_GETFIRST) && (CALLER != HASHMAP_CALLER_RESIZE) )
+    /* missed in the old layout of a map being resized, try the new one */
+    alu[new_part, part_cfg, and, __HASHMAP_PART_MSK]
+    alu[--, ent_part, -, new_part]
+    beq[new_layout#]
+    #if (OP == HASHMAP_OP_LOOKUP)
+        __hashmap_seq_end(ent_index, ent_seq, retry#)
+    #else
+        __hashmap_lock_release(ent_index, ent_state)
+    #endif
+    alu[ent_part, --, b, new_part]
+    __hashmap_index_from_hash(hash[0], ent_index)
+    __hashmap_select_partition(hash[0], ent_part, ent_index)
+    __hashmap_lock_init(ent_state, ent_addr_hi, offset, ent_index)
+    br[retry#], defer[1]
+        alu[tbl_addr_hi, --, b, ent_addr_hi]
+new_layout#:
+#endif
 #if ( (OP == HASHMAP_OP_ADD_ANY) || (OP == HASHMAP_OP_ADD_ONLY) )   /* entry does not exist */
         __hashmap_lock_upgrade(ent_index, ent_state, retry#)
+    #if (CALLER != HASHMAP_CALLER_RESIZE)
+        __hashmap_set_opt_field(out_rc, CMSG_RC_ERR_ENOMEM)
+        __hashmap_percpu_alloc(map_type, percpu_blk, miss#)
+        __hashmap_set_opt_field(out_rc, CMSG_RC_ERR_E2BIG)
+        __hashmap_table_take_credits(fd, no_room#)
+    #else
         __hashmap_set_opt_field(out_rc, CMSG_RC_ERR_E2BIG)
-        __hashmap_table_take_credits(fd, miss#)
+    #endif
         br_bclr[ent_state, __HASHMAP_DESC_VALID_BIT, write_tid_key#], defer[1]
         alu[ent_state, ent_state, and~, 1, <<__HASHMAP_DESC_VALID_BIT]
 
-        __hashmap_ov_add(hash[1], tbl_addr_hi, ent_index, fd, ent_addr_hi, offset, add_error#)
+        __hashmap_ov_add(hash[1], tbl_addr_hi, ent_index, fd, slab, ent_addr_hi, offset, add_error#)
         br[write_key#]
 write_tid_key#:
         __hashmap_write_tid(fd, ent_index)
@@ -843,16 +1718,36 @@ write_key#:
         __hashmap_set_opt_field(out_ent_lw, 0)
         alu[bytes, --, b, key_lwsz, <<2]
         __hashmap_calc_value_addr(offset, bytes, offset)
+        #if (CALLER != HASHMAP_CALLER_RESIZE)
+            __hashmap_percpu_set_block(map_type, percpu_blk, ent_addr_hi, offset, CALLER)
+        #endif
         __hashmap_write_field(lm_value_addr, value_mask, ent_addr_hi, offset, value_lwsz, endian)
         __hashmap_lock_release(ent_index, ent_state)
         __hashmap_set_opt_field(out_rc, CMSG_RC_SUCCESS)
         br[ret#]
 add_error#:
+    #if (CALLER != HASHMAP_CALLER_RESIZE)
     __hashmap_table_return_credits(fd)
+no_room#:
+    __hashmap_percpu_free(map_type, percpu_blk)
+    /* map or bucket full, an LRU map makes room within the bucket */
+    alu[--, map_type, -, BPF_MAP_TYPE_LRU_HASH]
+    bne[miss#]
+    __hashmap_lru_evict(fd, hash[1], tbl_addr_hi, ent_index, slab, ent_addr_hi, offset, miss#)
+    br[write_key#]
+    #else
+    /* a moved entry is not evicted, the old one stays in place */
+    br[miss#]
+    #endif
 #endif /* ADD_ANY/UPDATE entry */
     /* falls thru to miss if entry is not valid, not found, and not add/update function */
 miss#:
-    __hashmap_lock_release(ent_index, ent_state)
+    #if (OP == HASHMAP_OP_LOOKUP)
+        /* a writer may have moved the entry while it was searched for */
+        __hashmap_seq_end(ent_index, ent_seq, retry#)
+    #else
+        __hashmap_lock_release(ent_index, ent_state)
+    #endif
     #if (OP != HASHMAP_OP_GETNEXT)
         br[NOTFOUND_LABEL]
     #else
@@ -861,14 +1756,14 @@ miss#:
 #if ((OP == HASHMAP_OP_GETNEXT) || (OP == HASHMAP_OP_GETFIRST))
 getfirst_ent#:
         immed[ent_index, 0]
-        __hashmap_lock_init(ent_state, ent_addr_hi, offset, mu_partition, ent_index)
+        __hashmap_lock_init(ent_state, ent_addr_hi, offset, ent_index)
         alu[tbl_addr_hi, --, b, ent_addr_hi]
         __hashmap_lock_shared(ent_index, fd, found#, found#)
         br[found#]
 #endif
 #if (OP == HASHMAP_OP_REMOVE)
 delete_ov_ent#:
-    __hashmap_ov_delete(tbl_addr_hi, ent_index, offset, ent_state)
+    __hashmap_ov_delete(tbl_addr_hi, ent_index, slab, offset, ent_state)
     __hashmap_lock_release(ent_index, ent_state)
     br[ret#]
 #endif  /* REMOVE entry */
@@ -946,6 +1841,7 @@ ret#:
     #define MAP_RDXR $__pv_pkt_data
     #define HASHMAP_RXFR_COUNT 16
 
+    hashmap_prog_count_helper()
     local_csr_rd[ACTIVE_LM_ADDR_/**/HTAB_EBPF_LM_KEY_HANDLE]
     immed[lm_key_offset, 0]
     alu[tid, htab_in_tid, or, 0]
@@ -954,10 +1850,21 @@ ret#:
     immed[out_addr[0], 0]
     immed[out_addr[1], 0]
 
+    .begin
+        .reg key_sz, value_sz, key_mask, value_mask, map_type
+
+        hashmap_get_fd(tid, key_sz, value_sz, key_mask, value_mask, map_type, htab_lookup_error_map#)
+        alu[--, map_type, -, BPF_MAP_TYPE_LPM_TRIE]
+        beq[htab_lookup_lpm#]
+    .end
     hashmap_ops(tid, lm_key_offset, --, HASHMAP_OP_LOOKUP, htab_lookup_error_map#, htab_lookup_not_found#, HASHMAP_RTN_ADDR, --, --, out_addr, swap)
+    br[htab_lookup_done#]
+htab_lookup_lpm#:
+    hashmap_lpm_lookup(tid, lm_key_offset, htab_lookup_error_map#, htab_lookup_not_found#, --, out_addr, swap)
 
 htab_lookup_error_map#:
 htab_lookup_not_found#:
+htab_lookup_done#:
     // restore stack LM before returning from map function
     local_csr_wr[ACTIVE_LM_ADDR_/**/HTAB_EBPF_LM_KEY_HANDLE, lm_key_offset]
 
@@ -1104,4 +2011,75 @@ ret#:
 #endm
 
 
+/*
+ * XADD of an eBPF program on a map value, in place at the address the
+ * lookup returned. No entry lock is taken, the add is a single MU atomic
+ * command so updates from all MEs are counted.
+ *
+ * A1 value address hi as returned by the lookup, A0 value address lo
+ * plus the offset of the counter, B1 operand, B2 operand high word for
+ * WIDTH 64, B0 return address.
+ *
+ * The atomic engine adds big endian words, so the value words the programs
+ * XADD to are kept in NFP byte order, 64 bit counters low word first as
+ * mem[add64] carries them. The host marks these words at ALLOC and control
+ * messages swap them from and to host byte order, see
+ * hashmap_get_fd_xadd().
+ *
+ * Adds racing with a resize that moves the entry may be lost, the host
+ * resizes maps of counters before they fill up.
+ */
+#macro htab_map_xadd_subr_func(WIDTH)
+.reentry
+.begin
+    htab_subr_regs_alloc()
+    .reg htab_return_addr
+    .reg_addr htab_return_addr 0 B
+    .set htab_return_addr
+    .reg htab_value_addr_hi
+    .reg_addr htab_value_addr_hi 1 A
+    .set htab_value_addr_hi
+    .reg htab_value_addr_lo
+    .reg_addr htab_value_addr_lo 0 A
+    .set htab_value_addr_lo
+    .reg htab_operand
+    .reg_addr htab_operand 1 B
+    .set htab_operand
+    #if (WIDTH == 64)
+        .reg htab_operand_hi
+        .reg_addr htab_operand_hi 2 B
+        .set htab_operand_hi
+    #elif (WIDTH != 32)
+        #error "htab_map_xadd_subr_func: WIDTH must be 32 or 64"
+    #endif
+
+    .reg rtn_addr
+    .reg addr_lo
+    .reg $xadd[2]
+    .xfer_order $xadd
+    .sig sig_xadd
+
+    hashmap_prog_count_helper()
+    alu[rtn_addr, --, b, htab_return_addr]
+    alu[addr_lo, --, b, htab_value_addr_lo]
+    alu[$xadd[0], --, b, htab_operand]
+
+    #if (WIDTH == 64)
+        alu[$xadd[1], --, b, htab_operand_hi]
+        mem[add64, $xadd[0], htab_value_addr_hi, <<8, addr_lo, 1], ctx_swap[sig_xadd]
+    #else
+        mem[add, $xadd[0], htab_value_addr_hi, <<8, addr_lo, 1], ctx_swap[sig_xadd]
+    #endif
+
+    htab_subr_regs_free()
+    #pragma warning(push)
+    #pragma warning(disable: 5116)  // disable warning "Return register may not contain valid addr"
+        .use htab_return_addr
+        .use htab_value_addr_hi
+        rtn[rtn_addr]
+    #pragma warning(pop)
+.end
+#endm
+
+
 #endif  /* __HASHMAP_UC__ */
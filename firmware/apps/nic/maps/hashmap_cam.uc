@@ -54,51 +54,29 @@
 #define HASHMAP_MAX_OV_SZ    (HASHMAP_KEYS_VALU_SZ)
 #define HASHMAP_OV_ENTRY_SZ_SHFT (LOG2(HASHMAP_MAX_OV_SZ))
 
+/*
+ * Overflow entries of slab class n are (1 << (HASHMAP_SLAB_MIN_SZ_SHFT + n))
+ * bytes, each class has its own pool and free ring. The class of a map is
+ * set by hashmap_alloc_fd().
+ *
+ * Only overflow entries are sized by class. The buckets are shared by all
+ * maps and keep their HASHMAP_MAX_ENTRY_SZ bytes, the primary entry and the
+ * CAM of the overflow entries, so the classes add overflow entries rather
+ * than primary ones: the three pools hold 16M entries in the 512 MB that
+ * the single pool of 8M 64 byte entries took.
+ */
+#macro __hashmap_freelist_init(SLAB, NUM_ENTRIES)
 
-#macro __hashmap_freelist_init(NUM_ENTRIES)
-
-    passert(NUM_ENTRIES, "MULTIPLE_OF", 16)
-
-    // debug counters
-    pkt_counter_decl(num_ov_alloc)
-    pkt_counter_decl(num_ov_free)
-
-    EMEM0_QUEUE_ALLOC(HASHMAP_FREE_QID, global)
-    .alloc_mem HASHMAP_FREE_RBASE emem0 global (NUM_ENTRIES * 4) (NUM_ENTRIES * 4)
-    .init_mu_ring HASHMAP_FREE_QID HASHMAP_FREE_RBASE 0
-
-    .alloc_mem HASHMAP_FREEPOOL_BASE emem global (NUM_ENTRIES * HASHMAP_MAX_OV_SZ) 256
-    .init HASHMAP_FREEPOOL_BASE 0
-
-#ifdef GLOBAL_INIT
-    .if (ctx() == 0)
-    .begin
-        .sig sig_init_write
-        .reg base
-        .reg offset
-        .reg index
-        .reg $data[16]
-        .xfer_order $data
-
-        .reg val
-
-        move(index, (NUM_ENTRIES-1))
-        alu[val, --, b, 1, <<__HASHMAP_OV_SIG_BIT__]
-        .while (index > 0)
-            #define_eval __IDX 0
-            #while (__IDX < 16)
-                alu[$data[__IDX], val, or, index, <<HASHMAP_OV_ENTRY_SZ_SHFT]
-                alu[$data[__IDX], val, or, index]
-                alu[index, index, -, 1]
-                #define_eval __IDX (__IDX + 1)
-            #endloop
-            ru_emem_ring_op($data, HASHMAP_FREE_QID, sig_init_write, journal, HASHMAP_FREE_RBASE, 16, --)
-        .endw
-        #undef __IDX
-    .end
-    .endif
+    #if (SLAB == 0)
+        // debug counters
+        pkt_counter_decl(num_ov_alloc)
+        pkt_counter_decl(num_ov_free)
+    #endif
+
+    __hashmap_free_ring_init(HASHMAP_FREE_QID_/**/SLAB, HASHMAP_FREE_RBASE_/**/SLAB, 0, NUM_ENTRIES, __HASHMAP_OV_SIG_BIT__)
 
-#endif    //GLOBAL_INIT
+    .alloc_mem HASHMAP_FREEPOOL_BASE_/**/SLAB emem global (NUM_ENTRIES << (HASHMAP_SLAB_MIN_SZ_SHFT + SLAB)) 256
+    .init HASHMAP_FREEPOOL_BASE_/**/SLAB 0
 #endm
 
 /*
@@ -109,14 +87,52 @@
  *   put - add to tail
  */
 
-#macro __hashmap_freelist_alloc(out_index, NO_BUFF_LABEL)
+/* pool, free ring and entry offset of slab class in_slab */
+#macro __hashmap_slab_pool(in_slab, out_pool_hi)
+    .if (in_slab == 0)
+        move(out_pool_hi, HASHMAP_FREEPOOL_BASE_0 >>8)
+    .elif (in_slab == 1)
+        move(out_pool_hi, HASHMAP_FREEPOOL_BASE_1 >>8)
+    .else
+        move(out_pool_hi, HASHMAP_FREEPOOL_BASE_2 >>8)
+    .endif
+#endm
+
+/* CMD on the free ring of slab class in_slab, one entry */
+#macro __hashmap_slab_ring_op(in_slab, io_entry, in_sig, CMD, EMPTY_LABEL)
+    .if (in_slab == 0)
+        ru_emem_ring_op(io_entry, HASHMAP_FREE_QID_0, in_sig, CMD, HASHMAP_FREE_RBASE_0, 1, EMPTY_LABEL)
+    .elif (in_slab == 1)
+        ru_emem_ring_op(io_entry, HASHMAP_FREE_QID_1, in_sig, CMD, HASHMAP_FREE_RBASE_1, 1, EMPTY_LABEL)
+    .else
+        ru_emem_ring_op(io_entry, HASHMAP_FREE_QID_2, in_sig, CMD, HASHMAP_FREE_RBASE_2, 1, EMPTY_LABEL)
+    .endif
+#endm
+
+#macro __hashmap_slab_offset(in_slab, in_index, out_offset)
+.begin
+    .reg shft
+
+    alu[shft, in_slab, +, HASHMAP_SLAB_MIN_SZ_SHFT]
+    alu[--, shft, or, 0]
+    alu[out_offset, --, b, in_index, <<indirect]
+.end
+#endm
+
+/* entry size of slab class in_slab in LW */
+#macro __hashmap_slab_lw(in_slab, out_lw)
+    alu[--, in_slab, or, 0]
+    alu[out_lw, --, b, (1 << (HASHMAP_SLAB_MIN_SZ_SHFT - 2)), <<indirect]
+#endm
+
+#macro __hashmap_freelist_alloc(in_slab, out_index, NO_BUFF_LABEL)
 .begin
     .sig sig_freelist_pop
     .reg $free_index
     .reg max
 
 do_pop#:
-    ru_emem_ring_op($free_index, HASHMAP_FREE_QID, sig_freelist_pop, pop, HASHMAP_FREE_RBASE, 1,NO_BUFF_LABEL)
+    __hashmap_slab_ring_op(in_slab, $free_index, sig_freelist_pop, pop, NO_BUFF_LABEL)
 
     br_bclr[$free_index, __HASHMAP_OV_SIG_BIT__, do_pop#], defer[2]
     alu_shf[max, --, b, 1, <<__HASHMAP_OV_SIG_BIT__]
@@ -136,15 +152,17 @@ ret#:
 .end
 #endm
 
-#macro __hashmap_freelist_free(in_offset)
+#macro __hashmap_freelist_free(in_slab, in_offset)
 .begin
     .sig sig_freelist_put
     .reg $free_index
     .reg free_index
 
-    alu[free_index, --, b, in_offset, >>HASHMAP_OV_ENTRY_SZ_SHFT]
+    alu[free_index, in_slab, +, HASHMAP_SLAB_MIN_SZ_SHFT]
+    alu[--, free_index, or, 0]
+    alu[free_index, --, b, in_offset, >>indirect]
     alu[$free_index, free_index, or, 1, <<__HASHMAP_OV_SIG_BIT__]
-    ru_emem_ring_op($free_index, HASHMAP_FREE_QID, sig_freelist_put, put, HASHMAP_FREE_RBASE, 1, --)
+    __hashmap_slab_ring_op(in_slab, $free_index, sig_freelist_put, put, --)
     pkt_counter_incr(num_ov_free)
 ret#:
 .end
@@ -159,7 +177,7 @@ ret#:
     .sig dbg_ring_sig
     .reg ring_no
 
-    alu[ring_no, --, b, HASHMAP_FREE_QID]
+    alu[ring_no, --, b, HASHMAP_FREE_QID_0]
     immed40(r_addr, qdesc_addr, HASHMAP_FREE_QDESC)
     mem[push_qdesc, $qdesc[0], r_addr, <<8, ring_no], ctx_swap[dbg_ring_sig]
     nop
@@ -253,7 +271,7 @@ ret#:
 .end
 #endm
 
-#macro __hashmap_ov_add(in_hashkey, in_addr_hi, in_idx, in_tid, out_addr_hi, out_addr_lo, ERROR_LABEL)
+#macro __hashmap_ov_add(in_hashkey, in_addr_hi, in_idx, in_tid, in_slab, out_addr_hi, out_addr_lo, ERROR_LABEL)
 .begin
     .reg ov_offset
     .reg pool_index
@@ -263,45 +281,57 @@ ret#:
     .reg addr_lo
 
 
-    __hashmap_freelist_alloc(pool_index, no_free_buf#)
-    alu[addr_lo, --, b, in_idx, <<HASHMAP_ENTRY_SZ_SHFT]
+    __hashmap_freelist_alloc(in_slab, pool_index, no_free_buf#)
+    __hashmap_partition_offset(in_idx, addr_lo, HASHMAP_ENTRY_SZ_SHFT)
     alu[cam_offset, addr_lo, +, HASHMAP_OV_CAM_OFFSET]
 
     __hashmap_cam_add(in_hashkey, in_addr_hi, cam_offset, ov_offset, not_add#, cam_add_fail#)
 
     alu[$ov_addr, pool_index, or, in_tid, <<24]
     mem[write32, $ov_addr, in_addr_hi, <<8, ov_offset, 1], sig_done[ov_add_sig]
-    move(out_addr_hi, HASHMAP_FREEPOOL_BASE >>8)
-    alu[out_addr_lo, --, b, pool_index, <<HASHMAP_OV_ENTRY_SZ_SHFT]
+    __hashmap_slab_pool(in_slab, out_addr_hi)
+    __hashmap_slab_offset(in_slab, pool_index, out_addr_lo)
     ctx_arb[ov_add_sig], br[ret#]
 
 no_free_buf#:
-    /* TODO: LRU  */
+    /* LRU maps evict from the bucket in hashmap_ops() */
     br[ERROR_LABEL]
 
 not_add#:
 cam_add_fail#:
-    alu[pool_index, --, b, pool_index, <<HASHMAP_OV_ENTRY_SZ_SHFT]
-    __hashmap_freelist_free(pool_index)
+    __hashmap_slab_offset(in_slab, pool_index, pool_index)
+    __hashmap_freelist_free(in_slab, pool_index)
     br[ERROR_LABEL]
 ret#:
 .end
 #endm
 
-#macro __hashmap_ov_delete(in_addr_hi, in_idx, in_offset, in_state)
+#macro __hashmap_ov_delete(in_addr_hi, in_idx, in_slab, in_offset, in_state)
 .begin
     .reg ov_offset
     .reg cam_offset
     .reg $cam_wd
     .reg $value
+    .reg $ref_xfer
     .sig cam_del_sig
     .sig ov_del_sig
+    .sig ref_clr_sig
     .reg tmp
     .reg addr_lo
+    .reg lk_addr_hi
+    .reg lk_addr_lo
 
-    __hashmap_freelist_free(in_offset)
+    __hashmap_freelist_free(in_slab, in_offset)
 
-    alu[addr_lo, --, b, in_idx, <<HASHMAP_ENTRY_SZ_SHFT]
+    __hashmap_partition_offset(in_idx, addr_lo, HASHMAP_ENTRY_SZ_SHFT)
+
+    /* the slot starts out unreferenced for the next owner */
+    alu[tmp, 7, and, in_state, >>__HASHMAP_DESC_OV_IDX]
+    alu[tmp, tmp, +, __HASHMAP_DESC_LRU_OV_REF_BIT]
+    alu[--, tmp, or, 0]
+    alu[$ref_xfer, --, b, 1, <<indirect]
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
+    mem[clr, $ref_xfer, lk_addr_hi, <<8, lk_addr_lo, 1], sig_done[ref_clr_sig]
 
     #define __OV_IDX_SHFT__ (__HASHMAP_DESC_OV_IDX - 2)
     alu[cam_offset, 0x1c, and, in_state, >>__OV_IDX_SHFT__]
@@ -314,13 +344,13 @@ ret#:
     alu[ov_offset, cam_offset, +, HASHMAP_OV_ENTRY_OFFSET]
     immed[$value, 0]
     mem[write32, $value, in_addr_hi, <<8, ov_offset], sig_done[ov_del_sig]
-    ctx_arb[ov_del_sig, cam_del_sig]
+    ctx_arb[ov_del_sig, cam_del_sig, ref_clr_sig]
 
 .end
 #endm
 
 
-#macro __hashmap_ov_lookup(in_hashkey, in_tid, in_addr_hi, in_idx, in_key_lmaddr, in_key_lwsz, o_tindex, out_addr_hi, out_addr_lo, out_state, FOUND_LABEL, endian, map_type)
+#macro __hashmap_ov_lookup(in_hashkey, in_tid, in_addr_hi, in_idx, in_slab, in_key_lmaddr, in_key_lwsz, in_rd_lwsz, o_tindex, out_addr_hi, out_addr_lo, out_state, FOUND_LABEL, endian, map_type)
 .begin
     .reg ov_offset
     .reg match_bitmap
@@ -334,11 +364,11 @@ ret#:
     .reg tmp
     .reg addr_lo
 
-    alu[addr_lo, --, b, in_idx, <<HASHMAP_ENTRY_SZ_SHFT]
+    __hashmap_partition_offset(in_idx, addr_lo, HASHMAP_ENTRY_SZ_SHFT)
     alu[cam_offset, addr_lo, +, HASHMAP_OV_CAM_OFFSET]
 
     __hashmap_cam_lu(in_hashkey, in_addr_hi, cam_offset, match_idx, match_bitmap, ret#)
-    move(freelist_hi, HASHMAP_FREEPOOL_BASE >>8)
+    __hashmap_slab_pool(in_slab, freelist_hi)
 
 match#:
     alu[match_idx, --, b, match_idx, <<2]
@@ -357,8 +387,8 @@ match#:
 
 compare_key#:
     ld_field_w_clr[pool_offset, 0111, $ov_addr]
-    alu[pool_offset, --, b, pool_offset, <<HASHMAP_OV_ENTRY_SZ_SHFT]
-    __hashmap_compare(o_tindex, in_key_lmaddr, freelist_hi, pool_offset, in_key_lwsz, comp_next_match#, endian, map_type)
+    __hashmap_slab_offset(in_slab, pool_offset, pool_offset)
+    __hashmap_compare(o_tindex, in_key_lmaddr, freelist_hi, pool_offset, in_key_lwsz, in_rd_lwsz, comp_next_match#, endian, map_type)
     #define __OV_IDX_SHFT__ (__HASHMAP_DESC_OV_IDX - 2)
     alu[out_state, out_state, or, match_idx, <<__OV_IDX_SHFT__]
     alu[out_state, out_state, or, 1, <<__HASHMAP_DESC_OV_BIT]
@@ -376,7 +406,7 @@ ret#:
 .end
 #endm
 
-#macro __hashmap_ov_getnext(in_addr_hi, in_idx, in_tid, out_addr_hi, out_addr_lo, io_state, FOUND_LABEL)
+#macro __hashmap_ov_getnext(in_addr_hi, in_idx, in_tid, in_slab, out_addr_hi, out_addr_lo, io_state, FOUND_LABEL)
 .begin
     .reg lm_off
     .reg ov_offset
@@ -392,7 +422,7 @@ ret#:
     alu[ctx_tindex, (&$ov_addr[0] << 2), or, my_act_ctx, <<7]
 
     #define __OV_OFFSET__    (HASHMAP_OV_CAM_OFFSET+HASHMAP_OV_ENTRY_OFFSET)
-    alu[ov_offset, --, b, in_idx, <<HASHMAP_ENTRY_SZ_SHFT]
+    __hashmap_partition_offset(in_idx, ov_offset, HASHMAP_ENTRY_SZ_SHFT)
     alu[ov_offset, ov_offset, +, __OV_OFFSET__]
     #undef __OV_OFFSET__
     mem[read32, $ov_addr[0], in_addr_hi, <<8, ov_offset, 8], sig_done[ov_read_sig]
@@ -420,9 +450,9 @@ next_entry#:
         alu[ov_idx, ov_idx, +, 1]
 
 found#:
-    move(out_addr_hi, HASHMAP_FREEPOOL_BASE>>8)
+    __hashmap_slab_pool(in_slab, out_addr_hi)
     ld_field_w_clr[out_addr_lo, 0111, value]
-    alu[out_addr_lo, --, b, out_addr_lo, <<HASHMAP_OV_ENTRY_SZ_SHFT]
+    __hashmap_slab_offset(in_slab, out_addr_lo, out_addr_lo)
     br[FOUND_LABEL], defer[2]
         alu[io_state, io_state, or, 1, <<__HASHMAP_DESC_OV_BIT]
         alu[io_state, io_state, or, idx, <<__HASHMAP_DESC_OV_IDX]
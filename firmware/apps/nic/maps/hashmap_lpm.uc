@@ -0,0 +1,879 @@
+/*
+ * Copyright (C) 2020,  Netronome Systems, Inc.  All rights reserved.
+ *
+ * @file       hashmap_lpm.uc
+ * @brief      longest prefix match tables of BPF_MAP_TYPE_LPM_TRIE maps.
+ *
+ * The key of an LPM_TRIE map is a 32 bit prefix length followed by the
+ * address bytes, see struct bpf_lpm_trie_key. Prefixes are kept in a
+ * multibit trie with a stride of 8 bits: byte d of the address picks a
+ * slot of the node at level d, prefixes of 8d+1 to 8d+8 bits (and the
+ * default route at level 0) are stored in that node and expanded over the
+ * slots they cover. A slot holds the longest prefix of its node covering
+ * it and the node of the next level.
+ *
+ * A lookup reads one 8 byte slot per address byte of the key prefix and
+ * stops at the first slot without a child: at most 4 reads for IPv4 and
+ * 16 for IPv6. A key prefix length that is not a multiple of 8 adds up to
+ * 8 reads of the prefixes of the last node, the datapath looks up full
+ * length keys. A wider root stride would cut IPv4 to 2 reads but takes a
+ * 512 KB (16 bit) or 128 MB (24 bit) root node per map.
+ *
+ * node, HASHMAP_LPM_NODE_SZ bytes
+ *    slot[256]     w0: (prefix length + 1) << 24 | leaf, w1: child node
+ *    pfx[512]      leaf of the prefix of r bits at pfx[(1 << r) | byte >> (8 - r)],
+ *                  pfx[0] counts the prefixes and children of the node
+ *
+ * leaf, HASHMAP_LPM_LEAF_SZ bytes
+ *    w0 fd, w1 next leaf, w2 previous leaf, key at 16, value after the key
+ *
+ * Node n of fd n is the root of the map, others come from a free ring as
+ * do the leaves. Node and leaf 0 are never handed out, 0 is no child and
+ * no prefix. The leaves of a map are listed from the fd table for
+ * getnext and free.
+ *
+ * The datapath only looks up, the map ME serialises the updates. Slots
+ * are rewritten after the leaf is complete and before it is freed.
+ * Lookups take no lock, so a lookup may still hold a leaf or node that an
+ * update frees. The free rings are FIFOs for this: a freed leaf is handed
+ * out again only after the leaves ahead of it in the ring. Maps hold at
+ * most HASHMAP_LPM_LEAVES - HASHMAP_LPM_LEAF_DEFER prefixes, so while they
+ * do not share more than that, that is at least HASHMAP_LPM_LEAF_DEFER
+ * updates later. That is many map ME round trips after a lookup has read
+ * the value.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __HASHMAP_LPM_UC__
+#define __HASHMAP_LPM_UC__
+
+#include <nfp_chipres.h>
+#include <ring_utils.uc>
+#include <ring_ext.uc>
+
+#ifndef HASHMAP_LPM_NODES
+    #define HASHMAP_LPM_NODES               4096
+#endif
+
+#ifndef HASHMAP_LPM_LEAVES
+    #define HASHMAP_LPM_LEAVES              (64 * 1024)
+#endif
+
+/* free leaves a freed leaf waits behind before it is reused */
+#ifndef HASHMAP_LPM_LEAF_DEFER
+    #define HASHMAP_LPM_LEAF_DEFER          1024
+#endif
+#define_eval __HASHMAP_LPM_MAX_ENTRIES      (HASHMAP_LPM_LEAVES - HASHMAP_LPM_LEAF_DEFER)
+
+#define HASHMAP_LPM_MAX_DATA_SZ             16      /* IPv6 */
+#define HASHMAP_LPM_MIN_KEY_SZ              5
+#define HASHMAP_LPM_MAX_KEY_SZ              (4 + HASHMAP_LPM_MAX_DATA_SZ)
+#define_eval HASHMAP_LPM_MAX_KEY_LW         (HASHMAP_LPM_MAX_KEY_SZ >> 2)
+
+#define HASHMAP_LPM_NODE_SZ                 4096
+#define HASHMAP_LPM_NODE_SZ_SHFT            12
+#define __HASHMAP_LPM_SLOT_SZ_SHFT          3
+#define __HASHMAP_LPM_SLOT_NDX_LEAF         0
+#define __HASHMAP_LPM_SLOT_NDX_CHILD        1
+#define __HASHMAP_LPM_SLOT_PLEN_SHFT        24
+#define __HASHMAP_LPM_PFX_SHFT              11      /* pfx[] follows the 256 slots */
+
+#define HASHMAP_LPM_LEAF_SZ                 128
+#define HASHMAP_LPM_LEAF_SZ_SHFT            7
+#define __HASHMAP_LPM_LEAF_NDX_FD           0
+#define __HASHMAP_LPM_LEAF_NDX_NEXT         1
+#define __HASHMAP_LPM_LEAF_NDX_PREV         2
+#define __HASHMAP_LPM_LEAF_KEY_OFFSET       16
+
+#define __HASHMAP_LPM_SIG_BIT__             31
+
+
+#macro __hashmap_lpm_init()
+
+    /* nodes past the roots, leaves from 1 */
+    __hashmap_free_ring_init(HASHMAP_LPM_NODE_QID, HASHMAP_LPM_NODE_RBASE, HASHMAP_MAX_TID, HASHMAP_LPM_NODES, __HASHMAP_LPM_SIG_BIT__)
+    __hashmap_free_ring_init(HASHMAP_LPM_LEAF_QID, HASHMAP_LPM_LEAF_RBASE, 1, HASHMAP_LPM_LEAVES, __HASHMAP_LPM_SIG_BIT__)
+
+    .alloc_mem __HASHMAP_LPM_NODE_TBL emem global ((HASHMAP_MAX_TID + HASHMAP_LPM_NODES) * HASHMAP_LPM_NODE_SZ) HASHMAP_LPM_NODE_SZ
+    .init __HASHMAP_LPM_NODE_TBL 0
+    .alloc_mem __HASHMAP_LPM_LEAF_TBL emem global ((HASHMAP_LPM_LEAVES + 1) * HASHMAP_LPM_LEAF_SZ) 256
+    .init __HASHMAP_LPM_LEAF_TBL 0
+#endm
+
+
+/* take from the head of the ring, __hashmap_lpm_push() adds to the tail */
+#macro __hashmap_lpm_get(out_index, QID, RBASE, NO_ENTRY_LABEL)
+.begin
+    .sig sig_lpm_get
+    .reg $index
+    .reg sig
+
+do_get#:
+    ru_emem_ring_op($index, QID, sig_lpm_get, get, RBASE, 1, NO_ENTRY_LABEL)
+    br_bclr[$index, __HASHMAP_LPM_SIG_BIT__, do_get#], defer[2]
+    alu_shf[sig, --, b, 1, <<__HASHMAP_LPM_SIG_BIT__]
+    alu[out_index, $index, and~, sig]
+.end
+#endm
+
+#macro __hashmap_lpm_push(in_index, QID, RBASE)
+.begin
+    .sig sig_lpm_put
+    .reg $index
+
+    alu[$index, in_index, or, 1, <<__HASHMAP_LPM_SIG_BIT__]
+    ru_emem_ring_op($index, QID, sig_lpm_put, put, RBASE, 1, --)
+.end
+#endm
+
+/* nodes are empty when they are freed */
+#macro __hashmap_lpm_node_alloc(out_node, NO_NODE_LABEL)
+    __hashmap_lpm_get(out_node, HASHMAP_LPM_NODE_QID, HASHMAP_LPM_NODE_RBASE, NO_NODE_LABEL)
+#endm
+
+#macro __hashmap_lpm_node_free(in_node)
+    __hashmap_lpm_push(in_node, HASHMAP_LPM_NODE_QID, HASHMAP_LPM_NODE_RBASE)
+#endm
+
+#macro __hashmap_lpm_leaf_alloc(out_leaf, NO_LEAF_LABEL)
+    __hashmap_lpm_get(out_leaf, HASHMAP_LPM_LEAF_QID, HASHMAP_LPM_LEAF_RBASE, NO_LEAF_LABEL)
+#endm
+
+/*
+ * freed leaves go to the tail of the ring, a lookup that still holds one
+ * reads it before it comes round again, see HASHMAP_LPM_LEAF_DEFER
+ */
+#macro __hashmap_lpm_leaf_free(in_leaf)
+    __hashmap_lpm_push(in_leaf, HASHMAP_LPM_LEAF_QID, HASHMAP_LPM_LEAF_RBASE)
+#endm
+
+
+/* offset of slot in_byte of in_node */
+#macro __hashmap_lpm_slot_offset(in_node, in_byte, out_offset)
+    alu[out_offset, --, b, in_node, <<HASHMAP_LPM_NODE_SZ_SHFT]
+    alu[out_offset, out_offset, or, in_byte, <<__HASHMAP_LPM_SLOT_SZ_SHFT]
+#endm
+
+/* offset of the prefix of in_bits bits of in_byte in in_node */
+#macro __hashmap_lpm_pfx_offset(in_node, in_bits, in_byte, out_offset)
+.begin
+    .reg shft
+    .reg pos
+
+    alu[shft, 8, -, in_bits]
+    alu[--, shft, or, 0]
+    alu[pos, --, b, in_byte, >>indirect]
+    alu[--, in_bits, or, 0]
+    alu[shft, --, b, 1, <<indirect]
+    alu[pos, pos, or, shft]
+    alu[out_offset, --, b, in_node, <<HASHMAP_LPM_NODE_SZ_SHFT]
+    alu[out_offset, out_offset, or, 1, <<__HASHMAP_LPM_PFX_SHFT]
+    alu[out_offset, out_offset, +, pos, <<2]
+.end
+#endm
+
+/* offset of the value of in_leaf */
+#macro __hashmap_lpm_value_offset(in_leaf, in_key_lwsz, out_offset)
+.begin
+    .reg bytes
+
+    alu[bytes, --, b, in_key_lwsz, <<2]
+    alu[out_offset, --, b, in_leaf, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+    alu[out_offset, out_offset, +, __HASHMAP_LPM_LEAF_KEY_OFFSET]
+    __hashmap_calc_value_addr(out_offset, bytes, out_offset)
+.end
+#endm
+
+/* fd table word holding the first leaf of in_fd */
+#macro __hashmap_lpm_head_offset(in_fd, out_addr_hi, out_offset)
+    move(out_addr_hi, __HASHMAP_FD_TBL >>8)
+    alu[out_offset, --, b, in_fd, <<__HASHMAP_FD_TBL_SHFT]
+    alu[out_offset, out_offset, +, (__HASHMAP_FD_NDX_LPM_HEAD * 4)]
+#endm
+
+/* prefixes and children of in_node, OP is + or - */
+#macro __hashmap_lpm_count(in_node, OP, out_count)
+.begin
+    .reg addr_hi
+    .reg offset
+    .reg count
+    .reg $count
+    .sig sig_count
+
+    move(addr_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    alu[offset, --, b, in_node, <<HASHMAP_LPM_NODE_SZ_SHFT]
+    alu[offset, offset, or, 1, <<__HASHMAP_LPM_PFX_SHFT]
+    mem[read32, $count, addr_hi, <<8, offset, 1], ctx_swap[sig_count]
+    alu[count, $count, OP, 1]
+    alu[$count, --, b, count]
+    mem[write32, $count, addr_hi, <<8, offset, 1], ctx_swap[sig_count]
+    __hashmap_set_opt_field(out_count, count)
+.end
+#endm
+
+
+/*
+ * next address byte of the key, HASHMAP_LM_INDEX walks the key words and
+ * io_word holds the current one
+ */
+#macro __hashmap_lpm_next_byte(in_depth, io_word, out_byte, endian)
+.begin
+    .reg shft
+
+    alu[shft, in_depth, and, 3]
+    bne[have_word#]
+    alu[io_word, --, b, HASHMAP_LM_INDEX++]
+have_word#:
+    #if (streq('endian', 'swap'))
+        alu[shft, --, b, shft, <<3]
+    #else
+        alu[shft, 3, -, shft]
+        alu[shft, --, b, shft, <<3]
+    #endif
+    alu[--, shft, or, 0]
+    alu[out_byte, 0xff, and, io_word, >>indirect]
+.end
+#endm
+
+/* address byte in_depth of the key at in_lm_key */
+#macro __hashmap_lpm_key_byte(in_lm_key, in_depth, out_byte, endian)
+.begin
+    .reg offset
+    .reg shft
+
+    __hashmap_lm_handles_define()
+    alu[offset, in_depth, and~, 3]
+    alu[offset, offset, +, in_lm_key]
+    alu[offset, offset, +, 4]
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, offset]
+    alu[shft, in_depth, and, 3]
+    #if (streq('endian', 'swap'))
+        alu[shft, --, b, shft, <<3]
+    #else
+        alu[shft, 3, -, shft]
+        alu[shft, --, b, shft, <<3]
+    #endif
+    alu[--, shft, or, 0]
+    alu[out_byte, 0xff, and, HASHMAP_LM_INDEX, >>indirect]
+    __hashmap_lm_handles_undef()
+.end
+#endm
+
+/*
+ * prefix length of the key, the level its prefix is stored at and its
+ * bits within that level, keys longer than the map are rejected
+ */
+#macro __hashmap_lpm_key_prefix(in_lm_key, in_key_lwsz, out_plen, out_depth, out_bits, BAD_KEY_LABEL)
+.begin
+    .reg max
+
+    __hashmap_lm_handles_define()
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, in_lm_key]
+    alu[max, --, b, in_key_lwsz, <<5]
+    alu[max, max, -, 32]
+    immed[out_depth, 0]
+    alu[out_plen, --, b, HASHMAP_LM_INDEX]
+    __hashmap_lm_handles_undef()
+
+    alu[--, max, -, out_plen]
+    blo[BAD_KEY_LABEL]
+    alu[out_bits, --, b, out_plen]
+    beq[ret#]
+    alu[out_depth, out_plen, -, 1]
+    alu[out_depth, --, b, out_depth, >>3]
+    alu[out_bits, out_plen, -, out_depth, <<3]
+ret#:
+.end
+#endm
+
+
+/*
+ * node at level in_depth on the path of the key, out_level is the level
+ * reached. With CREATE missing nodes are added, the caller prunes the
+ * path if the node pool runs out.
+ */
+#macro __hashmap_lpm_walk(in_fd, in_lm_key, in_depth, out_node, out_level, NO_NODE_LABEL, endian, CREATE)
+.begin
+    .reg level
+    .reg byte
+    .reg offset
+    .reg child
+    .reg addr_hi
+    .reg $child
+    .sig sig_child
+
+    move(addr_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    alu[out_node, --, b, in_fd]
+    immed[level, 0]
+walk_loop#:
+    __hashmap_set_opt_field(out_level, level)
+    alu[--, level, -, in_depth]
+    beq[ret#]
+    __hashmap_lpm_key_byte(in_lm_key, level, byte, endian)
+    __hashmap_lpm_slot_offset(out_node, byte, offset)
+    alu[offset, offset, +, (__HASHMAP_LPM_SLOT_NDX_CHILD * 4)]
+    mem[read32, $child, addr_hi, <<8, offset, 1], ctx_swap[sig_child]
+    alu[child, --, b, $child]
+    bne[walk_next#]
+    #if (CREATE)
+        __hashmap_lpm_node_alloc(child, NO_NODE_LABEL)
+        alu[$child, --, b, child]
+        mem[write32, $child, addr_hi, <<8, offset, 1], ctx_swap[sig_child]
+        __hashmap_lpm_count(out_node, +, --)
+    #else
+        br[NO_NODE_LABEL]
+    #endif
+walk_next#:
+    alu[out_node, --, b, child]
+    br[walk_loop#], defer[1]
+        alu[level, level, +, 1]
+ret#:
+.end
+#endm
+
+/*
+ * free in_node at level in_depth and the nodes above it it leaves empty,
+ * a node is empty once it has no prefix and no child
+ */
+#macro __hashmap_lpm_prune(in_fd, in_lm_key, in_node, in_depth, endian)
+.begin
+    .reg node
+    .reg depth
+    .reg parent
+    .reg byte
+    .reg offset
+    .reg addr_hi
+    .reg $count
+    .sig sig_prune
+
+    move(addr_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    alu[node, --, b, in_node]
+    alu[depth, --, b, in_depth]
+prune_loop#:
+    alu[--, --, b, depth]
+    beq[ret#]
+    alu[offset, --, b, node, <<HASHMAP_LPM_NODE_SZ_SHFT]
+    alu[offset, offset, or, 1, <<__HASHMAP_LPM_PFX_SHFT]
+    mem[read32, $count, addr_hi, <<8, offset, 1], ctx_swap[sig_prune]
+    alu[--, --, b, $count]
+    bne[ret#]
+
+    /* the slot of the parent is the only link to the node */
+    alu[depth, depth, -, 1]
+    __hashmap_lpm_walk(in_fd, in_lm_key, depth, parent, --, ret#, endian, 0)
+    __hashmap_lpm_key_byte(in_lm_key, depth, byte, endian)
+    __hashmap_lpm_slot_offset(parent, byte, offset)
+    alu[offset, offset, +, (__HASHMAP_LPM_SLOT_NDX_CHILD * 4)]
+    alu[$count, --, b, 0]
+    mem[write32, $count, addr_hi, <<8, offset, 1], ctx_swap[sig_prune]
+    __hashmap_lpm_node_free(node)
+    __hashmap_lpm_count(parent, -, --)
+    br[prune_loop#], defer[1]
+        alu[node, --, b, parent]
+ret#:
+.end
+#endm
+
+/*
+ * set the slots of in_node covered by the prefix of in_bits bits of
+ * in_byte to in_slot, SKIP_BR skips those whose prefix length compares
+ * to in_plen_w (prefix length + 1) as given
+ */
+#macro __hashmap_lpm_fill(in_node, in_bits, in_byte, in_plen_w, in_slot, SKIP_BR)
+.begin
+    .reg shft
+    .reg first
+    .reg count
+    .reg offset
+    .reg addr_hi
+    .reg plen_w
+    .reg $slot
+    .sig sig_fill
+
+    move(addr_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    alu[shft, 8, -, in_bits]
+    alu[--, shft, or, 0]
+    alu[first, --, b, in_byte, >>indirect]
+    alu[--, shft, or, 0]
+    alu[first, --, b, first, <<indirect]
+    alu[--, shft, or, 0]
+    alu[count, --, b, 1, <<indirect]
+    __hashmap_lpm_slot_offset(in_node, first, offset)
+fill_loop#:
+    mem[read32, $slot, addr_hi, <<8, offset, 1], ctx_swap[sig_fill]
+    alu[plen_w, --, b, $slot, >>__HASHMAP_LPM_SLOT_PLEN_SHFT]
+    alu[--, in_plen_w, -, plen_w]
+    SKIP_BR[fill_next#]
+    alu[$slot, --, b, in_slot]
+    mem[write32, $slot, addr_hi, <<8, offset, 1], ctx_swap[sig_fill]
+fill_next#:
+    alu[count, count, -, 1]
+    bne[fill_loop#], defer[1]
+        alu[offset, offset, +, (1 << __HASHMAP_LPM_SLOT_SZ_SHFT)]
+.end
+#endm
+
+
+/*
+ * check the key size of a new LPM_TRIE map and clear its root, keys have
+ * 1 to HASHMAP_LPM_MAX_DATA_SZ address bytes. The leaves and nodes are
+ * shared by all LPM_TRIE maps, a map of more than HASHMAP_LPM_LEAVES less
+ * the HASHMAP_LPM_LEAF_DEFER ones kept back for reuse could never fill
+ * and branches to NO_ROOM_LABEL.
+ */
+#macro hashmap_lpm_alloc(in_fd, in_key_size, in_max_entries, ERROR_LABEL, NO_ROOM_LABEL)
+.begin
+    .reg addr_hi
+    .reg offset
+    .reg end
+    .reg $zero[16]
+    .xfer_order $zero
+    .sig sig_zero
+
+    alu[--, in_key_size, -, HASHMAP_LPM_MIN_KEY_SZ]
+    blo[ERROR_LABEL]
+    alu[--, in_key_size, -, (HASHMAP_LPM_MAX_KEY_SZ + 1)]
+    bhs[ERROR_LABEL]
+    move(end, __HASHMAP_LPM_MAX_ENTRIES)
+    alu[--, end, -, in_max_entries]
+    blo[NO_ROOM_LABEL]
+
+    aggregate_zero($zero, 16)
+    move(addr_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    alu[offset, --, b, in_fd, <<HASHMAP_LPM_NODE_SZ_SHFT]
+    alu[end, offset, +, 1, <<HASHMAP_LPM_NODE_SZ_SHFT]
+clear_loop#:
+    mem[write32, $zero[0], addr_hi, <<8, offset, 16], ctx_swap[sig_zero]
+    alu[offset, offset, +, 64]
+    alu[--, end, -, offset]
+    bne[clear_loop#]
+
+    __hashmap_lpm_head_offset(in_fd, addr_hi, offset)
+    mem[write32, $zero[0], addr_hi, <<8, offset, 1], ctx_swap[sig_zero]
+.end
+#endm
+
+/*
+ * longest prefix match of the key at in_lm_key, the key prefix length
+ * bounds the bits compared. out_ent_addr is the value of the leaf.
+ */
+#macro hashmap_lpm_lookup(in_fd, in_lm_key, INVALID_MAP_LABEL, NOTFOUND_LABEL, out_ent_lw, out_ent_addr, endian)
+.begin
+    .reg key_lwsz
+    .reg value_lwsz
+    .reg key_mask
+    .reg value_mask
+    .reg map_type
+    .reg plen
+    .reg max
+    .reg node
+    .reg leaf
+    .reg depth
+    .reg bits
+    .reg word
+    .reg byte
+    .reg offset
+    .reg addr_hi
+    .reg $slot[2]
+    .xfer_order $slot
+    .sig sig_slot
+
+    hashmap_get_fd(in_fd, key_lwsz, value_lwsz, key_mask, value_mask, map_type, INVALID_MAP_LABEL)
+
+    __hashmap_lm_handles_define()
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, in_lm_key]
+    move(addr_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    alu[max, --, b, key_lwsz, <<5]
+    alu[max, max, -, 32]
+    alu[plen, --, b, HASHMAP_LM_INDEX++]
+    alu[--, max, -, plen]
+    bhs[plen_ok#]
+    alu[plen, --, b, max]
+plen_ok#:
+    alu[node, --, b, in_fd]
+    immed[leaf, 0]
+    immed[depth, 0]
+
+    /* one slot per full byte, deeper prefixes are longer ones */
+walk#:
+    alu[--, plen, -, 8]
+    blo[partial#]
+    __hashmap_lpm_next_byte(depth, word, byte, endian)
+    __hashmap_lpm_slot_offset(node, byte, offset)
+    mem[read32, $slot[0], addr_hi, <<8, offset, 2], ctx_swap[sig_slot]
+    alu[plen, plen, -, 8]
+    alu[depth, depth, +, 1]
+    alu[--, --, b, $slot[__HASHMAP_LPM_SLOT_NDX_LEAF]]
+    beq[no_leaf#]
+    alu[leaf, --, b, $slot[__HASHMAP_LPM_SLOT_NDX_LEAF]]
+no_leaf#:
+    alu[node, --, b, $slot[__HASHMAP_LPM_SLOT_NDX_CHILD]]
+    bne[walk#]
+    br[found#]
+
+    /* prefixes of the node no longer than the bits left */
+partial#:
+    alu[bits, --, b, plen]
+    bne[partial_byte#]
+    alu[--, --, b, depth]
+    bne[found#]
+    br[scan#], defer[1]
+        immed[byte, 0]
+partial_byte#:
+    __hashmap_lpm_next_byte(depth, word, byte, endian)
+scan#:
+    __hashmap_lpm_pfx_offset(node, bits, byte, offset)
+    mem[read32, $slot[0], addr_hi, <<8, offset, 1], ctx_swap[sig_slot]
+    alu[--, --, b, $slot[0]]
+    bne[scan_hit#]
+    alu[--, --, b, bits]
+    beq[found#]
+    alu[bits, bits, -, 1]
+    bne[scan#]
+    alu[--, --, b, depth]
+    beq[scan#]
+    br[found#]
+scan_hit#:
+    alu[leaf, --, b, $slot[0]]
+
+found#:
+    __hashmap_lm_handles_undef()
+    alu[leaf, leaf, and~, 0xff, <<__HASHMAP_LPM_SLOT_PLEN_SHFT]
+    beq[NOTFOUND_LABEL]
+    __hashmap_set_opt_field(out_ent_lw, value_lwsz)
+    #if (!streq('out_ent_addr', '--'))
+        move(out_ent_addr[0], __HASHMAP_LPM_LEAF_TBL >>8)
+        __hashmap_lpm_value_offset(leaf, key_lwsz, out_ent_addr[1])
+    #endif
+.end
+#endm
+
+/*
+ * in_op is HASHMAP_OP_ADD_ANY, _ADD_ONLY or _UPDATE. A new prefix takes a
+ * credit of the map and a leaf, the nodes on its path are added as needed.
+ * Errors go to NOTFOUND_LABEL with out_rc set.
+ */
+#macro hashmap_lpm_update(in_fd, in_lm_key, in_lm_value, in_op, INVALID_MAP_LABEL, NOTFOUND_LABEL, endian, out_rc)
+.begin
+    .reg key_lwsz
+    .reg value_lwsz
+    .reg key_mask
+    .reg value_mask
+    .reg map_type
+    .reg plen
+    .reg plen_w
+    .reg depth
+    .reg level
+    .reg bits
+    .reg node
+    .reg byte
+    .reg pfx_offset
+    .reg offset
+    .reg leaf
+    .reg head
+    .reg slot
+    .reg node_hi
+    .reg leaf_hi
+    .reg fd_hi
+    .reg fd_offset
+    .reg my_act_ctx
+    .reg $pfx
+    .reg $link[3]
+    .xfer_order $link
+    .sig sig_pfx
+    .sig sig_link
+
+    hashmap_get_fd(in_fd, key_lwsz, value_lwsz, key_mask, value_mask, map_type, INVALID_MAP_LABEL)
+    local_csr_rd[ACTIVE_CTX_STS]
+    immed[my_act_ctx, 0]
+    alu_shf[my_act_ctx, my_act_ctx, and, 0x7]
+
+    immed[out_rc, CMSG_RC_ERR_MAP_ERR]
+    __hashmap_lpm_key_prefix(in_lm_key, key_lwsz, plen, depth, bits, NOTFOUND_LABEL)
+
+    .if (in_op == HASHMAP_OP_UPDATE)
+        immed[out_rc, CMSG_RC_ERR_ENOENT]
+        __hashmap_lpm_walk(in_fd, in_lm_key, depth, node, --, NOTFOUND_LABEL, endian, 0)
+    .else
+        immed[out_rc, CMSG_RC_ERR_ENOMEM]
+        __hashmap_lpm_walk(in_fd, in_lm_key, depth, node, level, no_room#, endian, 1)
+    .endif
+
+    move(node_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    move(leaf_hi, __HASHMAP_LPM_LEAF_TBL >>8)
+    __hashmap_lpm_key_byte(in_lm_key, depth, byte, endian)
+    __hashmap_lpm_pfx_offset(node, bits, byte, pfx_offset)
+    mem[read32, $pfx, node_hi, <<8, pfx_offset, 1], ctx_swap[sig_pfx]
+    alu[leaf, --, b, $pfx]
+    bne[update_value#]
+
+    .if (in_op == HASHMAP_OP_UPDATE)
+        immed[out_rc, CMSG_RC_ERR_ENOENT]
+        br[NOTFOUND_LABEL]
+    .endif
+    immed[out_rc, CMSG_RC_ERR_E2BIG]
+    __hashmap_table_take_credits(in_fd, no_room#)
+    immed[out_rc, CMSG_RC_ERR_ENOMEM]
+    __hashmap_lpm_leaf_alloc(leaf, no_leaf#)
+
+    /* the leaf is complete before the trie points to it */
+    __hashmap_lpm_head_offset(in_fd, fd_hi, fd_offset)
+    mem[read32, $link[0], fd_hi, <<8, fd_offset, 1], ctx_swap[sig_link]
+    alu[head, --, b, $link[0]]
+    alu[$link[__HASHMAP_LPM_LEAF_NDX_FD], --, b, in_fd]
+    alu[$link[__HASHMAP_LPM_LEAF_NDX_NEXT], --, b, head]
+    alu[$link[__HASHMAP_LPM_LEAF_NDX_PREV], --, b, 0]
+    alu[offset, --, b, leaf, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+    mem[write32, $link[0], leaf_hi, <<8, offset, 3], ctx_swap[sig_link]
+    alu[offset, offset, +, __HASHMAP_LPM_LEAF_KEY_OFFSET]
+    __hashmap_write_field(in_lm_key, key_mask, leaf_hi, offset, key_lwsz, endian)
+    __hashmap_lpm_value_offset(leaf, key_lwsz, offset)
+    __hashmap_write_field(in_lm_value, value_mask, leaf_hi, offset, value_lwsz, endian)
+
+    alu[$link[0], --, b, leaf]
+    alu[--, --, b, head]
+    beq[link_head#]
+    alu[offset, --, b, head, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+    alu[offset, offset, +, (__HASHMAP_LPM_LEAF_NDX_PREV * 4)]
+    mem[write32, $link[0], leaf_hi, <<8, offset, 1], ctx_swap[sig_link]
+link_head#:
+    mem[write32, $link[0], fd_hi, <<8, fd_offset, 1], ctx_swap[sig_link]
+
+    alu[$pfx, --, b, leaf]
+    mem[write32, $pfx, node_hi, <<8, pfx_offset, 1], ctx_swap[sig_pfx]
+    __hashmap_lpm_count(node, +, --)
+    alu[plen_w, plen, +, 1]
+    alu[slot, leaf, or, plen_w, <<__HASHMAP_LPM_SLOT_PLEN_SHFT]
+    __hashmap_lpm_fill(node, bits, byte, plen_w, slot, blo)
+    br[ret#], defer[1]
+        immed[out_rc, CMSG_RC_SUCCESS]
+
+update_value#:
+    .if (in_op == HASHMAP_OP_ADD_ONLY)
+        immed[out_rc, CMSG_RC_ERR_EEXIST]
+        br[NOTFOUND_LABEL]
+    .endif
+    __hashmap_lpm_value_offset(leaf, key_lwsz, offset)
+    __hashmap_write_field(in_lm_value, value_mask, leaf_hi, offset, value_lwsz, endian)
+    br[ret#], defer[1]
+        immed[out_rc, CMSG_RC_SUCCESS]
+
+no_leaf#:
+    __hashmap_table_return_credits(in_fd)
+no_room#:
+    /* drop the nodes added for the prefix */
+    __hashmap_lpm_prune(in_fd, in_lm_key, node, level, endian)
+    br[NOTFOUND_LABEL]
+ret#:
+.end
+#endm
+
+/*
+ * The slots of a deleted prefix go to the longest prefix of the node that
+ * covers it, or to none. Errors go to NOTFOUND_LABEL with out_rc set.
+ */
+#macro hashmap_lpm_delete(in_fd, in_lm_key, INVALID_MAP_LABEL, NOTFOUND_LABEL, endian, out_rc)
+.begin
+    .reg key_lwsz
+    .reg value_lwsz
+    .reg key_mask
+    .reg value_mask
+    .reg map_type
+    .reg plen
+    .reg plen_w
+    .reg depth
+    .reg bits
+    .reg fb_bits
+    .reg fallback
+    .reg node
+    .reg byte
+    .reg pfx_offset
+    .reg offset
+    .reg leaf
+    .reg next
+    .reg prev
+    .reg count
+    .reg node_hi
+    .reg leaf_hi
+    .reg addr_hi
+    .reg $pfx
+    .reg $link[3]
+    .xfer_order $link
+    .sig sig_pfx
+    .sig sig_link
+
+    hashmap_get_fd(in_fd, key_lwsz, value_lwsz, key_mask, value_mask, map_type, INVALID_MAP_LABEL)
+    immed[out_rc, CMSG_RC_ERR_MAP_ERR]
+    __hashmap_lpm_key_prefix(in_lm_key, key_lwsz, plen, depth, bits, NOTFOUND_LABEL)
+    immed[out_rc, CMSG_RC_ERR_ENOENT]
+    __hashmap_lpm_walk(in_fd, in_lm_key, depth, node, --, NOTFOUND_LABEL, endian, 0)
+
+    move(node_hi, __HASHMAP_LPM_NODE_TBL >>8)
+    __hashmap_lpm_key_byte(in_lm_key, depth, byte, endian)
+    __hashmap_lpm_pfx_offset(node, bits, byte, pfx_offset)
+    mem[read32, $pfx, node_hi, <<8, pfx_offset, 1], ctx_swap[sig_pfx]
+    alu[leaf, --, b, $pfx]
+    beq[NOTFOUND_LABEL]
+    alu[$pfx, --, b, 0]
+    mem[write32, $pfx, node_hi, <<8, pfx_offset, 1], ctx_swap[sig_pfx]
+
+    immed[fallback, 0]
+    alu[fb_bits, --, b, bits]
+    beq[fallback_done#]
+fallback_loop#:
+    alu[fb_bits, fb_bits, -, 1]
+    bne[fallback_read#]
+    alu[--, --, b, depth]
+    bne[fallback_done#]
+fallback_read#:
+    __hashmap_lpm_pfx_offset(node, fb_bits, byte, offset)
+    mem[read32, $pfx, node_hi, <<8, offset, 1], ctx_swap[sig_pfx]
+    alu[fallback, --, b, $pfx]
+    bne[fallback_found#]
+    alu[--, --, b, fb_bits]
+    bne[fallback_loop#]
+    br[fallback_done#]
+fallback_found#:
+    alu[plen_w, fb_bits, +, 1]
+    alu[plen_w, plen_w, +, depth, <<3]
+    alu[fallback, fallback, or, plen_w, <<__HASHMAP_LPM_SLOT_PLEN_SHFT]
+fallback_done#:
+    alu[plen_w, plen, +, 1]
+    __hashmap_lpm_fill(node, bits, byte, plen_w, fallback, bne)
+    __hashmap_lpm_count(node, -, count)
+
+    /* no slot points to the leaf, unlink and free it */
+    move(leaf_hi, __HASHMAP_LPM_LEAF_TBL >>8)
+    alu[offset, --, b, leaf, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+    mem[read32, $link[0], leaf_hi, <<8, offset, 3], ctx_swap[sig_link]
+    alu[next, --, b, $link[__HASHMAP_LPM_LEAF_NDX_NEXT]]
+    alu[prev, --, b, $link[__HASHMAP_LPM_LEAF_NDX_PREV]]
+    alu[$link[0], --, b, next]
+    alu[--, --, b, prev]
+    bne[unlink_prev#]
+    __hashmap_lpm_head_offset(in_fd, addr_hi, offset)
+    br[unlink_write#]
+unlink_prev#:
+    alu[addr_hi, --, b, leaf_hi]
+    alu[offset, --, b, prev, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+    alu[offset, offset, +, (__HASHMAP_LPM_LEAF_NDX_NEXT * 4)]
+unlink_write#:
+    mem[write32, $link[0], addr_hi, <<8, offset, 1], ctx_swap[sig_link]
+    alu[--, --, b, next]
+    beq[unlinked#]
+    alu[$link[0], --, b, prev]
+    alu[offset, --, b, next, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+    alu[offset, offset, +, (__HASHMAP_LPM_LEAF_NDX_PREV * 4)]
+    mem[write32, $link[0], leaf_hi, <<8, offset, 1], ctx_swap[sig_link]
+unlinked#:
+    __hashmap_lpm_leaf_free(leaf)
+    __hashmap_table_return_credits(in_fd)
+
+    alu[--, --, b, count]
+    bne[done#]
+    __hashmap_lpm_prune(in_fd, in_lm_key, node, depth, endian)
+done#:
+    immed[out_rc, CMSG_RC_SUCCESS]
+.end
+#endm
+
+/*
+ * in_op is HASHMAP_OP_GETFIRST or _GETNEXT, the leaf list gives the order.
+ * The prefix after a key that is not in the map is the first one.
+ * out_ent_addr is the key of the leaf.
+ */
+#macro hashmap_lpm_getnext(in_fd, in_lm_key, in_op, INVALID_MAP_LABEL, NOTFOUND_LABEL, out_ent_lw, out_ent_addr, endian)
+.begin
+    .reg key_lwsz
+    .reg value_lwsz
+    .reg key_mask
+    .reg value_mask
+    .reg map_type
+    .reg plen
+    .reg depth
+    .reg bits
+    .reg node
+    .reg byte
+    .reg offset
+    .reg leaf
+    .reg addr_hi
+    .reg $link
+    .sig sig_link
+
+    hashmap_get_fd(in_fd, key_lwsz, value_lwsz, key_mask, value_mask, map_type, INVALID_MAP_LABEL)
+    __hashmap_lpm_head_offset(in_fd, addr_hi, offset)
+    mem[read32, $link, addr_hi, <<8, offset, 1], ctx_swap[sig_link]
+    alu[leaf, --, b, $link]
+
+    .if (in_op == HASHMAP_OP_GETNEXT)
+        __hashmap_lpm_key_prefix(in_lm_key, key_lwsz, plen, depth, bits, have_leaf#)
+        __hashmap_lpm_walk(in_fd, in_lm_key, depth, node, --, have_leaf#, endian, 0)
+        __hashmap_lpm_key_byte(in_lm_key, depth, byte, endian)
+        __hashmap_lpm_pfx_offset(node, bits, byte, offset)
+        move(addr_hi, __HASHMAP_LPM_NODE_TBL >>8)
+        mem[read32, $link, addr_hi, <<8, offset, 1], ctx_swap[sig_link]
+        alu[--, --, b, $link]
+        beq[have_leaf#]
+        alu[offset, --, b, $link, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+        alu[offset, offset, +, (__HASHMAP_LPM_LEAF_NDX_NEXT * 4)]
+        move(addr_hi, __HASHMAP_LPM_LEAF_TBL >>8)
+        mem[read32, $link, addr_hi, <<8, offset, 1], ctx_swap[sig_link]
+        alu[leaf, --, b, $link]
+    .endif
+
+have_leaf#:
+    alu[--, --, b, leaf]
+    beq[NOTFOUND_LABEL]
+    __hashmap_set_opt_field(out_ent_lw, key_lwsz)
+    #if (!streq('out_ent_addr', '--'))
+        move(out_ent_addr[0], __HASHMAP_LPM_LEAF_TBL >>8)
+        alu[out_ent_addr[1], --, b, leaf, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+        alu[out_ent_addr[1], out_ent_addr[1], +, __HASHMAP_LPM_LEAF_KEY_OFFSET]
+    #endif
+.end
+#endm
+
+/*
+ * delete all prefixes of in_fd, in_lm_key is scratch space for the keys
+ * of the leaves
+ */
+#macro hashmap_lpm_free(in_fd, in_lm_key, endian, out_count)
+.begin
+    .reg leaf
+    .reg addr_hi
+    .reg offset
+    .reg rc
+    .reg $key[HASHMAP_LPM_MAX_KEY_LW]
+    .xfer_order $key
+    .sig sig_key
+
+    immed[out_count, 0]
+free_loop#:
+    __hashmap_lpm_head_offset(in_fd, addr_hi, offset)
+    mem[read32, $key[0], addr_hi, <<8, offset, 1], ctx_swap[sig_key]
+    alu[leaf, --, b, $key[0]]
+    beq[ret#]
+
+    __hashmap_lm_handles_define()
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, in_lm_key]
+    move(addr_hi, __HASHMAP_LPM_LEAF_TBL >>8)
+    alu[offset, --, b, leaf, <<HASHMAP_LPM_LEAF_SZ_SHFT]
+    alu[offset, offset, +, __HASHMAP_LPM_LEAF_KEY_OFFSET]
+    mem[read32_/**/endian, $key[0], addr_hi, <<8, offset, HASHMAP_LPM_MAX_KEY_LW], ctx_swap[sig_key]
+    #define_eval __LW 0
+    #while (__LW < HASHMAP_LPM_MAX_KEY_LW)
+        alu[HASHMAP_LM_INDEX++, --, b, $key[__LW]]
+        #define_eval __LW (__LW + 1)
+    #endloop
+    #undef __LW
+    __hashmap_lm_handles_undef()
+
+    hashmap_lpm_delete(in_fd, in_lm_key, ret#, ret#, endian, rc)
+    br[free_loop#], defer[1]
+        alu[out_count, out_count, +, 1]
+ret#:
+.end
+#endm
+
+#endif /* __HASHMAP_LPM_UC__ */
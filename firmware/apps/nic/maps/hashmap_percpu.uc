@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2020,  Netronome Systems, Inc.  All rights reserved.
+ *
+ * @file       hashmap_percpu.uc
+ * @brief      value blocks of BPF_MAP_TYPE_PERCPU_HASH and _PERCPU_ARRAY maps.
+ *
+ * The hash entry of a per-cpu map holds the index of a value block instead
+ * of the value. A block has one 64 byte slot per context of the BPF_NUM_MES
+ * eBPF MEs, so the datapath reads and updates its own slot without the
+ * bucket lock and a read-modify-write of a program never races another
+ * context. The host writes slot 0 and reads the sum of all slots, see
+ * cmsg_map.uc.
+ *
+ * The HASHMAP_PERCPU_ENTRIES blocks are shared by all per-cpu maps. The
+ * max_entries of a map are reserved from them when the map is allocated or
+ * grown, see hashmap_percpu_reserve(), so a map that could run out of
+ * blocks is refused up front rather than failing inserts later.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __HASHMAP_PERCPU_UC__
+#define __HASHMAP_PERCPU_UC__
+
+#include <nfp_chipres.h>
+#include <ring_utils.uc>
+#include <ring_ext.uc>
+
+/* 32 MB of blocks of 512 slots */
+#ifndef HASHMAP_PERCPU_ENTRIES
+    #define HASHMAP_PERCPU_ENTRIES          1024
+#endif
+
+#ifndef WORKERS_PER_ISLAND
+    #define WORKERS_PER_ISLAND              12
+#endif
+
+/*
+ * The eBPF MEs are the first WORKERS_PER_ISLAND MEs of islands 32 to 39,
+ * ME ordinal = (ME - 4) << 3 | (island & 7). A context of the 4 context
+ * mode has slot ordinal << 2 | ctx >> 1, padded to a power of 2 slots.
+ */
+#define BPF_NUM_MES                         (WORKERS_PER_ISLAND * 8)
+#define HASHMAP_PERCPU_CTXS                 4
+#define_eval __HASHMAP_PERCPU_CTX_SLOTS     (BPF_NUM_MES * HASHMAP_PERCPU_CTXS)
+#define_eval HASHMAP_PERCPU_SLOTS           1
+#while (HASHMAP_PERCPU_SLOTS < __HASHMAP_PERCPU_CTX_SLOTS)
+    #define_eval HASHMAP_PERCPU_SLOTS       (HASHMAP_PERCPU_SLOTS << 1)
+#endloop
+#undef __HASHMAP_PERCPU_CTX_SLOTS
+#define HASHMAP_PERCPU_SLOT_SZ              (HASHMAP_KEYS_VALU_SZ)
+#define HASHMAP_PERCPU_SLOT_SZ_LW           (HASHMAP_PERCPU_SLOT_SZ >> 2)
+#define HASHMAP_PERCPU_SLOT_SZ_SHFT         (LOG2(HASHMAP_PERCPU_SLOT_SZ))
+#define HASHMAP_PERCPU_BLK_SZ               (HASHMAP_PERCPU_SLOTS * HASHMAP_PERCPU_SLOT_SZ)
+#define HASHMAP_PERCPU_BLK_SZ_SHFT          (LOG2(HASHMAP_PERCPU_BLK_SZ))
+
+#define __HASHMAP_PERCPU_SIG_BIT__          31
+
+
+#macro __hashmap_percpu_init(NUM_ENTRIES)
+
+    pkt_counter_decl(num_percpu_alloc)
+    pkt_counter_decl(num_percpu_free)
+
+    __hashmap_free_ring_init(HASHMAP_PERCPU_FREE_QID, HASHMAP_PERCPU_FREE_RBASE, 0, NUM_ENTRIES, __HASHMAP_PERCPU_SIG_BIT__)
+
+    .alloc_mem __HASHMAP_PERCPU_DATA emem global (NUM_ENTRIES * HASHMAP_PERCPU_BLK_SZ) 256
+    .init __HASHMAP_PERCPU_DATA 0
+
+    /* blocks reserved by the max_entries of the per-cpu maps */
+    .alloc_mem __HASHMAP_PERCPU_RSVD HASH_MAP_IMEM global 8 8
+    .init __HASHMAP_PERCPU_RSVD 0
+#endm
+
+
+/* branch to NOT_PERCPU_LABEL unless the map is PERCPU_HASH or PERCPU_ARRAY */
+#macro __hashmap_percpu_br_not(in_map_type, NOT_PERCPU_LABEL)
+.begin
+    .reg type
+
+    alu[type, in_map_type, -, BPF_MAP_TYPE_PERCPU_HASH]
+    alu[--, type, -, (BPF_MAP_TYPE_PERCPU_ARRAY - BPF_MAP_TYPE_PERCPU_HASH + 1)]
+    bhs[NOT_PERCPU_LABEL]
+.end
+#endm
+
+
+/*
+ * reserve in_entries blocks for a per-cpu map being allocated or grown,
+ * branch to NO_ROOM_LABEL if fewer are left. Other map types reserve none.
+ */
+#macro hashmap_percpu_reserve(in_map_type, in_entries, NO_ROOM_LABEL)
+.begin
+    .sig sig_percpu_rsvd
+    .reg $rsvd
+    .reg addr_hi
+    .reg entries
+    .reg rsvd
+    .reg type
+
+    alu[type, --, b, in_map_type]
+    __hashmap_percpu_br_not(type, ret#)
+    move(addr_hi, __HASHMAP_PERCPU_RSVD >>8)
+    move(entries, in_entries)
+    alu[$rsvd, --, b, entries]
+    mem[test_add, $rsvd, addr_hi, <<8, 0, 1], ctx_swap[sig_percpu_rsvd]
+    alu[rsvd, $rsvd, +, entries]
+    bcs[no_room#]
+    move(type, HASHMAP_PERCPU_ENTRIES)
+    alu[--, type, -, rsvd]
+    bhs[ret#]
+no_room#:
+    hashmap_percpu_unreserve(BPF_MAP_TYPE_PERCPU_HASH, entries)
+    br[NO_ROOM_LABEL]
+ret#:
+.end
+#endm
+
+
+/* give back the blocks reserved by hashmap_percpu_reserve() */
+#macro hashmap_percpu_unreserve(in_map_type, in_entries)
+.begin
+    .sig sig_percpu_rsvd
+    .reg $rsvd
+    .reg addr_hi
+    .reg entries
+
+    __hashmap_percpu_br_not(in_map_type, ret#)
+    move(addr_hi, __HASHMAP_PERCPU_RSVD >>8)
+    move(entries, in_entries)
+    alu[$rsvd, --, b, entries]
+    mem[sub, $rsvd, addr_hi, <<8, 0, 1], ctx_swap[sig_percpu_rsvd]
+ret#:
+.end
+#endm
+
+
+/* offset of the slot of this context within a block */
+#macro __hashmap_percpu_slot(out_offset)
+.begin
+    .reg sts
+    .reg isl
+
+    local_csr_rd[ACTIVE_CTX_STS]
+    immed[sts, 0]
+    alu[out_offset, 0xf, and, sts, >>3]
+    alu[out_offset, out_offset, -, 4]
+    alu[isl, 0x7, and, sts, >>25]
+    alu[out_offset, isl, or, out_offset, <<3]
+    alu[sts, 0x7, and, sts]
+    alu[out_offset, --, b, out_offset, <<2]
+    alu[out_offset, out_offset, or, sts, >>1]
+    alu[out_offset, --, b, out_offset, <<HASHMAP_PERCPU_SLOT_SZ_SHFT]
+.end
+#endm
+
+
+/*
+ * take a zeroed block for a new entry, out_blk is left alone for
+ * other map types
+ */
+#macro __hashmap_percpu_alloc(in_map_type, out_blk, NO_BLOCK_LABEL)
+.begin
+    .sig sig_percpu_pop
+    .reg $blk
+
+    __hashmap_percpu_br_not(in_map_type, ret#)
+do_pop#:
+    ru_emem_ring_op($blk, HASHMAP_PERCPU_FREE_QID, sig_percpu_pop, pop, HASHMAP_PERCPU_FREE_RBASE, 1, NO_BLOCK_LABEL)
+    br_bclr[$blk, __HASHMAP_PERCPU_SIG_BIT__, do_pop#], defer[2]
+    alu_shf[out_blk, --, b, 1, <<__HASHMAP_PERCPU_SIG_BIT__]
+    alu[out_blk, $blk, and~, out_blk]
+    pkt_counter_incr(num_percpu_alloc)
+ret#:
+.end
+#endm
+
+
+/* zero all slots of the block at in_addr_hi/in_addr_lo */
+#macro __hashmap_percpu_zero(in_addr_hi, in_addr_lo)
+.begin
+    .sig sig_percpu_zero
+    .reg $zero[HASHMAP_PERCPU_SLOT_SZ_LW]
+    .xfer_order $zero
+    .reg addr_lo
+    .reg end
+
+    aggregate_zero($zero, HASHMAP_PERCPU_SLOT_SZ_LW)
+    alu[addr_lo, --, b, in_addr_lo]
+    move(end, HASHMAP_PERCPU_BLK_SZ)
+    alu[end, end, +, addr_lo]
+zero_loop#:
+    mem[write32, $zero[0], in_addr_hi, <<8, addr_lo, HASHMAP_PERCPU_SLOT_SZ_LW], ctx_swap[sig_percpu_zero]
+    alu[addr_lo, addr_lo, +, HASHMAP_PERCPU_SLOT_SZ]
+    alu[--, addr_lo, -, end]
+    blo[zero_loop#]
+.end
+#endm
+
+
+/* zero a block and return it to the free ring */
+#macro __hashmap_percpu_free(in_map_type, in_blk)
+.begin
+    .sig sig_percpu_put
+    .reg $free_blk
+    .reg addr_hi
+    .reg addr_lo
+
+    __hashmap_percpu_br_not(in_map_type, ret#)
+
+    move(addr_hi, __HASHMAP_PERCPU_DATA >>8)
+    alu[addr_lo, --, b, in_blk, <<HASHMAP_PERCPU_BLK_SZ_SHFT]
+    __hashmap_percpu_zero(addr_hi, addr_lo)
+
+    alu[$free_blk, in_blk, or, 1, <<__HASHMAP_PERCPU_SIG_BIT__]
+    ru_emem_ring_op($free_blk, HASHMAP_PERCPU_FREE_QID, sig_percpu_put, put, HASHMAP_PERCPU_FREE_RBASE, 1, --)
+    pkt_counter_incr(num_percpu_free)
+ret#:
+.end
+#endm
+
+
+/*
+ * in_blk was taken by __hashmap_percpu_alloc() for a new entry, store it in
+ * the value field at io_addr_hi/io_addr_lo and point them at the slot
+ * written by CALLER: this context's for the datapath, slot 0 for the host
+ */
+#macro __hashmap_percpu_set_block(in_map_type, in_blk, io_addr_hi, io_addr_lo, CALLER)
+.begin
+    .sig sig_percpu_blk
+    .reg $blk
+    .reg slot
+
+    __hashmap_percpu_br_not(in_map_type, ret#)
+    alu[$blk, --, b, in_blk]
+    mem[write32, $blk, io_addr_hi, <<8, io_addr_lo, 1], sig_done[sig_percpu_blk]
+    move(io_addr_hi, __HASHMAP_PERCPU_DATA >>8)
+    alu[io_addr_lo, --, b, in_blk, <<HASHMAP_PERCPU_BLK_SZ_SHFT]
+    #if (CALLER == HASHMAP_CALLER_DP)
+        __hashmap_percpu_slot(slot)
+        alu[io_addr_lo, io_addr_lo, +, slot]
+    #endif
+    ctx_arb[sig_percpu_blk]
+ret#:
+.end
+#endm
+
+
+/*
+ * point io_addr_hi/io_addr_lo, the value field of an existing entry, at
+ * its block: this context's slot for the datapath, the start of the block for
+ * the host. io_tindex is cleared as the value is no longer in the xfer regs.
+ */
+#macro __hashmap_percpu_value_addr(in_map_type, io_addr_hi, io_addr_lo, io_tindex, CALLER)
+.begin
+    .sig sig_percpu_blk
+    .reg $blk
+    .reg slot
+
+    __hashmap_percpu_br_not(in_map_type, ret#)
+    mem[read32, $blk, io_addr_hi, <<8, io_addr_lo, 1], sig_done[sig_percpu_blk]
+    #if (CALLER == HASHMAP_CALLER_DP)
+        __hashmap_percpu_slot(slot)
+    #endif
+    move(io_addr_hi, __HASHMAP_PERCPU_DATA >>8)
+    immed[io_tindex, 0]
+    ctx_arb[sig_percpu_blk]
+    alu[io_addr_lo, --, b, $blk, <<HASHMAP_PERCPU_BLK_SZ_SHFT]
+    #if (CALLER == HASHMAP_CALLER_DP)
+        alu[io_addr_lo, io_addr_lo, +, slot]
+    #endif
+ret#:
+.end
+#endm
+
+
+/* free the block of the entry whose value field is at in_addr_hi/in_addr_lo */
+#macro __hashmap_percpu_release(in_map_type, in_addr_hi, in_addr_lo)
+.begin
+    .sig sig_percpu_blk
+    .reg $blk
+    .reg blk
+
+    __hashmap_percpu_br_not(in_map_type, ret#)
+    mem[read32, $blk, in_addr_hi, <<8, in_addr_lo, 1], ctx_swap[sig_percpu_blk]
+    alu[blk, --, b, $blk]
+    __hashmap_percpu_free(in_map_type, blk)
+ret#:
+.end
+#endm
+
+#endif /* __HASHMAP_PERCPU_UC__ */
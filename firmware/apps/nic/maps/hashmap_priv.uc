@@ -17,7 +17,9 @@
 #include <passert.uc>
 #include <ov.uc>
 #include <unroll.uc>
+#include <nfp_chipres.h>
 #include <ring_utils.uc>
+#include <ring_ext.uc>
 //#include <ring_utils_ext.uc>
 
 #ifndef PKT_COUNTER_ENABLE
@@ -84,6 +86,45 @@
 #endif
 #endm
 
+/*
+ * EMEM0 free ring QID at RBASE holding indexes FIRST to
+ * FIRST + NUM_ENTRIES - 1, each with SIG_BIT set so that no entry reads 0.
+ * Context 0 fills it at GLOBAL_INIT, highest index first.
+ */
+#macro __hashmap_free_ring_init(QID, RBASE, FIRST, NUM_ENTRIES, SIG_BIT)
+
+    passert(NUM_ENTRIES, "MULTIPLE_OF", 16)
+
+    EMEM0_QUEUE_ALLOC(QID, global)
+    .alloc_mem RBASE emem0 global (NUM_ENTRIES * 4) (NUM_ENTRIES * 4)
+    .init_mu_ring QID RBASE 0
+
+#ifdef GLOBAL_INIT
+    .if (ctx() == 0)
+    .begin
+        .sig sig_init_write
+        .reg index
+        .reg last
+        .reg $data[16]
+        .xfer_order $data
+
+        move(index, (FIRST + NUM_ENTRIES))
+        move(last, FIRST)
+        .while (index > last)
+            #define_eval __IDX 0
+            #while (__IDX < 16)
+                alu[index, index, -, 1]
+                alu[$data[__IDX], index, or, 1, <<SIG_BIT]
+                #define_eval __IDX (__IDX + 1)
+            #endloop
+            ru_emem_ring_op($data, QID, sig_init_write, journal, RBASE, 16, --)
+        .endw
+        #undef __IDX
+    .end
+    .endif
+#endif    //GLOBAL_INIT
+#endm
+
 /*
  * debug word 0:
  *      0xd + ctx_num(4) + id(4) + num_lw(4) + tag(16)
@@ -220,9 +261,11 @@
  *      local_csr_wr[T_INDEX, temp_advance]
  *
  * length:    the number of bytes to read, returns the actual number of bytes read
+ * in_rd_wlen: entry size in LW of the map's slab class, at least as much is
+ *             read so that fields after the one asked for are in the buffer
  *
  */
-#macro __hashmap_read_data(o_tindex, in_addr_hi, in_addr_lo, buf_wlen, endian)
+#macro __hashmap_read_data(o_tindex, in_addr_hi, in_addr_lo, buf_wlen, in_rd_wlen, endian)
 .begin
 
     .reg txfr_size_lw       ; number of words available in $io_txfr
@@ -236,8 +279,16 @@
     alu[txfr_size_lw, --, b, HASHMAP_RXFR_COUNT]
 
 cont#:
+    /* read at least the entry size of the slab class, see __hashmap_read_more() */
+    alu[--, txfr_size_lw, -, in_rd_wlen]
+    bge[read#]
+    alu[txfr_size_lw, --, b, in_rd_wlen]
+    alu[--, txfr_size_lw, -, HASHMAP_RXFR_COUNT]
+    blt[read#]
     alu[txfr_size_lw, --, b, HASHMAP_RXFR_COUNT]
 
+read#:
+
     ov_start(OV_LENGTH)
     ov_set_use(OV_LENGTH, txfr_size_lw, OVF_SUBTRACT_ONE)    ; length is in 32-bit LWs
     ov_clean
@@ -251,7 +302,7 @@ ret#:
 .end
 #endm
 
-#macro __hashmap_read_more(io_tindex, in_addr_hi, in_addr_lo, buf_wlen, endian)
+#macro __hashmap_read_more(io_tindex, in_addr_hi, in_addr_lo, buf_wlen, in_rd_wlen, endian)
 .begin
     .reg start_tindex
     .reg consumed
@@ -263,18 +314,23 @@ ret#:
     alu[start_tindex, (&MAP_RDXR[0] << 2), OR, my_act_ctx, <<7]
     alu[consumed, io_tindex, -, start_tindex]
     alu[consumed, --, b, consumed, >>2]
-    alu[avail, HASHMAP_RXFR_COUNT, -, consumed]
+    alu[avail, --, b, in_rd_wlen]
+    alu[--, avail, -, HASHMAP_RXFR_COUNT]
+    blt[check_avail#]
+    immed[avail, HASHMAP_RXFR_COUNT]
+check_avail#:
+    alu[avail, avail, -, consumed]
     alu[--, avail, -, buf_wlen]
     bge[ret#]
 
 do_read#:
-    __hashmap_read_data(io_tindex, in_addr_hi, in_addr_lo, buf_wlen, endian)
+    __hashmap_read_data(io_tindex, in_addr_hi, in_addr_lo, buf_wlen, in_rd_wlen, endian)
 
 .end
 ret#:
 #endm
 
-#macro __hashmap_compare(io_tindex, lm_addr, in_addr_hi, in_addr_lo, in_wlen, MISS_LABEL, endian, map_type)
+#macro __hashmap_compare(io_tindex, lm_addr, in_addr_hi, in_addr_lo, in_wlen, in_rd_wlen, MISS_LABEL, endian, map_type)
 .begin
 
     .reg comp_lw
@@ -292,7 +348,7 @@ ret#:
 do_read#:
     local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, lm_off]
 
-    __hashmap_read_data(io_tindex, in_addr_hi, off, lw_read, endian)
+    __hashmap_read_data(io_tindex, in_addr_hi, off, lw_read, in_rd_wlen, endian)
 
 read_done#:
     local_csr_wr[T_INDEX, io_tindex]    ; global csr 3 cycles
@@ -317,7 +373,7 @@ ret#:
 #endm
 
 
-#macro __hashmap_read_field(io_tindex, lm_field_addr, in_addr_hi, in_addr_lo, in_wlen, RTN_OPT, out_addr, out_tindex, endian)
+#macro __hashmap_read_field(io_tindex, lm_field_addr, in_addr_hi, in_addr_lo, in_wlen, in_rd_wlen, RTN_OPT, out_addr, out_tindex, endian)
 .begin
     .reg read_lw, bytes
     .reg copy_lw
@@ -328,7 +384,7 @@ ret#:
         alu[out_addr[0], --, b, in_addr_hi]
         alu[out_addr[1], --, b, in_addr_lo]
     #elif (RTN_OPT == HASHMAP_RTN_TINDEX)
-        __hashmap_read_more(io_tindex, in_addr_hi, in_addr_lo, in_wlen, endian)
+        __hashmap_read_more(io_tindex, in_addr_hi, in_addr_lo, in_wlen, in_rd_wlen, endian)
         alu[out_tindex, --, b, io_tindex]
         alu[out_addr[0], --, b, in_addr_hi]
         alu[out_addr[1], --, b, in_addr_lo]
@@ -343,7 +399,7 @@ ret#:
 
 do_read#:
         local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, lm_off]
-        __hashmap_read_more(io_tindex, in_addr_hi, off, read_lw, endian)
+        __hashmap_read_more(io_tindex, in_addr_hi, off, read_lw, in_rd_wlen, endian)
 
         local_csr_wr[T_INDEX, io_tindex]    ; global csr 3 cycles
         alu[bytes, --, b, read_lw, <<2]
@@ -424,8 +480,7 @@ write_cont#:
     .reg lk_addr_lo
 
     alu[$tid_value, --, b, in_fd]
-    move(lk_addr_hi, __HASHMAP_LOCK_TBL >>8)
-    alu[lk_addr_lo, --, b, in_idx, <<HASHMAP_LOCK_SZ_SHFT]
+    __hashmap_lock_addr(in_idx, lk_addr_hi, lk_addr_lo)
     alu[lk_addr_lo, 4, +, lk_addr_lo]
     mem[atomic_write, $tid_value, lk_addr_hi, <<8, lk_addr_lo, 1], sig_done[write_tid_sig]
     ctx_arb[write_tid_sig]
@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2020,  Netronome Systems, Inc.  All rights reserved.
+ *
+ * @file       hashmap_prog.uc
+ * @brief      tables of BPF_MAP_TYPE_PROG_ARRAY, _DEVMAP and _PERF_EVENT_ARRAY
+ *             maps, eBPF tail calls and redirects.
+ *
+ * These map types are a row of HASHMAP_PROG_ENTRIES words per fd, indexed
+ * by the 32 bit key. 0 is no entry.
+ *
+ * The eBPF image of a vNIC is the entry program followed by the programs it
+ * tail calls, update_bpf_prog() loads it in one go. The entries of a
+ * PROG_ARRAY map are the code store addresses of programs of one image.
+ * A tail call branches to the address of the entry, see
+ * htab_prog_tail_call_subr_func(). LM0 (stack) and LM1 (packet vector) are
+ * not touched, the called program finds them as the entry program did.
+ * Like the kernel, a packet makes at most HASHMAP_PROG_TAIL_CALL_MAX tail
+ * calls.
+ *
+ * The entries of a DEVMAP map are redirect targets, see
+ * CMSG_MAP_REDIR_VALID_SHF in cmsg_map_types.h: TX_WIRE or TX_HOST action
+ * arguments resolved by the host. bpf_redirect() and bpf_redirect_map()
+ * keep the target of the packet, ebpf_reentry() sends it there.
+ *
+ * The entries of a PERF_EVENT_ARRAY map are the host CPUs with a perf
+ * event, see cmsg_perf.uc.
+ *
+ * context state, HASHMAP_PROG_CTX_SZ bytes per context, cleared by
+ * ebpf_call() for each packet
+ *    w0 tail calls, w1 redirect target, w2 XDP metadata length, see
+ *    ebpf_adjust_meta_subr_func() in ebpf.uc
+ * and with EBPF_PROG_STATS, see ebpf_prog_stats() in ebpf.uc
+ *    w3 helper calls, w4 LM stats slot of the program, w5 start TIMESTAMP
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __HASHMAP_PROG_UC__
+#define __HASHMAP_PROG_UC__
+
+#include <aggregate.uc>
+#include "nfd_user_cfg.h"
+
+#define HASHMAP_PROG_ENTRIES                64
+#define __HASHMAP_PROG_ROW_SHFT             8       /* HASHMAP_PROG_ENTRIES words */
+#define HASHMAP_PROG_TAIL_CALL_MAX          32      /* MAX_TAIL_CALL_CNT */
+#define __HASHMAP_PROG_USTORE_SZ            8192    /* instructions */
+
+#ifdef EBPF_PROG_STATS
+    #define HASHMAP_PROG_CTX_SZ             32
+#else
+    #define HASHMAP_PROG_CTX_SZ             16
+#endif
+#define HASHMAP_PROG_CTX_NDX_TAIL_CNT       0
+#define HASHMAP_PROG_CTX_NDX_REDIR          1
+#define HASHMAP_PROG_CTX_NDX_META_LEN       2
+#define HASHMAP_PROG_CTX_NDX_HELPERS        3
+#define HASHMAP_PROG_CTX_NDX_STATS          4
+#define HASHMAP_PROG_CTX_NDX_TS             5
+
+/* return codes of the redirect helpers */
+#define __HASHMAP_PROG_XDP_ABORTED          0
+#define __HASHMAP_PROG_XDP_REDIRECT         4
+
+
+#macro __hashmap_prog_init()
+    .alloc_mem __HASHMAP_PROG_TBL emem global (HASHMAP_MAX_TID << __HASHMAP_PROG_ROW_SHFT) 256
+    .init __HASHMAP_PROG_TBL 0
+
+    .alloc_mem __hashmap_prog_ctx lmem me (8 * HASHMAP_PROG_CTX_SZ) (8 * HASHMAP_PROG_CTX_SZ)
+#endm
+
+/* LM state of the packet of this context */
+#macro hashmap_prog_ctx_addr(out_addr)
+    immed[out_addr, __hashmap_prog_ctx]
+    alu[out_addr, out_addr, OR, t_idx_ctx, >>(7 - LOG2(HASHMAP_PROG_CTX_SZ))]
+#endm
+
+/*
+ * count a helper call of the packet for EBPF_PROG_STATS, for subroutines
+ * that do not point LM3 at the context state themselves
+ */
+#macro hashmap_prog_count_helper()
+#ifdef EBPF_PROG_STATS
+.begin
+    .reg ctx_addr
+
+    hashmap_prog_ctx_addr(ctx_addr)
+    local_csr_wr[ACTIVE_LM_ADDR_3, ctx_addr]
+    nop
+    nop
+    nop
+    alu[*l$index3[HASHMAP_PROG_CTX_NDX_HELPERS], *l$index3[HASHMAP_PROG_CTX_NDX_HELPERS], +, 1]
+.end
+#endif
+#endm
+
+/* branch to TABLE_LABEL for the map types kept in rows */
+#macro hashmap_prog_br_table(in_map_type, TABLE_LABEL)
+    alu[--, in_map_type, -, BPF_MAP_TYPE_PROG_ARRAY]
+    beq[TABLE_LABEL]
+    alu[--, in_map_type, -, BPF_MAP_TYPE_DEVMAP]
+    beq[TABLE_LABEL]
+    alu[--, in_map_type, -, BPF_MAP_TYPE_PERF_EVENT_ARRAY]
+    beq[TABLE_LABEL]
+#endm
+
+/* entry in_index of in_fd, NOTFOUND_LABEL past the end of the row */
+#macro __hashmap_prog_entry_addr(in_fd, in_index, out_addr_hi, out_offset, NOTFOUND_LABEL)
+    alu[--, in_index, -, HASHMAP_PROG_ENTRIES]
+    bhs[NOTFOUND_LABEL]
+    move(out_addr_hi, __HASHMAP_PROG_TBL >>8)
+    alu[out_offset, --, b, in_fd, <<__HASHMAP_PROG_ROW_SHFT]
+    alu[out_offset, out_offset, OR, in_index, <<2]
+#endm
+
+#macro __hashmap_prog_lm_word(in_lm_addr, out_word)
+    __hashmap_lm_handles_define()
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, in_lm_addr]
+    nop
+    nop
+    nop
+    alu[out_word, --, b, HASHMAP_LM_INDEX]
+    __hashmap_lm_handles_undef()
+#endm
+
+#macro __hashmap_prog_clear(in_fd)
+.begin
+    .reg addr_hi
+    .reg offset
+    .reg end
+    .reg $zero[16]
+    .xfer_order $zero
+    .sig sig_zero
+
+    aggregate_zero($zero, 16)
+    move(addr_hi, __HASHMAP_PROG_TBL >>8)
+    alu[offset, --, b, in_fd, <<__HASHMAP_PROG_ROW_SHFT]
+    alu[end, offset, +, 1, <<__HASHMAP_PROG_ROW_SHFT]
+clear_loop#:
+    mem[write32, $zero[0], addr_hi, <<8, offset, 16], ctx_swap[sig_zero]
+    alu[offset, offset, +, 64]
+    alu[--, end, -, offset]
+    bne[clear_loop#]
+.end
+#endm
+
+/*
+ * check the sizes of a new map kept in a row and clear it,
+ * keys and values are 4 bytes
+ */
+#macro hashmap_prog_alloc(in_fd, in_key_size, in_value_size, in_max_entries, ERROR_LABEL)
+    alu[--, in_key_size, -, 4]
+    bne[ERROR_LABEL]
+    alu[--, in_value_size, -, 4]
+    bne[ERROR_LABEL]
+    alu[--, in_max_entries, -, (HASHMAP_PROG_ENTRIES + 1)]
+    bhs[ERROR_LABEL]
+    __hashmap_prog_clear(in_fd)
+#endm
+
+/* drop all entries of in_fd */
+#macro hashmap_prog_free(in_fd)
+    __hashmap_prog_clear(in_fd)
+#endm
+
+/* entry of the index at in_lm_key, out_value is 0 for no entry */
+#macro hashmap_prog_lookup(in_fd, in_lm_key, NOTFOUND_LABEL, out_value)
+.begin
+    .reg index
+    .reg addr_hi
+    .reg offset
+    .reg $entry
+    .sig sig_entry
+
+    __hashmap_prog_lm_word(in_lm_key, index)
+    __hashmap_prog_entry_addr(in_fd, index, addr_hi, offset, NOTFOUND_LABEL)
+    mem[read32, $entry, addr_hi, <<8, offset, 1], ctx_swap[sig_entry]
+    alu[out_value, --, b, $entry]
+.end
+#endm
+
+/* NOTFOUND_LABEL unless in_target is a redirect target */
+#macro __hashmap_prog_br_not_target(in_target, NOTFOUND_LABEL)
+.begin
+    .reg tmp
+
+    alu[tmp, --, b, in_target, >>14]
+    alu[tmp, tmp, AND~, 1, <<(CMSG_MAP_REDIR_HOST_SHF - 14)]
+    alu[--, tmp, -, 1, <<(CMSG_MAP_REDIR_VALID_SHF - 14)]
+    bne[NOTFOUND_LABEL]
+.end
+#endm
+
+/*
+ * NOTFOUND_LABEL unless in_value is in the NFD_BPF_MAX_LEN code store
+ * window of a vNIC, out_base and out_end bound that window
+ */
+#macro __hashmap_prog_window(in_value, out_base, out_end, NOTFOUND_LABEL)
+    #define_eval __VNIC 0
+    #while ((NFD_BPF_START_OFF + ((__VNIC + 1) * NFD_BPF_MAX_LEN)) <= __HASHMAP_PROG_USTORE_SZ)
+        move(out_base, (NFD_BPF_START_OFF + (__VNIC * NFD_BPF_MAX_LEN)))
+        move(out_end, (NFD_BPF_START_OFF + ((__VNIC + 1) * NFD_BPF_MAX_LEN)))
+        alu[--, in_value, -, out_end]
+        blo[found#]
+        #define_eval __VNIC (__VNIC + 1)
+    #endloop
+    #undef __VNIC
+    br[NOTFOUND_LABEL]
+found#:
+    alu[--, in_value, -, out_base]
+    blo[NOTFOUND_LABEL]
+#endm
+
+/*
+ * NOTFOUND_LABEL if an entry of the row of in_fd other than in_index is
+ * outside in_base to in_end, the programs of a PROG_ARRAY map are all in
+ * the image of the vNIC that loaded it
+ */
+#macro __hashmap_prog_br_other_window(in_fd, in_index, in_base, in_end, NOTFOUND_LABEL)
+.begin
+    .reg addr_hi
+    .reg offset
+    .reg own
+    .reg count
+    .reg entry
+    .reg $row[16]
+    .xfer_order $row
+    .sig sig_row
+
+    move(addr_hi, __HASHMAP_PROG_TBL >>8)
+    alu[offset, --, b, in_fd, <<__HASHMAP_PROG_ROW_SHFT]
+    alu[own, --, b, in_index]
+    immed[count, (HASHMAP_PROG_ENTRIES / 16)]
+row_loop#:
+    mem[read32, $row[0], addr_hi, <<8, offset, 16], ctx_swap[sig_row]
+    #define_eval __W 0
+    #while (__W < 16)
+        alu[--, own, -, __W]
+        beq[next_/**/__W#]
+        alu[entry, --, b, $row[__W]]
+        beq[next_/**/__W#]
+        alu[--, entry, -, in_base]
+        blo[NOTFOUND_LABEL]
+        alu[--, entry, -, in_end]
+        bhs[NOTFOUND_LABEL]
+next_/**/__W#:
+        #define_eval __W (__W + 1)
+    #endloop
+    #undef __W
+    alu[own, own, -, 16]
+    alu[count, count, -, 1]
+    bne[row_loop#], defer[1]
+        alu[offset, offset, +, 64]
+.end
+#endm
+
+/*
+ * set the entry of the index at in_lm_key to the value at in_lm_value.
+ * Entries always exist, HASHMAP_OP_ADD_ONLY fails with EEXIST as for
+ * array maps. PROG_ARRAY values outside the code store window of a vNIC,
+ * or in another window than the other entries of the map, and DEVMAP
+ * values that are not redirect targets are refused, PERF_EVENT_ARRAY
+ * values are taken as they are.
+ */
+#macro hashmap_prog_update(in_fd, in_map_type, in_lm_key, in_lm_value, in_op, NOTFOUND_LABEL, out_rc)
+.begin
+    .reg index
+    .reg value
+    .reg addr_hi
+    .reg offset
+    .reg base
+    .reg end
+    .reg $entry
+    .sig sig_entry
+
+    immed[out_rc, CMSG_RC_ERR_E2BIG]
+    __hashmap_prog_lm_word(in_lm_key, index)
+    __hashmap_prog_entry_addr(in_fd, index, addr_hi, offset, NOTFOUND_LABEL)
+
+    immed[out_rc, CMSG_RC_ERR_EEXIST]
+    alu[--, in_op, -, HASHMAP_OP_ADD_ONLY]
+    beq[NOTFOUND_LABEL]
+
+    immed[out_rc, CMSG_RC_ERR_MAP_ERR]
+    __hashmap_prog_lm_word(in_lm_value, value)
+    alu[--, in_map_type, -, BPF_MAP_TYPE_PERF_EVENT_ARRAY]
+    beq[write#]
+    alu[--, in_map_type, -, BPF_MAP_TYPE_DEVMAP]
+    bne[prog_value#]
+    __hashmap_prog_br_not_target(value, NOTFOUND_LABEL)
+    br[write#]
+prog_value#:
+    __hashmap_prog_window(value, base, end, NOTFOUND_LABEL)
+    __hashmap_prog_br_other_window(in_fd, index, base, end, NOTFOUND_LABEL)
+
+write#:
+    alu[$entry, --, b, value]
+    mem[write32, $entry, addr_hi, <<8, offset, 1], ctx_swap[sig_entry]
+    immed[out_rc, CMSG_RC_SUCCESS]
+.end
+#endm
+
+/* clear the entry of the index at in_lm_key */
+#macro hashmap_prog_delete(in_fd, in_lm_key, NOTFOUND_LABEL, out_rc)
+.begin
+    .reg index
+    .reg addr_hi
+    .reg offset
+    .reg $entry
+    .sig sig_entry
+
+    immed[out_rc, CMSG_RC_ERR_E2BIG]
+    __hashmap_prog_lm_word(in_lm_key, index)
+    __hashmap_prog_entry_addr(in_fd, index, addr_hi, offset, NOTFOUND_LABEL)
+    immed[$entry, 0]
+    mem[write32, $entry, addr_hi, <<8, offset, 1], ctx_swap[sig_entry]
+    immed[out_rc, CMSG_RC_SUCCESS]
+.end
+#endm
+
+/*
+ * bpf_tail_call() of an eBPF program.
+ *
+ * A0 prog array tid, B1 index, B0 return address. Branches to the program
+ * of the entry, or returns if there is none or the packet made
+ * HASHMAP_PROG_TAIL_CALL_MAX tail calls already.
+ */
+#macro htab_prog_tail_call_subr_func()
+.reentry
+.begin
+    htab_subr_regs_alloc()
+    .reg htab_return_addr
+    .reg_addr htab_return_addr 0 B
+    .set htab_return_addr
+    .reg htab_in_tid
+    .reg_addr htab_in_tid 0 A
+    .set htab_in_tid
+    .reg htab_prog_index
+    .reg_addr htab_prog_index 1 B
+    .set htab_prog_index
+
+    .reg rtn_addr
+    .reg ctx_addr
+    .reg addr_hi
+    .reg offset
+    .reg $entry
+    .sig sig_entry
+
+    __hashmap_lm_handles_define()
+    hashmap_prog_ctx_addr(ctx_addr)
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, ctx_addr]
+    alu[rtn_addr, --, b, htab_return_addr]
+    alu[--, htab_in_tid, -, HASHMAP_MAX_TID]
+    bhs[ret#]
+    #ifdef EBPF_PROG_STATS
+        alu[HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_HELPERS], HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_HELPERS], +, 1]
+    #endif
+    alu[--, HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_TAIL_CNT], -, HASHMAP_PROG_TAIL_CALL_MAX]
+    bhs[ret#]
+
+    __hashmap_prog_entry_addr(htab_in_tid, htab_prog_index, addr_hi, offset, ret#)
+    mem[read32, $entry, addr_hi, <<8, offset, 1], ctx_swap[sig_entry]
+    alu[--, --, b, $entry]
+    beq[ret#]
+    alu[HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_TAIL_CNT], HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_TAIL_CNT], +, 1]
+    alu[rtn_addr, --, b, $entry]
+
+ret#:
+    __hashmap_lm_handles_undef()
+    htab_subr_regs_free()
+    #pragma warning(push)
+    #pragma warning(disable: 5116)  // disable warning "Return register may not contain valid addr"
+        .use htab_return_addr
+        rtn[rtn_addr]
+    #pragma warning(pop)
+.end
+#endm
+
+/*
+ * bpf_redirect() (MAP 0) and bpf_redirect_map() (MAP 1) of an eBPF
+ * program, keep the redirect target of the packet.
+ *
+ * MAP 0: A0 redirect target, B1 flags. MAP 1: A0 DEVMAP tid, B1 index,
+ * B2 flags. B0 return address.
+ *
+ * The firmware has no table of host ifindexes. bpf_redirect() only takes
+ * the constant ifindex of a program that the JIT rewrote to the redirect
+ * target of its port, see CMSG_MAP_REDIR_VALID_SHF. An ifindex computed at
+ * run time or read from a map is not a target and returns XDP_ABORTED;
+ * such programs redirect through a DEVMAP, whose entries the host resolves.
+ *
+ * A0 returns XDP_REDIRECT, XDP_ABORTED for a bad target or flags of
+ * bpf_redirect(), the low bits of the flags for an empty entry of
+ * bpf_redirect_map(). A failed redirect drops the target, the packet
+ * goes back out of its ingress port if the program redirects anyway.
+ */
+#macro htab_redirect_subr_func(MAP)
+.reentry
+.begin
+    htab_subr_regs_alloc()
+    .reg htab_return_addr
+    .reg_addr htab_return_addr 0 B
+    .set htab_return_addr
+    .reg htab_arg0
+    .reg_addr htab_arg0 0 A
+    .set htab_arg0
+    .reg htab_arg1
+    .reg_addr htab_arg1 1 B
+    .set htab_arg1
+    #if (MAP == 1)
+        .reg htab_arg2
+        .reg_addr htab_arg2 2 B
+        .set htab_arg2
+    #endif
+
+    .reg rtn_addr
+    .reg ctx_addr
+    .reg target
+    .reg rc
+    .reg ebpf_rc
+    .reg addr_hi
+    .reg offset
+    .reg $entry
+    .sig sig_entry
+
+    __hashmap_lm_handles_define()
+    hashmap_prog_ctx_addr(ctx_addr)
+    local_csr_wr[ACTIVE_LM_ADDR_/**/HASHMAP_LM_HANDLE, ctx_addr]
+    alu[rtn_addr, --, b, htab_return_addr]
+    immed[target, 0]
+
+    #if (MAP == 1)
+        alu[rc, htab_arg2, AND, 3]
+        alu[--, htab_arg0, -, HASHMAP_MAX_TID]
+        bhs[store#]
+        __hashmap_prog_entry_addr(htab_arg0, htab_arg1, addr_hi, offset, store#)
+        mem[read32, $entry, addr_hi, <<8, offset, 1], ctx_swap[sig_entry]
+        alu[target, --, b, $entry]
+        beq[store#]
+    #elif (MAP == 0)
+        immed[rc, __HASHMAP_PROG_XDP_ABORTED]
+        alu[--, --, b, htab_arg1]
+        bne[store#]
+        __hashmap_prog_br_not_target(htab_arg0, store#)
+        alu[target, --, b, htab_arg0]
+    #else
+        #error "htab_redirect_subr_func: MAP must be 0 or 1"
+    #endif
+    immed[rc, __HASHMAP_PROG_XDP_REDIRECT]
+
+store#:
+    alu[HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_REDIR], --, b, target]
+    #ifdef EBPF_PROG_STATS
+        alu[HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_HELPERS], HASHMAP_LM_INDEX[HASHMAP_PROG_CTX_NDX_HELPERS], +, 1]
+    #endif
+    __hashmap_lm_handles_undef()
+
+    .reg_addr ebpf_rc 0 A
+    alu[ebpf_rc, --, b, rc]
+
+    htab_subr_regs_free()
+    #pragma warning(push)
+    #pragma warning(disable: 5116)  // disable warning "Return register may not contain valid addr"
+        .use htab_return_addr
+        .use ebpf_rc
+        rtn[rtn_addr]
+    #pragma warning(pop)
+.end
+#endm
+
+#endif /* __HASHMAP_PROG_UC__ */
@@ -204,7 +204,7 @@
      NFD_VF_CFG_MB_CAP_SPOOF | NFD_VF_CFG_MB_CAP_LINK_STATE |\
      NFD_VF_CFG_MB_CAP_TRUST)
 
-#define NFD_RSS_HASH_FUNC NFP_NET_CFG_RSS_CRC32
+#define NFD_RSS_HASH_FUNC NFP_NET_CFG_RSS_TOEPLITZ
 
 #define NFD_CFG_RING_EMEM       emem0
 
@@ -55,6 +55,288 @@ nfd_out_send_init()
 .addr $__pkt_io_nfd_desc[0] 48
 .xfer_order $__pkt_io_nfd_desc
 
+/* CTM exhaustion backoff, in TIMESTAMP ticks (16 ME cycles each).
+ *
+ * A context that cannot allocate a CTM buffer for an NFD packet retries after
+ * its current backoff, which doubles on every consecutive failure up to
+ * PKT_IO_CTM_BACKOFF_MAX and drops back to PKT_IO_CTM_BACKOFF_MIN once an
+ * allocation succeeds. Brief contention is retried quickly and sustained
+ * exhaustion does not keep hammering _pkt_buf_ctm_credits, while the cap
+ * bounds how long any context waits behind the others.
+ *
+ * Each failure adds one event and the backoff ticks to the per ME 64-bit
+ * counters in the _pkt_io_ctm_stall rtsym, indexed by (island << 4) | ME.
+ */
+#ifndef PKT_IO_CTM_BACKOFF_MIN
+    #define PKT_IO_CTM_BACKOFF_MIN 16 // 256 cycles
+#endif
+#ifndef PKT_IO_CTM_BACKOFF_MAX
+    #define PKT_IO_CTM_BACKOFF_MAX 1024 // 16384 cycles
+#endif
+#define PKT_IO_CTM_STALL_ME_SIZE 16
+#define PKT_IO_CTM_STALL_EVENTS 0
+#define PKT_IO_CTM_STALL_TICKS 8
+.alloc_mem _pkt_io_ctm_stall emem global (64 * 16 * PKT_IO_CTM_STALL_ME_SIZE) 256
+.reg volatile __pkt_io_ctm_backoff
+
+/* NFD out credits are reserved PKT_IO_NFD_CREDIT_BATCH at a time and the
+ * surplus is kept per queue in LM, shared by the contexts of the ME. LM is
+ * only updated between context swaps, so no locking is needed. Surplus
+ * credits are returned to NFD when a context consumes the epoch signal or
+ * goes quiescent, so they are never held back for longer than an epoch (the
+ * app master runs one periodically and after every action table update).
+ *
+ * A surplus is only kept while NFD has at least PKT_IO_NFD_CREDIT_LOW
+ * credits for the queue. Below that an ME takes the one credit it needs and
+ * hands the rest of the batch back at once, so no new credits are stranded
+ * in the LM of MEs that do not see the queue, and the surplus already held
+ * drains as the MEs deliver to the queue. A queue only looks empty to an ME
+ * with up to PKT_IO_NFD_CREDIT_BATCH - 1 credits held by each other ME,
+ * taken while the queue had PKT_IO_NFD_CREDIT_LOW or more.
+ */
+#ifndef PKT_IO_NFD_CREDIT_BATCH
+    #define PKT_IO_NFD_CREDIT_BATCH 16
+#endif
+#ifndef PKT_IO_NFD_CREDIT_LOW
+    #define PKT_IO_NFD_CREDIT_LOW (PKT_IO_NFD_CREDIT_BATCH * 16)
+#endif
+#ifdef PV_MULTI_PCI
+    #define PKT_IO_NFD_CREDIT_PCIE 4
+#else
+    #define PKT_IO_NFD_CREDIT_PCIE 1
+#endif
+.alloc_mem __pkt_io_nfd_credits lmem me (PKT_IO_NFD_CREDIT_PCIE * 64 * 4) (PKT_IO_NFD_CREDIT_PCIE * 64 * 4)
+.alloc_mem __pkt_io_nfd_credits_held lmem me 4 4
+
+
+#macro __pkt_io_lm_clear(IN_ADDR, IN_WORDS)
+.begin
+    .reg addr
+    .reg count
+
+    immed[addr, IN_ADDR]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    immed[count, IN_WORDS]
+    nop
+    nop
+
+clear_loop#:
+    alu[count, count, -, 1]
+    bne[clear_loop#], defer[1]
+        alu[*l$index3++, --, B, 0]
+.end
+#endm
+
+
+#macro __pkt_io_nfd_credits_init()
+    __pkt_io_lm_clear(__pkt_io_nfd_credits_held, 1)
+    __pkt_io_lm_clear(__pkt_io_nfd_credits, (PKT_IO_NFD_CREDIT_PCIE * 64))
+#endm
+
+
+/** __pkt_io_nfd_credit_get
+ *
+ * Takes one NFD out credit for a host queue, from the surplus held by the ME
+ * if there is any, otherwise by reserving a batch from the NFD credit atomic.
+ * The surplus of the batch is returned at once if NFD had fewer than
+ * PKT_IO_NFD_CREDIT_LOW credits.
+ *
+ * @param in_pci_isl        PCIe island, only used with PV_MULTI_PCI
+ * @param in_pci_q          NFD queue
+ * @param NO_CREDIT_LABEL   Label to branch to if the queue has no credits
+ */
+#macro __pkt_io_nfd_credit_get(in_pci_isl, in_pci_q, NO_CREDIT_LABEL)
+.begin
+    .reg addr_hi
+    .reg addr_lo
+    .reg credits
+    .reg low
+    .reg read $credits
+    .sig sig_credits
+
+    passert(PKT_IO_NFD_CREDIT_BATCH, "GT", 0)
+    passert(PKT_IO_NFD_CREDIT_BATCH, "LT", 256)
+
+    #ifdef PV_MULTI_PCI
+        alu[addr_lo, in_pci_q, OR, in_pci_isl, <<6]
+        alu[addr_lo, --, B, addr_lo, <<2]
+    #else
+        alu[addr_lo, --, B, in_pci_q, <<2]
+    #endif
+    immed[credits, __pkt_io_nfd_credits]
+    alu[addr_lo, addr_lo, OR, credits]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr_lo]
+    #ifdef PV_MULTI_PCI
+        alu[addr_hi, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), OR, in_pci_isl]
+        alu[addr_hi, --, B, addr_hi, <<24]
+    #else
+        alu[addr_hi, --, B, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), <<24]
+        nop
+    #endif
+    alu[addr_lo, --, B, in_pci_q, <<(log2(NFD_OUT_ATOMICS_SZ))]
+
+    alu[credits, *l$index3, -, 1]
+    bmi[reserve#]
+    br[end#], defer[1]
+        alu[*l$index3, --, B, credits]
+
+reserve#:
+    ov_single(OV_IMMED8, PKT_IO_NFD_CREDIT_BATCH)
+    mem[test_subsat_imm, $credits, addr_hi, <<8, addr_lo, 1], indirect_ref, ctx_swap[sig_credits]
+
+    // NFD hands out fewer than a batch when it has fewer left
+    alu[credits, --, B, $credits]
+    beq[NO_CREDIT_LABEL]
+    alu[--, credits, -, PKT_IO_NFD_CREDIT_BATCH]
+    blo[granted#], defer[1]
+        alu[credits, credits, -, 1]
+    immed[credits, (PKT_IO_NFD_CREDIT_BATCH - 1)]
+
+granted#:
+    // the queue runs low, do not strand its credits in this ME
+    move(low, PKT_IO_NFD_CREDIT_LOW)
+    alu[--, $credits, -, low]
+    bhs[keep_surplus#]
+    alu[--, --, B, credits]
+    beq[end#]
+    ov_single(OV_IMMED16, credits)
+    mem[add_imm, --, addr_hi, <<8, addr_lo], indirect_ref
+    br[end#]
+
+keep_surplus#:
+    // other contexts may have added to the surplus while swapped out
+    alu[*l$index3, *l$index3, +, credits]
+    immed[addr_lo, __pkt_io_nfd_credits_held]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr_lo]
+    nop
+    nop
+    nop
+    alu[*l$index3, --, B, 1]
+
+end#:
+.end
+#endm
+
+
+/* Return the NFD out credits held by the ME, if any */
+#macro __pkt_io_nfd_credits_return()
+.begin
+    .reg addr
+    .reg addr_hi
+    .reg addr_lo
+    .reg credits
+    .reg idx
+
+    immed[addr, __pkt_io_nfd_credits_held]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    immed[addr, __pkt_io_nfd_credits]
+    immed[idx, 0]
+    alu[addr_hi, --, B, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), <<24]
+    alu[--, --, B, *l$index3]
+    beq[end#], defer[1]
+        alu[*l$index3, --, B, 0]
+
+return_loop#:
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    alu[addr, addr, +, 4]
+    alu[addr_lo, idx, AND, 0x3f]
+    alu[addr_lo, --, B, addr_lo, <<(log2(NFD_OUT_ATOMICS_SZ))]
+    alu[credits, --, B, *l$index3]
+    beq[next#], defer[1]
+        alu[*l$index3, --, B, 0]
+
+    #ifdef PV_MULTI_PCI
+        alu[addr_hi, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), +, idx, >>6]
+        alu[addr_hi, --, B, addr_hi, <<24]
+    #endif
+    ov_single(OV_IMMED16, credits)
+    mem[add_imm, --, addr_hi, <<8, addr_lo], indirect_ref
+
+next#:
+    alu[idx, idx, +, 1]
+    alu[--, idx, -, (PKT_IO_NFD_CREDIT_PCIE * 64)]
+    blo[return_loop#]
+
+end#:
+.end
+#endm
+
+
+/* Free list buffer sizes of the host queues, copied from _fl_buf_sz_cache
+ * into LM on first use. The app master bumps the action table generation
+ * (NIC_CFG_INSTR_GEN_NN_IDX) after every update of _fl_buf_sz_cache, and a
+ * worker that sees a new generation drops all the sizes cached by its ME.
+ * A size of 0 marks an entry that is not cached.
+ */
+.alloc_mem __pkt_io_fl_buf_sz lmem me (PKT_IO_NFD_CREDIT_PCIE * 64 * 4) (PKT_IO_NFD_CREDIT_PCIE * 64 * 4)
+.alloc_mem __pkt_io_fl_buf_sz_gen lmem me 4 4
+
+
+/** __pkt_io_fl_buf_sz
+ *
+ * Looks up the free list buffer size of a host queue.
+ *
+ * @param out_rxb       Free list buffer size
+ * @param in_pci_isl    PCIe island, only used with PV_MULTI_PCI
+ * @param in_pci_q      NFD queue
+ */
+#macro __pkt_io_fl_buf_sz(out_rxb, in_pci_isl, in_pci_q)
+.begin
+    .reg addr
+    .reg addr_hi
+    .reg addr_lo
+    .reg gen
+    .reg read $rxb
+    .sig sig_rxb
+
+    local_csr_wr[NN_GET, NIC_CFG_INSTR_GEN_NN_IDX]
+    immed[addr, __pkt_io_fl_buf_sz_gen]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    #ifdef PV_MULTI_PCI
+        alu[addr_lo, in_pci_q, OR, in_pci_isl, <<6]
+        alu[addr_lo, --, B, addr_lo, <<2]
+    #else
+        alu[addr_lo, --, B, in_pci_q, <<2]
+        nop
+    #endif
+    immed[addr, __pkt_io_fl_buf_sz]
+    alu[gen, --, B, *n$index]
+    alu[--, gen, -, *l$index3]
+    beq[lookup#], defer[1]
+        alu[addr, addr, OR, addr_lo]
+
+    // the sizes may have changed, drop the ones cached by the ME
+    alu[*l$index3, --, B, gen]
+    __pkt_io_lm_clear(__pkt_io_fl_buf_sz, (PKT_IO_NFD_CREDIT_PCIE * 64))
+
+lookup#:
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    move(addr_hi, (_fl_buf_sz_cache >> 8))
+    nop
+    alu[out_rxb, --, B, *l$index3]
+    bne[end#]
+
+    mem[read32, $rxb, addr_hi, <<8, addr_lo, 1], ctx_swap[sig_rxb]
+    local_csr_wr[NN_GET, NIC_CFG_INSTR_GEN_NN_IDX]
+    alu[out_rxb, --, B, $rxb]
+    nop
+    nop
+
+    // don't cache a size read while the generation changed
+    alu[--, gen, -, *n$index]
+    bne[end#]
+    alu[*l$index3, --, B, out_rxb]
+
+end#:
+.end
+#endm
+
+
+.if (ctx() == 0)
+    __pkt_io_nfd_credits_init()
+    __pkt_io_lm_clear(__pkt_io_fl_buf_sz, (PKT_IO_NFD_CREDIT_PCIE * 64))
+.endif
+
 #define __PKT_IO_QUIESCE_NBI 1
 #define __PKT_IO_QUIESCE_NFD 2
 #define __PKT_IO_QUIESCE_ALL (__PKT_IO_QUIESCE_NBI | __PKT_IO_QUIESCE_NFD)
@@ -94,12 +376,10 @@ nfd_out_send_init()
     .reg multicast
     .reg pci_isl
     .reg pci_q
-    .reg read $rxb
-    .reg read $nfd_credits
+    .reg rxb
     .reg write $nfd_desc[4]
     .xfer_order $nfd_desc
     .sig sig_nfd
-    .sig sig_rd
 
     #ifdef PV_MULTI_PCI
         alu[pci_isl, 3, AND, in_tx_args, >>6]
@@ -122,18 +402,7 @@ check_mru#:
     bmi[buf_sz_check#]
 
 check_credits#:
-    #ifdef PV_MULTI_PCI
-        alu[addr_hi, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), OR, pci_isl]
-        alu[addr_hi, --, B, addr_hi, <<24]
-    #else
-        alu[addr_hi, --, B, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), <<24]
-    #endif
-    alu[addr_lo, --, B, pci_q, <<(log2(NFD_OUT_ATOMICS_SZ))]
-    ov_single(OV_IMMED8, 1)
-    mem[test_subsat_imm, $nfd_credits, addr_hi, <<8, addr_lo, 1], indirect_ref, ctx_swap[sig_nfd]
-
-    alu[--, --, B, $nfd_credits]
-    beq[drop_buf_pci#]
+    __pkt_io_nfd_credit_get(pci_isl, pci_q, drop_buf_pci#)
 
     br=byte[bls, 0, 3, tx_nfd#]
 
@@ -166,13 +435,8 @@ tx_nfd#:
     ctx_arb[sig_nfd], br[tx_stats_update#]
 
 buf_sz_check#:
-    move(addr_hi, (_fl_buf_sz_cache >> 8))
-    alu[addr_lo, --, B, pci_q, <<2]
-#ifdef PV_MULTI_PCI
-    alu[addr_lo, addr_lo, OR, pci_isl, <<(6 + 2)]
-#endif
-    mem[read32, $rxb, addr_hi, <<8, addr_lo, 1], ctx_swap[sig_rd]
-    alu[--, $rxb, -, buf_sz]
+    __pkt_io_fl_buf_sz(rxb, pci_isl, pci_q)
+    alu[--, rxb, -, buf_sz]
     bge[check_credits#]
 
 #ifdef PV_MULTI_PCI
@@ -295,8 +559,7 @@ end#:
     .reg vlan_id
     .reg vlan_ports[2] // top six bits of vlan_ports[0] used to store base queue when processing flips to 2nd word
     .reg null_vlan_id
-    .reg read $vf_rxb
-    .reg read $nfd_credits
+    .reg vf_rxb
     .reg write $nfd_desc[4]
     .xfer_order $nfd_desc
     .reg read $vlan_ports[2]
@@ -361,13 +624,7 @@ tx_vlan_loop#:
     bmi[vf_buf_sz_check#]
 
 packet_fits#:
-    alu[addr_hi, --, B, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), <<24]
-    alu[addr_lo, --, B, pci_q, <<(log2(NFD_OUT_ATOMICS_SZ))]
-    ov_single(OV_IMMED8, 1)
-    mem[test_subsat_imm, $nfd_credits, addr_hi, <<8, addr_lo, 1], indirect_ref, ctx_swap[sig_nfd]
-
-    alu[--, --, B, $nfd_credits]
-    beq[no_tx_continue#]
+    __pkt_io_nfd_credit_get(0, pci_q, no_tx_continue#)
 
     pv_multicast_resend(io_pkt_vec)
 
@@ -380,10 +637,8 @@ packet_fits#:
     pv_stats_tx_host(io_pkt_vec, 0, pci_q, --, tx_vlan_loop#, --)
 
 vf_buf_sz_check#:
-    move(addr_hi, (_fl_buf_sz_cache >> 8))
-    alu[addr_lo, --, B, pci_q, <<2]
-    mem[read32, $vf_rxb, addr_hi, <<8, addr_lo, 1], ctx_swap[sig_rd]
-    alu[--, $vf_rxb, -, buf_sz]
+    __pkt_io_fl_buf_sz(vf_rxb, 0, pci_q)
+    alu[--, vf_rxb, -, buf_sz]
     bge[packet_fits#]
 
     pv_stats_update(io_pkt_vec, RX_DISCARD_MRU, pci_q, tx_vlan_loop#)
@@ -431,18 +686,47 @@ check_done#:
 
 #macro __pkt_io_no_ctm_buffer()
 .begin
+    .reg addr_hi
+    .reg addr_lo
     .reg future
+    .reg sts
+    .reg write $stall[4]
+    .xfer_order $stall
+    .sig sig_stall
+
+    passert(PKT_IO_CTM_BACKOFF_MIN, "POWER_OF_2")
+    passert(PKT_IO_CTM_BACKOFF_MAX, "POWER_OF_2")
+    passert(PKT_IO_CTM_BACKOFF_MIN, "LE", PKT_IO_CTM_BACKOFF_MAX)
+
     local_csr_wr[ACTIVE_FUTURE_COUNT_SIGNAL, &__pkt_io_sig_nfd_retry]
     local_csr_rd[TIMESTAMP_LOW]
     immed[future, 0]
-    alu[future, future, +, 250] // 4000 cycles
+    alu[future, future, +, __pkt_io_ctm_backoff]
     local_csr_wr[ACTIVE_CTX_FUTURE_COUNT, future]
+
+    local_csr_rd[ACTIVE_CTX_STS]
+    immed[sts, 0]
+    alu[addr_lo, 0xf, AND, sts, >>3]
+    alu[sts, 0x3f, AND, sts, >>25]
+    alu[addr_lo, addr_lo, OR, sts, <<4]
+    alu[addr_lo, --, B, addr_lo, <<(log2(PKT_IO_CTM_STALL_ME_SIZE))]
+    move(addr_hi, (_pkt_io_ctm_stall >> 8))
+    immed[$stall[0], 0]
+    immed[$stall[1], 1]
+    immed[$stall[2], 0]
+    alu[$stall[3], --, B, __pkt_io_ctm_backoff]
+    mem[add64, $stall[0], addr_hi, <<8, addr_lo, 2], ctx_swap[sig_stall]
+
+    br_bset[__pkt_io_ctm_backoff, log2(PKT_IO_CTM_BACKOFF_MAX), end#]
+    alu[__pkt_io_ctm_backoff, --, B, __pkt_io_ctm_backoff, <<1]
+end#:
 .end
 #endm
 
 
 #macro __pkt_io_dispatch_nfd()
     pkt_buf_alloc_ctm(__pkt_io_nfd_pkt_no, PKT_BUF_ALLOC_CTM_SZ_256B, skip_dispatch#, __pkt_io_no_ctm_buffer)
+    immed[__pkt_io_ctm_backoff, PKT_IO_CTM_BACKOFF_MIN]
     nfd_in_recv($__pkt_io_nfd_desc, 0, 0, 0, __pkt_io_sig_nfd, SIG_DONE)
 skip_dispatch#:
 #endm
@@ -450,6 +734,7 @@ skip_dispatch#:
 
 #macro pkt_io_init(out_pkt_vec)
     immed[__pkt_io_quiescent, 0]
+    immed[__pkt_io_ctm_backoff, PKT_IO_CTM_BACKOFF_MIN]
     alu[BF_A(out_pkt_vec, PV_QUEUE_IN_TYPE_bf), --, B, 0, <<BF_L(PV_QUEUE_IN_TYPE_bf)]
     __pkt_io_dispatch_nbi()
 #endm
@@ -477,7 +762,7 @@ nbi_dispatch#:
 wait_nfd_priority#:
     ctx_arb[__pkt_io_sig_epoch, __pkt_io_sig_nbi, __pkt_io_sig_nfd, __pkt_io_sig_nfd_retry], any
     br_signal[__pkt_io_sig_nfd_retry, nfd_dispatch#]
-    br_signal[__pkt_io_sig_epoch, wait_nfd_priority#]
+    br_signal[__pkt_io_sig_epoch, epoch#]
 
 clear_sig_rx_nfd#:
     br_!signal[__pkt_io_sig_nfd, clear_sig_rx_nbi#] // __pkt_io_sig_nbi is asserted
@@ -488,6 +773,13 @@ rx_nfd#:
         alu[out_act_addr, 0xff, AND, BF_A($__pkt_io_nfd_desc, NFD_IN_QID_fld)]
         alu[out_act_addr, --, B, out_act_addr, <<(log2(NIC_MAX_INSTR * 4))]
 
+epoch#:
+    __pkt_io_nfd_credits_return()
+    ebpf_prog_stats_flush()
+    cmsg_perf_epoch()
+    br_bclr[BF_AL(io_vec, PV_QUEUE_IN_TYPE_bf), wait_nbi_priority#]
+    br[wait_nfd_priority#]
+
 quiesce_nbi#:
     __pkt_io_quiesce_wait_active(NBI, nbi_dispatch#, nfd, rx_nfd#, quiescence#)
 
@@ -495,6 +787,8 @@ quiesce_nfd#:
     __pkt_io_quiesce_wait_active(NFD, nfd_dispatch#, nbi, rx_nbi#, quiescence#)
 
 quiescence#:
+    __pkt_io_nfd_credits_return()
+    ebpf_prog_stats_flush()
     ctx_arb[__pkt_io_sig_resume]
     pkt_io_init(io_vec)
 
@@ -505,7 +799,7 @@ nfd_dispatch#:
 wait_nbi_priority#:
     ctx_arb[__pkt_io_sig_epoch, __pkt_io_sig_nbi, __pkt_io_sig_nfd, __pkt_io_sig_nfd_retry], any
     br_signal[__pkt_io_sig_nfd_retry, nfd_dispatch#]
-    br_signal[__pkt_io_sig_epoch, wait_nbi_priority#]
+    br_signal[__pkt_io_sig_epoch, epoch#]
 
 clear_sig_rx_nbi#:
     br_!signal[__pkt_io_sig_nbi, clear_sig_rx_nfd#] // __pkt_io_sig_nfd is asserted
@@ -487,12 +487,122 @@ ct_signal(unsigned int isl, unsigned int me, unsigned int ctx, unsigned int sign
 
 __shared __lmem uint32_t dp_mes_ids[] = { APP_MES_LIST };
 
+/* Stop the threads of a datapath ME that went quiescent, force the ones that
+ * did not within the grace period. */
 static __intrinsic void
-update_bpf_prog(__gpr uint32_t *ctx_mode, __emem __addr40 uint8_t *bar_base, uint32_t vnic)
+bpf_me_quiesce(unsigned int isl, unsigned int me)
+{
+    __gpr unsigned int ctx;
+    __gpr unsigned int wkp_mask;
+    __gpr unsigned int ctx_enables;
+
+    do {
+        ctx_enables = ct_read_csr(isl, me, ME_CSR_CTX_ENABLES);
+        ctx_enables &= 0xffff00ff;
+        ct_write_csr(isl, me, ME_CSR_CTX_ENABLES, ctx_enables);
+        sleep(250);
+        for (ctx = 0; ctx < 8; ctx += 2) {
+            ct_write_csr(isl, me, ME_CSR_CTX_PTR, ctx);
+            wkp_mask = ct_read_csr(isl, me, ME_CSR_IND_CTX_WKP_EVT);
+            if (! (wkp_mask & ((1 << PKT_IO_SIG_EPOCH) | (1 << PKT_IO_SIG_RESUME))))
+                ctx_enables |= (1 << (8 + ctx));
+        }
+        if (ctx_enables & 0xff00) {
+            ct_write_csr(isl, me, ME_CSR_CTX_ENABLES, ctx_enables);
+            sleep(1000); // shorter wait, will wait again if necessary
+        }
+    }
+    while (ctx_enables & 0xff00);
+}
+
+/* The eBPF image of the vNIC being loaded, fetched from the host once and
+ * written to the code store of every datapath ME from here. Padded with
+ * zeros to a multiple of BPF_IMAGE_CHUNK instructions, which stays within
+ * the NFD_BPF_MAX_LEN window of the vNIC. */
+#define BPF_IMAGE_CHUNK         4
+#if (NFD_BPF_MAX_LEN % BPF_IMAGE_CHUNK)
+    #error "NFD_BPF_MAX_LEN must be a multiple of BPF_IMAGE_CHUNK"
+#endif
+__export __emem __addr40 uint64_t bpf_image[NFD_BPF_MAX_LEN];
+
+/* Copy words instructions from host memory at addr_hi:addr_lo to
+ * bpf_image[], return the padded instruction count. */
+static __intrinsic unsigned int
+bpf_image_fetch(unsigned int addr_hi, unsigned int addr_lo, unsigned int words)
 {
-    __xread uint32_t host_mem_bpf_cfg[3];
     __xread uint32_t data[2];
+    __xwrite uint32_t data_out[2];
+    __gpr unsigned int i;
+
+    for (i = 0; i < words; i++) {
+        pcie_read(&data, 4, PCIE_CPP2PCIE_BPF_LOAD, addr_hi, addr_lo << 3, sizeof(data));
+
+        addr_lo++;
+        addr_hi += addr_lo >> 29;
+        data_out[0] = data[0];
+        data_out[1] = data[1];
+        mem_write64(data_out, &bpf_image[i], sizeof(data_out));
+    }
+
+    data_out[0] = 0;
+    data_out[1] = 0;
+    for (; i % BPF_IMAGE_CHUNK; i++)
+        mem_write64(data_out, &bpf_image[i], sizeof(data_out));
+
+    return i;
+}
+
+/* Write words instructions of bpf_image[] to the code store of a stopped
+ * ME, from ustore_addr on. words is a multiple of BPF_IMAGE_CHUNK. */
+static __intrinsic void
+bpf_me_load(unsigned int isl, unsigned int me, unsigned int ustore_addr,
+            unsigned int words)
+{
+    __xread uint32_t data[2 * BPF_IMAGE_CHUNK];
     __gpr uint32_t data_out;
+    __gpr unsigned int i;
+
+    // set instr pointer to 'start' and enable writing. */
+    data_out = 0x80000000 + ustore_addr;
+    ct_write_csr(isl, me, ME_CSR_USTORE_ADDR, data_out);
+
+    for (i = 0; i < words; i += BPF_IMAGE_CHUNK) {
+        mem_read64(data, &bpf_image[i], sizeof(data));
+
+        #define _BPF_ME_LOAD_INSTR(_n)                                  \
+            data_out = data[2 * (_n)];                                  \
+            ct_write_csr(isl, me, ME_CSR_USTORE_DATA_LO, data_out);     \
+            data_out = data[2 * (_n) + 1];                              \
+            ct_write_csr(isl, me, ME_CSR_USTORE_DATA_HI, data_out);
+        _BPF_ME_LOAD_INSTR(0)
+        _BPF_ME_LOAD_INSTR(1)
+        _BPF_ME_LOAD_INSTR(2)
+        _BPF_ME_LOAD_INSTR(3)
+        #undef _BPF_ME_LOAD_INSTR
+    }
+
+    // normal mode
+    data_out = 0;
+    ct_write_csr(isl, me, ME_CSR_USTORE_ADDR, data_out);
+}
+
+/* Load the eBPF image of a vNIC into the code store of the datapath MEs.
+ * The image is the entry program followed by the programs it tail calls,
+ * the values of its PROG_ARRAY maps are code store addresses within the
+ * NFD_BPF_MAX_LEN instructions of the vNIC. Longer images would overwrite
+ * the next vNIC and are refused before any ME is stopped, the previous
+ * program stays in place and non-zero is returned.
+ *
+ * The EBPF action runs inline on every worker ME of every datapath island,
+ * so all of them take the image. It is read over PCIe once, before the MEs
+ * are stopped, and written to each code store from EMEM. The MEs are
+ * quiesced together, loaded and resumed together: the grace period is paid
+ * once rather than per ME and no packet sees the new program on one ME and
+ * the old one on another. */
+static __intrinsic int
+update_bpf_prog(__gpr uint32_t *ctx_mode, __emem __addr40 uint8_t *bar_base, uint32_t vnic)
+{
+    __xread uint32_t host_mem_bpf_cfg[3];
     __gpr unsigned int addr_hi;
     __gpr unsigned int addr_lo;
     __gpr unsigned int i;
@@ -500,91 +610,70 @@ update_bpf_prog(__gpr uint32_t *ctx_mode, __emem __addr40 uint8_t *bar_base, uin
     __gpr unsigned int isl;
     __gpr unsigned int me;
     __gpr unsigned int ctx;
-    __gpr unsigned int wkp_mask;
     __gpr unsigned int ctx_enables;
 
+    mem_read32(host_mem_bpf_cfg, bar_base + NFP_NET_CFG_BPF_SIZE - 2, sizeof host_mem_bpf_cfg);
+
+    // note: data from the BAR comes in 4B-swapped; low is high, high is low
+    words = host_mem_bpf_cfg[0] >> 16;
+    if (words > NFD_BPF_MAX_LEN)
+        return 1;
+    addr_lo = host_mem_bpf_cfg[1];
+    addr_hi = host_mem_bpf_cfg[2];
+
+    pcie_c2p_barcfg_set(0 /*pci_isl0*/, PCIE_CPP2PCIE_BPF_LOAD, addr_hi, addr_lo, 0);
+
+    addr_lo >>= 3;
+
+    words = bpf_image_fetch(addr_hi, addr_lo, words);
+
+    // signal threads of all MEs to go quiescent
     for (i = 0; i < sizeof(dp_mes_ids) / sizeof(uint32_t); i++) {
         isl = dp_mes_ids[i] >> 4;
         me = dp_mes_ids[i] & 0xf;
 
-        // signal threads to go quiescent
         for (ctx = 0; ctx < 8; ctx = ctx + 2) {
             ct_signal(isl, me, ctx, PKT_IO_SIG_QUIESCE_NBI);
             ct_signal(isl, me, ctx, PKT_IO_SIG_QUIESCE_NFD);
         }
-        sleep(10000);
-
-        // force any remaining threads to quiesce
-        do {
-            ctx_enables = ct_read_csr(isl, me, ME_CSR_CTX_ENABLES);
-            ctx_enables &= 0xffff00ff;
-            ct_write_csr(isl, me, ME_CSR_CTX_ENABLES, ctx_enables);
-            sleep(250);
-            for (ctx = 0; ctx < 8; ctx += 2) {
-                ct_write_csr(isl, me, ME_CSR_CTX_PTR, ctx);
-                wkp_mask = ct_read_csr(isl, me, ME_CSR_IND_CTX_WKP_EVT);
-                if (! (wkp_mask & ((1 << PKT_IO_SIG_EPOCH) | (1 << PKT_IO_SIG_RESUME))))
-                    ctx_enables |= (1 << (8 + ctx));
-            }
-            if (ctx_enables & 0xff00) {
-                ct_write_csr(isl, me, ME_CSR_CTX_ENABLES, ctx_enables);
-                sleep(1000); // shorter wait, will wait again if necessary
-            }
-        }
-        while (ctx_enables & 0xff00);
-
-        // safe to write BPF code store
-        mem_read32(host_mem_bpf_cfg, bar_base + NFP_NET_CFG_BPF_SIZE - 2, sizeof host_mem_bpf_cfg);
-
-        // note: data from the BAR comes in 4B-swapped; low is high, high is low
-        words = host_mem_bpf_cfg[0] >> 16;
-        addr_lo = host_mem_bpf_cfg[1];
-        addr_hi = host_mem_bpf_cfg[2];
-
-        pcie_c2p_barcfg_set(0 /*pci_isl0*/, PCIE_CPP2PCIE_BPF_LOAD, addr_hi, addr_lo, 0);
-
-        addr_lo >>= 3;
-
-        // set instr pointer to 'start' and enable writing. */
-        data_out = 0x80000000 + NFD_BPF_START_OFF + vnic * NFD_BPF_MAX_LEN;
-        ct_write_csr(isl, me, ME_CSR_USTORE_ADDR, data_out);
+    }
+    sleep(10000);
 
-        while (words--) {
-            pcie_read(&data, 4, PCIE_CPP2PCIE_BPF_LOAD, addr_hi, addr_lo << 3, sizeof(data));
+    // force any remaining threads to quiesce, safe to write BPF code store
+    for (i = 0; i < sizeof(dp_mes_ids) / sizeof(uint32_t); i++) {
+        isl = dp_mes_ids[i] >> 4;
+        me = dp_mes_ids[i] & 0xf;
 
-            addr_lo++;
-            addr_hi += addr_lo >> 29;
-            NIC_LIB_DBG(libnic_dbg, isl);
-            NIC_LIB_DBG(libnic_dbg, me);
-            data_out = data[0];
-            NIC_LIB_DBG(libnic_dbg, data_out);
-            ct_write_csr(isl, me, ME_CSR_USTORE_DATA_LO, data_out);
-            data_out = data[1];
-            NIC_LIB_DBG(libnic_dbg, data_out);
-            ct_write_csr(isl, me, ME_CSR_USTORE_DATA_HI, data_out);
-        }
+        bpf_me_quiesce(isl, me);
+        bpf_me_load(isl, me, NFD_BPF_START_OFF + vnic * NFD_BPF_MAX_LEN, words);
+    }
 
-        // normal mode
-        data_out = 0;
-        ct_write_csr(isl, me, ME_CSR_USTORE_ADDR, data_out);
+    sleep(500);
 
-        sleep(500);
+    for (i = 0; i < sizeof(dp_mes_ids) / sizeof(uint32_t); i++) {
+        isl = dp_mes_ids[i] >> 4;
+        me = dp_mes_ids[i] & 0xf;
 
         ctx_enables = ct_read_csr(isl, me, ME_CSR_CTX_ENABLES);
         ct_write_csr(isl, me, ME_CSR_CTX_ENABLES, ctx_enables | 0x5500);
+    }
 
-        sleep(500);
+    sleep(500);
+
+    // kick off threads again
+    for (i = 0; i < sizeof(dp_mes_ids) / sizeof(uint32_t); i++) {
+        isl = dp_mes_ids[i] >> 4;
+        me = dp_mes_ids[i] & 0xf;
 
-        // kick off threads again
         for (ctx = 0; ctx < 8; ctx += 2) {
             ct_signal(isl, me, ctx, PKT_IO_SIG_RESUME);
         }
-   }
+    }
 
-    return;
+    return 0;
 }
 
-__intrinsic void
+__intrinsic int
 nic_local_bpf_reconfig(__gpr uint32_t *ctx_mode, uint32_t vid, uint32_t vnic)
 {
     __shared __lmem volatile struct nic_local_state *nic = &nic_lstate;
@@ -596,14 +685,16 @@ nic_local_bpf_reconfig(__gpr uint32_t *ctx_mode, uint32_t vid, uint32_t vnic)
     /* Calculate the relevant configuration BAR base address */
     bar_base = NFD_CFG_BAR_ISL(NIC_PCI, vid);
 
-    update_bpf_prog(ctx_mode, bar_base, vnic);
-
-    return;
+    return update_bpf_prog(ctx_mode, bar_base, vnic);
 }
 
 #define EPOCH_NN_IDX 127
 __shared __lmem uint32_t epoch = 0;
 
+/* Signal every datapath context and wait for it to consume the signal. A
+ * context only does so between packets, so on return no packet that was in
+ * flight on entry is still being processed. MEs that are not running (and
+ * the calling ME) are skipped. */
 __intrinsic void
 nic_local_epoch() {
     __gpr unsigned int i;
@@ -611,13 +702,21 @@ nic_local_epoch() {
     __gpr unsigned int me;
     __gpr unsigned int ctx;
     __gpr unsigned int sig_mask;
+    __gpr unsigned int self;
 
     epoch++;
 
+    self = local_csr_read(local_csr_active_ctx_sts);
+    self = (((self >> 25) & 0x3f) << 4) | ((self >> 3) & 0xf);
+
     for (i = 0; i < sizeof(dp_mes_ids) / sizeof(uint32_t); i++) {
         isl = dp_mes_ids[i] >> 4;
         me = dp_mes_ids[i] & 0xf;
 
+        if (dp_mes_ids[i] == self ||
+            !(ct_read_csr(isl, me, ME_CSR_CTX_ENABLES) & 0xff00))
+            continue;
+
         for (ctx = 0; ctx < 8; ctx = ctx + 2) {
             ct_signal(isl, me, ctx, PKT_IO_SIG_EPOCH);
         }
@@ -0,0 +1,102 @@
+#! /usr/bin/env python
+
+# Copyright (c) 2019 Netronome Systems, Inc. All rights reserved.
+# SPDX-License-Identifier: BSD-2-Clause
+
+"""
+Decode the per action cycle profile of a datapath built with ACTIONS_PROFILE.
+
+The datapath (see __actions_prof in actions.uc) accumulates TIMESTAMP ticks
+and invocations per action opcode and periodically adds them to the
+_actions_prof rtsym. The rtsym holds ACTIONS_PROF_ME_SIZE bytes per ME,
+indexed by (island << 4) | ME, with ACTIONS_PROF_SLOTS slots of two 64-bit
+big endian counters each: ticks and invocations.
+
+Usage:
+    nfp-rtsym _actions_prof | nic-actions-prof.py [-m]
+"""
+
+from __future__ import print_function
+
+import argparse
+import fileinput
+import sys
+
+# Order of opcodes in app_config_instr.h, followed by the idle slot
+ACTIONS = [
+    "drop", "rx_wire", "dst_mac_match", "checksum", "rss", "tx_host",
+    "rx_host", "tx_wire", "cmsg", "ebpf", "pop_vlan", "push_vlan",
+    "src_mac_match", "veb_lookup", "pop_pkt", "push_pkt", "tx_vlan",
+    "l2_switch_wire", "l2_switch_host", "jump", "flow_lookup", "(idle)",
+]
+
+ACTIONS_PROF_SLOTS = 32
+ACTIONS_PROF_ME_WORDS = ACTIONS_PROF_SLOTS * 4
+CYCLES_PER_TICK = 16
+
+
+def read_words(lines):
+    """Parse nfp-rtsym output into a {word offset: value} dict."""
+    words = {}
+    off = 0
+    for line in lines:
+        for tok in line.split():
+            if tok.endswith(':'):
+                off = int(tok[:-1], 16) // 4
+                continue
+            words[off] = int(tok, 16)
+            off += 1
+    return words
+
+
+def me_profiles(words):
+    """Yield (island, me, [(calls, cycles)]) for every ME with samples."""
+    for idx in sorted(set(off // ACTIONS_PROF_ME_WORDS for off in words)):
+        base = idx * ACTIONS_PROF_ME_WORDS
+        slots = []
+        for slot in range(len(ACTIONS)):
+            w = [words.get(base + slot * 4 + i, 0) for i in range(4)]
+            ticks = (w[0] << 32) | w[1]
+            calls = (w[2] << 32) | w[3]
+            slots.append((calls, ticks * CYCLES_PER_TICK))
+        if any(calls for calls, _ in slots):
+            yield idx >> 4, idx & 0xf, slots
+
+
+def print_table(title, slots):
+    total = sum(cycles for _, cycles in slots)
+    print(title)
+    print("  %-16s %14s %18s %12s %7s" %
+          ("action", "calls", "cycles", "cycles/call", "share"))
+    for name, (calls, cycles) in zip(ACTIONS, slots):
+        if not calls:
+            continue
+        print("  %-16s %14d %18d %12.1f %6.2f%%" %
+              (name, calls, cycles, float(cycles) / calls,
+               100.0 * cycles / total if total else 0))
+    print("  %-16s %14s %18d" % ("total", "", total))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ACTIONS_PROFILE decoder")
+    parser.add_argument('-m', '--per-me', action='store_true',
+                        help="print a table per ME instead of the sum")
+    parser.add_argument('files', nargs='*', help="nfp-rtsym output")
+    args = parser.parse_args()
+
+    profiles = list(me_profiles(read_words(fileinput.input(args.files))))
+    if not profiles:
+        sys.exit("no samples, is the firmware built with ACTIONS_PROFILE?")
+
+    if args.per_me:
+        for isl, me, slots in profiles:
+            print_table("i%d.me%d" % (isl, me), slots)
+        return
+
+    slots = [(sum(p[2][s][0] for p in profiles),
+              sum(p[2][s][1] for p in profiles)) for s in range(len(ACTIONS))]
+    print_table("%d MEs" % len(profiles), slots)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,87 @@
+#! /usr/bin/env python
+
+# Copyright (c) 2020 Netronome Systems, Inc. All rights reserved.
+# SPDX-License-Identifier: BSD-2-Clause
+
+"""
+Decode the per program eBPF statistics of a datapath built with
+EBPF_PROG_STATS.
+
+The datapath (see ebpf_prog_stats in ebpf.uc) counts the runs of the eBPF
+image in each NFD_BPF_MAX_LEN code store slot, i.e. of the program of a
+vNIC, and periodically adds them to the _ebpf_prog_stats rtsym. The rtsym
+holds EBPF_PROG_STATS_CNTRS 64-bit big endian counters per slot: runs,
+TIMESTAMP ticks, PASS, DROP, REDIR (XDP_TX and XDP_REDIRECT), ABORT, helper
+calls and tail calls. Counts of the last 2^EBPF_PROG_STATS_FLUSH_SHF runs
+per ME may still be in LM.
+
+Usage:
+    nfp-rtsym _ebpf_prog_stats | nic-ebpf-stats.py [-c MHZ]
+"""
+
+from __future__ import print_function
+
+import argparse
+import fileinput
+import sys
+
+COUNTERS = [
+    "run_cnt", "ticks", "pass", "drop", "redir", "abort", "helper_calls",
+    "tail_calls",
+]
+
+EBPF_PROG_STATS_SLOT_WORDS = len(COUNTERS) * 2
+CYCLES_PER_TICK = 16
+
+
+def read_words(lines):
+    """Parse nfp-rtsym output into a {word offset: value} dict."""
+    words = {}
+    off = 0
+    for line in lines:
+        for tok in line.split():
+            if tok.endswith(':'):
+                off = int(tok[:-1], 16) // 4
+                continue
+            words[off] = int(tok, 16)
+            off += 1
+    return words
+
+
+def prog_stats(words):
+    """Yield (slot, {counter: value}) for every slot with runs."""
+    for slot in sorted(set(off // EBPF_PROG_STATS_SLOT_WORDS for off in words)):
+        base = slot * EBPF_PROG_STATS_SLOT_WORDS
+        stats = {}
+        for i, name in enumerate(COUNTERS):
+            stats[name] = ((words.get(base + i * 2, 0) << 32) |
+                           words.get(base + i * 2 + 1, 0))
+        if stats["run_cnt"]:
+            yield slot, stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description="EBPF_PROG_STATS decoder")
+    parser.add_argument('-c', '--clock', type=float, default=800.0,
+                        help="ME clock in MHz, for run_time_ns (default 800)")
+    parser.add_argument('files', nargs='*', help="nfp-rtsym output")
+    args = parser.parse_args()
+
+    progs = list(prog_stats(read_words(fileinput.input(args.files))))
+    if not progs:
+        sys.exit("no runs, is the firmware built with EBPF_PROG_STATS?")
+
+    for slot, stats in progs:
+        cycles = stats["ticks"] * CYCLES_PER_TICK
+        runs = stats["run_cnt"]
+        print("slot %d" % slot)
+        print("  %-14s %18d" % ("run_cnt", runs))
+        print("  %-14s %18d" % ("run_time_ns", cycles * 1000 / args.clock))
+        print("  %-14s %18.1f" % ("cycles/run", float(cycles) / runs))
+        for name in COUNTERS[2:]:
+            print("  %-14s %18d %10.2f/run" %
+                  (name, stats[name], float(stats[name]) / runs))
+
+
+if __name__ == '__main__':
+    main()
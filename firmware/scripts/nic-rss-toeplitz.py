@@ -0,0 +1,131 @@
+#! /usr/bin/env python
+
+# Copyright (c) 2019 Netronome Systems, Inc. All rights reserved.
+# SPDX-License-Identifier: BSD-2-Clause
+
+"""
+Host reference model of the RSS Toeplitz hash computed by the datapath.
+
+The app master expands the 40 byte RSS key of a vNIC into a table of
+precomputed Toeplitz windows in CLS (NIC_RSS_KEY_TBL, see
+app_config_instr.h), one 16 entry row per nibble of hash input.  The
+datapath (__actions_rss in actions.uc) XORs one row entry per input nibble.
+
+This script implements both the plain bit serial Toeplitz hash (as
+specified by Microsoft and implemented by the Linux kernel) and the table
+driven variant used by the firmware, so that the two can be checked against
+each other and the expected values in test/datapath/actions_rss*_test.uc can
+be regenerated.
+
+Usage:
+    nic-rss-toeplitz.py [-k KEY] SRC DST [SPORT DPORT]
+    nic-rss-toeplitz.py [-k KEY] --table
+"""
+
+from __future__ import print_function
+
+import argparse
+import socket
+import struct
+import sys
+
+# Key used by the datapath unit tests, the Microsoft verification suite key
+RSS_TEST_KEY = ("6d5a56da255b0ec24167253d43a38fb0d0ca2bcbae7b30b4"
+                "77cb2da38030f20c6a42b73bbeac01fa")
+
+RSS_KEY_SZ = 40
+# IPv6 source and destination addresses followed by the L4 ports
+RSS_INPUT_MAX_WORDS = 9
+RSS_NIBBLES_PER_WORD = 8
+RSS_ROW_ENTRIES = 16
+
+
+def key_window(key, bit):
+    """Return the 32 bit window of the key starting at bit (MSB first)."""
+    val = int.from_bytes(key, 'big') if hasattr(int, 'from_bytes') else \
+        int(key.encode('hex'), 16)
+    shift = RSS_KEY_SZ * 8 - 32 - bit
+    return (val >> shift) & 0xffffffff
+
+
+def toeplitz(key, data):
+    """Bit serial Toeplitz hash of data (bytes) with key (bytes)."""
+    res = 0
+    for i, byte in enumerate(bytearray(data)):
+        for b in range(8):
+            if byte & (0x80 >> b):
+                res ^= key_window(key, i * 8 + b)
+    return res
+
+
+def key_table(key):
+    """Nibble lookup table as written to NIC_RSS_KEY_TBL for one vNIC.
+
+    Entry [(word * 8 + nibble) * 16 + value] holds the XOR of the key windows
+    selected by the set bits of value at that nibble position of the input.
+    """
+    tbl = []
+    for pos in range(RSS_INPUT_MAX_WORDS * RSS_NIBBLES_PER_WORD):
+        windows = [key_window(key, pos * 4 + b) for b in range(4)]
+        for val in range(RSS_ROW_ENTRIES):
+            entry = 0
+            for b in range(4):
+                if val & (0x8 >> b):
+                    entry ^= windows[b]
+            tbl.append(entry)
+    return tbl
+
+
+def toeplitz_table(tbl, data):
+    """Table driven hash, mirrors the lookups done by __actions_rss."""
+    res = 0
+    for i, byte in enumerate(bytearray(data)):
+        res ^= tbl[(i * 2) * RSS_ROW_ENTRIES + (byte >> 4)]
+        res ^= tbl[(i * 2 + 1) * RSS_ROW_ENTRIES + (byte & 0xf)]
+    return res
+
+
+def hash_input(src, dst, sport=None, dport=None):
+    """Build the hash input in the order the datapath feeds it."""
+    family = socket.AF_INET6 if ':' in src else socket.AF_INET
+    data = socket.inet_pton(family, src) + socket.inet_pton(family, dst)
+    if sport is not None:
+        data += struct.pack('>HH', sport, dport)
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description="RSS Toeplitz reference")
+    parser.add_argument('-k', '--key', default=RSS_TEST_KEY,
+                        help="RSS key as 80 hex digits")
+    parser.add_argument('--table', action='store_true',
+                        help="dump the NIC_RSS_KEY_TBL words for the key")
+    parser.add_argument('src', nargs='?')
+    parser.add_argument('dst', nargs='?')
+    parser.add_argument('sport', nargs='?', type=int)
+    parser.add_argument('dport', nargs='?', type=int)
+    args = parser.parse_args()
+
+    key = bytearray.fromhex(args.key)
+    if len(key) != RSS_KEY_SZ:
+        sys.exit("key must be %d bytes" % RSS_KEY_SZ)
+    key = bytes(key)
+    tbl = key_table(key)
+
+    if args.table:
+        for off, entry in enumerate(tbl):
+            print("%4d 0x%08x" % (off * 4, entry))
+        return
+
+    if args.dst is None:
+        parser.error("SRC and DST are required")
+
+    data = hash_input(args.src, args.dst, args.sport, args.dport)
+    res = toeplitz(key, data)
+    if res != toeplitz_table(tbl, data):
+        sys.exit("table driven hash mismatch")
+    print("0x%08x" % res)
+
+
+if __name__ == '__main__':
+    main()
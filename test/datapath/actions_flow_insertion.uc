@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_flow_insertion.uc
+ * @brief         Allocates the flow cache map and inserts flows, as the
+ *                host does with map add control messages.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+hashmap_alloc_fd(FLOW_TID, FLOW_KEY_SZ, FLOW_VALUE_SZ, 2000, --, swap, BPF_MAP_TYPE_HASH)
+
+.alloc_mem LM_FLOW_BASE_ADDR lmem me (FLOW_KEY_SZ + FLOW_VALUE_SZ) 64
+
+/* in_key[4] as in cmsg_map_types.h, the value holds words IN_VALUE + i */
+#macro flow_entry_insert(in_key, IN_VALUE, SUCCESS)
+.begin
+
+	.reg lm_key_offset
+	.reg lm_value_offset
+	.reg tid
+	.reg value
+
+	move(lm_key_offset, LM_FLOW_BASE_ADDR)
+	local_csr_wr[ACTIVE_LM_ADDR_0, lm_key_offset]
+	alu[lm_value_offset, lm_key_offset, +, FLOW_KEY_SZ]
+	move(value, IN_VALUE)
+	alu[tid, --, b, FLOW_TID]
+
+	alu[*l$index0++, --, b, in_key[0]]
+	alu[*l$index0++, --, b, in_key[1]]
+	alu[*l$index0++, --, b, in_key[2]]
+	alu[*l$index0++, --, b, in_key[3]]
+	#define_eval _FLOW_WORD 0
+	#while (_FLOW_WORD < (FLOW_VALUE_SZ / 4))
+		alu[*l$index0++, --, b, value]
+		alu[value, value, +, 1]
+		#define_eval _FLOW_WORD (_FLOW_WORD + 1)
+	#endloop
+	#undef _FLOW_WORD
+
+	#define HASHMAP_RXFR_COUNT 16
+	#define MAP_RDXR $__pv_pkt_data
+
+	#define_eval HASHMAP_TXFR_COUNT 16
+	.reg write $__map_txfr[HASHMAP_TXFR_COUNT]
+	.xfer_order $__map_txfr
+	__hashmap_set($__map_txfr)
+	#define MAP_TXFR $__map_txfr
+
+	#define MAP_RXCAM $__pv_pkt_data[16]	/* start at 16 for 8 regs */
+
+	hashmap_ops(tid,
+			lm_key_offset,
+			lm_value_offset,
+			HASHMAP_OP_ADD_ANY,
+			error_map_fd#,
+			lookup_not_found#,
+			HASHMAP_RTN_LMEM,
+			--,
+			--,
+			--,
+			swap)
+	#undef MAP_RDXR
+	#undef HASHMAP_RXFR_COUNT
+	#undef HASHMAP_TXFR_COUNT
+	#undef MAP_TXFR
+	#undef MAP_RXCAM
+
+	pv_invalidate_cache(pkt_vec)
+
+	br[SUCCESS]
+
+	error_map_fd#:
+	lookup_not_found#:
+	test_fail()
+
+.end
+#endm
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_flow_lookup_fragment_test.uc
+ * @brief         Tests that packets without a five-tuple skip the flow
+ *                cache lookup and continue with the next instruction.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_32=0x00280101
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_33=0x00140000
+
+#include "pkt_ipv4_udp_x88.uc"
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include "single_ctx_test.uc"
+
+.reg expected_t_idx
+
+test_action_reset()
+
+alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+nop
+local_csr_wr[T_INDEX, __actions_t_idx]
+nop
+nop
+nop
+
+test_assert_equal($__actions[0], ((INSTR_FLOW_LOOKUP << INSTR_OPCODE_LSB) | 0x101))
+
+bitfield_insert__sz2(BF_AML(pkt_vec, PV_PROTO_bf), PROTO_IPV4_FRAGMENT)
+
+__actions_flow_lookup(pkt_vec)
+
+alu[expected_t_idx, t_idx_ctx, OR, &$__actions[1], <<2]
+test_assert_equal(__actions_t_idx, expected_t_idx)
+
+test_assert_equal(*$index, ((INSTR_POP_VLAN << INSTR_OPCODE_LSB)))
+
+test_pass()
+
+PV_SEEK_SUBROUTINE#:
+   pv_seek_subroutine(pkt_vec)
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_flow_lookup_hit_test.uc
+ * @brief         Tests that a cached IPv4 UDP flow replaces the rest of the
+ *                action list with the FLOW_VALUE_SZ bytes of its value.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_32=0x00280101
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_33=0x00140000
+
+#include "pkt_ipv4_udp_x88.uc"
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include "single_ctx_test.uc"
+#include "actions_flow_insertion.uc"
+
+#define TEST_VALUE 0xf00d0000
+
+.reg key[4]
+.reg expected_t_idx
+
+// 192.168.0.1:1024 -> 192.168.0.2:53 UDP from port 0x101
+move(key[0], 0xc0a80001)
+move(key[1], 0xc0a80002)
+move(key[2], 0x04000035)
+move(key[3], ((PROTO_IPV4_UDP << 16) | 0x101))
+flow_entry_insert(key, TEST_VALUE, continue#)
+continue#:
+
+test_action_reset()
+
+alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+nop
+local_csr_wr[T_INDEX, __actions_t_idx]
+nop
+nop
+nop
+
+test_assert_equal($__actions[0], ((INSTR_FLOW_LOOKUP << INSTR_OPCODE_LSB) | 0x101))
+
+__actions_flow_lookup(pkt_vec)
+
+alu[expected_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+test_assert_equal(__actions_t_idx, expected_t_idx)
+
+#define_eval _TEST_WORD 0
+#while (_TEST_WORD < (FLOW_VALUE_SZ / 4))
+    test_assert_equal($__actions[_TEST_WORD], (TEST_VALUE + _TEST_WORD))
+    #define_eval _TEST_WORD (_TEST_WORD + 1)
+#endloop
+
+test_pass()
+
+PV_SEEK_SUBROUTINE#:
+   pv_seek_subroutine(pkt_vec)
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_flow_lookup_miss_test.uc
+ * @brief         Tests that a flow cached for another ingress port is not
+ *                used, processing continues with the next instruction.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_32=0x00280101
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_33=0x00140000
+
+#include "pkt_ipv4_udp_x88.uc"
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include "single_ctx_test.uc"
+#include "actions_flow_insertion.uc"
+
+.reg key[4]
+.reg expected_t_idx
+
+// the flow of the packet, from port 0x102
+move(key[0], 0xc0a80001)
+move(key[1], 0xc0a80002)
+move(key[2], 0x04000035)
+move(key[3], ((PROTO_IPV4_UDP << 16) | 0x102))
+flow_entry_insert(key, 0xf00d0000, continue#)
+continue#:
+
+test_action_reset()
+
+alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+nop
+local_csr_wr[T_INDEX, __actions_t_idx]
+nop
+nop
+nop
+
+__actions_flow_lookup(pkt_vec)
+
+alu[expected_t_idx, t_idx_ctx, OR, &$__actions[1], <<2]
+test_assert_equal(__actions_t_idx, expected_t_idx)
+
+test_assert_equal(*$index, ((INSTR_POP_VLAN << INSTR_OPCODE_LSB)))
+
+test_pass()
+
+PV_SEEK_SUBROUTINE#:
+   pv_seek_subroutine(pkt_vec)
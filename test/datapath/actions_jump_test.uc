@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_jump_test.uc
+ * @brief         Tests following an action list into a continuation entry.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_32=0x00266040
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_33=0xdeafbeef
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x6040 0x00140000
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x6044 0x44554D4D
+
+#include "pkt_ipv4_udp_x88.uc"
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include "single_ctx_test.uc"
+
+.reg expected_t_idx
+
+test_action_reset()
+
+alu[__actions_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+nop
+local_csr_wr[T_INDEX, __actions_t_idx]
+nop
+nop
+nop
+
+test_assert_equal($__actions[0], ((INSTR_JUMP << INSTR_OPCODE_LSB) | 0x6040))
+
+__actions_jump()
+
+alu[expected_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+test_assert_equal(__actions_t_idx, expected_t_idx)
+
+test_assert_equal(*$index++, ((INSTR_POP_VLAN << INSTR_OPCODE_LSB)))
+test_assert_equal(*$index++, 0x44554D4D)
+
+test_pass()
+
+PV_SEEK_SUBROUTINE#:
+   pv_seek_subroutine(pkt_vec)
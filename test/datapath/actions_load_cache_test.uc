@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_load_cache_test.uc
+ * @brief         Tests that actions_load reuses the list of the previous
+ *                packet while the address and table generation match.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x40 0x000e0007
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x80 0x000e0008
+
+#include "pkt_ipv4_udp_x88.uc"
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include "single_ctx_test.uc"
+
+.reg act_addr
+.reg instr
+.reg tbl_addr
+.reg write $instr
+.sig sig_write
+
+actions_init()
+
+immed[act_addr, 0x40]
+actions_load(act_addr)
+test_assert_equal($__actions[0], ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 7))
+test_assert_equal(__actions_cache_addr, 0x40)
+
+// rewrite the entry without bumping the generation
+move(instr, ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 9))
+alu[$instr, --, B, instr]
+immed[tbl_addr, 0x40]
+cls[write, $instr, 0, tbl_addr, 1], ctx_swap[sig_write]
+
+// hit, no CLS read
+actions_load(act_addr)
+test_assert_equal($__actions[0], ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 7))
+
+// another list
+immed[act_addr, 0x80]
+actions_load(act_addr)
+test_assert_equal($__actions[0], ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 8))
+test_assert_equal(__actions_cache_addr, 0x80)
+
+// back to the first one, the rewritten entry is read
+immed[act_addr, 0x40]
+actions_load(act_addr)
+test_assert_equal($__actions[0], ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 9))
+
+// a generation change forces a reload
+alu[__actions_cache_gen, __actions_cache_gen, +, 1]
+move(instr, ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 10))
+alu[$instr, --, B, instr]
+cls[write, $instr, 0, tbl_addr, 1], ctx_swap[sig_write]
+actions_load(act_addr)
+test_assert_equal($__actions[0], ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 10))
+
+// reloading from elsewhere invalidates the list
+__actions_jump()
+test_assert_equal(__actions_cache_addr, 0xffffffff)
+
+test_pass()
+
+PV_SEEK_SUBROUTINE#:
+   pv_seek_subroutine(pkt_vec)
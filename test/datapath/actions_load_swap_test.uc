@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_load_swap_test.uc
+ * @brief         Tests loading a head entry while it is being replaced: the
+ *                first word has been swapped for a jump to the staged list
+ *                and the rest of the entry still holds the previous list.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x40 0x00266040
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x44 0x00140000
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x6040 0x000e0007
+;TEST_INIT_EXEC nfp-rtsym i32.NIC_CFG_INSTR_TBL:0x6044 0x00000000
+
+#include "pkt_ipv4_udp_x88.uc"
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include "single_ctx_test.uc"
+
+.reg act_addr
+.reg expected_t_idx
+
+immed[act_addr, 0x40]
+actions_load(act_addr)
+
+test_assert_equal($__actions[0], ((INSTR_JUMP << INSTR_OPCODE_LSB) | 0x6040))
+test_assert_equal($__actions[1], ((INSTR_POP_VLAN << INSTR_OPCODE_LSB)))
+
+__actions_jump()
+
+alu[expected_t_idx, t_idx_ctx, OR, &$__actions[0], <<2]
+test_assert_equal(__actions_t_idx, expected_t_idx)
+
+test_assert_equal(*$index++, ((INSTR_TX_WIRE << INSTR_OPCODE_LSB) | 7))
+test_assert_equal(*$index++, ((INSTR_DROP << INSTR_OPCODE_LSB)))
+
+test_pass()
+
+PV_SEEK_SUBROUTINE#:
+   pv_seek_subroutine(pkt_vec)
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          actions_prof_test.uc
+ * @brief         Tests that the per action profile adds up to the elapsed
+ *                time of an action list.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define ACTIONS_PROFILE
+
+#include <single_ctx_test.uc>
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include <timestamp.uc>
+
+.reg addr
+.reg calls
+.reg cycles
+.reg expected
+.reg start
+
+timestamp_enable();
+
+actions_prof_init()
+alu[start, --, B, __actions_prof_ts]
+
+// rx_wire, checksum, rss, tx_wire with known minimum durations
+__actions_prof(INSTR_RX_WIRE)
+timestamp_sleep(10)
+__actions_prof(INSTR_CHECKSUM)
+timestamp_sleep(20)
+__actions_prof(INSTR_RSS)
+timestamp_sleep(30)
+__actions_prof(INSTR_TX_WIRE)
+timestamp_sleep(40)
+actions_prof_end()
+
+immed[addr, __actions_prof]
+local_csr_wr[ACTIVE_LM_ADDR_0, addr]
+immed[cycles, 0]
+immed[calls, 0]
+nop
+
+#define_eval SLOT 0
+#while (SLOT < ACTIONS_PROF_SLOTS)
+    alu[cycles, cycles, +, *l$index0++]
+    alu[calls, calls, +, *l$index0++]
+    #define_eval SLOT (SLOT + 1)
+#endloop
+#undef SLOT
+
+alu[expected, __actions_prof_ts, -, start]
+test_assert_equal(cycles, expected)
+test_assert_equal(calls, 5)
+
+#macro check_slot(IN_OP, IN_MIN_TICKS)
+.begin
+    .reg slot_addr
+    .reg min_ticks
+
+    immed[slot_addr, __actions_prof]
+    alu[slot_addr, slot_addr, OR, (IN_OP * 8)]
+    local_csr_wr[ACTIVE_LM_ADDR_0, slot_addr]
+    immed[min_ticks, IN_MIN_TICKS]
+    nop
+    nop
+    test_assert_equal(*l$index0[1], 1)
+    alu[--, *l$index0[0], -, min_ticks]
+    blo[fail#]
+.end
+#endm
+
+check_slot(INSTR_RX_WIRE, 10)
+check_slot(INSTR_CHECKSUM, 20)
+check_slot(INSTR_RSS, 30)
+check_slot(INSTR_TX_WIRE, 40)
+check_slot(ACTIONS_PROF_IDLE, 0)
+
+test_pass()
+
+fail#:
+test_fail()
@@ -3,7 +3,7 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
-;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_33=0xc0ffee
+;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_33=0x9000
 ;TEST_INIT_EXEC nfp-reg mereg:i32.me0.XferIn_34=0xdeadbeef
 
 ;TEST_INIT_EXEC nfp-rtsym i32.NIC_RSS_TBL:0   0
@@ -82,9 +82,108 @@
 
 local_csr_wr[NN_GET, 96]
 
-test_assert_equal($__actions[1], 0xc0ffee)
+test_assert_equal($__actions[1], NIC_RSS_KEY_TBL_ADDR)
 test_assert_equal($__actions[2], 0xdeadbeef)
 
+/* Key of the Microsoft RSS verification suite, the expected hashes in the
+ * tests are generated by firmware/scripts/nic-rss-toeplitz.py for this key.
+ */
+#define RSS_TEST_KEY_0 0x6d5a56da
+#define RSS_TEST_KEY_1 0x255b0ec2
+#define RSS_TEST_KEY_2 0x4167253d
+#define RSS_TEST_KEY_3 0x43a38fb0
+#define RSS_TEST_KEY_4 0xd0ca2bcb
+#define RSS_TEST_KEY_5 0xae7b30b4
+#define RSS_TEST_KEY_6 0x77cb2da3
+#define RSS_TEST_KEY_7 0x8030f20c
+#define RSS_TEST_KEY_8 0x6a42b73b
+#define RSS_TEST_KEY_9 0xbeac01fa
+
+/* Expand the test key into the first NIC_RSS_KEY_TBL slot, independently of
+ * the app master implementation. The key is shifted through {hi, lo} one bit
+ * at a time so that hi always holds the window at the current input bit.
+ */
+#macro rss_key_tbl_init()
+.begin
+    .reg addr
+    .reg entry
+    .reg hi
+    .reg key[8]
+    .reg lo
+    .reg nibbles
+    .reg win[4]
+    .reg words
+    .reg write $row[16]
+    .xfer_order $row
+    .sig sig_row_lo
+    .sig sig_row_hi
+
+    move(hi, RSS_TEST_KEY_0)
+    move(lo, RSS_TEST_KEY_1)
+    move(key[0], RSS_TEST_KEY_2)
+    move(key[1], RSS_TEST_KEY_3)
+    move(key[2], RSS_TEST_KEY_4)
+    move(key[3], RSS_TEST_KEY_5)
+    move(key[4], RSS_TEST_KEY_6)
+    move(key[5], RSS_TEST_KEY_7)
+    move(key[6], RSS_TEST_KEY_8)
+    move(key[7], RSS_TEST_KEY_9)
+
+    move(addr, NIC_RSS_KEY_TBL_ADDR)
+    immed[words, NIC_RSS_KEY_TBL_WORDS]
+word_loop#:
+    immed[nibbles, 8]
+nibble_loop#:
+    #define_eval LOOP (0)
+    #while (LOOP < 4)
+        alu[win[LOOP], --, B, hi]
+        dbl_shf[hi, hi, lo, >>31]
+        alu[lo, --, B, lo, <<1]
+        #define_eval LOOP (LOOP + 1)
+    #endloop
+
+    #define_eval LOOP (0)
+    #while (LOOP < 16)
+        immed[entry, 0]
+        #if (LOOP & 8)
+            alu[entry, entry, XOR, win[0]]
+        #endif
+        #if (LOOP & 4)
+            alu[entry, entry, XOR, win[1]]
+        #endif
+        #if (LOOP & 2)
+            alu[entry, entry, XOR, win[2]]
+        #endif
+        #if (LOOP & 1)
+            alu[entry, entry, XOR, win[3]]
+        #endif
+        alu[$row[LOOP], --, B, entry]
+        #define_eval LOOP (LOOP + 1)
+    #endloop
+
+    cls[write, $row[0], addr, 0, 8], sig_done[sig_row_lo]
+    cls[write, $row[8], addr, 32, 8], sig_done[sig_row_hi]
+    ctx_arb[sig_row_lo, sig_row_hi]
+    alu[addr, addr, +, NIC_RSS_KEY_TBL_ROW_SZ]
+    alu[nibbles, nibbles, -, 1]
+    bne[nibble_loop#]
+
+    /* lo is exhausted after 32 bits, pull in the next key word */
+    alu[lo, --, B, key[0]]
+    #define_eval LOOP (0)
+    #while (LOOP < 7)
+        alu[key[LOOP], --, B, key[LOOP + 1]]
+        #define_eval LOOP (LOOP + 1)
+    #endloop
+    immed[key[7], 0]
+    alu[words, words, -, 1]
+    bne[word_loop#]
+    #undef LOOP
+.end
+#endm
+
+rss_key_tbl_init()
+
 #macro rss_reset_test(in_pkt_vec)
     local_csr_wr[T_INDEX, (32 * 4)]
     immed[__actions_t_idx, (32 * 4)]
@@ -17,7 +17,7 @@ pv_get_length(pkt_len, pkt_vec)
 
 rss_reset_test(pkt_vec)
 __actions_rss(pkt_vec)
-rss_validate(pkt_vec, NFP_NET_RSS_IPV4, test_assert_equal, 0xce60ab57)
+rss_validate(pkt_vec, NFP_NET_RSS_IPV4, test_assert_equal, 0x4b4e59b1)
 
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV4, excl, 0, (14 + 12))
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV4, incl, (14 + 12), (14 + 12 + 8))
@@ -14,7 +14,7 @@ pv_get_length(pkt_len, pkt_vec)
 
 rss_reset_test(pkt_vec)
 __actions_rss(pkt_vec)
-rss_validate(pkt_vec, NFP_NET_RSS_IPV4_TCP, test_assert_equal, 0x3bf00e81)
+rss_validate(pkt_vec, NFP_NET_RSS_IPV4_TCP, test_assert_equal, 0xf730a57b)
 
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV4_TCP, excl, 0, (14 + 12))
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV4_TCP, incl, (14 + 12), (14 + 12 + 8 + 4))
@@ -15,7 +15,7 @@ pv_get_length(pkt_len, pkt_vec)
 rss_reset_test(pkt_vec)
 __actions_rss(pkt_vec)
 
-rss_validate(pkt_vec, NFP_NET_RSS_IPV6_UDP, test_assert_equal, 0x5333e499)
+rss_validate(pkt_vec, NFP_NET_RSS_IPV6_UDP, test_assert_equal, 0xa2ab8a18)
 
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV6_UDP, excl, 0, (14/* + 8*/))
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV6_UDP, incl, (14 + 8), (14 + 8 + 32))
@@ -15,7 +15,7 @@ pv_get_length(pkt_len, pkt_vec)
 
 rss_reset_test(pkt_vec)
 __actions_rss(pkt_vec)
-rss_validate(pkt_vec, NFP_NET_RSS_IPV4_UDP, test_assert_equal, 0x8090a37d)
+rss_validate(pkt_vec, NFP_NET_RSS_IPV4_UDP, test_assert_equal, 0x711cda74)
 
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV4_UDP, excl, 0, (14 + 4 + 12))
 rss_validate_range(pkt_vec, NFP_NET_RSS_IPV4_UDP, incl, (14 + 4 + 12), (14 + 4 + 12 + 8 + 4))
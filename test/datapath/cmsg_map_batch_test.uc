@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          cmsg_map_batch_test.uc
+ * @brief         Tests batched map update, lookup, dump and delete control
+ *                messages on packed records, their error codes and the end
+ *                of a dump, and compares one batch against the same updates
+ *                sent one message per entry.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define NFD_CFG_CLASS_VERSION   0
+#define NFD_CFG_CLASS_DEFAULT 0
+
+#define CMSG_MAP_PROC 1
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+#include "cmsg_map.uc"
+
+pkt_counter_init()
+hashmap_init()
+cmsg_init()
+
+#define TEST_ENTRIES    32
+#define TEST_MISSING    1000
+#define TEST_REC_SZ     12          // 4 byte key, 8 byte value
+#define TEST_DATA       (NFD_IN_DATA_OFFSET + (CMSG_OP_HDR_LW * 4))
+
+.alloc_mem test_cmsg emem global 2048 256
+
+.reg cmsg_addr_hi
+.reg cmsg_type
+.reg cmsg_tag
+.reg cmsg_reply_pktlen
+.reg my_act_ctx
+.reg ctx_num
+.reg hdr[4]
+.reg fd
+.reg fd_single
+.reg map_type
+.reg count
+.reg key
+.reg sum
+.reg offset
+.reg start
+.reg batched
+.reg single
+.reg $rec[3]
+.xfer_order $rec
+.reg read $rd[4]
+.xfer_order $rd
+.sig sig_rec
+
+#macro write_rec(IN_OFFSET, IN_KEY)
+    alu[$rec[0], --, b, IN_KEY]
+    alu[$rec[1], --, b, IN_KEY, <<8]
+    alu[$rec[2], --, ~b, IN_KEY]
+    mem[write32, $rec[0], cmsg_addr_hi, <<8, IN_OFFSET, 3], ctx_swap[sig_rec]
+#endm
+
+#macro check_rec(IN_OFFSET, IN_KEY)
+    mem[read32, $rd[0], cmsg_addr_hi, <<8, IN_OFFSET, 3], ctx_swap[sig_rec]
+    test_assert_equal($rd[0], IN_KEY)
+    alu[key, --, b, IN_KEY, <<8]
+    test_assert_equal($rd[1], key)
+    alu[key, --, ~b, IN_KEY]
+    test_assert_equal($rd[2], key)
+#endm
+
+#macro batch(IN_TYPE, IN_FD, IN_COUNT, IN_FLAGS)
+    immed[cmsg_type, IN_TYPE]
+    alu[hdr[CMSG_MAP_TID_IDX], --, b, IN_FD]
+    alu[hdr[CMSG_MAP_OP_COUNT_IDX], --, b, IN_COUNT]
+    alu[hdr[CMSG_MAP_OP_FLAGS_IDX], --, b, IN_FLAGS]
+    _cmsg_batch_proc(hdr, ctx_num)
+#endm
+
+#macro check_reply(IN_RC, IN_COUNT)
+    immed[offset, NFD_IN_DATA_OFFSET]
+    mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, 4], ctx_swap[sig_rec]
+    test_assert_equal($rd[1], IN_RC)
+    test_assert_equal($rd[2], IN_COUNT)
+#endm
+
+move(cmsg_addr_hi, (test_cmsg >> 8))
+immed[cmsg_tag, 0x55]
+immed[my_act_ctx, 0]
+immed[ctx_num, 0]
+
+immed[map_type, BPF_MAP_TYPE_HASH]
+immed[fd, 1]
+hashmap_alloc_fd(fd, 4, 8, 64, fail#, swap, map_type)
+immed[fd_single, 2]
+hashmap_alloc_fd(fd_single, 4, 8, 64, fail#, swap, map_type)
+
+/*
+ * The same updates, batched then one message per entry
+ */
+immed[key, 1]
+immed[offset, TEST_DATA]
+fill_loop#:
+    write_rec(offset, key)
+    alu[offset, offset, +, TEST_REC_SZ]
+    alu[--, key, -, TEST_ENTRIES]
+    bne[fill_loop#], defer[1]
+    alu[key, key, +, 1]
+
+local_csr_rd[TIMESTAMP_LOW]
+immed[start, 0]
+immed[count, TEST_ENTRIES]
+batch(CMSG_TYPE_MAP_BATCH_UPDATE, fd, count, CMSG_BPF_ANY)
+local_csr_rd[TIMESTAMP_LOW]
+immed[batched, 0]
+alu[batched, batched, -, start]
+check_reply(CMSG_RC_SUCCESS, TEST_ENTRIES)
+test_assert_equal(cmsg_reply_pktlen, (CMSG_OP_HDR_LW * 4))
+
+immed[single, 0]
+immed[key, 1]
+single_loop#:
+    immed[offset, TEST_DATA]
+    write_rec(offset, key)
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[start, 0]
+    immed[count, 1]
+    batch(CMSG_TYPE_MAP_BATCH_UPDATE, fd_single, count, CMSG_BPF_ANY)
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[offset, 0]
+    alu[offset, offset, -, start]
+    alu[single, single, +, offset]
+    check_reply(CMSG_RC_SUCCESS, 1)
+    alu[--, key, -, TEST_ENTRIES]
+    bne[single_loop#], defer[1]
+    alu[key, key, +, 1]
+
+// the per message work is paid once
+alu[--, batched, -, single]
+bhs[fail#]
+
+// a record that already exists is not added again
+immed[offset, TEST_DATA]
+immed[key, 1]
+write_rec(offset, key)
+immed[count, 1]
+batch(CMSG_TYPE_MAP_BATCH_UPDATE, fd, count, CMSG_BPF_NOEXIST)
+check_reply(CMSG_RC_ERR_MAP_EXIST, 0)
+
+// a record that does not exist is not updated
+immed[offset, TEST_DATA]
+immed[key, TEST_MISSING]
+write_rec(offset, key)
+immed[count, 1]
+batch(CMSG_TYPE_MAP_BATCH_UPDATE, fd, count, CMSG_BPF_EXIST)
+check_reply(CMSG_RC_ERR_MAP_NOENT, 0)
+
+/*
+ * Lookup of all keys and a missing one, found records are compacted
+ */
+immed[key, 1]
+immed[offset, TEST_DATA]
+lookup_fill_loop#:
+    write_rec(offset, key)
+    alu[offset, offset, +, TEST_REC_SZ]
+    alu[--, key, -, (TEST_ENTRIES / 2)]
+    bne[lookup_fill_loop#], defer[1]
+    alu[key, key, +, 1]
+immed[sum, TEST_MISSING]
+write_rec(offset, sum)
+alu[offset, offset, +, TEST_REC_SZ]
+lookup_fill_2_loop#:
+    write_rec(offset, key)
+    alu[offset, offset, +, TEST_REC_SZ]
+    alu[--, key, -, TEST_ENTRIES]
+    bne[lookup_fill_2_loop#], defer[1]
+    alu[key, key, +, 1]
+
+immed[count, (TEST_ENTRIES + 1)]
+batch(CMSG_TYPE_MAP_BATCH_LOOKUP, fd, count, 0)
+check_reply(CMSG_RC_SUCCESS, TEST_ENTRIES)
+test_assert_equal(cmsg_reply_pktlen, ((CMSG_OP_HDR_LW * 4) + (TEST_ENTRIES * TEST_REC_SZ)))
+
+immed[key, 1]
+immed[offset, TEST_DATA]
+lookup_check_loop#:
+    check_rec(offset, key)
+    alu[offset, offset, +, TEST_REC_SZ]
+    alu[--, key, -, TEST_ENTRIES]
+    bne[lookup_check_loop#], defer[1]
+    alu[key, key, +, 1]
+
+/*
+ * Dump from bucket 0 until the cursor ends, every entry shows up once and
+ * the message with the last one ends the dump
+ */
+immed[sum, 0]
+immed[key, 0]
+immed[start, 0]
+dump_loop#:
+    immed[offset, TEST_DATA]
+    alu[$rec[0], --, b, start]
+    mem[write32, $rec[0], cmsg_addr_hi, <<8, offset, 1], ctx_swap[sig_rec]
+    immed[count, 64]
+    batch(CMSG_TYPE_MAP_BATCH_DUMP, fd, count, key)
+    immed[offset, NFD_IN_DATA_OFFSET]
+    mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, 4], ctx_swap[sig_rec]
+    test_assert_equal($rd[1], CMSG_RC_SUCCESS)
+    alu[count, --, b, $rd[2]]
+    alu[start, start, +, count]
+    alu[key, --, b, $rd[3]]
+    alu[--, key, +, 1]
+    bne[dump_more#]
+    alu[--, count, -, 0]
+    beq[fail#]
+dump_more#:
+    immed[offset, TEST_DATA]
+dump_rec_loop#:
+    alu[--, count, -, 0]
+    beq[dump_next#]
+    mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, 1], ctx_swap[sig_rec]
+    alu[sum, sum, +, $rd[0]]
+    alu[offset, offset, +, TEST_REC_SZ]
+    br[dump_rec_loop#], defer[1]
+    alu[count, count, -, 1]
+dump_next#:
+    alu[--, key, +, 1]
+    bne[dump_loop#]
+
+test_assert_equal(sum, ((TEST_ENTRIES * (TEST_ENTRIES + 1)) / 2))
+test_assert_equal(start, TEST_ENTRIES)
+
+/*
+ * Delete requests carry keys only
+ */
+immed[key, 1]
+immed[offset, TEST_DATA]
+delete_fill_loop#:
+    alu[$rec[0], --, b, key]
+    mem[write32, $rec[0], cmsg_addr_hi, <<8, offset, 1], ctx_swap[sig_rec]
+    alu[offset, offset, +, 4]
+    alu[--, key, -, TEST_ENTRIES]
+    bne[delete_fill_loop#], defer[1]
+    alu[key, key, +, 1]
+
+immed[count, TEST_ENTRIES]
+batch(CMSG_TYPE_MAP_BATCH_DELETE, fd, count, 0)
+check_reply(CMSG_RC_SUCCESS, TEST_ENTRIES)
+
+// the first key is gone, the delete stops there
+immed[count, TEST_ENTRIES]
+batch(CMSG_TYPE_MAP_BATCH_DELETE, fd, count, 0)
+check_reply(CMSG_RC_ERR_MAP_NOENT, 0)
+
+test_pass()
+
+fail#:
+test_fail()
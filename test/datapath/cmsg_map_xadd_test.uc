@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          cmsg_map_xadd_test.uc
+ * @brief         Tests that the XADD words of a value, kept in NFP byte
+ *                order, are swapped by map update and lookup control
+ *                messages, so counters added by the XADD subroutines read
+ *                back as the host wrote them: little endian, 64 bit
+ *                counters low word first with the carry in the high word.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define NFD_CFG_CLASS_VERSION   0
+#define NFD_CFG_CLASS_DEFAULT 0
+
+#define CMSG_MAP_PROC 1
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+#include "cmsg_map.uc"
+
+pkt_counter_init()
+hashmap_init()
+cmsg_init()
+
+#define TEST_FD         1
+#define TEST_DATA       (NFD_IN_DATA_OFFSET + (CMSG_OP_HDR_LW * 4))
+
+.alloc_mem test_cmsg emem global 2048 256
+.alloc_mem test_lm_key lm me 8 8
+
+.reg cmsg_addr_hi
+.reg cmsg_type
+.reg cmsg_tag
+.reg cmsg_reply_pktlen
+.reg my_act_ctx
+.reg ctx_num
+.reg hdr[4]
+.reg fd
+.reg map_type
+.reg count
+.reg offset
+.reg word
+.reg value
+.reg lm_key
+.reg ent_addr[2]
+.reg $rec[5]
+.xfer_order $rec
+.reg read $rd[5]
+.xfer_order $rd
+.sig sig_rec
+
+// registers of the subroutine calls, as the JIT sets them
+.reg xadd_rtn
+.reg_addr xadd_rtn 0 B
+.reg xadd_operand
+.reg_addr xadd_operand 1 B
+.reg xadd_operand_hi
+.reg_addr xadd_operand_hi 2 B
+.reg xadd_addr_lo
+.reg_addr xadd_addr_lo 0 A
+.reg xadd_addr_hi
+.reg_addr xadd_addr_hi 1 A
+
+#macro batch(IN_TYPE, IN_FD, IN_COUNT, IN_FLAGS)
+    immed[cmsg_type, IN_TYPE]
+    alu[hdr[CMSG_MAP_TID_IDX], --, b, IN_FD]
+    alu[hdr[CMSG_MAP_OP_COUNT_IDX], --, b, IN_COUNT]
+    alu[hdr[CMSG_MAP_OP_FLAGS_IDX], --, b, IN_FLAGS]
+    _cmsg_batch_proc(hdr, ctx_num)
+#endm
+
+#macro check_reply(IN_RC, IN_COUNT)
+    immed[offset, NFD_IN_DATA_OFFSET]
+    mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, 4], ctx_swap[sig_rec]
+    test_assert_equal($rd[1], IN_RC)
+    test_assert_equal($rd[2], IN_COUNT)
+#endm
+
+#macro xadd(WIDTH, IN_OFFSET, IN_OPERAND, IN_OPERAND_HI)
+    alu[xadd_addr_hi, --, b, ent_addr[0]]
+    alu[xadd_addr_lo, ent_addr[1], +, IN_OFFSET]
+    move(xadd_operand, IN_OPERAND)
+    move(xadd_operand_hi, IN_OPERAND_HI)
+    load_addr[xadd_rtn, ret#]
+    br[HTAB_MAP_XADD/**/WIDTH/**/_SUBROUTINE#]
+ret#:
+#endm
+
+#macro check_host_word(IN_IDX, IN_VALUE)
+    alu[word, --, b, $rd[IN_IDX]]
+    swap(value, word, NO_LOAD_CC)
+    test_assert_equal(value, IN_VALUE)
+#endm
+
+// the host looks key 1 up and reads the value words little endian
+#macro check_host(IN_W0, IN_W1, IN_W2, IN_W3)
+    immed[offset, TEST_DATA]
+    move($rec[0], 0x01000000)
+    immed[$rec[1], 0]
+    immed[$rec[2], 0]
+    immed[$rec[3], 0]
+    immed[$rec[4], 0]
+    mem[write32, $rec[0], cmsg_addr_hi, <<8, offset, 5], ctx_swap[sig_rec]
+    immed[count, 1]
+    batch(CMSG_TYPE_MAP_BATCH_LOOKUP, fd, count, 0)
+    check_reply(CMSG_RC_SUCCESS, 1)
+    immed[offset, TEST_DATA]
+    mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, 5], ctx_swap[sig_rec]
+    test_assert_equal($rd[0], 0x01000000)
+    check_host_word(1, IN_W0)
+    check_host_word(2, IN_W1)
+    check_host_word(3, IN_W2)
+    check_host_word(4, IN_W3)
+#endm
+
+move(cmsg_addr_hi, (test_cmsg >> 8))
+immed[cmsg_tag, 0x55]
+immed[my_act_ctx, 0]
+immed[ctx_num, 0]
+
+immed[map_type, BPF_MAP_TYPE_HASH]
+immed[fd, TEST_FD]
+hashmap_alloc_fd(fd, 4, 16, 16, fail#, swap, map_type)
+// words 0-2 are counters, as the host marks them at ALLOC
+immed[value, 0x7]
+hashmap_set_fd_xadd(fd, value)
+
+// the host adds key 1: a 64 bit counter about to carry, a 32 bit one and
+// a guard word
+immed[offset, TEST_DATA]
+move($rec[0], 0x01000000)
+move($rec[1], 0xf0ffffff)
+immed[$rec[2], 0]
+move($rec[3], 0x05000000)
+immed[$rec[4], 0]
+mem[write32, $rec[0], cmsg_addr_hi, <<8, offset, 5], ctx_swap[sig_rec]
+immed[count, 1]
+batch(CMSG_TYPE_MAP_BATCH_UPDATE, fd, count, CMSG_BPF_ANY)
+check_reply(CMSG_RC_SUCCESS, 1)
+check_host(0xfffffff0, 0, 5, 0)
+
+// the program looks it up, its key is in host byte order as well
+immed[lm_key, test_lm_key]
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+nop
+nop
+nop
+immed[*l$index0, 1]
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, --, --, ent_addr, swap)
+
+// the update stored the counters in NFP byte order, the guard word as is
+mem[read32, $rd[0], ent_addr[0], <<8, ent_addr[1], 4], ctx_swap[sig_rec]
+test_assert_equal($rd[0], 0xfffffff0)
+test_assert_equal($rd[1], 0)
+test_assert_equal($rd[2], 5)
+test_assert_equal($rd[3], 0)
+
+xadd(64, 0, 0x20, 0)
+check_host(0x10, 1, 5, 0)
+xadd(32, 8, 7, 0)
+check_host(0x10, 1, 12, 0)
+xadd(64, 0, 1, 2)
+check_host(0x11, 3, 12, 0)
+
+test_pass()
+
+fail#:
+test_fail()
+
+HTAB_MAP_XADD32_SUBROUTINE#:
+    htab_map_xadd_subr_func(32)
+HTAB_MAP_XADD64_SUBROUTINE#:
+    htab_map_xadd_subr_func(64)
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          cmsg_perf_test.uc
+ * @brief         Tests bpf_perf_event_output() to the EMEM rings: bad
+ *                arguments are refused, flush requests are queued every
+ *                batch and window and an epoch asks for the partial
+ *                batches, records past the rate of the ME are dropped, a
+ *                lapped ring reports its lost records in the message and
+ *                a request for a ring that is being drained is kept.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define NFD_CFG_CLASS_VERSION   0
+#define NFD_CFG_CLASS_DEFAULT 0
+
+#define CMSG_MAP_PROC 1
+
+#define CMSG_PERF_SLOTS         4
+#define CMSG_PERF_BATCH         4
+#define CMSG_PERF_RATE          4
+#define CMSG_PERF_RATE_TICKS    2000
+
+#include <single_ctx_test.uc>
+#include <timestamp.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+#include "cmsg_map.uc"
+
+pkt_counter_init()
+hashmap_init()
+cmsg_init()
+
+#define TEST_FD         5
+#define TEST_CPUS       4
+#define TEST_CPU        1
+#define TEST_DATA       (NFD_IN_DATA_OFFSET + (CMSG_OP_HDR_LW * 4))
+
+.alloc_mem test_cmsg emem global 2048 256
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+.alloc_mem test_lm_data lm me CMSG_PERF_SLOT_SZ 8
+
+.reg volatile t_idx_ctx
+immed[t_idx_ctx, 0]
+
+.reg fd
+.reg map_type
+.reg key_sz
+.reg value_sz
+.reg max_entries
+.reg op
+.reg rc
+.reg value
+.reg lm_key
+.reg lm_value
+.reg lm_data
+.reg lm_ring
+.reg cmsg_addr_hi
+.reg offset
+.reg ring
+.reg prod
+.reg pkt_len
+.reg more
+.reg $q[CMSG_DESC_LW]
+.xfer_order $q
+.reg read $rd[8]
+.xfer_order $rd
+.sig sig_q
+.sig sig_rd
+
+// registers of the subroutine calls, as the JIT sets them
+.reg call_rtn
+.reg_addr call_rtn 0 B
+.reg call_a0
+.reg_addr call_a0 0 A
+.reg call_b1
+.reg_addr call_b1 1 B
+.reg call_b2
+.reg_addr call_b2 2 B
+.reg call_a1
+.reg_addr call_a1 1 A
+
+#macro set_lm(in_lm, IN_VALUE)
+    local_csr_wr[ACTIVE_LM_ADDR_0, in_lm]
+    move(value, IN_VALUE)
+    nop
+    nop
+    alu[*l$index0, --, b, value]
+#endm
+
+#macro output(IN_TID, IN_CPU, IN_SIZE, IN_RC)
+    move(call_a0, IN_TID)
+    move(call_b1, IN_CPU)
+    alu[call_b2, --, b, lm_data]
+    move(call_a1, IN_SIZE)
+    load_addr[call_rtn, ret#]
+    br[CMSG_PERF_OUTPUT_SUBROUTINE#]
+ret#:
+    move(value, IN_RC)
+    test_assert_equal(call_a0, value)
+    #if (IN_RC == 0)
+        test_assert_equal(call_a1, 0)
+    #else
+        test_assert_equal(call_a1, 0xffffffff)
+    #endif
+#endm
+
+#macro check_flush(IN_RING)
+    cmsg_recv_workq($q, sig_q, SIG_WAIT)
+    test_assert_equal($q[0], IN_RING)
+    test_assert_equal($q[1], 0)
+#endm
+
+#macro check_stat(STAT, IN_VALUE)
+    move(offset, (_cmsg_perf_stats >> 8))
+    mem[read32, $rd[0], offset, <<8, (STAT * 8), 2], ctx_swap[sig_rd]
+    test_assert_equal($rd[0], 0)
+    test_assert_equal($rd[1], IN_VALUE)
+#endm
+
+#macro fill(IN_RING)
+    immed[ring, IN_RING]
+    move(offset, (_cmsg_perf_prod >> 8))
+    mem[read32, $rd[0], offset, <<8, (IN_RING * 4), 1], ctx_swap[sig_rd]
+    alu[prod, --, b, $rd[0]]
+    cmsg_perf_fill(ring, prod, cmsg_addr_hi, pkt_len, more)
+#endm
+
+#macro check_hdr(IN_RING, IN_COUNT, IN_LOST)
+    immed[offset, NFD_IN_DATA_OFFSET]
+    mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, CMSG_OP_HDR_LW], ctx_swap[sig_rd]
+    move(value, ((CMSG_TYPE_PERF_EVENT << 24) | (CMSG_MAP_VERSION << 16)))
+    test_assert_equal($rd[0], value)
+    test_assert_equal($rd[CMSG_PERF_RING_IDX], IN_RING)
+    test_assert_equal($rd[CMSG_PERF_COUNT_IDX], IN_COUNT)
+    test_assert_equal($rd[CMSG_PERF_LOST_IDX], IN_LOST)
+#endm
+
+timestamp_enable();
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+immed[lm_data, test_lm_data]
+move(cmsg_addr_hi, (test_cmsg >> 8))
+
+// the record data, words 0x00010203 and up on the stack
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_data]
+move(value, 0x00010203)
+move(prod, 0x04040404)
+immed[offset, (CMSG_PERF_DATA_MAX / 4)]
+data_loop#:
+    alu[*l$index0++, --, b, value]
+    alu[offset, offset, -, 1]
+    bne[data_loop#], defer[1]
+    alu[value, value, +, prod]
+
+immed[fd, TEST_FD]
+immed[map_type, BPF_MAP_TYPE_PERF_EVENT_ARRAY]
+immed[key_sz, 4]
+immed[value_sz, 4]
+immed[max_entries, TEST_CPUS]
+hashmap_alloc_fd(fd, 4, 4, TEST_CPUS, fail#, be, map_type)
+hashmap_prog_alloc(fd, key_sz, value_sz, max_entries, fail#)
+
+set_lm(lm_key, TEST_CPU)
+set_lm(lm_value, 7)
+immed[op, HASHMAP_OP_ADD_ANY]
+hashmap_prog_update(fd, map_type, lm_key, lm_value, op, fail#, rc)
+test_assert_equal(rc, CMSG_RC_SUCCESS)
+
+// bad arguments take no slot and count for no rate
+output(TEST_FD, 2, 8, (-CMSG_RC_ERR_ENOENT))
+output(TEST_FD, HASHMAP_PROG_ENTRIES, 8, (-CMSG_RC_ERR_E2BIG))
+output(TEST_FD, TEST_CPU, 0, (-CMSG_RC_ERR_E2BIG))
+output(TEST_FD, TEST_CPU, (CMSG_PERF_DATA_MAX + 1), (-CMSG_RC_ERR_E2BIG))
+output(HASHMAP_MAX_TID, TEST_CPU, 8, (-CMSG_RC_ERR_EINVAL))
+
+// a new window flushes its first record, then every CMSG_PERF_BATCH
+timestamp_sleep((CMSG_PERF_RATE_TICKS * 2))
+output(TEST_FD, TEST_CPU, 5, 0)
+output(TEST_FD, TEST_CPU, 8, 0)
+output(TEST_FD, TEST_CPU, 40, 0)
+output(TEST_FD, TEST_CPU, CMSG_PERF_DATA_MAX, 0)
+check_flush(TEST_CPU)
+check_flush(TEST_CPU)
+
+// BPF_F_CURRENT_CPU goes to the ring of the context, past the rate of the
+// ME records are dropped
+timestamp_sleep(CMSG_PERF_RATE_TICKS)
+output(TEST_FD, 0xffffffff, 4, 0)
+output(TEST_FD, 0xffffffff, 4, 0)
+output(TEST_FD, 0xffffffff, 4, 0)
+output(TEST_FD, 0xffffffff, 4, 0)
+output(TEST_FD, 0xffffffff, 4, (-__CMSG_PERF_ENOSPC))
+check_flush(0)
+check_flush(0)
+timestamp_sleep(CMSG_PERF_RATE_TICKS)
+output(TEST_FD, 0xffffffff, 4, 0)
+output(TEST_FD, 0xffffffff, 4, 0)
+check_flush(0)
+
+check_stat(CMSG_PERF_STAT_RECORDS, 10)
+check_stat(CMSG_PERF_STAT_RATE_DROPS, 1)
+
+// all records of the CPU ring, the stack words byte swapped for the host
+fill(TEST_CPU)
+test_assert_equal(more, 0)
+test_assert_equal(pkt_len, ((CMSG_OP_HDR_LW + (4 * CMSG_PERF_REC_HDR_LW) + 2 + 2 + 10 + 28) * 4))
+check_hdr(TEST_CPU, 4, 0)
+immed[offset, TEST_DATA]
+mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, 5], ctx_swap[sig_rd]
+test_assert_equal($rd[0], TEST_FD)
+test_assert_equal($rd[1], TEST_CPU)
+test_assert_equal($rd[2], 5)
+test_assert_equal($rd[3], 0x03020100)
+test_assert_equal($rd[4], 0x07060504)
+immed[offset, (TEST_DATA + ((5 + 5 + 13) * 4))]
+mem[read32, $rd[0], cmsg_addr_hi, <<8, offset, 4], ctx_swap[sig_rd]
+test_assert_equal($rd[2], CMSG_PERF_DATA_MAX)
+test_assert_equal($rd[3], 0x03020100)
+
+// 6 records in a ring of 4, the oldest 2 are lost
+fill(0)
+test_assert_equal(more, 0)
+check_hdr(0, 4, 2)
+check_stat(CMSG_PERF_STAT_LOST, 2)
+
+fill(0)
+test_assert_equal(pkt_len, 0)
+
+// both rings were left with partial batches, an epoch asks for them
+cmsg_perf_epoch()
+check_flush(0)
+check_flush(TEST_CPU)
+
+// a partial batch and then no more records: the window flushes its first
+// record, the epoch the one after it
+timestamp_sleep((CMSG_PERF_RATE_TICKS * 2))
+output(TEST_FD, TEST_CPU, 4, 0)
+check_flush(TEST_CPU)
+output(TEST_FD, TEST_CPU, 8, 0)
+cmsg_perf_epoch()
+check_flush(TEST_CPU)
+check_stat(CMSG_PERF_STAT_RECORDS, 12)
+fill(TEST_CPU)
+test_assert_equal(more, 0)
+check_hdr(TEST_CPU, 2, 0)
+
+// a request for a ring that is being drained is left to the draining context
+immed[lm_ring, (__cmsg_perf_ring + (TEST_CPU * 8) + 4)]
+set_lm(lm_ring, (1 << __CMSG_PERF_BUSY_BIT))
+immed[ring, TEST_CPU]
+cmsg_perf_flush(ring)
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_ring]
+move(value, ((1 << __CMSG_PERF_BUSY_BIT) | (1 << __CMSG_PERF_PENDING_BIT)))
+nop
+nop
+test_assert_equal(*l$index0, value)
+
+test_pass()
+
+fail#:
+test_fail()
+
+CMSG_PERF_OUTPUT_SUBROUTINE#:
+    cmsg_perf_output_subr_func()
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          ebpf_helpers_test.uc
+ * @brief         Tests the ktime, csum_diff and xdp_adjust_meta helpers:
+ *                time in ns goes forward with the TIMESTAMP at the ME
+ *                clock, checksum differences carry end around, also past
+ *                a chunk of 32 words, and bad sizes are refused, and the
+ *                XDP metadata stays within the PV prepend area and the
+ *                headroom of the packet.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include <timestamp.uc>
+
+#define TEST_EINVAL     (-EBPF_EINVAL)
+#define TEST_BIG_WORDS  40
+
+.alloc_mem test_lm_from lm me 16 8
+.alloc_mem test_lm_to lm me 16 8
+.alloc_mem test_lm_big lm me (TEST_BIG_WORDS * 4) 8
+.alloc_mem test_lm_vec lm me (PV_SIZE_LW * 4) 64
+
+.reg lm_from
+.reg lm_to
+.reg ctx_addr
+.reg count
+.reg value
+.reg ns[2]
+
+// registers of the subroutine calls, as the JIT sets them
+.reg call_rtn
+.reg_addr call_rtn 0 B
+.reg call_a0
+.reg_addr call_a0 0 A
+.reg call_b1
+.reg_addr call_b1 1 B
+.reg call_b2
+.reg_addr call_b2 2 B
+.reg call_a1
+.reg_addr call_a1 1 A
+.reg call_a2
+.reg_addr call_a2 2 A
+
+#macro ktime()
+    load_addr[call_rtn, ret#]
+    br[EBPF_KTIME_SUBROUTINE#]
+ret#:
+#endm
+
+#macro csum_diff(IN_FROM_SZ, IN_TO_SZ, IN_SEED, IN_RC)
+    alu[call_a0, --, b, lm_from]
+    move(call_b1, IN_FROM_SZ)
+    alu[call_b2, --, b, lm_to]
+    move(call_a1, IN_TO_SZ)
+    move(call_a2, IN_SEED)
+    load_addr[call_rtn, ret#]
+    br[EBPF_CSUM_DIFF_SUBROUTINE#]
+ret#:
+    move(value, IN_RC)
+    test_assert_equal(call_a0, value)
+#endm
+
+#macro adjust_meta(IN_DELTA, IN_RC, IN_META_LEN)
+    move(call_a0, IN_DELTA)
+    load_addr[call_rtn, ret#]
+    br[EBPF_ADJUST_META_SUBROUTINE#]
+ret#:
+    move(value, IN_RC)
+    test_assert_equal(call_a0, value)
+    local_csr_wr[ACTIVE_LM_ADDR_3, ctx_addr]
+    nop
+    nop
+    nop
+    test_assert_equal(*l$index3[HASHMAP_PROG_CTX_NDX_META_LEN], IN_META_LEN)
+#endm
+
+#macro set_words(in_lm, IN_W0, IN_W1)
+    local_csr_wr[ACTIVE_LM_ADDR_3, in_lm]
+    move(value, IN_W0)
+    nop
+    nop
+    alu[*l$index3++, --, b, value]
+    move(value, IN_W1)
+    alu[*l$index3++, --, b, value]
+#endm
+
+timestamp_enable();
+
+// ktime goes forward by 16 ME cycles per tick
+ktime()
+alu[ns[0], --, b, call_a0]
+alu[ns[1], --, b, call_a1]
+timestamp_sleep(10)
+ktime()
+alu[ns[0], call_a0, -, ns[0]]
+alu[ns[1], call_a1, -carry, ns[1]]
+test_assert_equal(ns[1], 0)
+immed[value, ((10 * EBPF_KTIME_NS_PER_TICK_Q16) >> 16)]
+alu[--, ns[0], -, value]
+blo[fail#]
+
+// csum_diff
+immed[lm_from, test_lm_from]
+immed[lm_to, test_lm_to]
+set_words(lm_from, 0x12345678, 0)
+set_words(lm_to, 0x9abcdef0, 0x00010002)
+csum_diff(4, 8, 0, 0x8889887a)
+csum_diff(0, 0, 1, 1)
+csum_diff(8, 0, 0xffffffff, 0xedcba987)
+set_words(lm_from, 0, 0)
+csum_diff(4, 0, 0xffffffff, 0xffffffff)
+csum_diff(3, 0, 0, TEST_EINVAL)
+csum_diff(4, 510, 0, TEST_EINVAL)
+csum_diff(256, 260, 0, TEST_EINVAL)
+
+// 40 words of 0x80000000 carry 20 times, over two chunks
+immed[lm_from, test_lm_big]
+local_csr_wr[ACTIVE_LM_ADDR_3, lm_from]
+immed[count, TEST_BIG_WORDS]
+move(value, 0x80000000)
+nop
+big_loop#:
+    alu[count, count, -, 1]
+    bne[big_loop#], defer[1]
+        alu[*l$index3++, --, b, value]
+immed[lm_to, test_lm_big]
+immed[lm_from, test_lm_from]
+csum_diff(0, (TEST_BIG_WORDS * 4), 0, 0x14)
+
+// xdp_adjust_meta in the headroom of a packet at offset 128
+hashmap_prog_ctx_addr(ctx_addr)
+local_csr_wr[ACTIVE_LM_ADDR_3, ctx_addr]
+immed[value, test_lm_vec]
+local_csr_wr[ACTIVE_LM_ADDR_1, value]
+nop
+nop
+immed[*l$index3[HASHMAP_PROG_CTX_NDX_META_LEN], 0]
+alu[BF_A(_ebpf_pkt_vec, PV_OFFSET_bf), --, b, 128]
+
+adjust_meta(-8, 0, 8)
+adjust_meta(-28, TEST_EINVAL, 8)
+adjust_meta(-24, 0, EBPF_XDP_META_MAX)
+adjust_meta(-4, TEST_EINVAL, EBPF_XDP_META_MAX)
+adjust_meta(2, TEST_EINVAL, EBPF_XDP_META_MAX)
+adjust_meta(40, TEST_EINVAL, EBPF_XDP_META_MAX)
+adjust_meta(32, 0, 0)
+
+// only 16 bytes of headroom above EBPF_PKT_MIN_OFFSET
+alu[BF_A(_ebpf_pkt_vec, PV_OFFSET_bf), --, b, (EBPF_PKT_MIN_OFFSET + 16)]
+adjust_meta(-20, TEST_EINVAL, 0)
+adjust_meta(-16, 0, 16)
+
+test_pass()
+
+fail#:
+test_fail()
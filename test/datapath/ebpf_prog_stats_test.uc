@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          ebpf_prog_stats_test.uc
+ * @brief         Tests that runs of eBPF programs are counted in the LM slot
+ *                of their code store slot with their ticks, return code,
+ *                helper and tail calls, and that a full slot is added to
+ *                the _ebpf_prog_stats rtsym and cleared, as is a partial
+ *                slot on an epoch.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define EBPF_PROG_STATS
+#define EBPF_PROG_STATS_FLUSH_SHF 1
+
+#include <single_ctx_test.uc>
+#include <global.uc>
+#include "actions_harness.uc"
+#include <actions.uc>
+#include <timestamp.uc>
+
+#define TEST_SLOT0  NFD_BPF_START_OFF
+#define TEST_SLOT1  (NFD_BPF_START_OFF + NFD_BPF_MAX_LEN)
+#define TEST_PASS   ((1 << EBPF_RET_STATS_PASS) | (1 << EBPF_RET_PASS))
+#define TEST_DROP   ((1 << EBPF_RET_STATS_DROP) | (1 << EBPF_RET_DROP))
+
+.reg ctx_addr
+.reg ustore_addr
+.reg rc
+.reg addr
+.reg addr_hi
+.reg min_ticks
+.reg $stats[16]
+.xfer_order $stats
+.sig sig_stats
+
+#macro run(IN_USTORE_ADDR, IN_RC, IN_HELPERS, IN_TAIL_CALLS, IN_TICKS)
+    local_csr_wr[ACTIVE_LM_ADDR_3, ctx_addr]
+    move(ustore_addr, IN_USTORE_ADDR)
+    move(rc, IN_RC)
+    nop
+    immed[*l$index3[HASHMAP_PROG_CTX_NDX_TAIL_CNT], IN_TAIL_CALLS]
+    ebpf_prog_stats_start(ustore_addr)
+    immed[*l$index3[HASHMAP_PROG_CTX_NDX_HELPERS], IN_HELPERS]
+    timestamp_sleep(IN_TICKS)
+    ebpf_prog_stats(rc)
+#endm
+
+#macro check_slot(IN_SLOT, IN_RUNS, IN_MIN_TICKS, IN_PASS, IN_DROP, IN_HELPERS, IN_TAIL_CALLS)
+    immed[addr, __ebpf_prog_stats]
+    alu[addr, addr, +, (IN_SLOT * EBPF_PROG_STATS_CNTRS * 4)]
+    local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+    immed[min_ticks, IN_MIN_TICKS]
+    nop
+    nop
+    test_assert_equal(*l$index3[EBPF_PROG_STATS_NDX_RUN], IN_RUNS)
+    test_assert_equal(*l$index3[EBPF_PROG_STATS_NDX_PASS], IN_PASS)
+    test_assert_equal(*l$index3[(EBPF_PROG_STATS_NDX_PASS + 1)], IN_DROP)
+    test_assert_equal(*l$index3[EBPF_PROG_STATS_NDX_HELPERS], IN_HELPERS)
+    test_assert_equal(*l$index3[EBPF_PROG_STATS_NDX_TAIL_CALLS], IN_TAIL_CALLS)
+    alu[--, *l$index3[EBPF_PROG_STATS_NDX_TICKS], -, min_ticks]
+    blo[fail#]
+#endm
+
+timestamp_enable();
+
+ebpf_prog_stats_init()
+hashmap_prog_ctx_addr(ctx_addr)
+
+run(TEST_SLOT1, TEST_PASS, 3, 2, 10)
+check_slot(1, 1, 10, 1, 0, 3, 2)
+check_slot(0, 0, 0, 0, 0, 0, 0)
+
+// the second run fills the slot, it goes to the rtsym
+run(TEST_SLOT1, TEST_DROP, 1, 0, 20)
+check_slot(1, 0, 0, 0, 0, 0, 0)
+
+move(addr_hi, (_ebpf_prog_stats >> 8))
+immed[addr, (EBPF_PROG_STATS_CNTRS * 8)]
+mem[read32, $stats[0], addr_hi, <<8, addr, 16], ctx_swap[sig_stats]
+test_assert_equal($stats[0], 0)
+test_assert_equal($stats[1], 2)
+immed[min_ticks, 30]
+alu[--, $stats[3], -, min_ticks]
+blo[fail#]
+test_assert_equal($stats[5], 1)
+test_assert_equal($stats[7], 1)
+test_assert_equal($stats[9], 0)
+test_assert_equal($stats[11], 0)
+test_assert_equal($stats[13], 4)
+test_assert_equal($stats[15], 2)
+
+// no stats bit in the return code, only the run is counted
+run(TEST_SLOT0, (1 << EBPF_RET_PASS), 0, 0, 0)
+check_slot(0, 1, 0, 0, 0, 0, 0)
+
+// an epoch flushes the partial slot, the empty one is left alone
+ebpf_prog_stats_flush()
+check_slot(0, 0, 0, 0, 0, 0, 0)
+move(addr_hi, (_ebpf_prog_stats >> 8))
+immed[addr, 0]
+mem[read32, $stats[0], addr_hi, <<8, addr, 16], ctx_swap[sig_stats]
+test_assert_equal($stats[1], 1)
+test_assert_equal($stats[5], 0)
+immed[addr, (EBPF_PROG_STATS_CNTRS * 8)]
+mem[read32, $stats[0], addr_hi, <<8, addr, 2], ctx_swap[sig_stats]
+test_assert_equal($stats[1], 2)
+
+test_pass()
+
+fail#:
+test_fail()
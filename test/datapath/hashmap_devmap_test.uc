@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_devmap_test.uc
+ * @brief         Tests DEVMAP updates from the host and the redirect
+ *                subroutines: only wire and host redirect targets are
+ *                taken, bpf_redirect_map() keeps the target of the entry
+ *                or returns the low bits of its flags and bpf_redirect()
+ *                keeps valid targets only.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_FD         6
+#define TEST_ENTRIES    4
+
+// NBI 0 TM queue 16, PCIe 0 queue 3
+#define TEST_WIRE       ((1 << CMSG_MAP_REDIR_VALID_SHF) | 16)
+#define TEST_HOST       ((1 << CMSG_MAP_REDIR_VALID_SHF) | (1 << CMSG_MAP_REDIR_HOST_SHF) | 3)
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg volatile t_idx_ctx
+immed[t_idx_ctx, 0]
+
+.reg fd
+.reg map_type
+.reg key_sz
+.reg value_sz
+.reg max_entries
+.reg op
+.reg rc
+.reg value
+.reg lm_key
+.reg lm_value
+.reg ctx_addr
+
+// registers of the subroutine calls, as the JIT sets them
+.reg redir_rtn
+.reg_addr redir_rtn 0 B
+.reg redir_arg0
+.reg_addr redir_arg0 0 A
+.reg redir_arg1
+.reg_addr redir_arg1 1 B
+.reg redir_arg2
+.reg_addr redir_arg2 2 B
+
+#macro set_lm(in_lm, IN_VALUE)
+    local_csr_wr[ACTIVE_LM_ADDR_0, in_lm]
+    move(value, IN_VALUE)
+    nop
+    nop
+    alu[*l$index0, --, b, value]
+#endm
+
+#macro update(IN_OP, IN_INDEX, IN_VALUE, IN_RC)
+    set_lm(lm_key, IN_INDEX)
+    set_lm(lm_value, IN_VALUE)
+    immed[op, IN_OP]
+    hashmap_prog_update(fd, map_type, lm_key, lm_value, op, error#, rc)
+error#:
+    test_assert_equal(rc, IN_RC)
+#endm
+
+#macro check(IN_INDEX, IN_VALUE)
+    set_lm(lm_key, IN_INDEX)
+    hashmap_prog_lookup(fd, lm_key, fail#, value)
+    move(rc, IN_VALUE)
+    test_assert_equal(value, rc)
+#endm
+
+#macro redirect_map(IN_INDEX, IN_FLAGS)
+    alu[redir_arg0, --, b, fd]
+    move(redir_arg1, IN_INDEX)
+    move(redir_arg2, IN_FLAGS)
+    load_addr[redir_rtn, ret#]
+    br[HTAB_REDIRECT_MAP_SUBROUTINE#]
+ret#:
+#endm
+
+#macro redirect(IN_TARGET, IN_FLAGS)
+    move(redir_arg0, IN_TARGET)
+    move(redir_arg1, IN_FLAGS)
+    load_addr[redir_rtn, ret#]
+    br[HTAB_REDIRECT_SUBROUTINE#]
+ret#:
+#endm
+
+#macro check_redirect(IN_RC, IN_TARGET)
+    test_assert_equal(redir_arg0, IN_RC)
+    local_csr_wr[ACTIVE_LM_ADDR_2, ctx_addr]
+    move(value, IN_TARGET)
+    nop
+    nop
+    test_assert_equal(*l$index2[HASHMAP_PROG_CTX_NDX_REDIR], value)
+#endm
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+hashmap_prog_ctx_addr(ctx_addr)
+
+immed[fd, TEST_FD]
+immed[map_type, BPF_MAP_TYPE_DEVMAP]
+immed[key_sz, 4]
+immed[value_sz, 4]
+immed[max_entries, TEST_ENTRIES]
+hashmap_alloc_fd(fd, 4, 4, TEST_ENTRIES, fail#, be, map_type)
+hashmap_prog_alloc(fd, key_sz, value_sz, max_entries, fail#)
+
+// host updates take resolved wire and host targets only
+update(HASHMAP_OP_ADD_ANY, 0, TEST_WIRE, CMSG_RC_SUCCESS)
+update(HASHMAP_OP_UPDATE, 1, TEST_HOST, CMSG_RC_SUCCESS)
+update(HASHMAP_OP_ADD_ANY, 2, 16, CMSG_RC_ERR_MAP_ERR)
+update(HASHMAP_OP_ADD_ANY, 2, (TEST_WIRE | (1 << 15)), CMSG_RC_ERR_MAP_ERR)
+update(HASHMAP_OP_ADD_ANY, 2, (TEST_WIRE | (1 << 20)), CMSG_RC_ERR_MAP_ERR)
+update(HASHMAP_OP_ADD_ONLY, 2, TEST_WIRE, CMSG_RC_ERR_EEXIST)
+update(HASHMAP_OP_ADD_ANY, 3, TEST_HOST, CMSG_RC_SUCCESS)
+check(0, TEST_WIRE)
+check(1, TEST_HOST)
+check(2, 0)
+
+set_lm(lm_key, 3)
+hashmap_prog_delete(fd, lm_key, fail#, rc)
+test_assert_equal(rc, CMSG_RC_SUCCESS)
+check(3, 0)
+
+// bpf_redirect_map() takes the entry or falls back to the flags
+redirect_map(0, 0)
+check_redirect(4, TEST_WIRE)
+redirect_map(1, 2)
+check_redirect(4, TEST_HOST)
+redirect_map(3, 2)
+check_redirect(2, 0)
+redirect_map(HASHMAP_PROG_ENTRIES, 0x11)
+check_redirect(1, 0)
+
+// bpf_redirect() takes valid targets without flags only
+redirect(TEST_HOST, 0)
+check_redirect(4, TEST_HOST)
+redirect(TEST_WIRE, 1)
+check_redirect(0, 0)
+redirect(16, 0)
+check_redirect(0, 0)
+redirect(TEST_WIRE, 0)
+check_redirect(4, TEST_WIRE)
+
+test_pass()
+
+fail#:
+test_fail()
+
+HTAB_REDIRECT_SUBROUTINE#:
+    htab_redirect_subr_func(0)
+HTAB_REDIRECT_MAP_SUBROUTINE#:
+    htab_redirect_subr_func(1)
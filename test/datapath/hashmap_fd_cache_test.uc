@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_fd_cache_test.uc
+ * @brief         Tests that fd descriptors are served from LM until the fd
+ *                table generation changes, and that fds sharing a cache
+ *                slot replace each other.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+
+#define TEST_FD         3
+#define TEST_FD_ALIAS   (TEST_FD + HASHMAP_FD_CACHE_SLOTS)
+
+.reg fd
+.reg fd_alias
+.reg map_type
+.reg key_sz
+.reg value_sz
+.reg key_mask
+.reg value_mask
+.reg addr
+.reg addr_hi
+.reg addr_lo
+.reg value
+.reg $type
+.sig sig_type
+
+#macro check_fd(IN_FD, IN_KEY_SZ, IN_VALUE_SZ, IN_TYPE)
+    hashmap_get_fd(IN_FD, key_sz, value_sz, key_mask, value_mask, map_type, fail#)
+    test_assert_equal(key_sz, IN_KEY_SZ)
+    test_assert_equal(value_sz, IN_VALUE_SZ)
+    test_assert_equal(map_type, IN_TYPE)
+#endm
+
+immed[fd, TEST_FD]
+immed[fd_alias, TEST_FD_ALIAS]
+immed[map_type, BPF_MAP_TYPE_HASH]
+hashmap_alloc_fd(fd, 4, 8, 16, fail#, be, map_type)
+
+check_fd(fd, 1, 2, BPF_MAP_TYPE_HASH)
+
+immed[addr, (__hashmap_fd_cache + (TEST_FD * __HASHMAP_FD_CACHE_SLOT_SZ))]
+local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+#define_eval __TAG_PART ((1 << __HASHMAP_PART_CNT_SHFT) << __HASHMAP_FD_CACHE_TAG_PART_SHFT)
+move(value, ((1 << __HASHMAP_FD_CACHE_VALID_BIT) | __TAG_PART | (TEST_FD << __HASHMAP_FD_CACHE_TAG_FD_SHFT) | BPF_MAP_TYPE_HASH))
+#undef __TAG_PART
+nop
+nop
+test_assert_equal(*l$index3[__HASHMAP_FD_CACHE_NDX_TAG], value)
+
+// served from LM, no alloc or free was signalled
+move(addr_hi, (__HASHMAP_FD_TBL >> 8))
+move(addr_lo, ((TEST_FD << __HASHMAP_FD_TBL_SHFT) + (__HASHMAP_FD_NDX_TYPE * 4)))
+immed[$type, BPF_MAP_TYPE_LRU_HASH]
+mem[write32, $type, addr_hi, <<8, addr_lo, 1], ctx_swap[sig_type]
+check_fd(fd, 1, 2, BPF_MAP_TYPE_HASH)
+
+// a new generation drops the cached descriptors
+__hashmap_fd_cache_invalidate()
+check_fd(fd, 1, 2, BPF_MAP_TYPE_LRU_HASH)
+
+// an fd sharing the slot takes it over, the first one is read again
+immed[map_type, BPF_MAP_TYPE_ARRAY]
+hashmap_alloc_fd(fd_alias, 4, 16, 16, fail#, be, map_type)
+check_fd(fd, 1, 2, BPF_MAP_TYPE_LRU_HASH)
+check_fd(fd_alias, 1, 4, BPF_MAP_TYPE_ARRAY)
+check_fd(fd, 1, 2, BPF_MAP_TYPE_LRU_HASH)
+
+// fds past the table are still rejected
+immed[fd, HASHMAP_MAX_TID]
+hashmap_get_fd(fd, key_sz, value_sz, key_mask, value_mask, map_type, bad_fd#)
+br[fail#]
+
+bad_fd#:
+test_pass()
+
+fail#:
+test_fail()
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_lpm_ipv4_test.uc
+ * @brief         Tests that LPM_TRIE lookups of IPv4 keys return the longest
+ *                matching prefix, bounded by the prefix length of the key,
+ *                that a deleted prefix falls back to the next shorter
+ *                one and that its leaf is not handed out again right away.
+ *                A lookup of a 32 bit key reads at most 4 slots.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_FD         4
+#define TEST_NODES      16
+#define TEST_LEAVES     16
+
+// hashmap_lpm_free() reads whole keys back into LM
+.alloc_mem test_lm_key lm me 32 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg fd
+.reg map_type
+.reg key_sz
+.reg max_entries
+.reg op
+.reg rc
+.reg count
+.reg index
+.reg addr
+.reg lm_key
+.reg lm_value
+.reg ent_lw
+.reg ent_addr[2]
+.reg freed
+.reg $value
+.sig sig_value
+
+#macro set_key(IN_PLEN, IN_ADDR)
+    local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+    move(addr, IN_ADDR)
+    nop
+    nop
+    alu[*l$index0++, --, b, IN_PLEN]
+    alu[*l$index0++, --, b, addr]
+#endm
+
+#macro update(IN_OP, IN_PLEN, IN_ADDR, IN_VALUE)
+    set_key(IN_PLEN, IN_ADDR)
+    local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+    immed[op, IN_OP]
+    nop
+    nop
+    immed[*l$index1, IN_VALUE]
+    hashmap_lpm_update(fd, lm_key, lm_value, op, fail#, fail#, be, rc)
+    test_assert_equal(rc, CMSG_RC_SUCCESS)
+#endm
+
+#macro delete(IN_PLEN, IN_ADDR)
+    set_key(IN_PLEN, IN_ADDR)
+    hashmap_lpm_delete(fd, lm_key, fail#, fail#, be, rc)
+    test_assert_equal(rc, CMSG_RC_SUCCESS)
+#endm
+
+#macro check(IN_PLEN, IN_ADDR, IN_VALUE)
+    set_key(IN_PLEN, IN_ADDR)
+    hashmap_lpm_lookup(fd, lm_key, fail#, fail#, ent_lw, ent_addr, be)
+    test_assert_equal(ent_lw, 1)
+    mem[read32, $value, ent_addr[0], <<8, ent_addr[1], 1], ctx_swap[sig_value]
+    test_assert_equal($value, IN_VALUE)
+#endm
+
+#macro check_miss(IN_PLEN, IN_ADDR)
+    set_key(IN_PLEN, IN_ADDR)
+    hashmap_lpm_lookup(fd, lm_key, fail#, miss#, --, --, be)
+    br[fail#]
+miss#:
+#endm
+
+// GLOBAL_INIT is not defined, hand out a few nodes and leaves
+move(index, (HASHMAP_MAX_TID + TEST_NODES))
+node_loop#:
+    __hashmap_lpm_node_free(index)
+    alu[index, index, -, 1]
+    alu[--, index, -, HASHMAP_MAX_TID]
+    bne[node_loop#]
+immed[index, TEST_LEAVES]
+leaf_loop#:
+    __hashmap_lpm_leaf_free(index)
+    alu[index, index, -, 1]
+    bne[leaf_loop#]
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+
+// keys have 1 to 16 address bytes
+immed[fd, TEST_FD]
+immed[key_sz, 4]
+hashmap_lpm_alloc(fd, key_sz, 16, bad_size#, fail#)
+br[fail#]
+bad_size#:
+immed[key_sz, 8]
+
+// no more entries than the leaves less the ones kept back for reuse
+move(max_entries, (HASHMAP_LPM_LEAVES - HASHMAP_LPM_LEAF_DEFER + 1))
+hashmap_lpm_alloc(fd, key_sz, max_entries, fail#, too_big#)
+br[fail#]
+too_big#:
+
+immed[map_type, BPF_MAP_TYPE_LPM_TRIE]
+hashmap_alloc_fd(fd, 8, 4, 16, fail#, be, map_type)
+hashmap_lpm_alloc(fd, key_sz, 16, fail#, fail#)
+
+update(HASHMAP_OP_ADD_ONLY, 0, 0, 1)
+update(HASHMAP_OP_ADD_ONLY, 8, 0x0a000000, 2)
+update(HASHMAP_OP_ADD_ONLY, 16, 0x0a010000, 3)
+update(HASHMAP_OP_ADD_ONLY, 24, 0x0a010200, 4)
+update(HASHMAP_OP_ADD_ONLY, 25, 0x0a010280, 5)
+update(HASHMAP_OP_ADD_ONLY, 32, 0x0a010203, 6)
+update(HASHMAP_OP_ADD_ONLY, 15, 0xc0a80000, 7)
+
+check(32, 0x0a010203, 6)
+check(32, 0x0a0102c8, 5)
+check(32, 0x0a010205, 4)
+check(32, 0x0a010909, 3)
+check(32, 0x0a090909, 2)
+check(32, 0x0b000001, 1)
+check(32, 0xc0a90101, 7)
+check(32, 0xc0aa0001, 1)
+
+// only the first 20 bits of the key are compared
+check(20, 0x0a0102c8, 3)
+
+// prefixes are added once, updates need the exact prefix
+set_key(24, 0x0a010200)
+immed[op, HASHMAP_OP_ADD_ONLY]
+hashmap_lpm_update(fd, lm_key, lm_value, op, fail#, exists#, be, rc)
+br[fail#]
+exists#:
+test_assert_equal(rc, CMSG_RC_ERR_EEXIST)
+set_key(23, 0x0a010200)
+immed[op, HASHMAP_OP_UPDATE]
+hashmap_lpm_update(fd, lm_key, lm_value, op, fail#, no_entry#, be, rc)
+br[fail#]
+no_entry#:
+test_assert_equal(rc, CMSG_RC_ERR_ENOENT)
+update(HASHMAP_OP_UPDATE, 24, 0x0a010200, 8)
+check(32, 0x0a010205, 8)
+
+// deleted prefixes fall back to the shorter ones of their node and above
+check(25, 0x0a010280, 5)
+alu[freed, --, b, ent_addr[1]]
+delete(25, 0x0a010280)
+check(32, 0x0a0102c8, 8)
+check(32, 0x0a010203, 6)
+delete(16, 0x0a010000)
+check(32, 0x0a010909, 2)
+check(32, 0x0a010205, 8)
+delete(0, 0)
+check_miss(32, 0x0b000001)
+check_miss(32, 0xc0aa0001)
+check(32, 0xc0a90101, 7)
+
+// a freed leaf waits at the tail of the ring, the next prefix gets another
+update(HASHMAP_OP_ADD_ONLY, 32, 0x0a0102fe, 9)
+check(32, 0x0a0102fe, 9)
+alu[--, freed, -, ent_addr[1]]
+beq[fail#]
+delete(32, 0x0a0102fe)
+
+set_key(16, 0x0a010000)
+hashmap_lpm_delete(fd, lm_key, fail#, gone#, be, rc)
+br[fail#]
+gone#:
+test_assert_equal(rc, CMSG_RC_ERR_ENOENT)
+
+// the credits of the deleted prefixes are back
+_hashmap_get_fd(fd, fail#)
+test_assert_equal(MAP_RDXR[__HASHMAP_FD_NDX_CUR_CRED], (16 - 4))
+
+hashmap_lpm_free(fd, lm_key, be, count)
+test_assert_equal(count, 4)
+check_miss(32, 0x0a010203)
+check_miss(32, 0xc0a90101)
+
+test_pass()
+
+fail#:
+test_fail()
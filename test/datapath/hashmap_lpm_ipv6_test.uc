@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_lpm_ipv6_test.uc
+ * @brief         Tests LPM_TRIE lookups of IPv6 keys through all 16 levels
+ *                of the trie, and that freeing the map drops its prefixes
+ *                and hands its nodes back. A lookup of a 128 bit key reads
+ *                at most 16 slots, one per level.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_FD         7
+#define TEST_NODES      32
+#define TEST_LEAVES     8
+
+.alloc_mem test_lm_key lm me 32 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg fd
+.reg map_type
+.reg key_sz
+.reg op
+.reg rc
+.reg count
+.reg index
+.reg node
+.reg addr
+.reg lm_key
+.reg lm_value
+.reg ent_lw
+.reg ent_addr[2]
+.reg $value
+.sig sig_value
+
+#macro set_key(IN_PLEN, IN_W0, IN_W1, IN_W2, IN_W3)
+    local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+    move(addr, IN_W0)
+    nop
+    nop
+    alu[*l$index0++, --, b, IN_PLEN]
+    alu[*l$index0++, --, b, addr]
+    move(addr, IN_W1)
+    alu[*l$index0++, --, b, addr]
+    move(addr, IN_W2)
+    alu[*l$index0++, --, b, addr]
+    move(addr, IN_W3)
+    alu[*l$index0++, --, b, addr]
+#endm
+
+#macro add(IN_PLEN, IN_W0, IN_W1, IN_W2, IN_W3, IN_VALUE)
+    set_key(IN_PLEN, IN_W0, IN_W1, IN_W2, IN_W3)
+    local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+    immed[op, HASHMAP_OP_ADD_ANY]
+    nop
+    nop
+    immed[*l$index1, IN_VALUE]
+    hashmap_lpm_update(fd, lm_key, lm_value, op, fail#, fail#, be, rc)
+    test_assert_equal(rc, CMSG_RC_SUCCESS)
+#endm
+
+#macro check(IN_PLEN, IN_W0, IN_W1, IN_W2, IN_W3, IN_VALUE)
+    set_key(IN_PLEN, IN_W0, IN_W1, IN_W2, IN_W3)
+    hashmap_lpm_lookup(fd, lm_key, fail#, fail#, ent_lw, ent_addr, be)
+    mem[read32, $value, ent_addr[0], <<8, ent_addr[1], 1], ctx_swap[sig_value]
+    test_assert_equal($value, IN_VALUE)
+#endm
+
+#macro check_miss(IN_PLEN, IN_W0, IN_W1, IN_W2, IN_W3)
+    set_key(IN_PLEN, IN_W0, IN_W1, IN_W2, IN_W3)
+    hashmap_lpm_lookup(fd, lm_key, fail#, miss#, --, --, be)
+    br[fail#]
+miss#:
+#endm
+
+// GLOBAL_INIT is not defined, hand out a few nodes and leaves
+move(index, (HASHMAP_MAX_TID + TEST_NODES))
+node_loop#:
+    __hashmap_lpm_node_free(index)
+    alu[index, index, -, 1]
+    alu[--, index, -, HASHMAP_MAX_TID]
+    bne[node_loop#]
+immed[index, TEST_LEAVES]
+leaf_loop#:
+    __hashmap_lpm_leaf_free(index)
+    alu[index, index, -, 1]
+    bne[leaf_loop#]
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+
+immed[fd, TEST_FD]
+immed[key_sz, 20]
+immed[map_type, BPF_MAP_TYPE_LPM_TRIE]
+hashmap_alloc_fd(fd, 20, 4, 16, fail#, be, map_type)
+hashmap_lpm_alloc(fd, key_sz, 16, fail#, fail#)
+
+add(0, 0, 0, 0, 0, 1)                                   // ::/0
+add(32, 0x20010db8, 0, 0, 0, 2)                         // 2001:db8::/32
+add(64, 0x20010db8, 0x00000001, 0, 0, 3)                // 2001:db8:0:1::/64
+add(128, 0x20010db8, 0x00000001, 0, 1, 4)               // 2001:db8:0:1::1/128
+add(33, 0x20010db8, 0x80000000, 0, 0, 5)                // 2001:db8:8000::/33
+
+check(128, 0x20010db8, 0x00000001, 0, 1, 4)
+check(128, 0x20010db8, 0x00000001, 0, 2, 3)
+check(128, 0x20010db8, 0x00000002, 0, 1, 2)
+check(128, 0x20010db8, 0x80000000, 0, 1, 5)
+check(128, 0x20010db9, 0, 0, 1, 1)
+check(48, 0x20010db8, 0x00000001, 0, 1, 2)
+
+// the /128 took a node per level below the /64
+set_key(128, 0x20010db8, 0x00000001, 0, 1)
+hashmap_lpm_delete(fd, lm_key, fail#, fail#, be, rc)
+test_assert_equal(rc, CMSG_RC_SUCCESS)
+check(128, 0x20010db8, 0x00000001, 0, 1, 3)
+
+hashmap_lpm_free(fd, lm_key, be, count)
+test_assert_equal(count, 4)
+check_miss(128, 0x20010db8, 0x00000001, 0, 1)
+check_miss(128, 0x20010db9, 0, 0, 1)
+
+// all nodes are back in the ring
+immed[count, 0]
+count_loop#:
+    __hashmap_lpm_node_alloc(node, counted#)
+    br[count_loop#], defer[1]
+    alu[count, count, +, 1]
+counted#:
+test_assert_equal(count, TEST_NODES)
+
+test_pass()
+
+fail#:
+test_fail()
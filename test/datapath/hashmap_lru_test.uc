@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_lru_test.uc
+ * @brief         Tests the reference bits of LRU hash maps: datapath
+ *                lookups set them, host lookups and deletes leave no stale
+ *                bit behind, and the clock sweep of a full bucket evicts
+ *                the first unreferenced entry of the map.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_FD         7
+#define TEST_FD_OTHER   8
+#define TEST_IDX        5
+#define TEST_HASH       0xabcdef
+#define TEST_SLAB       1
+
+#define TEST_OV_OFFSET  ((TEST_IDX * HASHMAP_MAX_ENTRY_SZ) + HASHMAP_OV_CAM_OFFSET + HASHMAP_OV_ENTRY_OFFSET)
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg addr
+.reg fd
+.reg lm_key
+.reg lm_value
+.reg hash
+.reg slab
+.reg idx
+.reg lk_addr_hi
+.reg lk_addr_lo
+.reg tbl_addr_hi
+.reg ov_addr_lo
+.reg out_addr_hi
+.reg out_addr_lo
+.reg ent_lw
+.reg ent_addr[2]
+.reg state
+.reg value
+.reg $lock[2]
+.xfer_order $lock
+.reg $ov[4]
+.xfer_order $ov
+.sig sig_lock
+.sig sig_ov
+
+#macro read_lock(IN_IDX)
+    alu[lk_addr_lo, --, b, IN_IDX, <<HASHMAP_LOCK_SZ_SHFT]
+    mem[read_atomic, $lock[0], lk_addr_hi, <<8, lk_addr_lo, 2], ctx_swap[sig_lock]
+#endm
+
+#macro write_lock(IN_DESC, IN_TID)
+    move(value, IN_DESC)
+    alu[$lock[0], --, b, value]
+    immed[$lock[1], IN_TID]
+    immed[lk_addr_lo, (TEST_IDX << HASHMAP_LOCK_SZ_SHFT)]
+    mem[atomic_write, $lock[0], lk_addr_hi, <<8, lk_addr_lo, 2], ctx_swap[sig_lock]
+#endm
+
+#macro check_lock_refs(IN_REFS)
+    immed[idx, TEST_IDX]
+    read_lock(idx)
+    move(value, (__HASHMAP_DESC_LRU_REF | __HASHMAP_DESC_LRU_OV_REF))
+    alu[value, value, and, $lock[0]]
+    test_assert_equal(value, IN_REFS)
+#endm
+
+#macro check_ov_victim(IN_POOL_INDEX)
+    move(value, (HASHMAP_FREEPOOL_BASE_1 >> 8))
+    test_assert_equal(out_addr_hi, value)
+    test_assert_equal(out_addr_lo, (IN_POOL_INDEX << (HASHMAP_SLAB_MIN_SZ_SHFT + TEST_SLAB)))
+#endm
+
+move(lk_addr_hi, (__HASHMAP_LOCK_TBL_0 >> 8))
+move(tbl_addr_hi, (__HASHMAP_DATA_0 >> 8))
+move(hash, TEST_HASH)
+immed[fd, TEST_FD]
+immed[slab, TEST_SLAB]
+
+/*
+ * Bucket TEST_IDX: referenced primary entry of TEST_FD, TEST_FD in
+ * ov slots 1 (unreferenced) and 2 (referenced), TEST_FD_OTHER in slot 3.
+ */
+#define_eval __REFS (__HASHMAP_DESC_LRU_REF | (1 << (__HASHMAP_DESC_LRU_OV_REF_BIT + 2)))
+write_lock((__HASHMAP_DESC_VALID | __REFS), TEST_FD)
+immed[$ov[0], 0]
+move(value, ((TEST_FD << 24) | 0x10))
+alu[$ov[1], --, b, value]
+move(value, ((TEST_FD << 24) | 0x20))
+alu[$ov[2], --, b, value]
+move(value, ((TEST_FD_OTHER << 24) | 0x30))
+alu[$ov[3], --, b, value]
+move(ov_addr_lo, TEST_OV_OFFSET)
+mem[write32, $ov[0], tbl_addr_hi, <<8, ov_addr_lo, 4], ctx_swap[sig_ov]
+
+// slot 1 is the first unreferenced entry, nothing referenced was passed
+immed[idx, TEST_IDX]
+__hashmap_lru_evict(fd, hash, tbl_addr_hi, idx, slab, out_addr_hi, out_addr_lo, fail#)
+check_ov_victim(0x10)
+check_lock_refs(__REFS)
+
+// the cam slot now matches the new key
+move(addr, ((TEST_IDX * HASHMAP_MAX_ENTRY_SZ) + HASHMAP_OV_CAM_OFFSET + 4))
+mem[read32, $ov[0], tbl_addr_hi, <<8, addr, 1], ctx_swap[sig_ov]
+test_assert_equal($ov[0], (TEST_HASH | 1))
+
+// a lookup hitting slot 1 sets its bit, a second one does not write
+move(state, ((1 << __HASHMAP_DESC_OV_BIT) | (1 << __HASHMAP_DESC_OV_IDX)))
+move(value, __REFS)
+__hashmap_lru_ref_set(idx, state, value)
+#define_eval __REFS (__REFS | (1 << (__HASHMAP_DESC_LRU_OV_REF_BIT + 1)))
+check_lock_refs(__REFS)
+__hashmap_lru_ref_set(idx, state, $lock[0])
+check_lock_refs(__REFS)
+
+// everything referenced, the sweep clears all of TEST_FD and takes slot 1
+__hashmap_lru_evict(fd, hash, tbl_addr_hi, idx, slab, out_addr_hi, out_addr_lo, fail#)
+check_ov_victim(0x10)
+check_lock_refs(0)
+
+// both ov entries used, the primary entry goes
+move(state, ((1 << __HASHMAP_DESC_OV_BIT) | (1 << __HASHMAP_DESC_OV_IDX)))
+__hashmap_lru_ref_set(idx, state, 0)
+move(state, ((1 << __HASHMAP_DESC_OV_BIT) | (2 << __HASHMAP_DESC_OV_IDX)))
+__hashmap_lru_ref_set(idx, state, 0)
+__hashmap_lru_evict(fd, hash, tbl_addr_hi, idx, slab, out_addr_hi, out_addr_lo, fail#)
+test_assert_equal(out_addr_hi, tbl_addr_hi)
+test_assert_equal(out_addr_lo, (TEST_IDX << HASHMAP_ENTRY_SZ_SHFT))
+check_lock_refs(0)
+
+// no entry of the map in the bucket, the insert must fail
+immed[state, (TEST_FD + 2)]
+__hashmap_lru_evict(state, hash, tbl_addr_hi, idx, slab, out_addr_hi, out_addr_lo, no_victim#)
+br[fail#]
+
+no_victim#:
+#undef __REFS
+
+/*
+ * Through hashmap_ops(): host lookups leave the reference bit alone,
+ * datapath lookups set it and a delete clears it again.
+ */
+immed[state, BPF_MAP_TYPE_LRU_HASH]
+hashmap_alloc_fd(fd, 4, 8, 16, fail#, be, state)
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+move(value, 0x12345678)
+nop
+nop
+alu[*l$index0, --, b, value]
+immed[*l$index1++, 0xcafe]
+immed[*l$index1++, 0xf00d]
+
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be, --, HASHMAP_CALLER_HOST)
+test_assert_equal(ent_lw, 2)
+alu[idx, --, b, ent_addr[1], >>HASHMAP_ENTRY_SZ_SHFT]
+read_lock(idx)
+br_bset[$lock[0], __HASHMAP_DESC_LRU_REF_BIT, fail#]
+
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+read_lock(idx)
+br_bclr[$lock[0], __HASHMAP_DESC_LRU_REF_BIT, fail#]
+
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_REMOVE, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+read_lock(idx)
+br_bset[$lock[0], __HASHMAP_DESC_LRU_REF_BIT, fail#]
+br_bset[$lock[0], __HASHMAP_DESC_VALID_BIT, fail#]
+
+test_pass()
+
+fail#:
+test_fail()
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_partition_test.uc
+ * @brief         Tests that maps are placed on the partitions picked at
+ *                alloc time, that the bucket hash spreads entries over them
+ *                and that every access is counted against its partition.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define HASHMAP_PARTITIONS  3
+#define PKT_COUNTER_ENABLE
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_KEYS   48
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg fd_all
+.reg fd_one
+.reg map_type
+.reg key_sz
+.reg value_sz
+.reg key_mask
+.reg value_mask
+.reg part
+.reg hash
+.reg idx
+.reg lm_key
+.reg lm_value
+.reg key
+.reg ent_lw
+.reg ent_addr[2]
+.reg addr_hi
+.reg addr_lo
+.reg total
+.reg $stats[6]
+.xfer_order $stats
+.sig sig_stats
+
+#macro check_select(IN_HASH, IN_PART, IN_EXPECTED)
+    move(hash, IN_HASH)
+    immed[idx, 5]
+    __hashmap_select_partition(hash, IN_PART, idx)
+    test_assert_equal(idx, ((IN_EXPECTED << HASHMAP_NUM_ENTRIES_SHFT) | 5))
+#endm
+
+#macro set_key(IN_KEY)
+    local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+    nop
+    nop
+    nop
+    alu[*l$index0, --, b, IN_KEY]
+#endm
+
+// buckets past the first partition map to the start of the next one
+immed[idx, 1]
+alu[idx, idx, or, 2, <<HASHMAP_NUM_ENTRIES_SHFT]
+__hashmap_lock_init(ent_lw, addr_hi, addr_lo, idx)
+move(key, (__HASHMAP_DATA_2 >> 8))
+test_assert_equal(addr_hi, key)
+test_assert_equal(addr_lo, HASHMAP_MAX_ENTRY_SZ)
+__hashmap_lock_addr(idx, addr_hi, addr_lo)
+move(key, (__HASHMAP_LOCK_TBL_2 >> 8))
+test_assert_equal(addr_hi, key)
+test_assert_equal(addr_lo, HASHMAP_LOCK_SZ)
+
+// maps on all partitions start at 0, others at their fd modulo the partitions
+immed[map_type, BPF_MAP_TYPE_HASH]
+immed[fd_all, 4]
+hashmap_alloc_fd(fd_all, 4, 8, 256, fail#, be, map_type)
+hashmap_get_fd(fd_all, key_sz, value_sz, key_mask, value_mask, map_type, fail#, part)
+test_assert_equal(part, (3 << __HASHMAP_PART_CNT_SHFT))
+
+immed[fd_one, 5]
+hashmap_alloc_fd(fd_one, 4, 8, 256, fail#, be, map_type, 1)
+hashmap_get_fd(fd_one, key_sz, value_sz, key_mask, value_mask, map_type, fail#, part)
+test_assert_equal(part, ((1 << __HASHMAP_PART_CNT_SHFT) | 2))
+
+// the cached descriptor carries the partitions as well
+hashmap_get_fd(fd_one, key_sz, value_sz, key_mask, value_mask, map_type, fail#, part)
+test_assert_equal(part, ((1 << __HASHMAP_PART_CNT_SHFT) | 2))
+
+check_select(0x00000000, (3 << __HASHMAP_PART_CNT_SHFT), 0)
+check_select(0x55000000, (3 << __HASHMAP_PART_CNT_SHFT), 0)
+check_select(0x56000000, (3 << __HASHMAP_PART_CNT_SHFT), 1)
+check_select(0xab000000, (3 << __HASHMAP_PART_CNT_SHFT), 2)
+check_select(0xff000000, (3 << __HASHMAP_PART_CNT_SHFT), 2)
+check_select(0x7f000000, ((2 << __HASHMAP_PART_CNT_SHFT) | 2), 2)
+check_select(0x80000000, ((2 << __HASHMAP_PART_CNT_SHFT) | 2), 0)
+check_select(0xffffffff, ((1 << __HASHMAP_PART_CNT_SHFT) | 1), 1)
+
+/*
+ * Entries of the single partition map all land on emem2, those of the
+ * other map on all three, each add and lookup is counted once.
+ */
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+nop
+nop
+nop
+immed[*l$index1++, 0xcafe]
+immed[*l$index1++, 0xf00d]
+
+// the checks above were counted too
+aggregate_zero($stats, 6)
+move(addr_hi, (__HASHMAP_PART_STATS >> 8))
+immed[addr_lo, 0]
+mem[atomic_write, $stats[0], addr_hi, <<8, addr_lo, 6], ctx_swap[sig_stats]
+
+immed[key, 1]
+add_loop#:
+    set_key(key)
+    hashmap_ops(fd_one, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+    hashmap_ops(fd_one, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+    move(addr_hi, (__HASHMAP_DATA_2 >> 8))
+    test_assert_equal(ent_addr[0], addr_hi)
+    hashmap_ops(fd_all, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+    alu[--, key, -, TEST_KEYS]
+    bne[add_loop#], defer[1]
+    alu[key, key, +, 1]
+
+move(addr_hi, (__HASHMAP_PART_STATS >> 8))
+immed[addr_lo, 0]
+mem[read_atomic, $stats[0], addr_hi, <<8, addr_lo, 6], ctx_swap[sig_stats]
+alu[--, $stats[0], or, $stats[1]]
+beq[fail#]
+alu[--, $stats[2], or, $stats[3]]
+beq[fail#]
+alu[total, $stats[0], +, $stats[1]]
+alu[total, total, +, $stats[2]]
+alu[total, total, +, $stats[3]]
+alu[total, total, +, $stats[4]]
+alu[total, total, +, $stats[5]]
+test_assert_equal(total, (TEST_KEYS * 3))
+
+test_pass()
+
+fail#:
+test_fail()
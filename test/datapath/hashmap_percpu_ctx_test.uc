@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_percpu_ctx_test.uc
+ * @brief         Tests that the contexts of an ME get their own per-cpu
+ *                slot, so read-modify-writes of the same entry from all
+ *                contexts do not lose updates and the slots add up.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "test.uc"
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.num_contexts 4
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+#define TEST_BLK        3
+#define TEST_INCR       32
+#define TEST_CTXS       4
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg volatile @fd
+.reg volatile @ready
+.reg volatile @done
+
+.reg fd
+.reg map_type
+.reg lm_key
+.reg lm_value
+.reg blk
+.reg ent_lw
+.reg ent_addr[2]
+.reg count
+.reg value
+.reg addr_lo
+.reg end
+.reg $value[2]
+.xfer_order $value
+.sig sig_value
+
+// context 0 runs first after reset, the others wait for its setup
+.if (ctx() == 0)
+    immed[@ready, 0]
+    immed[@done, 0]
+.else
+wait_ready#:
+    alu[--, --, b, @ready]
+    bne[start#]
+    ctx_arb[voluntary]
+    br[wait_ready#]
+.endif
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+immed[map_type, BPF_MAP_TYPE_PERCPU_HASH]
+hashmap_alloc_fd(fd, 4, 8, 16, fail#, be, map_type)
+alu[@fd, --, b, fd]
+
+// GLOBAL_INIT is not defined, hand the map a single block
+immed[blk, TEST_BLK]
+__hashmap_percpu_free(map_type, blk)
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+move(value, 0x12345678)
+nop
+nop
+alu[*l$index0, --, b, value]
+immed[*l$index1++, 0]
+immed[*l$index1++, 0]
+
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+immed[@ready, 1]
+
+start#:
+alu[fd, --, b, @fd]
+immed[lm_key, test_lm_key]
+immed[count, TEST_INCR]
+
+// the read-modify-write of a program, swapped out between read and write
+incr_loop#:
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+mem[read32, $value[0], ent_addr[0], <<8, ent_addr[1], 1], ctx_swap[sig_value]
+alu[value, $value[0], +, 1]
+ctx_arb[voluntary]
+alu[$value[0], --, b, value]
+mem[write32, $value[0], ent_addr[0], <<8, ent_addr[1], 1], ctx_swap[sig_value]
+alu[count, count, -, 1]
+bne[incr_loop#]
+
+// every context counted in its own slot
+mem[read32, $value[0], ent_addr[0], <<8, ent_addr[1], 1], ctx_swap[sig_value]
+test_assert_equal($value[0], TEST_INCR)
+alu[@done, @done, +, 1]
+
+.if (ctx() != 0)
+    ctx_arb[kill]
+.endif
+
+wait_done#:
+alu[--, @done, -, TEST_CTXS]
+beq[sum#]
+ctx_arb[voluntary]
+br[wait_done#]
+
+// the sum of all slots, as the host reads it, has no update lost
+sum#:
+immed[value, 0]
+move(addr_lo, (TEST_BLK << HASHMAP_PERCPU_BLK_SZ_SHFT))
+move(end, HASHMAP_PERCPU_BLK_SZ)
+alu[end, end, +, addr_lo]
+sum_loop#:
+mem[read32, $value[0], ent_addr[0], <<8, addr_lo, 1], ctx_swap[sig_value]
+alu[value, value, +, $value[0]]
+alu[addr_lo, addr_lo, +, HASHMAP_PERCPU_SLOT_SZ]
+alu[--, addr_lo, -, end]
+blo[sum_loop#]
+test_assert_equal(value, (TEST_INCR * TEST_CTXS))
+
+test_pass()
+
+fail#:
+test_fail()
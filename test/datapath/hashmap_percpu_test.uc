@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_percpu_test.uc
+ * @brief         Tests that per-cpu map entries get a value block, that the
+ *                datapath accesses the slot of its context, that host updates
+ *                replace all slots and that deletes zero and free the block.
+ *                Also tests that per-cpu maps reserve their blocks.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_BLK    3
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg fd
+.reg map_type
+.reg lm_key
+.reg lm_value
+.reg blk
+.reg slot
+.reg blk_addr_hi
+.reg blk_addr_lo
+.reg addr_lo
+.reg ent_lw
+.reg ent_addr[2]
+.reg value
+.reg $value[2]
+.xfer_order $value
+.sig sig_value
+
+#macro check_value(IN_ADDR_LO, IN_V0, IN_V1)
+    mem[read32, $value[0], blk_addr_hi, <<8, IN_ADDR_LO, 2], ctx_swap[sig_value]
+    test_assert_equal($value[0], IN_V0)
+    test_assert_equal($value[1], IN_V1)
+#endm
+
+#macro set_value(IN_V0, IN_V1)
+    local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+    nop
+    nop
+    nop
+    immed[*l$index1++, IN_V0]
+    immed[*l$index1++, IN_V1]
+#endm
+
+immed[map_type, BPF_MAP_TYPE_PERCPU_HASH]
+hashmap_alloc_fd(fd, 4, 8, 16, fail#, be, map_type)
+
+// GLOBAL_INIT is not defined, hand the map a single block
+immed[blk, TEST_BLK]
+__hashmap_percpu_free(map_type, blk)
+
+move(blk_addr_hi, (__HASHMAP_PERCPU_DATA >> 8))
+move(blk_addr_lo, (TEST_BLK << HASHMAP_PERCPU_BLK_SZ_SHFT))
+__hashmap_percpu_slot(slot)
+alu[addr_lo, blk_addr_lo, +, slot]
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+move(value, 0x12345678)
+nop
+nop
+alu[*l$index0, --, b, value]
+
+// a datapath insert takes the block and writes the slot of this ME
+set_value(0x11, 0x22)
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+check_value(addr_lo, 0x11, 0x22)
+
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+test_assert_equal(ent_lw, 2)
+test_assert_equal(ent_addr[0], blk_addr_hi)
+test_assert_equal(ent_addr[1], addr_lo)
+
+// a datapath update stays in the slot
+set_value(0x33, 0x44)
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_UPDATE, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+check_value(addr_lo, 0x33, 0x44)
+
+// the host sees the whole block
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be, --, HASHMAP_CALLER_HOST)
+test_assert_equal(ent_addr[0], blk_addr_hi)
+test_assert_equal(ent_addr[1], blk_addr_lo)
+
+// a host update leaves its value in slot 0 only
+set_value(0x55, 0x66)
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_UPDATE, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be, --, HASHMAP_CALLER_HOST)
+check_value(blk_addr_lo, 0x55, 0x66)
+alu[--, slot, -, 0]
+beq[remove#]
+check_value(addr_lo, 0, 0)
+
+remove#:
+// the delete zeroes the block and returns it
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_REMOVE, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+check_value(blk_addr_lo, 0, 0)
+
+immed[blk, 0]
+__hashmap_percpu_alloc(map_type, blk, fail#)
+test_assert_equal(blk, TEST_BLK)
+
+// no block left, the insert fails
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, no_block#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+br[fail#]
+
+no_block#:
+// per-cpu maps reserve their max_entries from the blocks, others none
+hashmap_percpu_reserve(map_type, (HASHMAP_PERCPU_ENTRIES - 16), fail#)
+hashmap_percpu_reserve(map_type, 16, fail#)
+hashmap_percpu_reserve(map_type, 1, no_room#)
+br[fail#]
+no_room#:
+immed[value, BPF_MAP_TYPE_HASH]
+hashmap_percpu_reserve(value, 1, fail#)
+hashmap_percpu_unreserve(map_type, 16)
+hashmap_percpu_reserve(map_type, 16, fail#)
+move(value, 0xffffffff)
+hashmap_percpu_reserve(map_type, value, no_room_wrap#)
+br[fail#]
+no_room_wrap#:
+test_pass()
+
+fail#:
+test_fail()
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_prog_test.uc
+ * @brief         Tests PROG_ARRAY map updates from the host and tail calls
+ *                through them: programs chain by index and keep the stack
+ *                LM pointer, empty and out of range entries return to the
+ *                caller and a program calling itself stops after
+ *                HASHMAP_PROG_TAIL_CALL_MAX tail calls.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_FD         5
+#define TEST_ENTRIES    8
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+.alloc_mem test_lm_stack lm me 8 8
+
+.reg volatile t_idx_ctx
+immed[t_idx_ctx, 0]
+
+.reg fd
+.reg map_type
+.reg key_sz
+.reg value_sz
+.reg max_entries
+.reg op
+.reg rc
+.reg value
+.reg lm_key
+.reg lm_value
+.reg lm_stack
+.reg cnt_addr
+.reg trace
+.reg addr_hi
+.reg offset
+.reg $entry
+.sig sig_entry
+
+// registers of the subroutine calls, as the JIT sets them
+.reg tc_rtn
+.reg_addr tc_rtn 0 B
+.reg tc_index
+.reg_addr tc_index 1 B
+.reg tc_tid
+.reg_addr tc_tid 0 A
+
+#macro set_lm(in_lm, IN_VALUE)
+    local_csr_wr[ACTIVE_LM_ADDR_0, in_lm]
+    move(value, IN_VALUE)
+    nop
+    nop
+    alu[*l$index0, --, b, value]
+#endm
+
+#macro update(IN_OP, IN_INDEX, IN_VALUE, IN_RC)
+    set_lm(lm_key, IN_INDEX)
+    set_lm(lm_value, IN_VALUE)
+    immed[op, IN_OP]
+    hashmap_prog_update(fd, map_type, lm_key, lm_value, op, error#, rc)
+error#:
+    test_assert_equal(rc, IN_RC)
+#endm
+
+#macro check(IN_INDEX, IN_VALUE)
+    set_lm(lm_key, IN_INDEX)
+    hashmap_prog_lookup(fd, lm_key, fail#, value)
+    test_assert_equal(value, IN_VALUE)
+#endm
+
+// entries of the test programs are below the eBPF code store
+#macro set_entry(IN_INDEX, IN_LABEL)
+    immed[value, IN_INDEX]
+    __hashmap_prog_entry_addr(fd, value, addr_hi, offset, fail#)
+    load_addr[value, IN_LABEL]
+    alu[$entry, --, b, value]
+    mem[write32, $entry, addr_hi, <<8, offset, 1], ctx_swap[sig_entry]
+#endm
+
+#macro tail_call(IN_INDEX)
+    alu[tc_tid, --, b, fd]
+    move(tc_index, IN_INDEX)
+    load_addr[tc_rtn, ret#]
+    br[HTAB_PROG_TAIL_CALL_SUBROUTINE#]
+ret#:
+#endm
+
+#macro check_tail_cnt(IN_COUNT)
+    local_csr_wr[ACTIVE_LM_ADDR_2, cnt_addr]
+    nop
+    nop
+    nop
+    test_assert_equal(*l$index2, IN_COUNT)
+#endm
+
+#macro check_stack()
+    local_csr_rd[ACTIVE_LM_ADDR_0]
+    immed[value, 0]
+    test_assert_equal(value, lm_stack)
+#endm
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+immed[lm_stack, test_lm_stack]
+hashmap_prog_ctx_addr(cnt_addr)
+
+immed[fd, TEST_FD]
+immed[map_type, BPF_MAP_TYPE_PROG_ARRAY]
+immed[key_sz, 4]
+immed[value_sz, 8]
+immed[max_entries, TEST_ENTRIES]
+hashmap_prog_alloc(fd, key_sz, value_sz, max_entries, bad_size#)
+br[fail#]
+bad_size#:
+immed[value_sz, 4]
+hashmap_alloc_fd(fd, 4, 4, TEST_ENTRIES, fail#, be, map_type)
+hashmap_prog_alloc(fd, key_sz, value_sz, max_entries, fail#)
+
+// host updates take code store addresses of the eBPF image only
+update(HASHMAP_OP_ADD_ANY, 1, NFD_BPF_START_OFF, CMSG_RC_SUCCESS)
+update(HASHMAP_OP_UPDATE, 2, (NFD_BPF_START_OFF + 100), CMSG_RC_SUCCESS)
+update(HASHMAP_OP_ADD_ANY, 3, 100, CMSG_RC_ERR_MAP_ERR)
+update(HASHMAP_OP_ADD_ANY, 3, 8192, CMSG_RC_ERR_MAP_ERR)
+// of the vNIC of the other entries
+update(HASHMAP_OP_ADD_ANY, 3, (NFD_BPF_START_OFF + NFD_BPF_MAX_LEN), CMSG_RC_ERR_MAP_ERR)
+update(HASHMAP_OP_ADD_ONLY, 3, NFD_BPF_START_OFF, CMSG_RC_ERR_EEXIST)
+update(HASHMAP_OP_ADD_ANY, HASHMAP_PROG_ENTRIES, NFD_BPF_START_OFF, CMSG_RC_ERR_E2BIG)
+check(0, 0)
+check(1, NFD_BPF_START_OFF)
+check(2, (NFD_BPF_START_OFF + 100))
+check(3, 0)
+
+set_lm(lm_key, 1)
+hashmap_prog_delete(fd, lm_key, fail#, rc)
+test_assert_equal(rc, CMSG_RC_SUCCESS)
+check(1, 0)
+
+set_lm(lm_key, HASHMAP_PROG_ENTRIES)
+hashmap_prog_lookup(fd, lm_key, out_of_range#, value)
+br[fail#]
+out_of_range#:
+
+// the stack LM pointer as ebpf_call() leaves it
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_stack]
+local_csr_wr[ACTIVE_LM_ADDR_2, cnt_addr]
+nop
+nop
+nop
+immed[*l$index2, 0]
+
+set_entry(0, prog0#)
+set_entry(1, prog1#)
+set_entry(2, prog2#)
+set_entry(3, prog_loop#)
+
+// 0 -> 1 -> 2, 2 calls the empty entry 4 and index 64 and goes on
+immed[trace, 0]
+tail_call(0)
+br[fail#]
+
+prog0#:
+    alu[trace, trace, OR, 1]
+    tail_call(1)
+    br[fail#]
+
+prog1#:
+    alu[trace, trace, OR, 2]
+    tail_call(2)
+    br[fail#]
+
+prog2#:
+    alu[trace, trace, OR, 4]
+    tail_call(4)
+    tail_call(HASHMAP_PROG_ENTRIES)
+    test_assert_equal(trace, 7)
+    check_tail_cnt(3)
+    check_stack()
+
+// the loop stops at the limit and goes on after its last call
+local_csr_wr[ACTIVE_LM_ADDR_2, cnt_addr]
+immed[trace, 0]
+nop
+nop
+immed[*l$index2, 0]
+tail_call(3)
+br[fail#]
+
+prog_loop#:
+    alu[trace, trace, +, 1]
+    tail_call(3)
+    test_assert_equal(trace, HASHMAP_PROG_TAIL_CALL_MAX)
+    check_tail_cnt(HASHMAP_PROG_TAIL_CALL_MAX)
+    check_stack()
+
+test_pass()
+
+fail#:
+test_fail()
+
+HTAB_PROG_TAIL_CALL_SUBROUTINE#:
+    htab_prog_tail_call_subr_func()
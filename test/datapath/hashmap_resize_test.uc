@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_resize_test.uc
+ * @brief         Tests that a resize grows the map at once, that keys are
+ *                found in both layouts while the map is moved, that adds
+ *                go to the new layout and that a full map asks for a
+ *                resize.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define HASHMAP_PARTITIONS  3
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_FD         4
+#define TEST_OLD_PART   ((1 << __HASHMAP_PART_CNT_SHFT) | (TEST_FD % HASHMAP_PARTITIONS))
+#define TEST_NEW_PART   (3 << __HASHMAP_PART_CNT_SHFT)
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg fd
+.reg map_type
+.reg key_sz
+.reg value_sz
+.reg key_mask
+.reg value_mask
+.reg part
+.reg max_entries
+.reg hint
+.reg rc
+.reg key
+.reg lm_key
+.reg lm_value
+.reg ent_lw
+.reg ent_addr[2]
+.reg value
+
+#macro set_key(IN_KEY)
+    local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+    nop
+    nop
+    nop
+    alu[*l$index0, --, b, IN_KEY]
+#endm
+
+#macro check_hint(IN_HINT)
+    hashmap_resize_hint(fd, hint, fail#)
+    test_assert_equal(hint, IN_HINT)
+#endm
+
+#macro check_part(IN_PART)
+    hashmap_get_fd(fd, key_sz, value_sz, key_mask, value_mask, map_type, fail#, part)
+    move(value, IN_PART)
+    test_assert_equal(part, value)
+#endm
+
+// keys IN_FIRST..IN_LAST are found
+#macro check_keys(IN_FIRST, IN_LAST)
+    immed[key, IN_FIRST]
+lookup_loop#:
+    set_key(key)
+    hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+    alu[--, key, -, IN_LAST]
+    bne[lookup_loop#], defer[1]
+    alu[key, key, +, 1]
+#endm
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+nop
+nop
+nop
+immed[*l$index1++, 0xcafe]
+immed[*l$index1++, 0xf00d]
+
+immed[fd, TEST_FD]
+immed[map_type, BPF_MAP_TYPE_HASH]
+hashmap_alloc_fd(fd, 4, 8, 8, fail#, be, map_type, 1)
+check_part(TEST_OLD_PART)
+
+// a quarter of the entries left is fine, fewer are not
+immed[key, 1]
+add_loop#:
+    set_key(key)
+    hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+    alu[--, key, -, 6]
+    bne[add_loop#], defer[1]
+    alu[key, key, +, 1]
+check_hint(0)
+set_key(7)
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+check_hint(1)
+
+// no larger than HASHMAP_MAX_ENTRIES
+move(max_entries, (HASHMAP_MAX_ENTRIES + 1))
+immed[part, 0]
+hashmap_resize_fd(fd, max_entries, part, part, fail#, too_big#, fail#)
+br[fail#]
+too_big#:
+check_part(TEST_OLD_PART)
+
+// the map grows at once and keeps its old partitions until it is moved
+immed[max_entries, 32]
+immed[part, 0]
+hashmap_resize_fd(fd, max_entries, part, part, fail#, fail#, fail#)
+test_assert_equal(part, ((TEST_OLD_PART << __HASHMAP_PART_OLD_SHFT) | TEST_NEW_PART))
+check_part(((TEST_OLD_PART << __HASHMAP_PART_OLD_SHFT) | TEST_NEW_PART))
+hashmap_get_fd_attr(fd, map_type, max_entries, fail#)
+test_assert_equal(max_entries, 32)
+check_hint(0)
+
+// one resize at a time
+immed[part, 0]
+hashmap_resize_fd(fd, max_entries, part, part, busy#, fail#, fail#)
+br[fail#]
+busy#:
+
+check_keys(1, 7)
+
+// new keys go to the new layout
+immed[key, 8]
+new_loop#:
+    set_key(key)
+    hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ONLY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+    alu[--, key, -, 12]
+    bne[new_loop#], defer[1]
+    alu[key, key, +, 1]
+check_keys(1, 12)
+
+/*
+ * Moved entries take no credit. Keys whose bucket is the same in both
+ * layouts are there already, as are the keys added since the resize.
+ */
+immed[key, 1]
+move_loop#:
+    set_key(key)
+    hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ONLY, fail#, move_next#, HASHMAP_RTN_ADDR, ent_lw, --, --, be, rc, HASHMAP_CALLER_RESIZE)
+move_next#:
+    alu[--, rc, -, CMSG_RC_ERR_E2BIG]
+    beq[fail#]
+    alu[--, key, -, 7]
+    bne[move_loop#], defer[1]
+    alu[key, key, +, 1]
+set_key(8)
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ONLY, fail#, moved#, HASHMAP_RTN_ADDR, ent_lw, --, --, be, rc, HASHMAP_CALLER_RESIZE)
+br[fail#]
+moved#:
+test_assert_equal(rc, CMSG_RC_ERR_EEXIST)
+_hashmap_get_fd(fd, fail#)
+test_assert_equal(MAP_RDXR[__HASHMAP_FD_NDX_CUR_CRED], (32 - 12))
+
+// the old layout is dropped, all keys are found in the new one
+hashmap_resize_done(fd)
+check_part(TEST_NEW_PART)
+check_keys(1, 12)
+
+test_pass()
+
+fail#:
+test_fail()
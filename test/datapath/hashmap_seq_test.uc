@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_seq_test.uc
+ * @brief         Tests that lookups leave the bucket lock alone, that
+ *                writers bump the bucket seq around their updates and that
+ *                a reader overlapping a writer is sent back to retry.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 8 8
+
+.reg fd
+.reg map_type
+.reg lm_key
+.reg lm_value
+.reg idx
+.reg seq
+.reg lk_addr_hi
+.reg lk_addr_lo
+.reg ent_lw
+.reg ent_addr[2]
+.reg value
+.reg $lock[3]
+.xfer_order $lock
+.sig sig_lock
+
+#macro check_lock(IN_META, IN_SEQ)
+    alu[lk_addr_lo, --, b, idx, <<HASHMAP_LOCK_SZ_SHFT]
+    mem[read_atomic, $lock[0], lk_addr_hi, <<8, lk_addr_lo, 3], ctx_swap[sig_lock]
+    test_assert_equal($lock[0], IN_META)
+    test_assert_equal($lock[1], fd)
+    test_assert_equal($lock[2], IN_SEQ)
+#endm
+
+move(lk_addr_hi, (__HASHMAP_LOCK_TBL_0 >> 8))
+
+immed[map_type, BPF_MAP_TYPE_HASH]
+hashmap_alloc_fd(fd, 4, 8, 16, fail#, be, map_type)
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+move(value, 0x12345678)
+nop
+nop
+alu[*l$index0, --, b, value]
+immed[*l$index1++, 0xcafe]
+immed[*l$index1++, 0xf00d]
+
+// the insert holds the bucket exclusively, seq goes odd and back to even
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+test_assert_equal(ent_lw, 2)
+alu[idx, --, b, ent_addr[1], >>HASHMAP_ENTRY_SZ_SHFT]
+check_lock(__HASHMAP_DESC_VALID, 2)
+
+// lookups neither count as a lock holder nor move seq
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+check_lock(__HASHMAP_DESC_VALID, 2)
+
+/*
+ * A writer runs between the start and the end of a read, the reader
+ * is sent back and succeeds on the next pass.
+ */
+__hashmap_seq_begin(idx, fd, fail#, fail#, seq, --)
+test_assert_equal(seq, 2)
+alu[lk_addr_lo, --, b, idx, <<HASHMAP_LOCK_SZ_SHFT]
+__hashmap_seq_incr(lk_addr_hi, lk_addr_lo)
+__hashmap_seq_incr(lk_addr_hi, lk_addr_lo)
+__hashmap_seq_end(idx, seq, retry#)
+br[fail#]
+
+retry#:
+__hashmap_seq_begin(idx, fd, fail#, fail#, seq, --)
+test_assert_equal(seq, 4)
+__hashmap_seq_end(idx, seq, fail#)
+
+// an update is a writer too
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+nop
+nop
+nop
+immed[*l$index1, 0xbeef]
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_UPDATE, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+check_lock(__HASHMAP_DESC_VALID, 6)
+
+// a miss is checked against seq as well and leaves the lock alone
+move(value, 0x87654321)
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+nop
+nop
+nop
+alu[*l$index0, --, b, value]
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, not_found#, HASHMAP_RTN_ADDR, ent_lw, --, ent_addr, be)
+br[fail#]
+
+not_found#:
+check_lock(__HASHMAP_DESC_VALID, 6)
+
+// the delete leaves the bucket invalid with an even seq
+move(value, 0x12345678)
+alu[*l$index0, --, b, value]
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_REMOVE, fail#, fail#, HASHMAP_RTN_ADDR, ent_lw, --, --, be)
+alu[lk_addr_lo, --, b, idx, <<HASHMAP_LOCK_SZ_SHFT]
+mem[read_atomic, $lock[0], lk_addr_hi, <<8, lk_addr_lo, 3], ctx_swap[sig_lock]
+test_assert_equal($lock[0], 0)
+test_assert_equal($lock[2], 8)
+
+test_pass()
+
+fail#:
+test_fail()
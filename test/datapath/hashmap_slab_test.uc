@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_slab_test.uc
+ * @brief         Tests that maps get the smallest slab class their key and
+ *                value fit in, that overflow entries come from the pool of
+ *                that class and that entries of the largest class read back
+ *                whole.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_IDX        9
+#define TEST_POOL_IDX   5
+
+.alloc_mem test_lm_key lm me 16 8
+.alloc_mem test_lm_value lm me 48 8
+
+.reg fd
+.reg map_type
+.reg key_sz
+.reg value_sz
+.reg key_mask
+.reg value_mask
+.reg slab
+.reg lm_key
+.reg lm_value
+.reg tbl_addr_hi
+.reg idx
+.reg hash
+.reg offset
+.reg out_addr_hi
+.reg out_addr_lo
+.reg value
+
+#macro check_class(IN_FD, IN_KEY_SZ, IN_VALUE_SZ, IN_SLAB)
+    immed[fd, IN_FD]
+    hashmap_alloc_fd(fd, IN_KEY_SZ, IN_VALUE_SZ, 16, fail#, be, map_type)
+    _hashmap_get_fd(fd, fail#)
+    test_assert_equal(MAP_RDXR[__HASHMAP_FD_NDX_SLAB], IN_SLAB)
+    // from the table, then from LM
+    hashmap_get_fd(fd, key_sz, value_sz, key_mask, value_mask, map_type, fail#, --, slab)
+    test_assert_equal(slab, IN_SLAB)
+    hashmap_get_fd(fd, key_sz, value_sz, key_mask, value_mask, map_type, fail#, --, slab)
+    test_assert_equal(slab, IN_SLAB)
+#endm
+
+// GLOBAL_INIT is not defined, hand the class a single entry
+#macro free_entry(IN_SLAB)
+    immed[slab, IN_SLAB]
+    move(offset, (TEST_POOL_IDX << (HASHMAP_SLAB_MIN_SZ_SHFT + IN_SLAB)))
+    __hashmap_freelist_free(slab, offset)
+#endm
+
+// the entry of the class is taken, the next add finds its ring empty
+#macro check_ov_add(IN_SLAB, IN_HASH)
+    immed[slab, IN_SLAB]
+    move(hash, IN_HASH)
+    __hashmap_ov_add(hash, tbl_addr_hi, idx, fd, slab, out_addr_hi, out_addr_lo, fail#)
+    move(value, (HASHMAP_FREEPOOL_BASE_/**/IN_SLAB >> 8))
+    test_assert_equal(out_addr_hi, value)
+    test_assert_equal(out_addr_lo, (TEST_POOL_IDX << (HASHMAP_SLAB_MIN_SZ_SHFT + IN_SLAB)))
+    move(hash, (IN_HASH + 1))
+    __hashmap_ov_add(hash, tbl_addr_hi, idx, fd, slab, out_addr_hi, out_addr_lo, empty#)
+    br[fail#]
+empty#:
+#endm
+
+immed[map_type, BPF_MAP_TYPE_HASH]
+
+check_class(1, 4, 4, 0)
+check_class(2, 4, 8, 0)
+check_class(3, 4, 24, 1)
+check_class(4, 12, 16, 1)
+check_class(5, 8, 40, 2)
+check_class(6, 16, 48, 2)
+
+move(tbl_addr_hi, (__HASHMAP_DATA_0 >> 8))
+immed[idx, TEST_IDX]
+free_entry(0)
+free_entry(1)
+free_entry(2)
+check_ov_add(0, 0x111111)
+check_ov_add(1, 0x222222)
+check_ov_add(2, 0x333333)
+
+/*
+ * A 64 byte entry of fd 6 is read back whole although only the
+ * key is compared.
+ */
+immed[fd, 6]
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+move(value, 0x12345678)
+nop
+nop
+alu[*l$index0++, --, b, value]
+alu[*l$index0++, --, ~b, value]
+alu[*l$index0++, --, b, value, <<4]
+alu[*l$index0++, --, b, value, >>4]
+immed[value, 0]
+value_loop#:
+    alu[*l$index1++, value, +, 0xa0]
+    alu[value, value, +, 1]
+    alu[--, value, -, 12]
+    bne[value_loop#]
+
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, --, --, --, be)
+
+// clear the value, the lookup copies it back to LM
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+immed[value, 12]
+nop
+nop
+clear_loop#:
+    alu[value, value, -, 1]
+    bne[clear_loop#], defer[1]
+        alu[*l$index1++, --, b, 0]
+
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_LMEM, --, --, --, be)
+
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+immed[value, 0]
+nop
+nop
+check_loop#:
+    alu[offset, value, +, 0xa0]
+    alu[out_addr_lo, --, b, *l$index1++]
+    test_assert_equal(out_addr_lo, offset)
+    alu[value, value, +, 1]
+    alu[--, value, -, 12]
+    bne[check_loop#]
+
+test_pass()
+
+fail#:
+test_fail()
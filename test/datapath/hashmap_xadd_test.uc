@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          hashmap_xadd_test.uc
+ * @brief         Tests that the XADD subroutines add in place at the value
+ *                address returned by a lookup, on words in NFP byte
+ *                order, that 64 bit counters carry from the low into the
+ *                high word and that the words around the counter are left
+ *                alone.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <single_ctx_test.uc>
+
+#include "cmsg_map_types.h"
+#include "slicc_hash.h"
+#include "hashmap.uc"
+
+#define HASHMAP_TXFR_COUNT 16
+#define HASHMAP_RXFR_COUNT 16
+
+.reg volatile read $map_rxfr[HASHMAP_RXFR_COUNT]
+.xfer_order $map_rxfr
+.reg write $map_txfr[HASHMAP_TXFR_COUNT]
+.xfer_order $map_txfr
+__hashmap_set($map_txfr)
+.reg read $map_cam[8]
+.xfer_order $map_cam
+
+#define MAP_RDXR $map_rxfr
+#define MAP_TXFR $map_txfr
+#define MAP_RXCAM $map_cam[0]
+
+.init_csr mecsr:CtxEnables.NNreceiveConfig 0x2 const
+
+pkt_counter_init()
+hashmap_init()
+slicc_hash_init_nn()
+
+#define TEST_FD         3
+
+.alloc_mem test_lm_key lm me 8 8
+.alloc_mem test_lm_value lm me 16 8
+
+.reg fd
+.reg map_type
+.reg lm_key
+.reg lm_value
+.reg ent_addr[2]
+.reg $value[4]
+.xfer_order $value
+.sig sig_value
+
+// registers of the subroutine calls, as the JIT sets them
+.reg xadd_rtn
+.reg_addr xadd_rtn 0 B
+.reg xadd_operand
+.reg_addr xadd_operand 1 B
+.reg xadd_operand_hi
+.reg_addr xadd_operand_hi 2 B
+.reg xadd_addr_lo
+.reg_addr xadd_addr_lo 0 A
+.reg xadd_addr_hi
+.reg_addr xadd_addr_hi 1 A
+
+#macro xadd(WIDTH, IN_OFFSET, IN_OPERAND, IN_OPERAND_HI)
+    alu[xadd_addr_hi, --, b, ent_addr[0]]
+    alu[xadd_addr_lo, ent_addr[1], +, IN_OFFSET]
+    move(xadd_operand, IN_OPERAND)
+    move(xadd_operand_hi, IN_OPERAND_HI)
+    load_addr[xadd_rtn, ret#]
+    br[HTAB_MAP_XADD/**/WIDTH/**/_SUBROUTINE#]
+ret#:
+#endm
+
+// the value words as the atomic engine adds them
+#macro check_value(IN_W0, IN_W1, IN_W2, IN_W3)
+    mem[read32, $value[0], ent_addr[0], <<8, ent_addr[1], 4], ctx_swap[sig_value]
+    test_assert_equal($value[0], IN_W0)
+    test_assert_equal($value[1], IN_W1)
+    test_assert_equal($value[2], IN_W2)
+    test_assert_equal($value[3], IN_W3)
+#endm
+
+immed[lm_key, test_lm_key]
+immed[lm_value, test_lm_value]
+local_csr_wr[ACTIVE_LM_ADDR_0, lm_key]
+local_csr_wr[ACTIVE_LM_ADDR_1, lm_value]
+immed[fd, TEST_FD]
+immed[map_type, BPF_MAP_TYPE_HASH]
+nop
+immed[*l$index0, 1]
+// a 64 bit counter about to carry, a 32 bit one and a guard word
+move(*l$index1++, 0xfffffff0)
+immed[*l$index1++, 0]
+immed[*l$index1++, 5]
+immed[*l$index1++, 0]
+
+hashmap_alloc_fd(fd, 4, 16, 16, fail#, be, map_type)
+hashmap_ops(fd, lm_key, lm_value, HASHMAP_OP_ADD_ANY, fail#, fail#, HASHMAP_RTN_ADDR, --, --, --, be)
+hashmap_ops(fd, lm_key, --, HASHMAP_OP_LOOKUP, fail#, fail#, HASHMAP_RTN_ADDR, --, --, ent_addr, be)
+check_value(0xfffffff0, 0, 5, 0)
+
+xadd(32, 8, 7, 0)
+check_value(0xfffffff0, 0, 12, 0)
+xadd(32, 8, 0xffffffff, 0)
+check_value(0xfffffff0, 0, 11, 0)
+
+xadd(64, 0, 0x20, 0)
+check_value(0x10, 1, 11, 0)
+xadd(64, 0, 1, 2)
+check_value(0x11, 3, 11, 0)
+
+test_pass()
+
+fail#:
+test_fail()
+
+HTAB_MAP_XADD32_SUBROUTINE#:
+    htab_map_xadd_subr_func(32)
+HTAB_MAP_XADD64_SUBROUTINE#:
+    htab_map_xadd_subr_func(64)
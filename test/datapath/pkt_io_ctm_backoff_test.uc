@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          pkt_io_ctm_backoff_test.uc
+ * @brief         Tests that consecutive CTM allocation failures back off
+ *                exponentially up to the cap, that every retry is signalled
+ *                no earlier than its backoff and that the stall counters
+ *                account for each failure.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define NFD_CFG_CLASS_VERSION   0
+#define NFD_CFG_CLASS_DEFAULT 0
+
+#include <pkt_io.uc>
+#include <single_ctx_test.uc>
+#include <global.uc>
+
+#define FAILURES 10
+
+.reg addr_hi
+.reg addr_lo
+.reg count
+.reg elapsed
+.reg expected
+.reg start
+.reg sts
+.reg ticks
+.reg read $stall[4]
+.xfer_order $stall
+.sig sig_stall
+
+immed[__pkt_io_ctm_backoff, PKT_IO_CTM_BACKOFF_MIN]
+immed[expected, PKT_IO_CTM_BACKOFF_MIN]
+immed[ticks, 0]
+immed[count, FAILURES]
+
+failure_loop#:
+    test_assert_equal(__pkt_io_ctm_backoff, expected)
+
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[start, 0]
+    __pkt_io_no_ctm_buffer()
+    ctx_arb[__pkt_io_sig_nfd_retry]
+    local_csr_rd[TIMESTAMP_LOW]
+    immed[elapsed, 0]
+    alu[elapsed, elapsed, -, start]
+
+    // the retry must not be signalled before the backoff expires
+    alu[--, elapsed, -, expected]
+    blo[fail#]
+
+    alu[ticks, ticks, +, expected]
+    alu[expected, --, B, expected, <<1]
+    move(start, PKT_IO_CTM_BACKOFF_MAX)
+    alu[--, start, -, expected]
+    bhs[next#]
+    alu[expected, --, B, start]
+
+next#:
+    alu[count, count, -, 1]
+    bne[failure_loop#]
+
+// backoff stays at the cap, bounding the latency of any context
+test_assert_equal(__pkt_io_ctm_backoff, PKT_IO_CTM_BACKOFF_MAX)
+
+local_csr_rd[ACTIVE_CTX_STS]
+immed[sts, 0]
+alu[addr_lo, 0xf, AND, sts, >>3]
+alu[sts, 0x3f, AND, sts, >>25]
+alu[addr_lo, addr_lo, OR, sts, <<4]
+alu[addr_lo, --, B, addr_lo, <<(log2(PKT_IO_CTM_STALL_ME_SIZE))]
+move(addr_hi, (_pkt_io_ctm_stall >> 8))
+mem[read32, $stall[0], addr_hi, <<8, addr_lo, 4], ctx_swap[sig_stall]
+
+test_assert_equal($stall[0], 0)
+test_assert_equal($stall[1], FAILURES)
+test_assert_equal($stall[2], 0)
+test_assert_equal($stall[3], ticks)
+
+test_pass()
+
+fail#:
+test_fail()
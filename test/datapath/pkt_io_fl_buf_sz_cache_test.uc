@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          pkt_io_fl_buf_sz_cache_test.uc
+ * @brief         Tests that free list buffer sizes are served from LM until
+ *                the action table generation changes.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define NFD_CFG_CLASS_VERSION   0
+#define NFD_CFG_CLASS_DEFAULT 0
+
+#include <pkt_io.uc>
+#include <single_ctx_test.uc>
+#include <global.uc>
+
+#define TEST_QUEUE 5
+
+.reg addr
+.reg addr_hi
+.reg addr_lo
+.reg queue
+.reg rxb
+.reg write $rxb
+.sig sig_rxb
+
+#macro set_fl_buf_sz(IN_SIZE)
+    move(rxb, IN_SIZE)
+    alu[$rxb, --, B, rxb]
+    mem[write32, $rxb, addr_hi, <<8, addr_lo, 1], ctx_swap[sig_rxb]
+#endm
+
+immed[queue, TEST_QUEUE]
+move(addr_hi, (_fl_buf_sz_cache >> 8))
+alu[addr_lo, --, B, queue, <<2]
+
+set_fl_buf_sz(2048)
+__pkt_io_fl_buf_sz(rxb, 0, queue)
+test_assert_equal(rxb, 2048)
+
+// served from LM, the table update has not been signalled yet
+set_fl_buf_sz(9216)
+__pkt_io_fl_buf_sz(rxb, 0, queue)
+test_assert_equal(rxb, 2048)
+
+immed[addr, (__pkt_io_fl_buf_sz + (TEST_QUEUE * 4))]
+local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+nop
+nop
+nop
+test_assert_equal(*l$index3, 2048)
+
+// a new generation drops the cached sizes
+immed[addr, __pkt_io_fl_buf_sz_gen]
+local_csr_wr[ACTIVE_LM_ADDR_3, addr]
+nop
+nop
+nop
+alu[*l$index3, *l$index3, +, 1]
+
+__pkt_io_fl_buf_sz(rxb, 0, queue)
+test_assert_equal(rxb, 9216)
+
+test_pass()
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 Netronome Systems, Inc. All rights reserved.
+ *
+ * @file          pkt_io_nfd_credit_batch_test.uc
+ * @brief         Tests that NFD out credits are reserved a batch at a time,
+ *                that the surplus is returned, that no surplus is kept for a
+ *                queue running low and that a queue running out of credits
+ *                is detected. Also compares the cost of a batch of credits
+ *                against taking them one atomic at a time.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#define NFD_CFG_CLASS_VERSION   0
+#define NFD_CFG_CLASS_DEFAULT 0
+
+#define PKT_IO_NFD_CREDIT_BATCH 16
+#define PKT_IO_NFD_CREDIT_LOW 24
+
+#include <pkt_io.uc>
+#include <single_ctx_test.uc>
+#include <global.uc>
+#include <timestamp.uc>
+
+#define TEST_QUEUE 3
+
+.reg addr_hi
+.reg addr_lo
+.reg batched
+.reg count
+.reg lm_addr
+.reg queue
+.reg single
+.reg start
+.reg write $nfd_credits
+.reg read $nfd_credits_rd
+.sig sig_credits
+
+#macro set_nfd_credits(IN_CREDITS)
+    immed[$nfd_credits, IN_CREDITS]
+    mem[write32, $nfd_credits, addr_hi, <<8, addr_lo, 1], ctx_swap[sig_credits]
+#endm
+
+#macro check_nfd_credits(IN_CREDITS)
+    timestamp_sleep(4) // credits are returned without waiting for completion
+    mem[read32, $nfd_credits_rd, addr_hi, <<8, addr_lo, 1], ctx_swap[sig_credits]
+    test_assert_equal($nfd_credits_rd, IN_CREDITS)
+#endm
+
+#macro check_surplus(IN_CREDITS)
+    local_csr_wr[ACTIVE_LM_ADDR_3, lm_addr]
+    nop
+    nop
+    nop
+    test_assert_equal(*l$index3, IN_CREDITS)
+#endm
+
+immed[queue, TEST_QUEUE]
+alu[addr_hi, --, B, (__NFD_DIRECT_ACCESS | NFD_PCIE_ISL_BASE), <<24]
+alu[addr_lo, --, B, queue, <<(log2(NFD_OUT_ATOMICS_SZ))]
+immed[lm_addr, (__pkt_io_nfd_credits + (TEST_QUEUE * 4))]
+
+// one atomic per packet, as without batching
+set_nfd_credits(40)
+local_csr_rd[TIMESTAMP_LOW]
+immed[start, 0]
+immed[count, PKT_IO_NFD_CREDIT_BATCH]
+single_loop#:
+    ov_single(OV_IMMED8, 1)
+    mem[test_subsat_imm, $nfd_credits_rd, addr_hi, <<8, addr_lo, 1], indirect_ref, ctx_swap[sig_credits]
+    alu[count, count, -, 1]
+    bne[single_loop#]
+local_csr_rd[TIMESTAMP_LOW]
+immed[single, 0]
+alu[single, single, -, start]
+
+// one atomic per batch
+set_nfd_credits(40)
+local_csr_rd[TIMESTAMP_LOW]
+immed[start, 0]
+immed[count, PKT_IO_NFD_CREDIT_BATCH]
+batch_loop#:
+    __pkt_io_nfd_credit_get(0, queue, fail#)
+    alu[count, count, -, 1]
+    bne[batch_loop#]
+local_csr_rd[TIMESTAMP_LOW]
+immed[batched, 0]
+alu[batched, batched, -, start]
+
+alu[--, batched, -, single]
+bhs[fail#]
+
+check_nfd_credits((40 - PKT_IO_NFD_CREDIT_BATCH))
+check_surplus(0)
+
+// the next packet reserves another batch, the surplus is returned
+__pkt_io_nfd_credit_get(0, queue, fail#)
+check_nfd_credits((40 - (2 * PKT_IO_NFD_CREDIT_BATCH)))
+check_surplus((PKT_IO_NFD_CREDIT_BATCH - 1))
+
+__pkt_io_nfd_credits_return()
+check_nfd_credits((40 - PKT_IO_NFD_CREDIT_BATCH - 1))
+check_surplus(0)
+
+// below PKT_IO_NFD_CREDIT_LOW the rest of the batch goes straight back
+set_nfd_credits(20)
+__pkt_io_nfd_credit_get(0, queue, fail#)
+check_nfd_credits(19)
+check_surplus(0)
+
+// fewer credits than a batch, then none
+set_nfd_credits(2)
+__pkt_io_nfd_credit_get(0, queue, fail#)
+check_nfd_credits(1)
+check_surplus(0)
+__pkt_io_nfd_credit_get(0, queue, fail#)
+check_nfd_credits(0)
+check_surplus(0)
+__pkt_io_nfd_credit_get(0, queue, no_credit#)
+
+fail#:
+test_fail()
+
+no_credit#:
+check_nfd_credits(0)
+check_surplus(0)
+
+test_pass()
@@ -31,17 +31,23 @@
 
 volatile __shared __lmem union instruction_format _action_list[NIC_MAX_INSTR];
 
+__intrinsic void
+cfg_act_read_addr(uint32_t addr)
+{
+    __xread uint32_t xwr_instr[NIC_MAX_INSTR];
+
+    cls_read(&xwr_instr, (__cls void *)addr, sizeof(xwr_instr));
+    reg_cp((void *)_action_list, xwr_instr, sizeof(xwr_instr));
+}
+
 __intrinsic void
 cfg_act_read_queue(uint32_t qid)
 {
-    SIGNAL sig;
     __gpr uint32_t addr = NIC_CFG_INSTR_TBL_ADDR;
-    __xread uint32_t xwr_instr[NIC_MAX_INSTR];
 
     addr = addr + qid * NIC_MAX_INSTR * 4;
 
-    cls_read(&xwr_instr, (__cls void *)addr, sizeof(xwr_instr));
-    reg_cp((void *)_action_list, xwr_instr, sizeof(xwr_instr));
+    cfg_act_read_addr(addr);
 }
 
 __intrinsic void
@@ -59,6 +65,7 @@ cfg_act_read_wire(const uint32_t pcie, uint32_t port)
 static void parse_action_list(void)
 {
     __gpr uint32_t i = 0;
+    __gpr uint32_t jumps = 0;
     __gpr union instruction_format action;
     __gpr union instruction_format action_next;
 
@@ -189,8 +196,28 @@ static void parse_action_list(void)
 
             case INSTR_L2_SWITCH_HOST:
                 action_next = _action_list[i];
-                if (action_next.pipeline)
-                    test_assert_equal(action.value, 0);
+                if (action_next.pipeline) {
+                    /* only a chained list continues after the switch */
+                    if (action_next.op == INSTR_JUMP)
+                        test_assert_unequal(jumps, NIC_MAX_INSTR_BLKS - 1);
+                    else
+                        test_assert_equal(action.value, 0);
+                }
+                break;
+
+            case INSTR_JUMP:
+                /* Continue with the chained entry, its first instruction
+                 * is always dispatched (pipeline bit clear) */
+                test_assert_unequal(jumps++, NIC_MAX_INSTR_BLKS - 1);
+                cfg_act_read_addr(action.args);
+                i = 0;
+                test_assert_equal(_action_list[i].pipeline, 0);
+                break;
+
+            case INSTR_FLOW_LOOKUP:
+                /* actions length: 1 word, last action in code store */
+                action_next = _action_list[i];
+                test_assert_equal(action_next.pipeline, 0);
                 break;
 
             default:
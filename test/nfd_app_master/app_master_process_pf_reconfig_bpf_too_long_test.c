@@ -0,0 +1,70 @@
+/*
+    Tests that process_pf_reconfig refuses an eBPF image longer than
+    NFD_BPF_MAX_LEN before the image is fetched or any ME is stopped
+*/
+
+#include "defines.h"
+#include "test.c"
+#include "app_master_test.h"
+#include "vnic_setup.c"
+#include "app_private.c"
+#include "app_config_tables.c"
+#include "nic_tables.c"
+#include "app_mac_vlan_config_cmsg.c"
+#include "app_control_lib.c"
+#include "nfd_cfg_base_decl.c"
+
+#define TEST_SENTINEL 0xdeadbeef
+
+void test(int pcie) {
+    uint32_t type, vnic, vid, pf, control, update;
+    struct nfd_cfg_msg cfg_msg;
+    __xwrite uint32_t bpf_cfg_wr[3];
+    __xwrite uint32_t image_wr[2];
+    __xread uint32_t image_rd[2];
+
+    for (pf = 0; pf < NFD_MAX_PFS; pf++) {
+
+        vid = NFD_PF2VID(pf);
+        NFD_VID2VNIC(type, vnic, vid);
+
+        reset_cfg_msg(&cfg_msg, vid, 0);
+
+        image_wr[0] = TEST_SENTINEL;
+        image_wr[1] = TEST_SENTINEL;
+        mem_write64(image_wr, &bpf_image[0], sizeof(image_wr));
+
+        // the size word as update_bpf_prog() reads it, one instruction too many
+        bpf_cfg_wr[0] = (NFD_BPF_MAX_LEN + 1) << 16;
+        bpf_cfg_wr[1] = 0;
+        bpf_cfg_wr[2] = 0;
+        mem_write32(bpf_cfg_wr, (__mem void*) (nfd_cfg_bar_base(pcie, vid) +
+                                  NFP_NET_CFG_BPF_SIZE - 2), sizeof(bpf_cfg_wr));
+
+        control = 0;
+        update = NFP_NET_CFG_UPDATE_BPF;
+        if (process_pf_reconfig(pcie, control, update, vid, vnic, &cfg_msg)) {
+             if (cfg_msg.error == 0)
+                 test_fail();
+        } else {
+            test_fail();
+        }
+
+        // nothing was read from the host
+        mem_read64(image_rd, &bpf_image[0], sizeof(image_rd));
+        if (image_rd[0] != TEST_SENTINEL || image_rd[1] != TEST_SENTINEL)
+            test_fail();
+    }
+}
+
+void main() {
+    int  pcie;
+    single_ctx_test();
+
+    for (pcie = 0; pcie < NFD_MAX_ISL; pcie++) {
+        if (pcie_is_present(pcie))
+            test(pcie);
+    }
+
+    test_pass();
+}
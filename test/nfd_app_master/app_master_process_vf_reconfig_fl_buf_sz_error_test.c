@@ -0,0 +1,96 @@
+//TEST_REQ_BLM
+//TEST_REQ_RESET
+
+/*
+    Tests that a VF reconfig refused after the free list buffer size was
+    cached still moves the action table generation on, so the workers
+    re-read the new size
+*/
+
+#include "defines.h"
+#include "test.c"
+#include "vnic_setup.c"
+#include "app_master_test.h"
+#include "action_parse.c"
+#include "app_private.c"
+#include "app_config_tables.c"
+#include "nic_tables.c"
+#include "map_cmsg_rx.c"
+#include "app_control_lib.c"
+#include "nfd_cfg_base_decl.c"
+
+#define TEST_FL_BUF_SZ  9216
+#define TEST_PF_MAC     0xAA00CCDDEE10ull
+
+void test(int pcie) {
+    uint32_t type, vnic, vid, pf, control, update, gen;
+    int vf;
+    struct nfd_cfg_msg cfg_msg;
+    __xwrite uint32_t rxb_wr;
+    __xread uint32_t rxb_rd;
+    __imem uint32_t *fl_buf_sz_cache =
+        (__imem uint32_t *) __link_sym("_fl_buf_sz_cache");
+
+    //First indicate PF's are enabled
+    for (pf = 0; pf < NFD_MAX_PFS; pf++) {
+        set_nic_control_word(pcie, NFD_PF2VID(pf),
+                get_nic_control_word(pcie,
+                    NFD_PF2VID(pf)) | NFP_NET_CFG_CTRL_ENABLE);
+        setup_pf_mac(pcie, NFD_PF2VID(pf), TEST_MAC);
+    }
+
+    for (vf = 0; vf < NFD_MAX_VFS; vf++) {
+
+        vid = NFD_VF2VID(vf);
+        NFD_VID2VNIC(type, vnic, vid);
+
+        reset_cfg_msg(&cfg_msg, vid, 0);
+
+        rxb_wr = TEST_FL_BUF_SZ + vf;
+        mem_write32(&rxb_wr, (__mem void*) (nfd_cfg_bar_base(pcie, vid) +
+                                            NFP_NET_CFG_FLBUFSZ),
+                    sizeof(rxb_wr));
+
+        // an untrusted VF setting another MAC than the PF gave it
+        setup_vf_mac(pcie, vid, TEST_MAC);
+        setup_sriov_cfg_data(NIC_PCI, vf, TEST_PF_MAC, 0,
+                NFD_VF_CFG_CTRL_LINK_STATE_ENABLE | (0 << NFD_VF_CFG_CTRL_TRUSTED_shf));
+
+        gen = cfg_act_gen;
+        control = NFD_CFG_VF_CAP;
+        update = NFD_CFG_VF_LEGAL_UPD;
+        if (process_vf_reconfig(pcie, control, update, vid, &cfg_msg)) {
+            if (cfg_msg.error == 0)
+                test_fail();
+        } else {
+            test_fail();
+        }
+
+        // the new size is cached and the workers are told to re-read it
+        if (cfg_act_gen == gen)
+            test_fail();
+        mem_read32(&rxb_rd,
+                   &fl_buf_sz_cache[pcie * 64 + NFD_VID2NATQ(vid, 0)],
+                   sizeof(rxb_rd));
+        if (rxb_rd != TEST_FL_BUF_SZ + vf)
+            test_fail();
+    }
+}
+
+void main(void)
+{
+    int pcie;
+    switch (ctx()) {
+        case 0:
+            for (pcie = 0; pcie < NFD_MAX_ISL; pcie++) {
+                if (pcie_is_present(pcie))
+                    test(pcie);
+            }
+
+            test_pass();
+            break;
+        default:
+            map_cmsg_rx();
+            break;
+    }
+}